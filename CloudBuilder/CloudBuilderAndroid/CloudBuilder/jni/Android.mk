@@ -48,10 +48,19 @@ LOCAL_C_INCLUDES 	+=  $(LOCAL_PATH)/$(CLOUDBUILDER_DIR)/Headers			\
 #						$(LOCAL_PATH)/$(CLOUDBUILDER_DIR)/sources/Marmalade
 						
 LOCAL_SRC_FILES		:= 	$(CLOUDBUILDER_DIR)/sources/CCallback.cpp				\
+						$(CLOUDBUILDER_DIR)/sources/CClientContext.cpp			\
+						$(CLOUDBUILDER_DIR)/sources/CPropertyShadow.cpp			\
+						$(CLOUDBUILDER_DIR)/sources/CProgressAggregator.cpp		\
+						$(CLOUDBUILDER_DIR)/sources/CProductCatalog.cpp			\
+						$(CLOUDBUILDER_DIR)/sources/CMatchState.cpp				\
+						$(CLOUDBUILDER_DIR)/sources/CFriendsCache.cpp			\
+						$(CLOUDBUILDER_DIR)/sources/CLeaderboardCache.cpp		\
+						$(CLOUDBUILDER_DIR)/sources/CValueStore.cpp				\
 						$(CLOUDBUILDER_DIR)/sources/CClannishRESTproxy.cpp		\
 						$(CLOUDBUILDER_DIR)/sources/CHjSON.cpp					\
 						$(CLOUDBUILDER_DIR)/sources/cotc_thread.cpp				\
 						$(CLOUDBUILDER_DIR)/sources/CotCHelpers.cpp				\
+						$(CLOUDBUILDER_DIR)/sources/CAllocator.cpp				\
 						$(CLOUDBUILDER_DIR)/sources/ErrorStrings.cpp			\
 						$(CLOUDBUILDER_DIR)/sources/Android/CloudBuilderJNI.cpp	\
 						$(CLOUDBUILDER_DIR)/sources/Android/JNIUtilities.cpp	\
@@ -71,6 +80,11 @@ LOCAL_SRC_FILES		:= 	$(CLOUDBUILDER_DIR)/sources/CCallback.cpp				\
 						$(CLOUDBUILDER_DIR)/sources/sdb/util.cpp				\
 						$(CLOUDBUILDER_DIR)/sources/tools/helpers.cpp			\
 						$(CLOUDBUILDER_DIR)/sources/tools/curltool.cpp			\
+						$(CLOUDBUILDER_DIR)/sources/tools/cbor.cpp				\
+						$(CLOUDBUILDER_DIR)/sources/tools/logging.cpp			\
+						$(CLOUDBUILDER_DIR)/sources/tools/metrics.cpp			\
+						$(CLOUDBUILDER_DIR)/sources/tools/transport.cpp			\
+						$(CLOUDBUILDER_DIR)/sources/tools/requestjournal.cpp	\
 						$(CLOUDBUILDER_DIR)/sources/tools/ssl_bio.cpp
 
 LOCAL_DISABLE_FATAL_LINKER_WARNINGS := true
@@ -0,0 +1,125 @@
+//
+//  CAllocator.h
+//  CloudBuilder
+//
+//  Created by florian on 20/10/16.
+//  Copyright (c) 2016 Clan of the Cloud. All rights reserved.
+//
+
+#ifndef CloudBuilder_CAllocator_h
+#define CloudBuilder_CAllocator_h
+
+#include <stddef.h>
+#include "CloudBuilder.h"
+
+/*! \file CAllocator.h
+ */
+
+namespace CloudBuilder {
+
+	/**
+	 * Families of internal allocations, used for accounting and passed to the allocator so that it
+	 * can dispatch them to different arenas.
+	 */
+	enum eMemoryCategory {
+		/// JSON nodes and the strings they hold (CHJSON)
+		enMemoryJSON,
+		/// HTTP requests and response buffers
+		enMemoryHTTP,
+		/// Delegates, results and pending callbacks
+		enMemoryCallbacks,
+		/// Internal string copies
+		enMemoryStrings,
+
+		enMemoryCategoryCount
+	};
+
+	/**
+	 * Describes a custom allocator through which the SDK will route its internal allocations.
+	 * Small blocks are recycled internally, so the allocator is only called when no free block is available.
+	 * Both functions may be called from any thread. Blocks are always released through the allocator
+	 * that allocated them, so it is safe to change the allocator while memory is in use, but the
+	 * functions must remain valid for the lifetime of the process.
+	 */
+	struct CAllocator {
+		/**
+		 * Allocates a block of memory, suitably aligned for any type (like malloc).
+		 * @param size number of bytes to allocate
+		 * @param category family of the allocation
+		 * @param userData value of the userData member of this structure
+		 * @return the block, or NULL if out of memory
+		 */
+		void *(*allocate)(size_t size, eMemoryCategory category, void *userData);
+		/**
+		 * Releases a block previously returned by allocate.
+		 * @param ptr block to release
+		 * @param category family of the allocation, as passed to allocate
+		 * @param userData value of the userData member of this structure
+		 */
+		void (*release)(void *ptr, eMemoryCategory category, void *userData);
+		/** Passed as is to the functions above. */
+		void *userData;
+	};
+
+	/**
+	 * Memory usage for a given category, as returned by CClan::GetMemoryStats.
+	 */
+	struct CMemoryStats {
+		/// Bytes currently allocated
+		size_t currentBytes;
+		/// Highest value reached by currentBytes
+		size_t peakBytes;
+		/// Number of allocations performed since the start of the process
+		unsigned long allocationCount;
+		/// Number of blocks released since the start of the process
+		unsigned long releaseCount;
+		/// Number of allocations served by recycling a previously released block; the difference with
+		/// allocationCount gives the number of calls that actually reached the allocator
+		unsigned long poolHitCount;
+	};
+}
+
+namespace CotCHelpers {
+	/**
+	 * Allocates memory through the allocator currently in use by the SDK.
+	 * @param size number of bytes to allocate
+	 * @param category family of the allocation, for accounting purposes
+	 * @return the block, to be released with ReleaseMemory, or NULL if out of memory
+	 */
+	FACTORY_FCT void *AllocateMemory(size_t size, CloudBuilder::eMemoryCategory category);
+	/**
+	 * Resizes a block allocated with AllocateMemory, keeping its category (like realloc).
+	 * @param ptr block to resize (may be NULL, in which case the category is used for a new allocation)
+	 * @param size new size of the block
+	 * @param category family of the allocation when ptr is NULL
+	 * @return the resized block, or NULL if out of memory (in which case ptr is left untouched)
+	 */
+	FACTORY_FCT void *ReallocateMemory(void *ptr, size_t size, CloudBuilder::eMemoryCategory category);
+	/**
+	 * Releases a block allocated with AllocateMemory.
+	 * @param ptr block to release (may be NULL)
+	 */
+	FACTORY_FCT void ReleaseMemory(void *ptr);
+	/**
+	 * Equivalent of strdup, allocating through AllocateMemory.
+	 * @param str string to copy
+	 * @param category family of the allocation
+	 * @return the copy, to be released with ReleaseMemory
+	 */
+	FACTORY_FCT char *DuplicateString(const char *str, CloudBuilder::eMemoryCategory category = CloudBuilder::enMemoryStrings);
+
+	/** \cond INTERNAL_USE */
+	bool InstallAllocator(const CloudBuilder::CAllocator *allocator);
+	void ReadMemoryStats(CloudBuilder::eMemoryCategory category, CloudBuilder::CMemoryStats *dest);
+	void ReleasePooledMemory();
+	/** \endcond */
+}
+
+/**
+ * Place in the declaration of a class so that instances allocated with new go through the SDK allocator.
+ */
+#define COTC_ALLOCATED_AS(category) \
+	static void *operator new(size_t size) { return CotCHelpers::AllocateMemory(size, category); } \
+	static void operator delete(void *ptr) { CotCHelpers::ReleaseMemory(ptr); }
+
+#endif
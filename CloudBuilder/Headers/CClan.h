@@ -13,6 +13,7 @@
 #include "CotCHelpers.h"		// for CRefClass
 #include "CHttpFailureEventArgs.h"
 #include "CLogLevel.h"
+#include "CAllocator.h"
 
 /*! \file CClan.h
  */
@@ -21,6 +22,18 @@ namespace CloudBuilder
 {
 	class CUserManager;
 	using namespace CotCHelpers;
+
+	/**
+	 * How the result handlers and event listeners are run, see CClan::SetCallbackDispatch.
+	 */
+	enum eCallbackDispatch {
+		/** By CClan::ProcessIdleTasks, on the thread calling it (default) */
+		enCallbackDispatchIdle,
+		/** As soon as they are ready, on the worker threads of the SDK */
+		enCallbackDispatchWorkers,
+		/** By CClan::ProcessIdleTasks, called by the host whenever it is notified that callbacks are pending */
+		enCallbackDispatchHost,
+	};
 	
 	/** The CloudBuilder::CClan class is the most important class. This is your primary
 		entry point in the CloudBuilder SDK. All the setup is done in this class.
@@ -29,7 +42,8 @@ namespace CloudBuilder
 	public:
 		
 		/** Function which returns the only instance of this class.
-			@result is the only instance of the CClan class.
+			@result is the only instance of the CClan class for the CClientContext in scope (that is the default one
+			unless you run several sessions, see CClientContext).
 		*/
 		static CClan *Instance();
 
@@ -59,8 +73,8 @@ namespace CloudBuilder
 
 			The optional keys are:
 			- "appFolder": used with the default CFileSystemHandler to set the folder in which
-			  the data will be saved. On Windows, it would be `%USERPROFILE%\AppData\Roaming\<appFolder>\`.
-			- "autoresume" : boolean to control if after a Setup the system has to proceed an automatic resumesession when possible.
+			  the data will be saved. On Windows, it would be `%USERPROFILE%\AppData\Roaming\<appFolder>\`. Only read by the default CClientContext.
+			- "autoresume" : boolean to control if after a Setup the system has to proceed an automatic resumesession when possible. Only read by the default CClientContext.
 			- "autoRegisterForNotification": by default, RegisterForNotification is called right after login.
 			  By setting this key to 'false', you can manage when you want to register for notifications by
 			  calling the CUserManager::RegisterForNotification at your convenience.
@@ -70,6 +84,55 @@ namespace CloudBuilder
 			  high value (at least 60). Defaults to 590.
 			- "httpVerbose": set to true to output detailed information about the requests performed to CotC servers. Can be used
 			  for debugging, though it will pollute the logs very much.
+			- "binaryWireFormat": set to true to exchange data with the servers in a compact binary form (CBOR) rather than JSON.
+			  This is transparent to the application, and the SDK falls back to JSON if the server doesn't support it. Defaults to false.
+			- "workerThreads": maximum number of threads used to run internal background tasks. Defaults to the number of
+			  processors (at least 2). The threads are shared by all the CClientContext of the process.
+			- "localValues": set to true to keep a local copy of the values of the gamer (CUserManager::GetValue, SetValue
+			  and DeleteValue), persisted through the CFilesystemManager. Reads are then answered locally once a key is known
+			  and writes are sent to the server in the background. Defaults to false.
+			- "localValuesFlushDelay": with localValues, time in milliseconds after which the values changed locally are sent
+			  to the server, so that successive changes are sent at once. 0 sends them immediately. Defaults to 2000.
+			- "localValuesRevalidateAfter": with localValues, time in seconds after which a value answered locally is read
+			  again from the server in the background. Defaults to 300.
+			- "requestJournal": set to true to keep the requests changing the state of the gamer (scores, transactions and
+			  achievements, properties, key/value storage) on the disk until the server has answered them. Those which could
+			  not reach the server are sent again when the network comes back and at the next Setup, and only the last of
+			  several changes to the same property or key is sent. Only read by the default CClientContext. Defaults to false.
+			- "deltaUpdates": set to true to remember the properties and profile last acknowledged by the server, so that
+			  CUserManager::SetProperties and SetProfile only send what changed (and nothing when nothing did). The properties
+			  of a domain are known once read or set as a whole; changes made by other means are only seen when reading them
+			  again. Defaults to false.
+			- "aggregateProgress": set to true to hold the increments of CUserManager::EarnAchievement (without gamer data)
+			  and the scores of CGameManager::Score (unless forced) for a while. Increments are then sent together in a single
+			  transaction, and only the best of the scores posted to a mode is sent; scores which can't beat the best one
+			  known for the gamer (read through CGameManager::UserBestScores or accepted earlier) are answered with done = 0
+			  without a request. Held progress is sent after aggregateProgressDelay, after aggregateProgressThreshold calls,
+			  and when suspending or logging out. CClan::Terminate queues it without waiting for the requests, so progress
+			  held at that point only survives with requestJournal (it is then sent at the next Setup). Defaults to false.
+			- "aggregateProgressDelay": with aggregateProgress, time in milliseconds for which progress is held. Defaults to 5000.
+			- "aggregateProgressThreshold": with aggregateProgress, number of calls after which held progress is sent right
+			  away. Defaults to 50.
+			- "leaderboardCacheTTL": time in seconds for which the pages of scores (CGameManager::BestHighScore and
+			  CenteredScore, CTribeManager::FriendsBestHighScore) are answered from memory. Scores of the gamer accepted by
+			  the server are reflected in the cached pages. Defaults to 0, which disables the cache.
+			- "leaderboardPrefetch": with leaderboardCacheTTL, whether the pages next to a viewed one are fetched in the
+			  background. Defaults to true.
+			- "friendsCache": if true, the friends and blacklisted gamers of the private domain (CTribeManager::ListFriends
+			  and BlacklistFriends) are kept in memory and updated with the relationship changes and the friend events
+			  received, rather than fetched each time. Defaults to false.
+			- "productCatalogTTL": time in seconds for which the products (CStoreManager::FetchProductInformation, and the
+			  check made by LaunchPurchase) and the purchase history are reused. Concurrent calls then share the same
+			  request. The product information is also saved to disk and answered from there after a restart, while it is
+			  fetched again. Defaults to 0, which disables the cache.
+			- "httpRecordFile": name of a file (as passed to the CFilesystemManager) to which all the HTTP requests and their
+			  responses are written, for later use with httpReplayFile.
+			- "httpReplayFile": name of a file written through httpRecordFile. Requests are then answered from this file rather
+			  than by the servers, without a network. Meant for tests and benchmarks. Like httpRecordFile, it applies to all the
+			  CClientContext of the process and stays in place after Terminate.
+			- "httpReplayLatencyMs": delay added to each response served with httpReplayFile. Defaults to 0.
+			- "httpReplayFailureRate": proportion of requests failing as if the network was down with httpReplayFile, from 0 to 1.
+			  Defaults to 0.
 			@param handler result handler whenever the call finishes (it might also be synchronous)
 			@result if noErr, the json passed to the handler may contain:
 			{ "_error" : 0}
@@ -113,6 +176,31 @@ namespace CloudBuilder
 		*/
 		void ProcessIdleTasks();
 
+		/**
+		 * Lets applications without a main loop (servers, tools) get their callbacks without polling ProcessIdleTasks.
+		 * Applies to the CClientContext in scope; callbacks already pending are handed over right away.
+		 *
+		 * With enCallbackDispatchWorkers, the callbacks run on the worker threads shared by the SDK. The callbacks of a
+		 * context still run one after the other, in order, but not always on the same thread. Do not call Terminate
+		 * from a callback in this mode.
+		 *
+		 * With enCallbackDispatchHost, aNotifier is called whenever callbacks become pending, from an internal thread
+		 * and with internal locks held: it should only wake up your loop or post a job to your executor, which then
+		 * calls ProcessIdleTasks (in the scope of the context).
+		 * @param aMode where the callbacks are run
+		 * @param aNotifier required for enCallbackDispatchHost, ignored otherwise; owned by the library
+		 */
+		void SetCallbackDispatch(eCallbackDispatch aMode, CDelegate<void ()> *aNotifier = NULL);
+
+		/**
+		 * Returns a file descriptor that is readable while callbacks are pending, to integrate the SDK in an event
+		 * loop (epoll, select, libuv...) in place of polling: wait for it, then call ProcessIdleTasks, which resets
+		 * it. Do not read from or close the descriptor yourself. It stays valid for the lifetime of the CClientContext
+		 * in scope. Not available on Windows.
+		 * @return the descriptor (an eventfd on Linux and Android, the read end of a pipe elsewhere), or -1 upon error
+		 */
+		int GetCallbackNotificationFd();
+
 		/**
 		 * When called once from your app, this function disables the default behavior of the HTTP layer (unless
 		 * called back with a null parameter). That is, no more retry by default, no more "offline mode" with
@@ -144,6 +232,61 @@ namespace CloudBuilder
 		 */
 		void SetLogLevel(LOG_LEVEL logLevel);
 
+		/**
+		 * Redirects the messages logged by the SDK. Messages are formatted on the thread that logs them and passed
+		 * to the sink in order from a background thread, so that logging doesn't slow down the SDK.
+		 * @param sink function receiving the messages; NULL to restore the default output (stderr, or logcat on Android)
+		 * @param userData passed as is to the sink
+		 */
+		void SetLogSink(LOG_SINK sink, void *userData);
+
+		/**
+		 * Limits the number of messages logged per second. Messages above the limit are dropped, and their count
+		 * is reported with the next message. Errors are never dropped.
+		 * @param messagesPerSecond maximum number of messages per second, 0 (default) for no limit
+		 */
+		void SetLogRateLimit(int messagesPerSecond);
+
+		/**
+		 * Routes the internal allocations of the SDK (JSON, HTTP buffers, callbacks) through a custom allocator.
+		 * It is recommended to call this before Setup, as memory allocated earlier with another allocator keeps
+		 * being released through it.
+		 * @param aAllocator the allocator to use, copied internally; pass NULL to go back to the C library.
+		 * @return whether the allocator was installed (a limited number of different allocators can be used
+		 * during the lifetime of the process)
+		 */
+		bool SetAllocator(const CAllocator *aAllocator);
+
+		/**
+		 * Queries the memory currently used by the SDK.
+		 * @param aCategory the family of allocations to query
+		 * @param aDest filled with the statistics for this category
+		 */
+		void GetMemoryStats(eMemoryCategory aCategory, CMemoryStats *aDest);
+
+		/**
+		 * Returns the HTTP metrics aggregated since the start of the process or the last reset, meant to be exported
+		 * to your telemetry. Requests are grouped by endpoint family, made of the first three components of their path
+		 * (e.g. /v1/gamer/vfs). The timings of a single request are available through CCloudResult::GetTimings.
+		 * Example:
+		 * {
+		 *   "periodMs": 60000,
+		 *   "bucketBoundsMs": [10, 25, 50, 100, 250, 500, 1000, 2500, 5000, 10000],
+		 *   "families": {
+		 *     "/v1/gamer/vfs": {
+		 *       "count": 12, "errors": 1, "retries": 2, "bytesSent": 2048, "bytesReceived": 4096, "queueMs": 35,
+		 *       "latency": {"buckets": [0, 0, 0, 4, 6, 1, 1, 0, 0, 0, 0], "sumMs": 2710, "maxMs": 1210}
+		 *     }
+		 *   },
+		 *   "callbackWait": {"buckets": [40, 2, 0, 0, 0, 0, 0, 0, 0, 0, 0], "sumMs": 97, "maxMs": 22}
+		 * }
+		 * Each histogram has one more bucket than bucketBoundsMs, counting the values above the last bound. Latency is measured
+		 * from the moment a request is queued to its completion, including retries. queueMs and sumMs are totals in milliseconds.
+		 * @param aReset whether to start a new aggregation period
+		 * @return the metrics, to be deleted by you
+		 */
+		CotCHelpers::CHJSON *GetHttpMetrics(bool aReset = false);
+
 		/** \cond INTERNAL_USE */
 		bool useAutoResume() { return mAutoresume; }
 		
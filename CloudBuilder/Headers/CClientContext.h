@@ -0,0 +1,108 @@
+//
+//  CClientContext.h
+//  CloudBuilder
+//
+//  Created by florian on 20/10/16.
+//  Copyright (c) 2016 Clan of the Cloud. All rights reserved.
+//
+
+#ifndef CloudBuilder_CClientContext_h
+#define CloudBuilder_CClientContext_h
+
+#include "CloudBuilder.h"
+#include "CotCHelpers.h"
+
+/*! \file CClientContext.h
+ */
+
+namespace CloudBuilder {
+
+	/**
+	 * A session with the servers: the app and gamer credentials, the queue of HTTP requests, the event loops and the
+	 * callbacks waiting for ProcessIdleTasks, along with the CClan and managers working on them. All the contexts of
+	 * the process share the connections to the servers and the worker threads.
+	 *
+	 * Most applications have a single session and never need this class: CClan::Instance(), CUserManager::Instance()
+	 * and the other managers belong to the default context. Running several gamers in one process (bots, server side
+	 * simulations) goes as follows:
+	 * @code
+		CClientContext *bot = CClientContext::Create();
+		{
+			// Calls made in the scope go to the session of the bot
+			CClientContext::Scope scope(bot);
+			CClan::Instance()->Setup(&configuration, setupHandler);
+		}
+		// In the main loop, for each bot
+		bot->ProcessIdleTasks();
+		// When done
+		{
+			CClientContext::Scope scope(bot);
+			CClan::Instance()->Terminate();
+		}
+		bot->Release(); @endcode
+	 * Result handlers and event listeners run in the scope of the context that made the call, so that the calls made
+	 * from them go to the same session.
+	 *
+	 * The log level and sink, the allocator, the filesystem, the HTTP transport, the HTTP metrics and the number of
+	 * worker threads are common to the whole process. The "appFolder" and "autoresume" setup options are only taken
+	 * into account by the default context.
+	 */
+	class FACTORY_CLS CClientContext : public CotCHelpers::CRefClass {
+	public:
+		/**
+		 * @return the context used when no other one is in scope
+		 */
+		static CClientContext *Default();
+		/**
+		 * Creates an independent context.
+		 * @return a new context, to be released by you once its CClan has been terminated
+		 */
+		static CClientContext *Create();
+		/**
+		 * @return the context in scope on the calling thread, or the default one
+		 */
+		static CClientContext *Current();
+
+		/**
+		 * Runs the callbacks pending on this context, as CClan::ProcessIdleTasks does for the context in scope.
+		 * Call it regularly from the thread on which the callbacks should run.
+		 */
+		void ProcessIdleTasks();
+
+		/**
+		 * @return whether this is the default context
+		 */
+		bool IsDefault() const { return mIsDefault; }
+
+		/**
+		 * Makes a context current on the calling thread for the lifetime of this object. Scopes can be nested.
+		 */
+		class FACTORY_CLS Scope {
+			CClientContext *mPrevious;
+			// Not allowed
+			Scope(const Scope &other);
+			Scope& operator = (const Scope &);
+
+		public:
+			/**
+			 * @param context context to use; NULL for the default one
+			 */
+			Scope(CClientContext *context);
+			~Scope();
+		};
+
+		/** \cond INTERNAL_USE */
+		struct Members;
+		Members &Internals() { return *mMembers; }
+		/** \endcond */
+
+	private:
+		Members *mMembers;
+		bool mIsDefault;
+
+		CClientContext(bool isDefault);
+		~CClientContext();
+	};
+}
+
+#endif
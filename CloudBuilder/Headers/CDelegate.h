@@ -5,6 +5,7 @@
 #include "CHJSON.h"
 #include "CFastDelegate.h"
 #include "CotCHelpers.h"
+#include "CAllocator.h"
 
 namespace CotCHelpers {
 	struct cstring;
@@ -13,6 +14,34 @@ namespace CotCHelpers {
 #pragma warning(disable:4355)
 namespace CloudBuilder {
 
+	/**
+	 * Timing breakdown of the HTTP request behind a result, as returned by CCloudResult::GetTimings.
+	 * All durations are in milliseconds. The network figures (DNS to transfer) are those of the last attempt,
+	 * and are zero for results that didn't come from the network.
+	 */
+	struct CRequestTimings {
+		/// Time spent in the request queue before the first attempt
+		double queueMs;
+		/// Host name resolution
+		double dnsMs;
+		/// TCP connection, after the resolution
+		double connectMs;
+		/// TLS handshake, after the connection
+		double tlsMs;
+		/// From the start of the attempt to the first byte of the response
+		double firstByteMs;
+		/// Whole attempt, from the start to the last byte of the response
+		double transferMs;
+		/// From the moment the request was queued to its completion, including all attempts and delays between them
+		double totalMs;
+		/// Time during which the result waited in the callback queue before being delivered by CClan::ProcessIdleTasks
+		double callbackWaitMs;
+		/// Number of attempts beyond the first one
+		int retryCount;
+		/// Body bytes sent and received, summed over all attempts
+		double bytesSent, bytesReceived;
+	};
+
 	/**
 		Used to manage the data returned by a callback.
 		Typically a result always has an Error Code and  usually a JSON struct if the request
@@ -59,7 +88,13 @@ namespace CloudBuilder {
 		const void *BinaryPtr() const;
 
 		bool IsObsolete() const { return mObsolete; }
-		
+
+		/**
+			Timing breakdown of the request that produced this result. Useful to find out whether the time
+			was spent on the network, on the server or waiting for ProcessIdleTasks.
+		*/
+		const CRequestTimings &GetTimings() const { return mTimings; }
+
 		/**
 			@return a copy of this object, to be deleted by you.
 		*/
@@ -78,8 +113,10 @@ namespace CloudBuilder {
 		void SetErrorCode(eErrorCode err);
 		void SetCurlErrorCode(int err);
 		void SetHttpStatusCode(int err);
-		void SetBinary(void *buffer, size_t size);
+		void SetBinary(void *buffer, size_t size);	// buffer allocated with CotCHelpers::AllocateMemory, owned by the result
 		void SetObsolete(bool obsolete) { mObsolete = obsolete; }
+		CRequestTimings &Timings() { return mTimings; }
+		COTC_ALLOCATED_AS(enMemoryCallbacks)
 
 		/**
 		 * Offers a pretty-printed view of this result, including the JSON inside when available.
@@ -93,6 +130,7 @@ namespace CloudBuilder {
 		DataHolder *mBinary;
 		size_t  mSize;
 		bool    mHasBinary, mObsolete;
+		CRequestTimings mTimings;
 	};
 
 	/**
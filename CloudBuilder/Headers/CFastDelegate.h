@@ -56,9 +56,11 @@
 
 #include <string.h>
 #include <memory.h> // to allow <,> comparisons
+#include "CAllocator.h"
 
 #define CDELEGATE_COMMON_CODE(className) 	RetType Invoke() const { \
-	return (m_Closure.GetClosureThis()->*(m_Closure.GetClosureMemPtr()))(); }
+	return (m_Closure.GetClosureThis()->*(m_Closure.GetClosureMemPtr()))(); } \
+	COTC_ALLOCATED_AS(CloudBuilder::enMemoryCallbacks)
 
 
 ////////////////////////////////////////////////////////////////////////////////
@@ -91,6 +91,12 @@ namespace CloudBuilder {
 		 * @param aNumBytes number of bytes to write.
 		*/
 		virtual size_t Write(const void *aSourceBuffer, size_t aNumBytes) = 0;
+
+		/**
+		 * Should make sure that the data written so far reaches the storage, so that it survives the death of
+		 * the process. Does nothing by default.
+		*/
+		virtual void Flush() {}
 	};
 	
 	/**
@@ -19,6 +19,7 @@ namespace CloudBuilder
 {
 	class CClan;
 	class CCloudResult;
+	class CLeaderboardCache;
 
 	/** The CGameManager class is helpful when you want to store global data for your
 		application. These data will be accessible to all users who have installed and
@@ -155,6 +156,11 @@ namespace CloudBuilder
 		 * @result if noErr, the json passed to the handler will contain the result of the executed batch
 		 */
 		void Batch(CResultHandler *aHandler, const CotCHelpers::CHJSON *aConfiguration, const CotCHelpers::CHJSON *aParameters);
+		/**
+		 * Same as the previous method, but takes over the contents of aParameters rather than copying them
+		 * (pass it with std::move). aParameters is left empty after the call.
+		 */
+		void Batch(CResultHandler *aHandler, const CotCHelpers::CHJSON *aConfiguration, CotCHelpers::CHJSON &&aParameters);
 
         DEPRECATED void Score(CResultHandler *aHandler, long long aHighScore, const char *aMode, const char *aScoreType, const char *aInfoScore, bool aForce, const char *aDomain="private");
         DEPRECATED void GetRank(CResultHandler *aHandler, long long aHighScore, const char *aMode, const char *aDomain="private");
@@ -178,7 +184,11 @@ namespace CloudBuilder
         void binaryReadDone(const CCloudResult *result, CResultHandler *aHandler);
         void getBinaryDone(const CCloudResult *result, CResultHandler *aHandler);
 
+		// Pages of scores kept for a while, enabled with the "leaderboardCacheTTL" setup option
+		CLeaderboardCache *mLeaderboards;
+
 		friend class CClan;
+		friend class CTribeManager;
 		friend struct singleton_holder<CGameManager>;
 	};
 	
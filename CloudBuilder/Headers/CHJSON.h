@@ -10,6 +10,7 @@
 #define CloudBuilder_CHjSON_h
 
 #include "CloudBuilder.h"
+#include "CAllocator.h"
 #include <vector>
 #include <iterator>
 
@@ -29,18 +30,31 @@ namespace CotCHelpers {
 	class FACTORY_CLS CHJSON
 	{
 	public:
+		COTC_ALLOCATED_AS(CloudBuilder::enMemoryJSON)
 		
 		//////////////////////////// Basic API -- getting and setting keys ////////////////////////////
 		/**
 		 * Default constructor, builds an empty JSON.
 		 */
 		CHJSON();
+		/**
+		 * Move constructor: takes over the contents of another JSON without copying them. The other JSON is left empty.
+		 * @param aOther JSON to take the contents from.
+		 */
+		CHJSON(CHJSON &&aOther);
 		/**
 		 *Function which creates a JSON object given a properly constructed string representing a JSON.
 		 * @param aJsonString is the string describing the JSON you want to create.
 		 * @result is the JSON object, which you must delete.
 		 */
 		static CHJSON *parse(const char *aJsonString);
+		/**
+		 * Function which creates a JSON object from its compact binary (CBOR) representation, as produced by printBinary.
+		 * @param aData is the binary data.
+		 * @param aLength is the size of the data, in bytes.
+		 * @result is the JSON object, which you must delete, or NULL if the data is malformed.
+		 */
+		static CHJSON *parseBinary(const void *aData, size_t aLength);
 		/**
 		 * Returns an empty JSON.
 		 */
@@ -113,6 +127,18 @@ namespace CotCHelpers {
 		 */
 		void Delete(const char *aItem);
 
+		/** Removes a pair key/value from a JSON object and hands the value over to the caller, without copying it.
+			@param aItem is the key of the pair key/value you want to remove from the dictionary.
+			@result is the value, which you must delete, or NULL if the key was not found.
+		 */
+		CHJSON *Extract(const char *aItem);
+
+		/** Removes an element from a JSON array and hands it over to the caller, without copying it.
+			@param aIndex is the index of the element in the array.
+			@result is the element, which you must delete, or NULL if out of bounds.
+		 */
+		CHJSON *Extract(int aIndex);
+
 		/**
 		 * Clears all elements.
 		 */
@@ -172,6 +198,12 @@ namespace CotCHelpers {
 		 * @param json is the value to put inside (copy)
 		 */
 		void Put(const char *aKey, const CHJSON& json) { Put(aKey, json.Duplicate()); }
+		/**
+		 * Same as the previous method, but moves the contents of the passed JSON rather than copying them.
+		 * @param aKey is the key to add or replace.
+		 * @param json is the value to put inside (left empty after the call)
+		 */
+		void Put(const char *aKey, CHJSON&& json) { Put(aKey, new CHJSON(static_cast<CHJSON&&>(json))); }
 
 		struct Iterator: std::iterator<std::forward_iterator_tag, const CHJSON*> {
 			Iterator(const CHJSON *json, int index);
@@ -185,6 +217,8 @@ namespace CotCHelpers {
 		private:
 			const CHJSON *json;
 			int index;
+			// Node at index, so that moving to the next one doesn't walk the list again
+			cJSON *node;
 		};
 		/**
 		 * Allow for iterating the nodes inside an object or an array.
@@ -209,6 +243,13 @@ namespace CotCHelpers {
 		cstring printFormatted() const;
 		cstring& printFormatted(cstring& dest) const;
 
+		/** Method which serializes the content of the JSON object in its compact binary (CBOR) representation.
+			Unlike print(), no escaping is done and numbers are stored in binary form.
+			@param outLength receives the size of the result, in bytes.
+			@result is a buffer which must be released using free(), or NULL if out of memory.
+		 */
+		void *printBinary(size_t *outLength) const;
+
 		//////////////////////////// Creating arrays ////////////////////////////
 
 		/** Static function to create a JSON as an empty array. Will create a JSON of type jsonArray.
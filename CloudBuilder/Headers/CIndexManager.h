@@ -17,6 +17,58 @@
 
 namespace CloudBuilder
 {
+	class CIndexManager;
+
+	/**
+	 * Cursor over the results of a search in an index, obtained from CIndexManager#OpenSearch. The hits are fetched
+	 * page by page as they are consumed: the next page is requested in advance when few hits are left, so that
+	 * scanning a large index doesn't wait for each page, while no more hits than the window are held at a time.
+	 *
+	 * This is a CRefClass: call Release() once you are done with it. It is kept alive until the pending requests
+	 * complete.
+	 */
+	class FACTORY_CLS CSearchCursor: public CotCHelpers::CRefClass {
+	public:
+		/**
+		 * Passes the next hits of the search. Only one call may be pending at a time.
+		 * @param aCount number of hits wanted (reduced to the window); fewer are passed at the end of the results only
+		 * @param aHandler result handler, called synchronously when enough hits have been fetched already
+		 * @result if noErr, the json passed to the handler contains:
+		 - total (number): the total number of hits of the search.
+		 - hits (array): the next hits, as described in CIndexManager#Search; empty once all have been passed.
+		 * On error (e.g. a page couldn't be fetched), the cursor stays where it was and the call may be repeated.
+		 */
+		void Next(int aCount, CResultHandler *aHandler);
+		/**
+		 * @return the total number of hits, or -1 until the first page has been received
+		 */
+		int GetTotal() const { return total; }
+		/**
+		 * @return whether all the hits have been passed
+		 */
+		bool IsDone() const;
+
+	private:
+		friend class CIndexManager;
+		struct Hits;
+
+		CIndexManager *expectedManager;
+		// Configuration of the search, with skip and limit set for the next page
+		CotCHelpers::CHJSON *config;
+		// Received and not passed yet
+		Hits &hits;
+		CResultHandler *pendingHandler;
+		int pendingCount, pageSize, window, skip, requested, total;
+		bool fetching, exhausted;
+
+		CSearchCursor(const CotCHelpers::CHJSON *aConfiguration);
+		~CSearchCursor();
+		bool CheckManager();
+		void FetchPage();
+		void PageFetched(const CCloudResult *result);
+		void PassHits(CResultHandler *handler, int count);
+	};
+
 	/** The CIndexManager class is used to index and search for objects (e.g. matches, players, ?).
 
 		The index is global to a domain (or your game if private, as usual), therefore all data is
@@ -112,6 +164,11 @@ namespace CloudBuilder
 		 }
 		 */
 		void IndexObject(const CotCHelpers::CHJSON *aConfiguration, CResultHandler *aHandler);
+		/**
+		 * Same as the previous method, but takes over the properties and payload from aConfiguration rather than
+		 * copying them (pass it with std::move). aConfiguration must not be used after the call.
+		 */
+		void IndexObject(CotCHelpers::CHJSON &&aConfiguration, CResultHandler *aHandler);
 
 		/**
 		 * Searches the index.
@@ -157,6 +214,19 @@ namespace CloudBuilder
 	    */
 		void Search(const CotCHelpers::CHJSON *aConfiguration, CResultHandler *aHandler);
 
+		/**
+		 * Searches the index with a cursor, which fetches the results page by page as they are consumed. Meant for
+		 * scanning many results, as in matchmaking.
+		 * @param aConfiguration same as #Search, where:
+		 - limit (optional number): the number of hits fetched per request, defaulting to 30.
+		 - skip (optional number): the first hit to start from.
+		 - window (optional number): the maximum number of hits held by the cursor, including the page fetched in
+		   advance. Defaults to twice the limit, and can't be less than it.
+		 * @return a cursor, which you own (call Release() once done). No request is made until CSearchCursor#Next
+		 * is called.
+		 */
+		CSearchCursor *OpenSearch(const CotCHelpers::CHJSON *aConfiguration);
+
 	private:
 
 		/**
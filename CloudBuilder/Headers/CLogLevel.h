@@ -8,5 +8,13 @@ enum LOG_LEVEL {
 	LOG_LEVEL_EXTRA
 };
 
+/**
+ * Receives the messages logged by the SDK (see CloudBuilder::CClan::SetLogSink).
+ * @param level severity of the message
+ * @param message formatted message, only valid during the call
+ * @param userData as passed to SetLogSink
+ */
+typedef void (*LOG_SINK)(LOG_LEVEL level, const char *message, void *userData);
+
 #endif
 
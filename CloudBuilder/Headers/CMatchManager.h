@@ -20,6 +20,7 @@ namespace CloudBuilder {
 	using CotCHelpers::CHJSON;
 	using CotCHelpers::CRefClass;
 	struct CMatch;
+	class CMatchState;
 	template<class T> struct chain;
 
 	/**
@@ -222,6 +223,11 @@ namespace CloudBuilder {
 		 } @endcode
 		 */
         void CreateMatch(const CHJSON *aConfiguration, CResultHandler *aHandler);
+		/**
+		 * Same as the previous method, but takes over the contents of aConfiguration rather than copying them
+		 * (pass it with std::move). aConfiguration is left empty after the call.
+		 */
+        void CreateMatch(CHJSON &&aConfiguration, CResultHandler *aHandler);
 
 		/**
 		 * Lists the matches available to join.
@@ -308,6 +314,11 @@ namespace CloudBuilder {
 		 - "match" (object): updated match object as described in #CreateMatch. Please take note of the `lastEventId` contained.
 		 */
         void PostMove(const CHJSON *aConfiguration, CResultHandler *aHandler);
+		/**
+		 * Same as the previous method, but takes over the move data from aConfiguration rather than copying it
+		 * (pass it with std::move). aConfiguration must not be used after the call.
+		 */
+        void PostMove(CHJSON &&aConfiguration, CResultHandler *aHandler);
 
 		/**
 		 * Draws one or more randomized items from the shoe (see #CreateMatch).
@@ -427,6 +438,19 @@ namespace CloudBuilder {
 			} @endcode
 		 */
 		const CHJSON *GetPlayers();
+		/**
+		 * Moves are logged from the time the match is joined or fetched (including the moves pending on the server
+		 * then), as received in match.move events or posted by you. The log is saved when the match is destroyed and
+		 * restored by CMatchManager#HLRestoreMatch, so it also holds the moves that the server dropped meanwhile.
+		 * @return the number of moves known for this match.
+		 */
+		int GetMoveCount();
+		/**
+		 * @param aIndex index of the move, from 0 to GetMoveCount() - 1, oldest first
+		 * @return the move as found in match.move events: {"_id": event ID, "player_id": gamer ID, "move": move data},
+		 * or NULL if out of bounds.
+		 */
+		const CHJSON *GetMove(int aIndex);
 		/**
 		 * @return the current status of the match.
 		 */
@@ -450,7 +474,12 @@ namespace CloudBuilder {
 		 */
 		void UnregisterEventListener(CMatchEventListener *aEventListener);
 		/**
-		 * Posts a move to other players.
+		 * Posts a move to other players. The move is added to the moves of the match (see #GetMove) at once, and
+		 * posted as soon as those posted before are done, so you don't need to wait for the handler to post the next
+		 * one. If the server refuses it (for instance because another player made a move first), this move and those
+		 * posted after it are removed from the moves; the handlers of the latter get enCanceled. They are also
+		 * canceled if a move of another player is received before they could be sent. The events of your own moves
+		 * are not passed to the listeners. Wait for the handlers before calling #DrawFromShoe or #Finish.
          * @param aHandler the result handler, which may be called synchronously
 		 * @param aMoveData a freeform JSON indicating your move so that others can track your progress
 		 * @param aOptionalUpdatedGameState a freeform JSON replacing the global game state, to be used by players who join from now on
@@ -496,15 +525,20 @@ namespace CloudBuilder {
 		void Finish(CMatchResultHandler *aHandler, bool aDeleteToo, const CHJSON *aOptionalAdditionalData);
 
 	private:
+		friend struct CMatchManager;
 		CMatchManager *expectedManager;
-		CotCHelpers::cstring lastEventId;
 		chain<CMatchEventListener> &eventListeners;
-		// Stores a part of the match data only (the players are separated because updated frequently, and some properties are not included)
-		owned_ref<CHJSON> matchData, playerData;
+		// Updated in place from the results and events, rather than copied from them
+		CMatchState &state;
+		struct MoveQueue;
+		MoveQueue &moves;
 
 		bool CheckManager();
 		void UpdateFromMatchData(const CHJSON *json);
 		const char *GetDomain();
+		void PostNextMove();
+		void MovePosted(const CCloudResult *result);
+		void CancelQueuedMoves(size_t kept);
 
 		virtual void onEventReceived(const char *aDomain, const CCloudResult *aEvent);
 		virtual void onEventError(eErrorCode aErrorCode, const char *aDomain, const CCloudResult *result);
@@ -19,6 +19,7 @@
 namespace CloudBuilder {
 	using CotCHelpers::CHJSON;
 	using CotCHelpers::CRefClass;
+	class CProductCatalog;
 
 	/**
 		The CStoreManager class allows to easily make in-app purchase on supported
@@ -100,6 +101,8 @@ namespace CloudBuilder {
 		
 	private:
 		bool currentlyProcessesProduct;
+		// Products and purchase history kept for a while, enabled with the "productCatalogTTL" setup option
+		CProductCatalog *mCatalog;
 		
 		CStoreManager();
 		~CStoreManager();
@@ -118,6 +121,7 @@ namespace CloudBuilder {
 		
 
 		friend void CClan::Terminate();
+		friend class CClan;
 		friend struct singleton_holder<CStoreManager>;
 	};
 }
@@ -18,6 +18,8 @@
 
 namespace CloudBuilder
 {
+	class CFriendsCache;
+
 	/**
 		The CTribeManager class is used to manage friends for a profile, and to allow
 		this profile to send friendship requests to other profiles. This class manages
@@ -143,6 +145,8 @@ private:
 		void ListFriendsGCDone(const CCloudResult *result, CHJSON *config, CResultHandler *callNext);
 
 		CGloballyKeptHandler<CResultHandler> &friendHandler;
+		// Friends and blacklist of the private domain, enabled with the "friendsCache" setup option
+		CFriendsCache *mFriends;
 				
 		public:
 			CTribeManager();
@@ -154,6 +158,7 @@ private:
 			void Terminate();
 
 			eErrorCode friendsGC(const CotCHelpers::CHJSON *friends);
+			friend class CClan;
 			friend struct singleton_holder<CTribeManager>;
 	};
 	
@@ -13,6 +13,7 @@
  */
 #include "CotCHelpers.h"
 #include "CHJSON.h"
+#include "CValueConflictEventArgs.h"
 
 extern "C" {
 	void LaunchAuthenticate(void);
@@ -22,6 +23,9 @@ namespace CloudBuilder
 {
 
 	class CCloudResult;
+	class CValueStore;
+	class CPropertyShadow;
+	class CProgressAggregator;
 
 	/** \cond INTERNAL_USE */
 	void AchieveRegisterDevice(unsigned long len, const void *bytes);
@@ -246,6 +250,11 @@ namespace CloudBuilder
 			"done" : 1
 		*/
 		void SetProfile(const CotCHelpers::CHJSON *aJson, CResultHandler *aHandler);
+		/**
+			Same as the previous method, but takes over the contents of aJson rather than copying them (pass it
+			with std::move). aJson is left empty after the call.
+		*/
+		void SetProfile(CotCHelpers::CHJSON &&aJson, CResultHandler *aHandler);
 
 		/**
 			Method used to retrieve some optional data of the logged in profile previously set by
@@ -277,6 +286,11 @@ namespace CloudBuilder
 			}
 		*/
         void SetProperties(const CotCHelpers::CHJSON* aPropertiesList, const char *aDomain, CResultHandler *aHandler);
+		/**
+			Same as the previous method, but takes over the contents of aPropertiesList rather than copying them
+			(pass it with std::move). aPropertiesList is left empty after the call.
+		*/
+        void SetProperties(CotCHelpers::CHJSON &&aPropertiesList, const char *aDomain, CResultHandler *aHandler);
 		
 		/**
 			Method to get the list of previously saved properties used to find opponents for a match.
@@ -307,6 +321,11 @@ namespace CloudBuilder
 			}
 		 */
         void SetProperty(const CotCHelpers::CHJSON* aProperty, const char *aDomain, CResultHandler *aHandler);
+		/**
+			Same as the previous method, but takes over the contents of aProperty rather than copying them
+			(pass it with std::move). aProperty is left empty after the call.
+		*/
+        void SetProperty(CotCHelpers::CHJSON &&aProperty, const char *aDomain, CResultHandler *aHandler);
 		
 		/**
 			Method to get the list of previously saved properties used to find opponents for a match.
@@ -381,6 +400,8 @@ namespace CloudBuilder
 
         /**
             Method to read a single key of the global JSON object stored for this user and this domain.
+            With the "localValues" setup option (see CClan::Setup), keys already read or written are answered
+            from the local copy right away, and read again from the server in the background from time to time.
             @param aConfiguration is a JSON configuration, that may contain
             - domain: the domain on which the action is to be taken (if not passed, the private domain is used)
             - key: name of the key to retrieve from the global JSON object (if not passed, all keys are returned)
@@ -397,6 +418,9 @@ namespace CloudBuilder
             Method to insert a key or modify the global JSON object stored for this user and this domain.
             Please note that if you have used BinaryWrite with a key you reuse in KeyValueWrite, you will
             lose your initial binary data.
+            With the "localValues" setup option, a key is only written locally (the handler is called right
+            away with "done": 1) and sent to the server later, see FlushValues. Writing the whole object (no key)
+            is still done immediately, and discards the local changes made to the domain.
             @param aConfiguration JSON allowing for extensible configuration, that may contain:
             - domain: the domain on which the action is to be taken (if not passed, the private domain is used)
             - key: name of the key to write to (if not passed, the JSON itself is replaced)
@@ -408,9 +432,15 @@ namespace CloudBuilder
             }
          */
         void SetValue(const CotCHelpers::CHJSON *aConfiguration, CResultHandler *aHandler);
+        /**
+            Same as the previous method, but takes over the data from aConfiguration rather than copying it
+            (pass it with std::move). aConfiguration must not be used after the call.
+         */
+        void SetValue(CotCHelpers::CHJSON &&aConfiguration, CResultHandler *aHandler);
 
 		/**
 			Method to delete a single key of the global JSON object stored for this user and domain.
+			With the "localValues" setup option, the key is deleted locally and on the server later, like SetValue.
 			@param aConfiguration is a JSON configuration, that may contain
 			- domain: the domain on which the action is to be taken (if not passed, the private domain is used)
 			- key: name of the key to delete from the global JSON object. BEWARE: if you omit the key, ALL entries
@@ -423,6 +453,24 @@ namespace CloudBuilder
 		 */
         void DeleteValue(const CotCHelpers::CHJSON *aConfiguration, CResultHandler *aHandler);
 
+		/**
+			Sends the values changed locally to the server now, rather than after the delay set by the
+			"localValuesFlushDelay" setup option. Changes are otherwise kept on the disk until they can be sent,
+			including across restarts of the application. Only the last change of each key is sent.
+			@param aHandler result handler called once all changes have been acknowledged by the server; the
+			error code is the one of the first change that failed, if any. Changes that failed because of the
+			network are sent again later, the ones rejected by the server are dropped.
+		 */
+		void FlushValues(CResultHandler *aHandler);
+
+		/**
+			Sets the handler deciding what to do when a key changed locally is found to have been changed on
+			the server as well, before the local change was sent. Conflicts are detected when the key is read
+			again from the server. By default the last writer wins, that is the local change.
+			@param aHandler handler, owned by the library from now on; NULL to restore the default behaviour
+		 */
+		void SetValueConflictHandler(CDelegate<void (CValueConflictEventArgs&)> *aHandler);
+
 		/**
 			 Method to read a single key containing binary data stored for this user and this domain.
 			 @param aConfiguration JSON allowing for extensible configuration, that may contain:
@@ -708,6 +756,11 @@ namespace CloudBuilder
 		 * @result if noErr, the json passed to the handler will contain the result of the executed batch
 		 */
         void Batch(const CotCHelpers::CHJSON *aConfiguration, const CotCHelpers::CHJSON *aParameters, CResultHandler *aHandler);
+		/**
+		 * Same as the previous method, but takes over the contents of aParameters rather than copying them
+		 * (pass it with std::move). aParameters is left empty after the call.
+		 */
+        void Batch(const CotCHelpers::CHJSON *aConfiguration, CotCHelpers::CHJSON &&aParameters, CResultHandler *aHandler);
 
 		/** @} */
 
@@ -742,6 +795,12 @@ private:
 		CGloballyKeptHandler<CResultHandler> &loginDoneHandler, &linkDoneHandler, &convertDoneHandler;
 		CGloballyKeptHandler<CResultHandler> &binaryDoneHandler;
 		CotCHelpers::cstring mDeviceOS, mDeviceToken, mAccountNetwork;
+		// Local copy of the key/value storage, enabled with the "localValues" setup option
+		CValueStore *mValueStore;
+		// Last properties and profile acknowledged by the server, enabled with the "deltaUpdates" setup option
+		CPropertyShadow *mPropertyShadow;
+		// Achievement increments and scores held for a while, enabled with the "aggregateProgress" setup option
+		CProgressAggregator *mProgress;
 		
 		// Not intended to be overloaded
 		CUserManager();
@@ -785,6 +844,7 @@ private:
 		void Terminate();
 
 		friend class CClan;
+		friend class CGameManager;
 		friend struct singleton_holder<CUserManager>;
 		friend void ::LaunchAuthenticate(void);
 		friend void publishUserAfterPermission(int err, void *params);
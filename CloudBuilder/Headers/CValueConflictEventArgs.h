@@ -0,0 +1,56 @@
+#ifndef CloudBuilder_ValueConflictEventArgs_h
+#define CloudBuilder_ValueConflictEventArgs_h
+
+#include "CHJSON.h"
+
+namespace CloudBuilder {
+	/**
+	 * Passed to the handler set with CUserManager::SetValueConflictHandler when a key modified locally has also
+	 * been changed on the server before the local change could be sent. Unless told otherwise, the last writer
+	 * wins, that is the local change.
+	 */
+	struct CValueConflictEventArgs {
+
+		/**
+			* @return the domain of the key
+			*/
+		const char *Domain() { return mDomain; }
+		/**
+			* @return the key in conflict
+			*/
+		const char *Key() { return mKey; }
+		/**
+			* @return the value set locally, or NULL if the key was deleted locally
+			*/
+		const CotCHelpers::CHJSON *LocalValue() { return mLocal; }
+		/**
+			* @return the value found on the server, or NULL if the key doesn't exist there
+			*/
+		const CotCHelpers::CHJSON *RemoteValue() { return mRemote; }
+		/**
+			* Keeps the local value, which will overwrite the one on the server (default).
+			*/
+		void KeepLocal() { mResolution = Local; }
+		/**
+			* Drops the local change in favor of the value on the server.
+			*/
+		void KeepRemote() { mResolution = Remote; }
+		/**
+			* Replaces the local change by another value, typically merging both, which will be sent to the server.
+			* @param aValue value to write, owned by the library from now on
+			*/
+		void Resolve(CotCHelpers::CHJSON *aValue) { mResolution = Merged; mMerged <<= aValue; }
+
+	private:
+		enum Resolution { Local, Remote, Merged };
+		CValueConflictEventArgs(const char *domain, const char *key, const CotCHelpers::CHJSON *local, const CotCHelpers::CHJSON *remote)
+			: mDomain(domain), mKey(key), mLocal(local), mRemote(remote), mResolution(Local) {}
+		const char *mDomain, *mKey;
+		const CotCHelpers::CHJSON *mLocal, *mRemote;
+		Resolution mResolution;
+		CotCHelpers::owned_ref<CotCHelpers::CHJSON> mMerged;
+		friend class CValueStore;
+	};
+}
+
+#endif
@@ -1,6 +1,7 @@
 #ifndef CotCHelpers_h
 #define CotCHelpers_h
 
+#include <atomic>
 #include "CloudBuilder.h"
 #include "CDelegate.h"
 
@@ -91,21 +92,27 @@ namespace CotCHelpers {
 		* In this example, the object A is destroyed by the compiler as we reach the end of the block, but it is still retained in B. This is why it is highly recommended not to create CRefClass'es on the stack except for local use.
 	 */
 	struct FACTORY_CLS CRefClass {
-		unsigned __ref_count;		// -1 => freed (an unmanaged object will be left at 0)
+		std::atomic<int> __ref_count;		// -1 => freed (an unmanaged object will be left at 0)
 		CRefClass() : __ref_count(0) {}
 		virtual ~CRefClass() noexcept(false);
 
-		// Simple reference inc/decrementers
-		void Retain() { __ref_count++; }
-		void Release() { if (__ref_count-- == 0) delete this; }
+		// Simple reference inc/decrementers, safe to use from multiple threads
+		void Retain() { __ref_count.fetch_add(1, std::memory_order_relaxed); }
+		void Release() {
+			// Writes made by other owners must be visible to the destructor
+			if (__ref_count.fetch_sub(1, std::memory_order_release) == 0) {
+				std::atomic_thread_fence(std::memory_order_acquire);
+				delete this;
+			}
+		}
 
 		// Null-safe version of Retain/Release with a return of the right subtype
 		template <class T> static T* Retain(T *t) { if (t) t->Retain(); return t; }
 		template <class T> static T* Release(T *t) { if (t) t->Release(); return NULL; }
 
 		// Always call the base member when overriding these!
-		CRefClass(const CRefClass& other) : __ref_count(other.__ref_count) {}
-		CRefClass& operator = (const CRefClass& other) { __ref_count = other.__ref_count; return *this; }
+		CRefClass(const CRefClass& other) : __ref_count(other.__ref_count.load()) {}
+		CRefClass& operator = (const CRefClass& other) { __ref_count = other.__ref_count.load(); return *this; }
 	};
 
 	/**
@@ -397,6 +404,7 @@ namespace CotCHelpers {
 	 * Note: the <<= operator can be used to start tacking a reference to a new object. These 2 lines are equivalent:
 		myRef = Autorelease(new Object);
 		myRef <<= new Object;
+	 * Moving an autoref (std::move, or returning it from a function) hands the reference over without touching the count.
 	 */
 	template <class T>
 	struct autoref {
@@ -404,11 +412,17 @@ namespace CotCHelpers {
 		explicit autoref(T *ref, bool takeOwnership = false) { ptr = takeOwnership? ref : Retain(ref); }
 		autoref(const autoref &ref) : ptr(ref.ptr) { ptr = Retain(ref.ptr); }
 		template<class U> autoref(const autoref<U> &ref) : ptr(ref.ptr) { ptr = Retain(ref.ptr); }
+		autoref(autoref &&ref) : ptr(ref.ptr) { ref.ptr = NULL; }
+		template<class U> autoref(autoref<U> &&ref) : ptr(ref.ptr) { ref.ptr = NULL; }
 		~autoref() { Release(ptr); }
 
 		// Various operator overloading
 		template<class U> autoref<T> &operator = (const autoref<U> &ref) { return (*this) = ref.ptr; }
 		autoref& operator = (const autoref &ref) { return (*this) = ref.ptr; }
+		autoref& operator = (autoref &&ref) {
+			if (this != &ref) { Release(ptr); ptr = ref.ptr; ref.ptr = NULL; }
+			return *this;
+		}
 		autoref& operator <<= (T *eptr) { Release(ptr); ptr = eptr; return *this; }
 		T* operator -> () const { return ptr; }
 		T& operator * () const { return *ptr; }
@@ -417,6 +431,7 @@ namespace CotCHelpers {
 		T *get() const { return ptr; }
 
 	private:
+		template<class U> friend struct autoref;
 		T *ptr;
 		autoref& operator = (T* eptr) {
 			// Not using this logic may free the original object if counter = 1
@@ -0,0 +1,254 @@
+//
+//  CAllocator.cpp
+//  CloudBuilder
+//
+//  Created by florian on 20/10/16.
+//  Copyright (c) 2016 Clan of the Cloud. All rights reserved.
+//
+
+#include <stdlib.h>
+#include <string.h>
+#include <atomic>
+
+#include "CAllocator.h"
+#include "CotCHelpers.h"
+#include "CloudBuilder_private.h"
+
+using namespace CloudBuilder;
+
+namespace CotCHelpers {
+
+	// Allocators are never removed from this table, so that blocks can always be released through the one that
+	// allocated them, even after the application switched to another one.
+	static const int MAX_ALLOCATORS = 8;
+
+	// Small blocks are recycled through per size class free lists rather than returned to the allocator. Classes
+	// go from 16 bytes to 8 kB by powers of two, which covers delegates, results, requests and response buffers.
+	static const int POOL_CLASS_COUNT = 10;
+	static const size_t POOL_MIN_SIZE = 16;
+	// Maximum amount of memory kept in each free list
+	static const size_t POOL_MAX_BYTES = 32 * 1024;
+	static const unsigned char NOT_POOLED = 0xff;
+
+	// Prepended to each block. Keeps the payload aligned like malloc would.
+	union BlockHeader {
+		struct {
+			size_t size;
+			unsigned char allocator;
+			unsigned char category;		// of the current use
+			unsigned char origin;		// category passed to the allocator, for release
+			unsigned char sizeClass;
+		} info;
+		void *alignPtr[2];
+		double alignDouble[2];
+		long long alignLong[2];
+	};
+
+	struct CategoryCounters {
+		std::atomic<size_t> currentBytes, peakBytes;
+		std::atomic<unsigned long> allocationCount, releaseCount, poolHitCount;
+	};
+
+	// Free list for a size class. Blocks are chained through their payload. The critical sections are a couple
+	// of instructions long, so a spin lock does better than a mutex, and it needs no construction.
+	struct Pool {
+		std::atomic<bool> busy;
+		BlockHeader *head;
+		size_t count;
+
+		void lock() { while (busy.exchange(true, std::memory_order_acquire)) {} }
+		void unlock() { busy.store(false, std::memory_order_release); }
+	};
+
+	static void *libc_allocate(size_t size, eMemoryCategory, void *) { return malloc(size); }
+	static void libc_release(void *ptr, eMemoryCategory, void *) { free(ptr); }
+
+	// Zero-initialized before any dynamic initialization takes place, so usable from static constructors.
+	static CAllocator gAllocators[MAX_ALLOCATORS] = { { libc_allocate, libc_release, NULL } };
+	static std::atomic<int> gAllocatorCount(1), gCurrentAllocator(0);
+	static CategoryCounters gCounters[enMemoryCategoryCount];
+	static Pool gPools[POOL_CLASS_COUNT];
+
+	static CMutex &registryMutex() {
+		static CMutex mutex;
+		return mutex;
+	}
+
+	static void countAllocation(unsigned category, size_t size) {
+		CategoryCounters &c = gCounters[category];
+		size_t now = c.currentBytes.fetch_add(size) + size;
+		size_t peak = c.peakBytes.load();
+		while (now > peak && !c.peakBytes.compare_exchange_weak(peak, now)) {}
+		c.allocationCount++;
+	}
+
+	static void countRelease(unsigned category, size_t size) {
+		gCounters[category].currentBytes.fetch_sub(size);
+		gCounters[category].releaseCount++;
+	}
+
+	static size_t classSize(int sizeClass) {
+		return POOL_MIN_SIZE << sizeClass;
+	}
+
+	static int sizeClassFor(size_t size) {
+		for (int i = 0; i < POOL_CLASS_COUNT; i++) {
+			if (size <= classSize(i)) { return i; }
+		}
+		return -1;
+	}
+
+	static BlockHeader *popPooled(int sizeClass) {
+		Pool &pool = gPools[sizeClass];
+		pool.lock();
+		BlockHeader *block = pool.head;
+		if (block) {
+			pool.head = *(BlockHeader**) (block + 1);
+			pool.count--;
+		}
+		pool.unlock();
+		return block;
+	}
+
+	static bool pushPooled(BlockHeader *block) {
+		Pool &pool = gPools[block->info.sizeClass];
+		bool accepted = false;
+		pool.lock();
+		if ((pool.count + 1) * classSize(block->info.sizeClass) <= POOL_MAX_BYTES) {
+			*(BlockHeader**) (block + 1) = pool.head;
+			pool.head = block;
+			pool.count++;
+			accepted = true;
+		}
+		pool.unlock();
+		return accepted;
+	}
+
+	static void releaseToAllocator(BlockHeader *block) {
+		const CAllocator &allocator = gAllocators[block->info.allocator];
+		allocator.release(block, (eMemoryCategory) block->info.origin, allocator.userData);
+	}
+
+	void *AllocateMemory(size_t size, eMemoryCategory category) {
+		int sizeClass = sizeClassFor(size);
+		BlockHeader *block = sizeClass >= 0 ? popPooled(sizeClass) : NULL;
+		if (block) {
+			gCounters[category].poolHitCount++;
+		} else {
+			int index = gCurrentAllocator.load();
+			const CAllocator &allocator = gAllocators[index];
+			size_t capacity = sizeClass >= 0 ? classSize(sizeClass) : size;
+			block = (BlockHeader*) allocator.allocate(sizeof(BlockHeader) + capacity, category, allocator.userData);
+			if (!block) { return NULL; }
+			block->info.allocator = (unsigned char) index;
+			block->info.origin = (unsigned char) category;
+			block->info.sizeClass = sizeClass >= 0 ? (unsigned char) sizeClass : NOT_POOLED;
+		}
+		block->info.size = size;
+		block->info.category = (unsigned char) category;
+		countAllocation(category, size);
+		return block + 1;
+	}
+
+	void *ReallocateMemory(void *ptr, size_t size, eMemoryCategory category) {
+		if (!ptr) { return AllocateMemory(size, category); }
+		BlockHeader *old = (BlockHeader*) ptr - 1;
+		// Grow in place when the size class leaves enough room
+		if (old->info.sizeClass != NOT_POOLED && size <= classSize(old->info.sizeClass)) {
+			countRelease(old->info.category, old->info.size);
+			countAllocation(old->info.category, size);
+			old->info.size = size;
+			return ptr;
+		}
+		// Custom allocators have no realloc entry point, so copy
+		void *result = AllocateMemory(size, (eMemoryCategory) old->info.category);
+		if (!result) { return NULL; }
+		memcpy(result, ptr, old->info.size < size ? old->info.size : size);
+		ReleaseMemory(ptr);
+		return result;
+	}
+
+	void ReleaseMemory(void *ptr) {
+		if (!ptr) { return; }
+		BlockHeader *block = (BlockHeader*) ptr - 1;
+		countRelease(block->info.category, block->info.size);
+		// Blocks from an allocator that was replaced are handed back to it rather than recycled
+		bool pooled = block->info.sizeClass != NOT_POOLED && block->info.allocator == gCurrentAllocator.load();
+		if (!pooled || !pushPooled(block)) {
+			releaseToAllocator(block);
+		}
+	}
+
+	void ReleasePooledMemory() {
+		for (int i = 0; i < POOL_CLASS_COUNT; i++) {
+			Pool &pool = gPools[i];
+			pool.lock();
+			BlockHeader *block = pool.head;
+			pool.head = NULL;
+			pool.count = 0;
+			pool.unlock();
+			while (block) {
+				BlockHeader *next = *(BlockHeader**) (block + 1);
+				releaseToAllocator(block);
+				block = next;
+			}
+		}
+	}
+
+	char *DuplicateString(const char *str, eMemoryCategory category) {
+		size_t length = strlen(str) + 1;
+		char *result = (char*) AllocateMemory(length, category);
+		if (result) { memcpy(result, str, length); }
+		return result;
+	}
+
+	bool InstallAllocator(const CAllocator *allocator) {
+		int index = -1;
+		if (!allocator) {
+			index = 0;
+		} else if (!allocator->allocate || !allocator->release) {
+			return false;
+		} else {
+			CMutex::ScopedLock lock(registryMutex());
+			int count = gAllocatorCount.load();
+			for (int i = 0; i < count && index < 0; i++) {
+				const CAllocator &existing = gAllocators[i];
+				if (existing.allocate == allocator->allocate && existing.release == allocator->release && existing.userData == allocator->userData) {
+					index = i;
+				}
+			}
+			if (index < 0) {
+				if (count >= MAX_ALLOCATORS) {
+					CONSOLE_ERROR("Too many allocators installed (max %d), keeping the current one\n", MAX_ALLOCATORS);
+					return false;
+				}
+				gAllocators[count] = *allocator;
+				index = count;
+				gAllocatorCount = count + 1;
+			}
+		}
+		// Recycled blocks must come from the allocator in use
+		if (gCurrentAllocator.exchange(index) != index) {
+			ReleasePooledMemory();
+		}
+		return true;
+	}
+
+	void ReadMemoryStats(eMemoryCategory category, CMemoryStats *dest) {
+		const CategoryCounters &c = gCounters[category];
+		dest->currentBytes = c.currentBytes.load();
+		dest->peakBytes = c.peakBytes.load();
+		dest->allocationCount = c.allocationCount.load();
+		dest->releaseCount = c.releaseCount.load();
+		dest->poolHitCount = c.poolHitCount.load();
+	}
+}
+
+//////////////////////////// cJSON hooks ////////////////////////////
+extern "C" void *cotc_json_malloc(size_t size) {
+	return CotCHelpers::AllocateMemory(size, enMemoryJSON);
+}
+
+extern "C" void cotc_json_free(void *ptr) {
+	CotCHelpers::ReleaseMemory(ptr);
+}
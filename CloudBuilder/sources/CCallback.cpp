@@ -7,9 +7,20 @@
 //
 
 #include "CloudBuilder.h"
+#include "CloudBuilder_private.h"
 #include "CCallback.h"
 #include "CHJSON.h"
 #include "cotc_thread.h"
+#include "metrics.h"
+#include "CClientContext_private.h"
+
+#if defined(__linux__)
+#include <sys/eventfd.h>
+#include <unistd.h>
+#elif !defined(WIN32)
+#include <fcntl.h>
+#include <unistd.h>
+#endif
 
 using namespace CotCHelpers;
 
@@ -18,59 +29,199 @@ using namespace CotCHelpers;
  */
 namespace CloudBuilder 
 {
-	CallbackStack *CallbackStack::gHead = NULL;
-	CMutex CallbackStack::gStackMutex;
 	bool CallbackStack::gCallbackQueueHandledByRabbitFactory = true;
+
+	static CallbackQueue &currentQueue() {
+		return CClientContext::Current()->Internals().callbacks;
+	}
+
+	/**
+	 * Runs the callbacks of a context on the executor (enCallbackDispatchWorkers). Only one is queued at a time
+	 * for a given context, so that its callbacks run in order and never concurrently.
+	 */
+	struct CallbackDrainTask: CTask {
+		virtual void Run() {
+			CallbackQueue &queue = currentQueue();
+			for (;;) {
+				CallbackStack::popAllCallbacks();
+				CMutex::ScopedLock lock(queue.mutex);
+				if (queue.head == NULL || queue.dispatch != enCallbackDispatchWorkers) {
+					queue.drainScheduled = false;
+					return;
+				}
+			}
+		}
+	};
+
+	CallbackQueue::~CallbackQueue() {
+		while (head) {
+			CallbackStack *callback = head;
+			head = head->next;
+			delete callback;
+		}
+#ifndef WIN32
+		if (notifyFds[0] >= 0) close(notifyFds[0]);
+		if (notifyFds[1] >= 0 && notifyFds[1] != notifyFds[0]) close(notifyFds[1]);
+#endif
+	}
+
+	void CallbackQueue::SetSignaled(bool signaled) {
+		if (notifyFds[0] < 0 || notifySignaled == signaled) {
+			return;
+		}
+		notifySignaled = signaled;
+#if defined(__linux__)
+		uint64_t value = 1;
+		ssize_t unused = signaled ? write(notifyFds[1], &value, sizeof(value)) : read(notifyFds[0], &value, sizeof(value));
+		(void) unused;
+#elif !defined(WIN32)
+		char byte = 0;
+		ssize_t unused = signaled ? write(notifyFds[1], &byte, 1) : read(notifyFds[0], &byte, 1);
+		(void) unused;
+#endif
+	}
+
+	void CallbackQueue::Dispatch() {
+		SetSignaled(true);
+		if (dispatch == enCallbackDispatchWorkers && !drainScheduled) {
+			drainScheduled = true;
+			autoref<CallbackDrainTask> task;
+			task <<= new CallbackDrainTask;
+			CTaskExecutor::Submit(task);
+		}
+		else if (dispatch == enCallbackDispatchHost && notifier) {
+			notifier->Invoke();
+		}
+	}
 	
 	CallbackStack::~CallbackStack() { delete call; delete result;}
 	
 	void CallbackStack::pushCallback(CCallback *call, CCloudResult *result)
 	{		
 		CallbackStack *ts = new CallbackStack(call, result);
-		CMutex::ScopedLock lock(CallbackStack::gStackMutex);
-		if (CallbackStack::gHead == NULL)
-			CallbackStack::gHead = ts;
+		CallbackQueue &queue = currentQueue();
+		CMutex::ScopedLock lock(queue.mutex);
+		if (queue.head == NULL) {
+			queue.head = ts;
+			// The host only needs to hear about the first of a series
+			queue.Dispatch();
+		}
 		else
-		{
-			CallbackStack *p = CallbackStack::gHead;
-			while (p->next != NULL)
-				p = p->next;
-			p->next = ts;
+			queue.tail->next = ts;
+		queue.tail = ts;
+	}
+
+	void CallbackStack::setDispatch(eCallbackDispatch mode, CDelegate<void ()> *notifier) {
+		CallbackQueue &queue = currentQueue();
+		CMutex::ScopedLock lock(queue.mutex);
+		queue.dispatch = mode;
+		queue.notifier <<= notifier;
+		// Hand over what is already pending
+		if (queue.head != NULL && mode != enCallbackDispatchIdle)
+			queue.Dispatch();
+	}
+
+	int CallbackStack::notificationFd() {
+		CallbackQueue &queue = currentQueue();
+		CMutex::ScopedLock lock(queue.mutex);
+		if (queue.notifyFds[0] < 0) {
+#if defined(__linux__)
+			queue.notifyFds[0] = queue.notifyFds[1] = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+#elif !defined(WIN32)
+			if (pipe(queue.notifyFds) == 0) {
+				for (int i = 0; i < 2; i++) {
+					fcntl(queue.notifyFds[i], F_SETFL, fcntl(queue.notifyFds[i], F_GETFL) | O_NONBLOCK);
+					fcntl(queue.notifyFds[i], F_SETFD, FD_CLOEXEC);
+				}
+			}
+			else
+				queue.notifyFds[0] = queue.notifyFds[1] = -1;
+#endif
+			if (queue.notifyFds[0] < 0) {
+				CONSOLE_ERROR("Could not create the callback notification descriptor\n");
+			}
+			else if (queue.head != NULL) {
+				queue.SetSignaled(true);
+			}
 		}
+		return queue.notifyFds[0];
 	}
 	
 	bool CallbackStack::popCallback() {	
+		CallbackQueue &queue = currentQueue();
 		CallbackStack *p = NULL;
 
-		gStackMutex.Lock();
-		if (CallbackStack::gHead != NULL) {
-			p  = CallbackStack::gHead;
-			CallbackStack::gHead = p->next;
+		queue.mutex.Lock();
+		if (queue.head != NULL) {
+			p  = queue.head;
+			queue.head = p->next;
+			if (queue.head == NULL) {
+				queue.tail = NULL;
+				queue.SetSignaled(false);
+			}
 		}
-		gStackMutex.Unlock();
+		queue.mutex.Unlock();
 		
 		if (p) {
-			p->call->Invoke(p->result);
+			p->Execute();
 			delete p;
 		}
 		return p != NULL;
 	}
 
+	int CallbackStack::popAllCallbacks() {
+		CallbackQueue &queue = currentQueue();
+		CallbackStack *p;
+		unsigned discardCount;
+		int executed = 0;
+
+		queue.mutex.Lock();
+		p = queue.head;
+		queue.head = queue.tail = NULL;
+		queue.SetSignaled(false);
+		discardCount = queue.discardCount;
+		queue.mutex.Unlock();
+
+		while (p) {
+			CallbackStack *next = p->next;
+			// A callback may terminate the library, in which case the rest of the batch is dropped as if it were still queued
+			if (discardCount == queue.discardCount) {
+				p->Execute();
+				executed++;
+			}
+			delete p;
+			p = next;
+		}
+		return executed;
+	}
+
+	void CallbackStack::Execute() {
+		if (result) {
+			result->Timings().callbackWaitMs = (double) (MonotonicMilliseconds() - pushedAt);
+			metrics_record_callback_wait(result->Timings().callbackWaitMs);
+		}
+		call->Invoke(result);
+	}
+
 	void CallbackStack::removeAllPendingCallbacksWithoutCallingThem() {
-		gStackMutex.Lock();
-		while (CallbackStack::gHead != NULL) {
-			CallbackStack *callback = CallbackStack::gHead;
-			CallbackStack::gHead = CallbackStack::gHead->next;
+		CallbackQueue &queue = currentQueue();
+		queue.mutex.Lock();
+		while (queue.head != NULL) {
+			CallbackStack *callback = queue.head;
+			queue.head = queue.head->next;
 			delete callback;
 		}
-		gStackMutex.Unlock();
+		queue.tail = NULL;
+		queue.SetSignaled(false);
+		queue.discardCount++;
+		queue.mutex.Unlock();
 	}
 	
 	// Ref-counted data holder (holds data and frees it when it gets destroyed; that is the ref count drops to zero).
 	struct CCloudResult::DataHolder: CotCHelpers::CRefClass {
 		void *ptr;
 		DataHolder(void *ownedData) : ptr(ownedData) {}
-		~DataHolder() { if (ptr) { free(ptr); } }
+		~DataHolder() { CotCHelpers::ReleaseMemory(ptr); }
 	};
 
 	cstring CCloudResult::GetJSONString() const {
@@ -97,22 +248,22 @@ namespace CloudBuilder
 		return mJson->GetInt("_curlerror");
 	}
 
-	CCloudResult::CCloudResult() : mHasBinary(false), mBinary(NULL), mSize(0), mObsolete(false) {
+	CCloudResult::CCloudResult() : mHasBinary(false), mBinary(NULL), mSize(0), mObsolete(false), mTimings() {
 		this->mJson = new CHJSON();
 	}
 	
-	CCloudResult::CCloudResult(eErrorCode err) : mHasBinary(false), mBinary(NULL), mSize(0), mObsolete(false) {
+	CCloudResult::CCloudResult(eErrorCode err) : mHasBinary(false), mBinary(NULL), mSize(0), mObsolete(false), mTimings() {
 		this->mJson = new CHJSON();
 		mJson->Put("_error", err);
 	}
 
-	CCloudResult::CCloudResult(eErrorCode err, const char *message) : mHasBinary(false), mBinary(NULL), mSize(0), mObsolete(false) {
+	CCloudResult::CCloudResult(eErrorCode err, const char *message) : mHasBinary(false), mBinary(NULL), mSize(0), mObsolete(false), mTimings() {
 		this->mJson = new CHJSON();
 		mJson->Put("_error", err);
 		if (message) { mJson->Put("_description", message); }
 	}
 
-	CCloudResult::CCloudResult(eErrorCode err, CHJSON *ajson) : mHasBinary(false), mBinary(NULL), mSize(0), mObsolete(false) {
+	CCloudResult::CCloudResult(eErrorCode err, CHJSON *ajson) : mHasBinary(false), mBinary(NULL), mSize(0), mObsolete(false), mTimings() {
 		if(ajson == NULL)
 			this->mJson = new CHJSON();
 		else if (ajson->type() == CotCHelpers::CHJSON::jsonObject)
@@ -124,7 +275,7 @@ namespace CloudBuilder
 		mJson->Put("_error", err);
 	}
 	
-	CCloudResult::CCloudResult(CHJSON *ajson) : mHasBinary(false), mBinary(NULL), mSize(0), mObsolete(false) {
+	CCloudResult::CCloudResult(CHJSON *ajson) : mHasBinary(false), mBinary(NULL), mSize(0), mObsolete(false), mTimings() {
 		if (!ajson)
 			this->mJson = new CHJSON();
 		else if (ajson->type() == CotCHelpers::CHJSON::jsonObject)
@@ -149,6 +300,7 @@ namespace CloudBuilder
 
 	CCloudResult *CCloudResult::Duplicate() const {
 		CCloudResult *n = new CCloudResult(this->mJson->Duplicate());
+		n->mTimings = this->mTimings;
 		if (this->mHasBinary) {
 			n->mBinary = Retain(this->mBinary);
 			n->mSize = this->mSize;
@@ -215,7 +367,7 @@ namespace CloudBuilder
 	void CThreadCloud::run(const char *webmethod)
 	{
 		if (webmethod == NULL ) // || !CThreadCloud::BacthAdd(method, mJSON))
-			this->Start();
+			CTaskExecutor::Submit(this);
 	}
 
 	void CThreadCloud::Run() {
@@ -225,6 +377,27 @@ namespace CloudBuilder
 	
 	void CThreadCloud::do_done(const CCloudResult *result) {
 		this->done(result);
-		delete this;
+		// The executor may not have released the task yet
+		this->Release();
+	}
+
+	CCallbackTimer::~CCallbackTimer() {
+		delete mCallback;
+	}
+
+	void CCallbackTimer::Start(int delayMilliseconds) {
+		CTaskExecutor::SubmitAfter(this, delayMilliseconds);
+	}
+
+	void CCallbackTimer::Cancel() {
+		mCancelled = true;
+		CTaskExecutor::Hasten(this);
+	}
+
+	void CCallbackTimer::Run() {
+		if (!mCancelled) {
+			CallbackStack::pushCallback(mCallback, new CCloudResult(enNoErr));
+			mCallback = NULL;
+		}
 	}
 }
@@ -12,6 +12,8 @@
 #include "CHJSON.h"
 #include "CotCHelpers.h"
 #include "helpers.h"
+#include "cotc_thread.h"
+#include "CClan.h"
 
 namespace CloudBuilder {
 	
@@ -22,29 +24,63 @@ namespace CloudBuilder {
 	 */
 	typedef CDelegate<void (const CCloudResult*)> CCallback;
 	
+	/**
+	 * Callbacks waiting to be run by ProcessIdleTasks. Each CClientContext has one; the static methods of
+	 * CallbackStack work on the queue of the context in scope.
+	 */
+	class CallbackStack;
+	struct CallbackQueue {
+		CallbackStack *head, *tail;
+		// Incremented whenever pending callbacks are discarded, so that a batch being executed stops as well
+		unsigned discardCount;
+		CotCHelpers::CMutex mutex;
+		// Set by CClan::SetCallbackDispatch
+		eCallbackDispatch dispatch;
+		owned_ref<CDelegate<void ()>> notifier;
+		// Whether a task running the callbacks is queued or ongoing on the executor (enCallbackDispatchWorkers)
+		bool drainScheduled;
+		// Readable while callbacks are pending, opened by CClan::GetCallbackNotificationFd (-1 until then)
+		int notifyFds[2];
+		bool notifySignaled;
+		CallbackQueue() : head(NULL), tail(NULL), discardCount(0), dispatch(enCallbackDispatchIdle), drainScheduled(false), notifySignaled(false) { notifyFds[0] = notifyFds[1] = -1; }
+		~CallbackQueue();
+		// Makes the notification descriptor readable or not; call with the mutex locked
+		void SetSignaled(bool signaled);
+		// Lets the host or the executor know that callbacks are pending; call with the mutex locked
+		void Dispatch();
+	};
+
 	class CallbackStack {
 	public:
-		CallbackStack(CCallback *aCall, CCloudResult *aResult) { call = aCall; result = aResult; next = NULL; }
+		COTC_ALLOCATED_AS(enMemoryCallbacks)
+		CallbackStack(CCallback *aCall, CCloudResult *aResult) { call = aCall; result = aResult; next = NULL; pushedAt = MonotonicMilliseconds(); }
 		~CallbackStack();
 
 		// Returns whether a callback was actually executed
 		static bool popCallback();
+		// Takes all pending callbacks at once and executes them in order. Callbacks pushed meanwhile are left for the
+		// next call. Returns the number of callbacks executed.
+		static int popAllCallbacks();
 		static void pushCallback(CCallback *aCall, CCloudResult *aResult);
+		// See CClan::SetCallbackDispatch and CClan::GetCallbackNotificationFd
+		static void setDispatch(eCallbackDispatch mode, CDelegate<void ()> *notifier);
+		static int notificationFd();
 		// Dangerous! Removes any pending callback but doesn't call them. May cause memory leaks and
 		// logic errors for any code relying on these callbacks. Only perform that at termination.
 		static void removeAllPendingCallbacksWithoutCallingThem();
 
 		CallbackStack 	*next;
-		static CallbackStack *gHead;
-		static CotCHelpers::CMutex gStackMutex;
 		static bool gCallbackQueueHandledByRabbitFactory;
 	protected:
 		CCallback 		*call;
 		CCloudResult *result;
+		long long pushedAt;
+		// Invokes the callback, after stamping the time spent in the queue on the result
+		void Execute();
 
 	};
 
-	class CThreadCloud : public CotCHelpers::CThread {
+	class CThreadCloud : public CTask {
 	public:
 		CThreadCloud();
 		~CThreadCloud();
@@ -57,6 +93,31 @@ namespace CloudBuilder {
 		virtual void Run();
 		virtual void do_done(const CCloudResult *cr);
 	};
+
+	/**
+	 * Pushes a callback on the queue of the context once a delay has elapsed, the delay being kept by the timer
+	 * thread of the CTaskExecutor rather than on a worker. Used by the managers to send what they hold back.
+		timer <<= new CCallbackTimer(MakeDelegate(this, &MyClass::TimerElapsed));
+		timer->Start(delay);
+	 */
+	class CCallbackTimer : public CTask {
+		// Owned until pushed
+		CCallback *mCallback;
+		volatile bool mCancelled;
+
+	public:
+		CCallbackTimer(CCallback *callback) : mCallback(callback), mCancelled(false) {}
+		~CCallbackTimer();
+		void Start(int delayMilliseconds);
+		/**
+		 * Drops the callback, unless pushed already, and ends the delay so that the tasks of the context can be
+		 * drained. Call from the thread running the callbacks.
+		 */
+		void Cancel();
+
+	protected:
+		virtual void Run();
+	};
 	
 	#define DECLARE_TASK(MANAGER, NAME) \
 		class NAME: public CThreadCloud { public : \
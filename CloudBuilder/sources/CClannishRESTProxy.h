@@ -11,6 +11,7 @@
 
 #include <sys/types.h>
 #include <vector>
+#include <utility>
 #include "CloudBuilder.h"
 #include "CCallback.h"
 #include "helpers.h"
@@ -32,6 +33,44 @@ namespace CloudBuilder {
 		fsAppMatch
 	} etTypeFS;
 
+	/**
+	 * JSON passed to a proxy call and that ends up in the body of the request. It is either borrowed from the
+	 * caller, in which case it is copied when building the request, or handed over (std::move), in which case
+	 * the document itself is sent.
+	 */
+	class CRequestBody {
+		const CHJSON *mJson;
+		CHJSON *mOwned;
+		CRequestBody(const CRequestBody &forbiddenCopyCtor);
+
+	public:
+		CRequestBody(const CHJSON *json) : mJson(json), mOwned(NULL) {}
+		CRequestBody(CHJSON &&json) : mOwned(new CHJSON(std::move(json))) { mJson = mOwned; }
+		CRequestBody(CRequestBody &&other) : mJson(other.mJson), mOwned(other.mOwned) { other.mOwned = NULL; }
+		~CRequestBody() { delete mOwned; }
+
+		const CHJSON *operator -> () const { return mJson; }
+		operator const CHJSON *() const { return mJson; }
+
+		/**
+		 * @return the whole document, to be passed to CHttpRequest::SetBody; only call once
+		 */
+		CHJSON *Take() {
+			CHJSON *result = mOwned ? mOwned : (mJson ? mJson->Duplicate() : new CHJSON);
+			mJson = mOwned = NULL;
+			return result;
+		}
+		/**
+		 * @param key key of a node in the document
+		 * @return the node, or NULL if there is none; either removed from the document or copied
+		 */
+		CHJSON *Take(const char *key) {
+			if (mOwned) { return mOwned->Extract(key); }
+			const CHJSON *node = mJson ? mJson->Get(key) : NULL;
+			return node ? node->Duplicate() : NULL;
+		}
+	};
+
 	class CClannishRESTProxy {
 	public:
 		
@@ -53,8 +92,8 @@ namespace CloudBuilder {
 		void ChangePassword(const char *aNewPassword, CInternalResultHandler *onFinished);
 		void ChangeEmail(const char *aNewEmail, CInternalResultHandler *onFinished);
 
-		void BatchGame(const CHJSON *ajSON, const CHJSON *aInput, CInternalResultHandler *onFinished);
-		void BatchUser(const CHJSON *ajSON, const CHJSON *aInput, CInternalResultHandler *onFinished);
+		void BatchGame(const CHJSON *ajSON, CRequestBody aInput, CInternalResultHandler *onFinished);
+		void BatchUser(const CHJSON *ajSON, CRequestBody aInput, CInternalResultHandler *onFinished);
 
 		void CheckUser(const CHJSON *ajSON, CInternalResultHandler *onFinished);
 		void UserExist(const CHJSON *ajSON, CInternalResultHandler *onFinished);
@@ -75,11 +114,11 @@ namespace CloudBuilder {
 		void GetGodchildren(const char *aDomain, CInternalResultHandler *onFinished);
 	
 		void GetUserProfile(const CHJSON *ajSON, CInternalResultHandler *onFinished);
-		void SetUserProfile(const CHJSON *aJSON, CInternalResultHandler *onFinished);
+		void SetUserProfile(CRequestBody aJSON, CInternalResultHandler *onFinished);
 
-		void UserSetProperties(const char *aDomain, const CHJSON *aJSON, CInternalResultHandler *onFinished);
+		void UserSetProperties(const char *aDomain, CRequestBody aJSON, CInternalResultHandler *onFinished);
 		void UserGetProperties(const char *aDomain, CInternalResultHandler *onFinished);
-		void UserSetProperty(const char *aDomain, const CHJSON *aJSON, CInternalResultHandler *onFinished);
+		void UserSetProperty(const char *aDomain, CRequestBody aJSON, CInternalResultHandler *onFinished);
 		void UserGetProperty(const char *aDomain, const char *key, CInternalResultHandler *onFinished);
 		void UserDelProperty(const char *aDomain, const char *key, CInternalResultHandler *onFinished);
 		void FindOpponents(const char *aDomain, const CHJSON *ajSON,  CInternalResultHandler *onFinished);
@@ -89,20 +128,20 @@ namespace CloudBuilder {
 		 * @param useV2_2 should be set to true, else will perform the call on the legacy resource (v1)
 		 * @param onFinished handler for the result (which contents will differ depending on whether useV2_2 was passed)
 		 */
-		void Transaction(const CHJSON *aJSON, bool useV2_2, CInternalResultHandler *onFinished);
+		void Transaction(CRequestBody aJSON, bool useV2_2, CInternalResultHandler *onFinished);
 		void Balance(const char *domain, const CHJSON *aJSON, CInternalResultHandler *onFinished);
 		void TxHistory(const char *domain, const CHJSON *aJSON, CInternalResultHandler *onFinished);
 
         void vfsRead(const char *domain, const char *key, CInternalResultHandler *onFinished);
-        void vfsWrite(const char *domain, const char *key, const CHJSON *aJSON, bool isBinary, CInternalResultHandler *onFinished);
+        void vfsWrite(const char *domain, const char *key, CRequestBody aJSON, bool isBinary, CInternalResultHandler *onFinished);
         void vfsReadv3(const char *domain, const char *key, CInternalResultHandler *onFinished);
-        void vfsWritev3(const char *domain, const char *key, const CHJSON *aJSON, bool isBinary, CInternalResultHandler *onFinished);
+        void vfsWritev3(const char *domain, const char *key, CRequestBody aJSON, bool isBinary, CInternalResultHandler *onFinished);
 		void vfsDelete(const char *domain, const char *key, bool isBinary, CInternalResultHandler *onFinished);
 		void UploadData(const char *url, const void *ptr, size_t size, CInternalResultHandler *onFinished);
 		void DownloadData(const char *url, CInternalResultHandler *onFinished);
 	   
 		void vfsReadGame(const char *domain, const char *key, CInternalResultHandler *onFinished);
-		void vfsWriteGame(const char *domain, const char *key, const CHJSON *aJSON, bool isBinary, CInternalResultHandler *onFinished);
+		void vfsWriteGame(const char *domain, const char *key, CRequestBody aJSON, bool isBinary, CInternalResultHandler *onFinished);
 		void vfsDeleteGame(const char *domain, const char *key, bool isBinary, CInternalResultHandler *onFinished);
         void vfsReadGamev3(const char *domain, const char *key, CInternalResultHandler *onFinished);
 
@@ -124,14 +163,14 @@ namespace CloudBuilder {
 
 		// configuration should contain: domain
 		void ListAchievements(const CHJSON *configuration, CInternalResultHandler *onFinished);
-		void SetAchievementGamerData(const char *domain, const char *achName, const CHJSON *data, CInternalResultHandler *onFinished);
-		void PushEvent(const char *domain, const char *gamerid, const CHJSON *aJSON, CInternalResultHandler *onFinished);
+		void SetAchievementGamerData(const char *domain, const char *achName, CRequestBody data, CInternalResultHandler *onFinished);
+		void PushEvent(const char *domain, const char *gamerid, CRequestBody aJSON, CInternalResultHandler *onFinished);
 		void ResetAchievements(const char *domain, CInternalResultHandler *onFinished);
 
 		CCloudResult *ForceActivate();
 
 		// Match API
-		void CreateMatch(const CHJSON *config, CInternalResultHandler *onFinished);
+		void CreateMatch(CRequestBody config, CInternalResultHandler *onFinished);
 		void FinishMatch(const CHJSON *config, CInternalResultHandler *onFinished);
 		void DeleteMatch(const CHJSON *config, CInternalResultHandler *onFinished);
 		void JoinMatch(const CHJSON *config, CInternalResultHandler *onFinished);
@@ -141,7 +180,7 @@ namespace CloudBuilder {
 		void LeaveMatch(const CHJSON *config, CInternalResultHandler *onFinished);
 		void FetchMatch(const CHJSON *config, CInternalResultHandler *onFinished);
 		void ListMatches(const CHJSON *config, CInternalResultHandler *onFinished);
-		void PostMove(const CHJSON *config, CInternalResultHandler *onFinished);
+		void PostMove(CRequestBody config, CInternalResultHandler *onFinished);
 		
 		// Store API
 		void GetProductList(const CHJSON *config, CInternalResultHandler *onFinished);
@@ -151,7 +190,7 @@ namespace CloudBuilder {
 		// Index API
 		void DeleteIndexedObject(const CHJSON *config, CInternalResultHandler *onFinished);
 		void GetIndexedObject(const CHJSON *config, CInternalResultHandler *onFinished);
-		void IndexObject(const CHJSON *config, CInternalResultHandler *onFinished);
+		void IndexObject(CRequestBody config, CInternalResultHandler *onFinished);
 		void SearchIndexedObjects(const CHJSON *config, CInternalResultHandler *onFinished);
 
 		/**
@@ -194,7 +233,8 @@ namespace CloudBuilder {
 		// Background thread issuing "pop" commands to the server.
 		class PopEventLoopThread;
 		CMutex popEventThreadMutex;
-		CConditionVariable suspendedThreadLock;
+		// Ends the holds of the event loops and the retry delays of synchronous requests
+		CWakeUpSignal mWakeUpSignal;
 
 		/** singleton */
 		CHJSON *mQueuesURL;
@@ -14,8 +14,10 @@
 #include "helpers.h"
 #include "util.h"
 #include "curltool.h"
+#include "transport.h"
 #include "cotc_thread.h"
 #include "CCallback.h"
+#include "CClientContext_private.h"
 
 #if defined(__WINDOWS_32__)
 #	include <process.h>
@@ -33,8 +35,6 @@ void endedPop() {}
 
 namespace CloudBuilder {
 	
-	static singleton_holder<CClannishRESTProxy> managerSingleton;
-	
 	CClannishRESTProxy::CClannishRESTProxy() {
 		CotCHelpers::Init();
 		mRegisterForNotification = true;
@@ -48,12 +48,12 @@ namespace CloudBuilder {
 	}
 	
 	CClannishRESTProxy *CClannishRESTProxy::Instance() {
-		return managerSingleton.Instance();
+		return CClientContext::Current()->Internals().proxy.Instance();
 	}
 
 	void CClannishRESTProxy::Terminate() {
 		StopEventListening();
-		managerSingleton.Release();
+		CClientContext::Current()->Internals().proxy.Release();
 	}
 	
 	bool CClannishRESTProxy::isSetup()
@@ -67,13 +67,14 @@ namespace CloudBuilder {
 	}
 
 	void CClannishRESTProxy::SetNetworkState(bool on) {
-		bool previousState = g_networkState;
+		bool previousState = http_network_state();
 		CONSOLE_ERROR( on ? "Network Activity Resumed !\n"  : "Network Activity Suspended !\n");
 		mNetSate = on;
-		g_networkState = on;
-		// Network just got back! -> trigger pending requests if any
-		if (g_networkState && !previousState) {
+		http_set_network_state(on);
+		// Network just got back! -> trigger pending requests if any, and end the holds
+		if (on && !previousState) {
 			http_trigger_pending();
+			mWakeUpSignal.WakeUp();
 		}
 	}
 
@@ -83,7 +84,7 @@ namespace CloudBuilder {
 
 	void CClannishRESTProxy::Resume() {
 		mSuspend = false;
-		suspendedThreadLock.SignalAll();
+		mWakeUpSignal.WakeUp();
 	}
 
 	const char *CClannishRESTProxy::GetGamerID() { return mGamerId; }
@@ -126,7 +127,30 @@ namespace CloudBuilder {
 		int connectTimeout = ajSON->GetInt("connectTimeout", 5);
 		int httpTimeout = ajSON->GetInt("httpTimeout");
 		bool httpVerbose = ajSON->GetBool("httpVerbose");
-		http_init(env, lbCount, connectTimeout, httpTimeout, httpVerbose, &suspendedThreadLock);
+		http_init(env, lbCount, connectTimeout, httpTimeout, httpVerbose, &mWakeUpSignal);
+		http_set_binary_wire_format(ajSON->GetBool("binaryWireFormat"));
+
+		// Traffic recording and replay, for tests and benchmarks
+		const char *replayFile = ajSON->GetString("httpReplayFile"), *recordFile = ajSON->GetString("httpRecordFile");
+		if (replayFile) {
+			autoref<CReplayTransport> replay = Autorelease(new CReplayTransport);
+			replay->LoadRecording(replayFile);
+			replay->SetLatency(ajSON->GetInt("httpReplayLatencyMs"), ajSON->GetInt("httpReplayLatencyMs"));
+			replay->SetFailureRate(ajSON->GetDouble("httpReplayFailureRate"), 0);
+			http_set_transport(replay);
+		} else if (recordFile) {
+			http_set_transport(Autorelease(new CRecordingTransport(Autorelease(new CCurlTransport), recordFile)));
+		}
+
+		// Requests changing the state of the gamer survive the loss of network and restarts
+		if (ajSON->GetBool("requestJournal")) {
+			// The file can't be shared, and other contexts don't outlive the process anyway
+			if (CClientContext::Current()->IsDefault()) {
+				http_open_journal("cotcsystem/Requests.journal");
+			} else {
+				CONSOLE_WARNING("The request journal is only available to the default context\n");
+			}
+		}
 		return InvokeHandler(onFinished, enNoErr);
 	}
 
@@ -232,20 +256,20 @@ namespace CloudBuilder {
 		http_perform(req);
 	}
 
-	void CClannishRESTProxy::BatchGame(const CHJSON *ajSON, const CHJSON *aInput, CInternalResultHandler *onFinished) {
+	void CClannishRESTProxy::BatchGame(const CHJSON *ajSON, CRequestBody aInput, CInternalResultHandler *onFinished) {
 		cstring url;
 		csprintf(url, "/v1/batch/%s/%s", ajSON->GetString("domain", "private"), ajSON->GetString("name"));
 		CHttpRequest *req = MakeHttpRequest(url);
-		req->SetBody(aInput->Duplicate());
+		req->SetBody(aInput.Take());
 		req->SetCallback(MakeBridgeCallback(onFinished));
 		return http_perform(req);
 	}
 	
-	void CClannishRESTProxy::BatchUser(const CHJSON *ajSON, const CHJSON *aInput, CInternalResultHandler *onFinished) {
+	void CClannishRESTProxy::BatchUser(const CHJSON *ajSON, CRequestBody aInput, CInternalResultHandler *onFinished) {
 		cstring url;
 		csprintf(url, "/v1/gamer/batch/%s/%s", ajSON->GetString("domain", "private"), ajSON->GetString("name"));
 		CHttpRequest *req = MakeHttpRequest(url);
-		req->SetBody(aInput->Duplicate());
+		req->SetBody(aInput.Take());
 		req->SetCallback(MakeBridgeCallback(onFinished));
 		return http_perform(req);
 	}
@@ -322,11 +346,11 @@ namespace CloudBuilder {
 		return http_perform(req);
 	}
 
-	void CClannishRESTProxy::SetUserProfile(const CHJSON *aJSON, CInternalResultHandler *onFinished) {
+	void CClannishRESTProxy::SetUserProfile(CRequestBody aJSON, CInternalResultHandler *onFinished) {
 		if (!isLoggedIn()) { return InvokeHandler(onFinished, enNotLogged); }
 		
 		CHttpRequest *req = MakeHttpRequest("/v1/gamer/profile");
-		req->SetBody(aJSON->Duplicate());
+		req->SetBody(aJSON.Take());
 		req->SetCallback(MakeBridgeCallback(onFinished));
 		return http_perform(req);
 	}
@@ -337,9 +361,9 @@ namespace CloudBuilder {
 		cstring url;
 		csprintf(url, "/v2.6/gamer/scores/%s/%s", aJSON->GetString("domain"), aJSON->GetString("mode"));
 		CHttpRequest *req = MakeHttpRequest(url);
-		CHJSON json;
-		json.Put("score", aJSON->GetDouble("score"));
-		req->SetBody(json.Duplicate());
+		CHJSON *json = new CHJSON;
+		json->Put("score", aJSON->GetDouble("score"));
+		req->SetBody(json);
 		req->SetMethod("PUT");
 		req->SetCallback(MakeBridgeCallback(onFinished));
 		return http_perform(req);
@@ -355,10 +379,11 @@ namespace CloudBuilder {
 		cstring url;
 		csprintf(url, "/v2.6/gamer/scores/%s/%s?order=%s&mayvary=%s", aJSON->GetString("domain"), aJSON->GetString("mode"), aJSON->GetString("order"), aJSON->GetBool("mayvary") ? "true" : "false");
 		CHttpRequest *req = MakeHttpRequest(url);
-		CHJSON json;
-		json.Put("score", aJSON->GetDouble("score"));
-		json.Put("info", aJSON->GetString("info"));
-		req->SetBody(json.Duplicate());
+		CHJSON *json = new CHJSON;
+		json->Put("score", aJSON->GetDouble("score"));
+		json->Put("info", aJSON->GetString("info"));
+		req->SetBody(json);
+		req->SetReplayable();
 		req->SetCallback(MakeBridgeCallback(onFinished));
 		return http_perform(req);
 	}
@@ -366,8 +391,8 @@ namespace CloudBuilder {
 	void CClannishRESTProxy::CenteredScore(const CHJSON *aJSON, CInternalResultHandler *onFinished) {
 		if (!isLoggedIn()) { return InvokeHandler(onFinished, enNotLogged); }
 
-		cstring url;
-		csprintf(url, "/v2.6/gamer/scores/%s/%s?count=%d&page=me", aJSON->GetString("domain"), aJSON->GetString("mode"), aJSON->GetInt("count"));
+		CUrlBuilder url("/v2.6/gamer/scores");
+		url.Subpath(aJSON->GetString("domain", "private")).Subpath(aJSON->GetString("mode")).QueryParam("count", aJSON->GetInt("count")).QueryParam("page", "me");
 		CHttpRequest *req = MakeHttpRequest(url);
 		req->SetCallback(MakeBridgeCallback(onFinished));
 		return http_perform(req);
@@ -376,8 +401,8 @@ namespace CloudBuilder {
 	void CClannishRESTProxy::BestHighScore (const CHJSON *aJSON, CInternalResultHandler *onFinished) {
 		if (!isLoggedIn()) { return InvokeHandler(onFinished, enNotLogged); }
 
-		cstring url;
-		csprintf(url, "/v2.6/gamer/scores/%s/%s?count=%d&page=%d", aJSON->GetString("domain"), aJSON->GetString("mode"), aJSON->GetInt("count"), aJSON->GetInt("page"));
+		CUrlBuilder url("/v2.6/gamer/scores");
+		url.Subpath(aJSON->GetString("domain", "private")).Subpath(aJSON->GetString("mode")).QueryParam("count", aJSON->GetInt("count")).QueryParam("page", aJSON->GetInt("page"));
 		CHttpRequest *req = MakeHttpRequest(url);
 		req->SetCallback(MakeBridgeCallback(onFinished));
 		return http_perform(req);
@@ -396,8 +421,8 @@ namespace CloudBuilder {
 	void CClannishRESTProxy::FriendsBestHighScore(const CHJSON *aJSON, CInternalResultHandler *onFinished) {
 		if (!isLoggedIn()) { return InvokeHandler(onFinished, enNotLogged); }
 		
-		cstring url;
-		csprintf(url, "/v2.6/gamer/scores/%s/%s?count=%d&page=%d&type=friendscore", aJSON->GetString("domain"), aJSON->GetString("mode"), aJSON->GetInt("count"), aJSON->GetInt("page"));
+		CUrlBuilder url("/v2.6/gamer/scores");
+		url.Subpath(aJSON->GetString("domain", "private")).Subpath(aJSON->GetString("mode")).QueryParam("count", aJSON->GetInt("count")).QueryParam("page", aJSON->GetInt("page")).QueryParam("type", "friendscore");
 		CHttpRequest *req = MakeHttpRequest(url);
 		req->SetCallback(MakeBridgeCallback(onFinished));
 		return http_perform(req);
@@ -485,17 +510,17 @@ namespace CloudBuilder {
 	}
 
 	//////////////////////////// Match API ////////////////////////////
-	void CClannishRESTProxy::CreateMatch(const CHJSON *config, CInternalResultHandler *onFinished) {
-		const char *domain = config->GetString("domain");
-		CHJSON *dupConfig = config->Duplicate();
+	void CClannishRESTProxy::CreateMatch(CRequestBody config, CInternalResultHandler *onFinished) {
 		if (!isSetup()) { return InvokeHandler(onFinished, enSetupNotCalled); }
 		if (!isLoggedIn()) { return InvokeHandler(onFinished, enNotLogged); }
-		dupConfig->Delete("domain");
 
+		const char *domain = config->GetString("domain");
 		CUrlBuilder url("/v1/gamer/matches");
 		url.QueryParam("domain", (domain && domain[0]) ? domain : "private");
 		CHttpRequest *req = MakeHttpRequest(url);
-		req->SetBody(dupConfig);
+		CHJSON *body = config.Take();
+		body->Delete("domain");
+		req->SetBody(body);
 		req->SetCallback(MakeBridgeCallback(onFinished));
 		return http_perform(req);
 	}
@@ -632,19 +657,17 @@ namespace CloudBuilder {
 		return http_perform(req);
 	}
 
-	void CClannishRESTProxy::PostMove(const CHJSON *config, CInternalResultHandler *onFinished) {
+	void CClannishRESTProxy::PostMove(CRequestBody config, CInternalResultHandler *onFinished) {
 		if (!isSetup()) { return InvokeHandler(onFinished, enSetupNotCalled); }
 		if (!isLoggedIn()) { return InvokeHandler(onFinished, enNotLogged); }
 		const char *matchId = config->GetString("id"), *lastEventId = config->GetString("lastEventId");
-		const CHJSON *move = config->Get("move");
-		if (!matchId || !move || !lastEventId) { return InvokeHandler(onFinished, enBadParameters, "Missing either match id, move node or lastEventId"); }
-
-		CHJSON *json = new CHJSON;
-		json->Put("move", move);
-		json->Put("globalState", config->Get("globalState"));
-		json->Put("osn", config->Get("osn"));
+		if (!matchId || !config->Has("move") || !lastEventId) { return InvokeHandler(onFinished, enBadParameters, "Missing either match id, move node or lastEventId"); }
 
 		CHttpRequest *req = MakeHttpRequest(CUrlBuilder("/v1/gamer/matches").Subpath(matchId).Subpath("move").QueryParam("lastEventId", lastEventId));
+		CHJSON *json = new CHJSON;
+		json->Put("move", config.Take("move"));
+		json->Put("globalState", config.Take("globalState"));
+		json->Put("osn", config.Take("osn"));
 		req->SetBody(json);
 		req->SetCallback(MakeBridgeCallback(onFinished));
 		return http_perform(req);
@@ -711,7 +734,7 @@ namespace CloudBuilder {
 		return http_perform(req);
 	}
 
-	void CClannishRESTProxy::IndexObject(const CHJSON *config, CInternalResultHandler *onFinished) {
+	void CClannishRESTProxy::IndexObject(CRequestBody config, CInternalResultHandler *onFinished) {
 		if (!config->Has("index") || !config->Has("objectid") || !config->Has("properties")) {
 			return InvokeHandler(onFinished, enBadParameters, "Missing index, objectid or properties in configuration");
 		}
@@ -721,8 +744,8 @@ namespace CloudBuilder {
 		CHttpRequest *req = MakeHttpRequest(url);
 		CHJSON *data = new CHJSON();
 		data->Put("id", config->GetString("objectid"));
-		data->Put("properties", config->Get("properties"));
-		data->Put("payload", config->Get("payload"));
+		data->Put("properties", config.Take("properties"));
+		data->Put("payload", config.Take("payload"));
 		req->SetBody(data);
 		req->SetCallback(MakeBridgeCallback(onFinished));
 		return http_perform(req);
@@ -797,11 +820,14 @@ namespace CloudBuilder {
 		return http_perform(req);
 	}
 	
-	void CClannishRESTProxy::UserSetProperties(const char *aDomain, const CHJSON *aJSON, CInternalResultHandler *onFinished) {
+	void CClannishRESTProxy::UserSetProperties(const char *aDomain, CRequestBody aJSON, CInternalResultHandler *onFinished) {
 		if (!isLoggedIn()) { return InvokeHandler(onFinished, enNotLogged); }
 		
-		CHttpRequest *req = MakeHttpRequest(CUrlBuilder("/v2.6/gamer/property").Subpath(aDomain));
-		req->SetBody(aJSON->Duplicate());
+		CUrlBuilder url("/v2.6/gamer/property");
+		url.Subpath(aDomain);
+		CHttpRequest *req = MakeHttpRequest(url);
+		req->SetBody(aJSON.Take());
+		req->SetReplayable(url);
 		req->SetCallback(MakeBridgeCallback(onFinished));
 		return http_perform(req);
 	}
@@ -817,17 +843,24 @@ namespace CloudBuilder {
 	void CClannishRESTProxy::UserDelProperty(const char *aDomain, const char *key, CInternalResultHandler *onFinished) {
 		if (!isLoggedIn()) { return InvokeHandler(onFinished, enNotLogged); }
 		
-		CHttpRequest *req = MakeHttpRequest(CUrlBuilder("/v2.6/gamer/property").Subpath(aDomain).Subpath(key));
+		CUrlBuilder url("/v2.6/gamer/property");
+		url.Subpath(aDomain).Subpath(key);
+		CHttpRequest *req = MakeHttpRequest(url);
 		req->SetMethod("DELETE");
+		req->SetReplayable(url);
 		req->SetCallback(MakeBridgeCallback(onFinished));
 		return http_perform(req);
 	}
 
-	void CClannishRESTProxy::UserSetProperty(const char *aDomain, const CHJSON *aJSON, CInternalResultHandler *onFinished) {
+	void CClannishRESTProxy::UserSetProperty(const char *aDomain, CRequestBody aJSON, CInternalResultHandler *onFinished) {
 		if (!isLoggedIn()) { return InvokeHandler(onFinished, enNotLogged); }
 		
-		CHttpRequest *req = MakeHttpRequest(CUrlBuilder("/v2.6/gamer/property").Subpath(aDomain).Subpath(aJSON->GetString("key")));
-		req->SetBody(aJSON->Duplicate());
+		CUrlBuilder url("/v2.6/gamer/property");
+		url.Subpath(aDomain).Subpath(aJSON->GetString("key"));
+		CHttpRequest *req = MakeHttpRequest(url);
+		req->SetBody(aJSON.Take());
+		// Setting or deleting the same property supersedes this request
+		req->SetReplayable(url);
 		req->SetCallback(MakeBridgeCallback(onFinished));
 		return http_perform(req);
 	}
@@ -857,7 +890,7 @@ namespace CloudBuilder {
         return http_perform(req);
     }
     
-    void CClannishRESTProxy::vfsWritev3(const char *domain, const char *key, const CHJSON *aJSON, bool isBinary, CInternalResultHandler *onFinished) {
+    void CClannishRESTProxy::vfsWritev3(const char *domain, const char *key, CRequestBody aJSON, bool isBinary, CInternalResultHandler *onFinished) {
         if (!isLoggedIn()) { return InvokeHandler(onFinished, enNotLogged); }
         
         CUrlBuilder url("/v3.0/gamer/vfs");
@@ -871,8 +904,12 @@ namespace CloudBuilder {
         }
         
         CHttpRequest *req = MakeHttpRequest(url);
-        req->SetBody(aJSON->Duplicate());
+        req->SetBody(aJSON.Take());
         req->SetMethod("PUT");
+        // Binary writes only fetch an upload URL
+        if (!isBinary) {
+            req->SetReplayable(url);
+        }
         req->SetCallback(MakeBridgeCallback(onFinished));
         return http_perform(req);
     }
@@ -891,7 +928,7 @@ namespace CloudBuilder {
         return http_perform(req);
     }
     
-    void CClannishRESTProxy::vfsWrite(const char *domain, const char *key, const CHJSON *aJSON, bool isBinary, CInternalResultHandler *onFinished) {
+    void CClannishRESTProxy::vfsWrite(const char *domain, const char *key, CRequestBody aJSON, bool isBinary, CInternalResultHandler *onFinished) {
         if (!isLoggedIn()) { return InvokeHandler(onFinished, enNotLogged); }
         
         CUrlBuilder url("/v1/gamer/vfs");
@@ -905,8 +942,12 @@ namespace CloudBuilder {
         }
         
         CHttpRequest *req = MakeHttpRequest(url);
-        req->SetBody(aJSON->Duplicate());
+        req->SetBody(aJSON.Take());
         req->SetMethod("PUT");
+        // Binary writes only fetch an upload URL
+        if (!isBinary) {
+            req->SetReplayable(url);
+        }
         req->SetCallback(MakeBridgeCallback(onFinished));
         return http_perform(req);
     }
@@ -923,6 +964,9 @@ namespace CloudBuilder {
 		}
 		CHttpRequest *req = MakeHttpRequest(url);
 		req->SetMethod("DELETE");
+		if (!isBinary) {
+			req->SetReplayable(url);
+		}
 		req->SetCallback(MakeBridgeCallback(onFinished));
 		return http_perform(req);
 	}
@@ -961,7 +1005,7 @@ namespace CloudBuilder {
 		return http_perform(req);
 	}
 	
-	void CClannishRESTProxy::vfsWriteGame(const char *domain, const char *key, const CHJSON *aJSON, bool isBinary, CInternalResultHandler *onFinished) {
+	void CClannishRESTProxy::vfsWriteGame(const char *domain, const char *key, CRequestBody aJSON, bool isBinary, CInternalResultHandler *onFinished) {
 		if (!isSetup()) { return InvokeHandler(onFinished, enSetupNotCalled); }
 		
 		CUrlBuilder url("/v1/vfs");
@@ -975,7 +1019,7 @@ namespace CloudBuilder {
 		}
 
 		CHttpRequest *req = MakeHttpRequest(url);
-		req->SetBody(aJSON->Duplicate());
+		req->SetBody(aJSON.Take());
 		req->SetMethod("PUT");
 		req->SetCallback(MakeBridgeCallback(onFinished));
 		return http_perform(req);
@@ -1025,21 +1069,21 @@ namespace CloudBuilder {
 		return http_perform(req);
 	}
 
-	void CClannishRESTProxy::Transaction (const CHJSON *aJSON, bool useV2_2, CInternalResultHandler *onFinished) {
+	void CClannishRESTProxy::Transaction (CRequestBody aJSON, bool useV2_2, CInternalResultHandler *onFinished) {
 		if (!CClan::Instance()->isSetup()) { return InvokeHandler(onFinished, enSetupNotCalled); }
 		if (!CClan::Instance()->isUserLogged()) { return InvokeHandler(onFinished, enNotLogged); }
 
-		const CHJSON *transaction = aJSON->Get("transaction");
-		if (!transaction) { return InvokeHandler(onFinished, enBadParameters, "Missing transaction in configuration"); }
+		if (!aJSON->Has("transaction")) { return InvokeHandler(onFinished, enBadParameters, "Missing transaction in configuration"); }
 		
 		CUrlBuilder url(useV2_2 ? "/v2.2/gamer/tx" : "/v1/gamer/tx");
 		const char *domain = aJSON->GetString("domain");
 		url.Subpath(domain && domain[0] ? domain : "private");
 		CHJSON *tx = new CHJSON();
-		tx->Put("transaction", transaction);
-		tx->Put("description", aJSON->Get("description"));
+		tx->Put("transaction", aJSON.Take("transaction"));
+		tx->Put("description", aJSON.Take("description"));
 		CHttpRequest *req = MakeHttpRequest(url);
 		req->SetBody(tx);
+		req->SetReplayable();
 		req->SetCallback(MakeBridgeCallback(onFinished));
 		return http_perform(req);
 	}
@@ -1070,7 +1114,7 @@ namespace CloudBuilder {
 		return http_perform(req);
 	}
 
-	void CClannishRESTProxy::SetAchievementGamerData(const char *domain, const char *achName, const CHJSON *data, CInternalResultHandler *onFinished) {
+	void CClannishRESTProxy::SetAchievementGamerData(const char *domain, const char *achName, CRequestBody data, CInternalResultHandler *onFinished) {
 		if (!data) { return InvokeHandler(onFinished, enBadParameters, "Missing gamer data JSON"); }
 
 		CUrlBuilder url("/v1/gamer/achievements");
@@ -1078,7 +1122,8 @@ namespace CloudBuilder {
 
 		CHttpRequest *req = MakeHttpRequest(url);
 		req->SetCallback(MakeBridgeCallback(onFinished));
-		req->SetBody(data->Duplicate());
+		req->SetBody(data.Take());
+		req->SetReplayable(url);
 		return http_perform(req);
 	}
 
@@ -1094,13 +1139,13 @@ namespace CloudBuilder {
 
 	//////////////////////////// Events ////////////////////////////
 
-	void CClannishRESTProxy::PushEvent (const char *domain, const char *gamerid, const CHJSON *aJSON, CInternalResultHandler *onFinished) {
+	void CClannishRESTProxy::PushEvent (const char *domain, const char *gamerid, CRequestBody aJSON, CInternalResultHandler *onFinished) {
 		if (!isLoggedIn()) { return InvokeHandler(onFinished, enNotLogged); }
 		
 		cstring url;
 		csprintf(url, "/v1/gamer/event/%s/%s" , domain && *domain ? domain : "private", gamerid);
 		CHttpRequest *req = MakeHttpRequest(url);
-		req->SetBody(aJSON->Duplicate());
+		req->SetBody(aJSON.Take());
 		req->SetCallback(MakeBridgeCallback(onFinished));
 		return http_perform(req);
 	}
@@ -1110,6 +1155,8 @@ namespace CloudBuilder {
 	 */
 	class CClannishRESTProxy::PopEventLoopThread: public CotCHelpers::CThread {
 		CClannishRESTProxy *self;
+		// Has its own thread, which runs in the context of the proxy (the thread is joined before the context goes away)
+		CClientContext *context;
 		bool stopped;
 
 		bool AmIMainPopThread();
@@ -1119,12 +1166,12 @@ namespace CloudBuilder {
 		chain<CEventListener> listeners;
 		cstring domain;
 
-		PopEventLoopThread(CClannishRESTProxy *parent, const char *domain) : self(parent), stopped(false), domain(domain) { CONSOLE_VERBOSE("Creating pop event loop for domain %s\n", domain);
+		PopEventLoopThread(CClannishRESTProxy *parent, const char *domain) : self(parent), context(CClientContext::Current()), stopped(false), domain(domain) { CONSOLE_VERBOSE("Creating pop event loop for domain %s\n", domain);
 		}
 		void AddListener(CEventListener *listener) { if (listener) { listeners.Add(listener); } }
 		void RemoveListener(CEventListener *listener) { if (listener) { listeners.Remove(listener); } }
 		virtual void Run();
-		void Terminate() { stopped = true; Join(); }
+		void Terminate() { stopped = true; self->mWakeUpSignal.WakeUp(); Join(); }
 		~PopEventLoopThread() { printf("Removing event loop for %s\n", domain.c_str()); }
 	};
 
@@ -1217,6 +1264,7 @@ namespace CloudBuilder {
 	}
 
 	void CClannishRESTProxy::PopEventLoopThread::Run() {
+		CClientContext::Scope scope(context);
 		cstring messageToAcknowledge;
 		bool lastResultPositive = true, lastResultNetworkError = false, mainThread = AmIMainPopThread();
 		owned_ref<CCloudResult> lastResult;
@@ -1224,13 +1272,15 @@ namespace CloudBuilder {
 		// Thread end condition
 		while (!stopped) {
 			int delay = self->mPopEventLoopDelay;
+			// Taken before checking the state, so that a resume happening meanwhile is not missed
+			unsigned wakeUpToken = self->mWakeUpSignal.Token();
 			// On hold
 			if (self->mSuspend) {
 				CONSOLE_VERBOSE("Suspending pop thread %s\n", domain.c_str());
-				self->suspendedThreadLock.Wait();
+				self->mWakeUpSignal.Sleep(0, wakeUpToken);
 				// Wait between 0 to 5 sec to avoid all threads to wake up at the same time
-				if (!AmIMainPopThread()) {
-					usleep((rand() % 50) * 100 * 1000);
+				if (!AmIMainPopThread() && !stopped) {
+					self->mWakeUpSignal.Sleep((rand() % 50) * 100 + 1);
 				}
 				continue;
 			}
@@ -1300,7 +1350,8 @@ namespace CloudBuilder {
 			if (!lastResultPositive) {
 				// Network down -- wait 20 sec to avoid bombing the poor internet
 				CONSOLE_VERBOSE("Event thread for domain %s put on hold for %ds\n", domain.c_str(), EVENT_THREAD_HOLD);
-				self->suspendedThreadLock.Wait(EVENT_THREAD_HOLD * 1000);
+				// Ends earlier upon resume or when the network is back
+				self->mWakeUpSignal.Sleep(EVENT_THREAD_HOLD * 1000, wakeUpToken);
 				if (mainThread) {
 					// On the main thread, try again with a smaller timeout so that we can notify that the network is back as soon as the server is reached
 					delay = POP_REQUEST_RECOVER_TIMEOUT;
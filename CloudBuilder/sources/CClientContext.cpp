@@ -0,0 +1,74 @@
+//
+//  CClientContext.cpp
+//  CloudBuilder
+//
+//  Created by florian on 20/10/16.
+//  Copyright (c) 2016 Clan of the Cloud. All rights reserved.
+//
+
+#include "CloudBuilder_private.h"
+#include "CClientContext_private.h"
+#include "CClan.h"
+
+using namespace CotCHelpers;
+
+namespace CloudBuilder {
+
+	// Context in scope on each thread; NULL stands for the default one
+	static thread_local CClientContext *tCurrentContext = NULL;
+
+	CClientContext::CClientContext(bool isDefault) : mMembers(new Members), mIsDefault(isDefault) {}
+
+	CClientContext::~CClientContext() {
+		delete mMembers;
+	}
+
+	CClientContext *CClientContext::Default() {
+		// Never released, as the singletons may be used until the very end of the process
+		static CClientContext *context = new CClientContext(true);
+		return context;
+	}
+
+	CClientContext *CClientContext::Create() {
+		return new CClientContext(false);
+	}
+
+	CClientContext *CClientContext::Current() {
+		return tCurrentContext ? tCurrentContext : Default();
+	}
+
+	void CClientContext::ProcessIdleTasks() {
+		Scope scope(this);
+		CClan::Instance()->ProcessIdleTasks();
+	}
+
+	CClientContext::Scope::Scope(CClientContext *context) : mPrevious(tCurrentContext) {
+		tCurrentContext = context;
+	}
+
+	CClientContext::Scope::~Scope() {
+		tCurrentContext = mPrevious;
+	}
+
+	void CClientContext::Members::TaskSubmitted() {
+		mTasksCondition.LockVar();
+		mPendingTasks++;
+		mTasksCondition.UnlockVar();
+	}
+
+	void CClientContext::Members::TaskFinished() {
+		mTasksCondition.LockVar();
+		if (--mPendingTasks == 0) {
+			mTasksCondition.SignalAll();
+		}
+		mTasksCondition.UnlockVar();
+	}
+
+	void CClientContext::Members::WaitForTasks() {
+		mTasksCondition.LockVar();
+		while (mPendingTasks > 0) {
+			mTasksCondition.Wait();
+		}
+		mTasksCondition.UnlockVar();
+	}
+}
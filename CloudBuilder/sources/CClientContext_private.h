@@ -0,0 +1,61 @@
+//
+//  CClientContext_private.h
+//  CloudBuilder
+//
+//  Created by florian on 20/10/16.
+//  Copyright (c) 2016 Clan of the Cloud. All rights reserved.
+//
+
+#ifndef CloudBuilder_CClientContext_private_h
+#define CloudBuilder_CClientContext_private_h
+
+#include "CClientContext.h"
+#include "CCallback.h"
+#include "curltool.h"
+#include "helpers.h"
+
+namespace CloudBuilder {
+	class CClan;
+	class CClannishRESTProxy;
+	class CUserManager;
+	class CGameManager;
+	class CTribeManager;
+	class CMatchManager;
+	class CIndexManager;
+	class CStoreManager;
+
+	/**
+	 * State of a session. The singletons are released by CClan::Terminate.
+	 */
+	struct CClientContext::Members {
+		singleton_holder<CClan> clan;
+		singleton_holder<CClannishRESTProxy> proxy;
+		singleton_holder<CUserManager> userManager;
+		singleton_holder<CGameManager> gameManager;
+		singleton_holder<CTribeManager> tribeManager;
+		singleton_holder<CMatchManager> matchManager;
+		singleton_holder<CIndexManager> indexManager;
+		singleton_holder<CStoreManager> storeManager;
+		// Results waiting for ProcessIdleTasks
+		CallbackQueue callbacks;
+		// HTTP request queue and settings, created on demand and released by http_terminate
+		autoref<RequestDispatcher> dispatcher;
+
+		Members() : mPendingTasks(0) {}
+		/**
+		 * Accounts for the tasks submitted to the CTaskExecutor from this context.
+		 */
+		void TaskSubmitted();
+		void TaskFinished();
+		/**
+		 * Blocks until all the tasks submitted from this context have been run.
+		 */
+		void WaitForTasks();
+
+	private:
+		CotCHelpers::CConditionVariable mTasksCondition;
+		int mPendingTasks;
+	};
+}
+
+#endif
@@ -0,0 +1,197 @@
+//
+//  CFriendsCache.cpp
+//  CloudBuilder
+//
+//  Created by florian on 20/10/16.
+//  Copyright (c) 2016 Clan of the Cloud. All rights reserved.
+//
+
+#include <string.h>
+#include "CFriendsCache.h"
+#include "CloudBuilder_private.h"
+#include "CClannishRESTProxy.h"
+
+using namespace CotCHelpers;
+
+namespace CloudBuilder {
+
+	static const char *listNames[] = { "friends", "blacklisted" };
+
+	/**
+	 * Request made by the cache, deleted once its result has been processed. Lists are not stored if anything has
+	 * changed since the request was made.
+	 */
+	struct CFriendsCache::Call {
+		typedef void (CFriendsCache::*Method)(const CCloudResult*, Call*);
+		CFriendsCache *cache;
+		Method method;
+		unsigned generation;
+		List list;
+		cstring id, status;
+		CResultHandler *handler;
+
+		Call(CFriendsCache *cache, Method method, CResultHandler *handler)
+			: cache(cache), method(method), generation(cache->mGeneration),
+			list(Friends), handler(handler) {}
+
+		bool IsCurrent() const { return generation == cache->mGeneration; }
+		// To pass to the proxy
+		CInternalResultHandler *Handler() { return MakeDelegate(this, &Call::Done); }
+		void Done(const CCloudResult *result) {
+			(cache->*method)(result, this);
+			delete this;
+		}
+	};
+
+	CFriendsCache::CFriendsCache() : mEnabled(false), mGeneration(0) {}
+
+	CFriendsCache::~CFriendsCache() {}
+
+	void CFriendsCache::Configure(const CHJSON *options) {
+		mEnabled = options->GetBool("friendsCache");
+	}
+
+	void CFriendsCache::Clear() {
+		Changed();
+		mLists[Friends] <<= NULL;
+		mLists[Blacklisted] <<= NULL;
+	}
+
+	void CFriendsCache::Changed() {
+		mGeneration++;
+	}
+
+	bool CFriendsCache::Listen(const char *domain) {
+		if (!IsEqual(domain ? domain : ADMIN_EVENT_DOMAIN, ADMIN_EVENT_DOMAIN)) {
+			return false;
+		}
+		// Also tells whether the event loop (and us with it) has been stopped since the lists were fetched
+		eErrorCode err = CClannishRESTProxy::Instance()->RegisterEventListener(ADMIN_EVENT_DOMAIN, this);
+		if (err == enNoErr) {
+			CONSOLE_VERBOSE("Listening to relationship changes, friends to be fetched again\n");
+			Clear();
+		}
+		return err == enNoErr || err == enEventListenerAlreadyRegistered;
+	}
+
+	void CFriendsCache::ListFriends(const char *domain, CResultHandler *handler) {
+		Get(Friends, domain, handler);
+	}
+
+	void CFriendsCache::BlacklistFriends(const char *domain, CResultHandler *handler) {
+		Get(Blacklisted, domain, handler);
+	}
+
+	void CFriendsCache::Get(List list, const char *domain, CResultHandler *handler) {
+		bool cached = Listen(domain);
+		if (cached && mLists[list]) {
+			CHJSON *json = new CHJSON;
+			json->Put(listNames[list], mLists[list]->Duplicate());
+			CCloudResult result(enNoErr, json);
+			return InvokeHandler(handler, &result);
+		}
+
+		CHJSON json;
+		json.Put("domain", domain);
+		CInternalResultHandler *onFinished;
+		if (cached) {
+			Call *call = new Call(this, &CFriendsCache::ListFetched, handler);
+			call->list = list;
+			onFinished = call->Handler();
+		} else {
+			// Not remembered for other domains
+			onFinished = MakeBridgeDelegate(handler);
+		}
+		if (list == Friends) {
+			CClannishRESTProxy::Instance()->ListFriends(&json, onFinished);
+		} else {
+			CClannishRESTProxy::Instance()->BlacklistFriends(&json, onFinished);
+		}
+	}
+
+	void CFriendsCache::ListFetched(const CCloudResult *result, Call *call) {
+		const CHJSON *list = result->GetJSON()->Get(listNames[call->list]);
+		if (call->IsCurrent() && result->GetErrorCode() == enNoErr && list) {
+			mLists[call->list] <<= list->Duplicate();
+		}
+		InvokeHandler(call->handler, result);
+	}
+
+	CHJSON *CFriendsCache::Remove(List list, const char *gamerId) {
+		if (!mLists[list]) {
+			return NULL;
+		}
+		CHJSON *kept = CHJSON::Array(), *removed = NULL;
+		FOR_EACH (const CHJSON *entry, *mLists[list]) {
+			if (!removed && IsEqual(entry->GetString("gamer_id"), gamerId)) {
+				removed = entry->Duplicate();
+			} else {
+				kept->Add(entry->Duplicate());
+			}
+		}
+		mLists[list] <<= kept;
+		return removed;
+	}
+
+	void CFriendsCache::Insert(List list, CHJSON *entry) {
+		if (!mLists[list]) {
+			delete entry;
+		} else if (!entry) {
+			// The profile is needed
+			mLists[list] <<= NULL;
+		} else {
+			delete Remove(list, entry->GetString("gamer_id"));
+			mLists[list]->Add(entry);
+		}
+	}
+
+	void CFriendsCache::ChangeRelationshipStatus(const CHJSON *options, CResultHandler *handler) {
+		Call *call = new Call(this, &CFriendsCache::StatusChanged, handler);
+		call->id = options->GetString("id");
+		// Left empty for other domains, which are not cached
+		if (IsEqual(options->GetString("domain", ADMIN_EVENT_DOMAIN), ADMIN_EVENT_DOMAIN)) {
+			call->status = options->GetString("status");
+		}
+		CClannishRESTProxy::Instance()->ChangeRelationshipStatus(options, call->Handler());
+	}
+
+	void CFriendsCache::StatusChanged(const CCloudResult *result, Call *call) {
+		if (result->GetErrorCode() == enNoErr && call->status) {
+			Changed();
+			if (IsEqual(call->status, "add")) {
+				Insert(Friends, Remove(Blacklisted, call->id));
+			} else if (IsEqual(call->status, "blacklist")) {
+				Insert(Blacklisted, Remove(Friends, call->id));
+			} else if (IsEqual(call->status, "forget")) {
+				delete Remove(Friends, call->id);
+				delete Remove(Blacklisted, call->id);
+			} else {
+				Clear();
+			}
+		}
+		InvokeHandler(call->handler, result);
+	}
+
+	void CFriendsCache::onEventReceived(const char *aDomain, const CCloudResult *aEvent) {
+		const char *type = aEvent->GetJSON()->GetString("type", "");
+		if (strncmp(type, "friend.", 7)) {
+			return;
+		}
+		// Made by the other gamer: {type: "friend.<status>", event: {friend: <gamer id>}}
+		const char *status = type + 7, *gamerId = aEvent->GetJSON()->GetSafe("event")->GetString("friend");
+		Changed();
+		if (IsEqual(status, "add")) {
+			// Already known otherwise
+			Insert(Friends, Remove(Friends, gamerId));
+		} else if (IsEqual(status, "blacklist") || IsEqual(status, "forget")) {
+			delete Remove(Friends, gamerId);
+		} else {
+			Clear();
+		}
+	}
+
+	void CFriendsCache::onEventError(eErrorCode aErrorCode, const char *aDomain, const CCloudResult *result) {
+		// Events may be lost, and the listener is removed if the loop is stopped
+		Clear();
+	}
+}
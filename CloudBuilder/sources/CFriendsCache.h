@@ -0,0 +1,71 @@
+//
+//  CFriendsCache.h
+//  CloudBuilder
+//
+//  Created by florian on 20/10/16.
+//  Copyright (c) 2016 Clan of the Cloud. All rights reserved.
+//
+
+#ifndef CloudBuilder_CFriendsCache_h
+#define CloudBuilder_CFriendsCache_h
+
+#include "CCallback.h"
+#include "CUserManager.h"
+#include "helpers.h"
+
+namespace CloudBuilder {
+
+	/**
+	 * Friends and blacklisted gamers of the private domain (CTribeManager::ListFriends and BlacklistFriends) kept in
+	 * memory, enabled with the "friendsCache" setup option. The lists are kept current with the relationship changes
+	 * made by the gamer and with the friend.* events received on the private domain, so that they are only fetched
+	 * again when something may have been missed: a friend added by someone else (the event doesn't carry the profile),
+	 * an error of the event loop, or an event loop restarted (e.g. after logging in again).
+	 *
+	 * Other domains have no event loop running by default and are always fetched. Meant to be used from the thread
+	 * running the callbacks, like the managers.
+	 */
+	class CFriendsCache: public CEventListener {
+	public:
+		CFriendsCache();
+
+		/**
+		 * @param options setup options: friendsCache
+		 */
+		void Configure(const CotCHelpers::CHJSON *options);
+		bool IsEnabled() const { return mEnabled; }
+
+		void ListFriends(const char *domain, CResultHandler *handler);
+		void BlacklistFriends(const char *domain, CResultHandler *handler);
+		/**
+		 * Same parameters as CTribeManager::ChangeRelationshipStatus, checked by it.
+		 */
+		void ChangeRelationshipStatus(const CotCHelpers::CHJSON *options, CResultHandler *handler);
+
+		virtual void onEventReceived(const char *aDomain, const CCloudResult *aEvent);
+		virtual void onEventError(eErrorCode aErrorCode, const char *aDomain, const CCloudResult *result);
+
+	private:
+		enum List { Friends, Blacklisted };
+		struct Call;
+
+		bool mEnabled;
+		// Incremented with each change, so that a list fetched meanwhile isn't stored
+		unsigned mGeneration;
+		// Arrays of {gamer_id, profile} as returned by the server, NULL when unknown
+		owned_ref<CotCHelpers::CHJSON> mLists[2];
+
+		~CFriendsCache();
+		void Clear();
+		bool Listen(const char *domain);
+		void Get(List list, const char *domain, CResultHandler *handler);
+		void Changed();
+		CotCHelpers::CHJSON *Remove(List list, const char *gamerId);
+		void Insert(List list, CotCHelpers::CHJSON *entry);
+
+		void ListFetched(const CCloudResult *result, Call *call);
+		void StatusChanged(const CCloudResult *result, Call *call);
+	};
+}
+
+#endif
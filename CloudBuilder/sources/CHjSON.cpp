@@ -10,6 +10,7 @@
 #include <stdlib.h>
 #include "CHJSON.h"
 #include "cJSON.h"
+#include "cbor.h"
 #include "CloudBuilder_private.h"
 #include "CotCHelpers.h"
 
@@ -52,16 +53,23 @@ namespace CotCHelpers {
 		mNext = NULL;
 	}
 
+	CHJSON::CHJSON(CHJSON &&other) {
+		mNext = NULL;
+		release = true;
+		if (other.release) {
+			mJSON = other.mJSON;
+			other.mJSON = cJSON_CreateObject();
+		} else {
+			// The other one is only a view on a node belonging to another JSON
+			mJSON = cJSON_Duplicate(other.mJSON, 1);
+		}
+	}
+
 	CHJSON *CHJSON::dup(const CHJSON *json)
 	{
-		// slow version
 		if (json == NULL)
 			return new CHJSON();
-			
-		char *jsonstring = cJSON_PrintUnformatted(json->mJSON);
-		CHJSON *newjson = CHJSON::parse(jsonstring);
-		free(jsonstring);
-		return newjson;
+		return new CHJSON(cJSON_Duplicate(json->mJSON, 1), true);
 	}
 
 	CHJSON *CHJSON::Duplicate() const {
@@ -247,6 +255,15 @@ namespace CotCHelpers {
 			return NULL;
 	}
 	
+	CHJSON *CHJSON::parseBinary(const void *data, size_t length)
+	{
+		cJSON *json = cbor_decode(data, length);
+		if (json)
+			return new CHJSON(json, true);
+		else
+			return NULL;
+	}
+
 	cstring CHJSON::print() const 
 	{
 		return cstring(cJSON_PrintUnformatted(mJSON), true);
@@ -267,6 +284,11 @@ namespace CotCHelpers {
 		dest <<= cJSON_Print(mJSON);
 		return dest;
 	}
+
+	void *CHJSON::printBinary(size_t *outLength) const
+	{
+		return cbor_encode(mJSON, outLength);
+	}
 	
 	void CHJSON::AddStringSafe(const char *item, const char *value)
 	{
@@ -291,7 +313,19 @@ namespace CotCHelpers {
 	void CHJSON::Delete(const char *item)
 	{
 		cJSON *j = cJSON_DetachItemFromObject(mJSON,item);
-		if (j) delete j;
+		if (j) cJSON_Delete(j);
+	}
+
+	CHJSON *CHJSON::Extract(const char *item)
+	{
+		cJSON *j = cJSON_DetachItemFromObject(mJSON, item);
+		return j ? new CHJSON(j, true) : NULL;
+	}
+
+	CHJSON *CHJSON::Extract(int index)
+	{
+		cJSON *j = cJSON_DetachItemFromArray(mJSON, index);
+		return j ? new CHJSON(j, true) : NULL;
 	}
 
 	CHJSON* CHJSON::initWith(const char **args)
@@ -372,7 +406,7 @@ namespace CotCHelpers {
 	}
 
 	CHJSON::Iterator CHJSON::begin() const {
-		return Iterator(this, size() > 0 ? 0 : -1);
+		return Iterator(this, 0);
 	}
 
 	CHJSON::Iterator CHJSON::end() const {
@@ -380,11 +414,16 @@ namespace CotCHelpers {
 	}
 
 	const CHJSON* CHJSON::Iterator::operator*() {
-		if (index >= 0) { return json->Get(index); } return NULL;
+		if (!node) { return NULL; }
+		CHJSON *result = new CHJSON(node, false);
+		json->push(result);
+		return result;
 	}
 
 	CHJSON::Iterator& CHJSON::Iterator::operator++() {
-		if (index < 0 || ++index >= json->size()) { index = -1; } return *this;
+		if (node) { node = node->next; }
+		index = node ? index + 1 : -1;
+		return *this;
 	}
 
 	CHJSON::Iterator CHJSON::Iterator::operator++(int) {
@@ -401,7 +440,7 @@ namespace CotCHelpers {
 		return index == other.index;
 	}
 
-	CHJSON::Iterator::Iterator(const CHJSON *json, int index) : json(json), index(index) {
-
+	CHJSON::Iterator::Iterator(const CHJSON *json, int index) : json(json), index(index), node(NULL) {
+		if (index >= 0 && !(node = cJSON_GetArrayItem(json->mJSON, index))) { this->index = -1; }
 	}
 }
@@ -0,0 +1,423 @@
+//
+//  CLeaderboardCache.cpp
+//  CloudBuilder
+//
+//  Created by florian on 20/10/16.
+//  Copyright (c) 2016 Clan of the Cloud. All rights reserved.
+//
+
+#include <time.h>
+#include <limits.h>
+#include "CLeaderboardCache.h"
+#include "CloudBuilder_private.h"
+#include "CClannishRESTProxy.h"
+
+// Beyond that many interned strings, the whole cache is dropped
+#define MAX_STRINGS 8192
+
+using namespace CotCHelpers;
+
+namespace CloudBuilder {
+
+	static const char *domainName(const char *domain) {
+		return (domain && domain[0]) ? domain : "private";
+	}
+
+	/**
+	 * Request for a page, deleted once its result has been processed. Not stored if the cache has been cleared
+	 * meanwhile.
+	 */
+	struct CLeaderboardCache::Call {
+		CLeaderboardCache *cache;
+		unsigned generation;
+		cstring boardKey, waitKey, mode;
+		int page;
+
+		Call(CLeaderboardCache *cache, const Board &board, const char *waitKey, int page)
+			: cache(cache), generation(cache->mGeneration),
+			boardKey(board.key), waitKey(waitKey), mode(board.mode), page(page) {}
+
+		bool IsCurrent() const { return generation == cache->mGeneration; }
+		// To pass to the proxy
+		CInternalResultHandler *Handler() { return MakeDelegate(this, &Call::Done); }
+		void Done(const CCloudResult *result) {
+			cache->PageFetched(result, this);
+			delete this;
+		}
+	};
+
+	void CLeaderboardCache::Page::Append(const Page &from, size_t index) {
+		ranks.push_back(from.ranks[index]);
+		scores.push_back(from.scores[index]);
+		timestamps.push_back(from.timestamps[index]);
+		gamers.push_back(from.gamers[index]);
+		profiles.push_back(from.profiles[index]);
+		infos.push_back(from.infos[index]);
+		extras.push_back(from.extras[index]);
+	}
+
+	CLeaderboardCache::CLeaderboardCache() : mTtlMs(0), mPrefetch(true), mGeneration(0) {}
+
+	CLeaderboardCache::~CLeaderboardCache() {
+		// Like the other callbacks at termination
+		for (std::map<cstring, std::list<CResultHandler*> >::iterator w = mWaiting.begin(); w != mWaiting.end(); ++w) {
+			for (std::list<CResultHandler*>::iterator it = w->second.begin(); it != w->second.end(); ++it) {
+				delete *it;
+			}
+		}
+	}
+
+	void CLeaderboardCache::Configure(const CHJSON *options) {
+		mTtlMs = options->GetInt("leaderboardCacheTTL") * 1000LL;
+		mPrefetch = options->GetBool("leaderboardPrefetch", true);
+	}
+
+	void CLeaderboardCache::Clear() {
+		mGeneration++;
+		mBoards.clear();
+		mStrings.clear();
+		mStringIndexes.clear();
+	}
+
+	void CLeaderboardCache::CheckGamer() {
+		const char *gamerId = CClannishRESTProxy::Instance()->GetGamerID();
+		// Centered and friends pages depend on the gamer
+		if (!IsEqual(mGamerId, gamerId)) {
+			Clear();
+			mGamerId = gamerId;
+		}
+	}
+
+	CLeaderboardCache::Board &CLeaderboardCache::BoardFor(Type type, const char *domain, const char *mode, int count) {
+		cstring key;
+		csprintf(key, "%s/%s/%s/%d", type == Friends ? "friends" : "best", domainName(domain), mode, count);
+		Board &board = mBoards[key];
+		if (!board.key) {
+			board.key = key;
+			board.type = type;
+			board.domain = domainName(domain);
+			board.mode = mode;
+			board.count = count;
+		}
+		return board;
+	}
+
+	void CLeaderboardCache::BestHighScore(int count, int page, const char *mode, const char *domain, CResultHandler *handler) {
+		CheckGamer();
+		Get(BoardFor(Best, domain, mode, count), page > 0 ? page : 1, handler);
+	}
+
+	void CLeaderboardCache::CenteredScore(int count, const char *mode, const char *domain, CResultHandler *handler) {
+		CheckGamer();
+		Get(BoardFor(Best, domain, mode, count), 0, handler);
+	}
+
+	void CLeaderboardCache::FriendsBestHighScore(int count, int page, const char *mode, const char *domain, CResultHandler *handler) {
+		CheckGamer();
+		Get(BoardFor(Friends, domain, mode, count), page > 0 ? page : 1, handler);
+	}
+
+	bool CLeaderboardCache::IsFresh(const Board &board, int page) const {
+		std::map<int, Page>::const_iterator it = board.pages.find(page);
+		return it != board.pages.end() && it->second.fetchedAt > 0 && MonotonicMilliseconds() - it->second.fetchedAt < mTtlMs;
+	}
+
+	void CLeaderboardCache::Get(Board &board, int page, CResultHandler *handler) {
+		// Page 0 is the one holding the score of the gamer
+		int known = page ? page : board.gamerPage;
+		if (known && IsFresh(board, known)) {
+			CCloudResult result(enNoErr, Build(board, known));
+			InvokeHandler(handler, &result);
+			return Prefetch(board, known);
+		}
+		Fetch(board, page, handler);
+	}
+
+	void CLeaderboardCache::Fetch(Board &board, int page, CResultHandler *handler) {
+		// A request made for a previous gamer doesn't do for the current one
+		cstring waitKey;
+		csprintf(waitKey, "%u/%s#%d", mGeneration, board.key.c_str(), page);
+		std::map<cstring, std::list<CResultHandler*> >::iterator waiting = mWaiting.find(waitKey);
+		// Already requested, the result will do for this one too
+		if (waiting != mWaiting.end()) {
+			if (handler) { waiting->second.push_back(handler); }
+			return;
+		}
+		std::list<CResultHandler*> &handlers = mWaiting[waitKey];
+		if (handler) { handlers.push_back(handler); }
+
+		CHJSON json;
+		json.Put("count", board.count);
+		json.Put("mode", board.mode.c_str());
+		json.Put("page", page);
+		json.Put("domain", board.domain.c_str());
+		Call *call = new Call(this, board, waitKey, page);
+		if (board.type == Friends) {
+			CClannishRESTProxy::Instance()->FriendsBestHighScore(&json, call->Handler());
+		} else if (page == 0) {
+			CClannishRESTProxy::Instance()->CenteredScore(&json, call->Handler());
+		} else {
+			CClannishRESTProxy::Instance()->BestHighScore(&json, call->Handler());
+		}
+	}
+
+	void CLeaderboardCache::Prefetch(Board &board, int page) {
+		if (!mPrefetch) {
+			return;
+		}
+		// The ones likely to be viewed next
+		if (page < board.maxPage && !IsFresh(board, page + 1)) {
+			Fetch(board, page + 1, NULL);
+		}
+		if (page > 1 && !IsFresh(board, page - 1)) {
+			Fetch(board, page - 1, NULL);
+		}
+	}
+
+	void CLeaderboardCache::PageFetched(const CCloudResult *result, Call *call) {
+		std::list<CResultHandler*> handlers;
+		std::map<cstring, std::list<CResultHandler*> >::iterator waiting = mWaiting.find(call->waitKey);
+		if (waiting != mWaiting.end()) {
+			handlers.swap(waiting->second);
+			mWaiting.erase(waiting);
+		}
+		// Only viewed pages lead to prefetching, not prefetched ones
+		bool viewed = !handlers.empty();
+		for (std::list<CResultHandler*>::iterator it = handlers.begin(); it != handlers.end(); ++it) {
+			InvokeHandler(*it, result);
+		}
+
+		const CHJSON *json = result->GetJSON()->Get(call->mode);
+		std::map<cstring, Board>::iterator board = mBoards.find(call->boardKey);
+		if (!call->IsCurrent() || result->GetErrorCode() != enNoErr || !json || board == mBoards.end()) {
+			return;
+		}
+		int page = call->page ? call->page : json->GetInt("page");
+		Store(board->second, page, json);
+		if (call->page == 0) {
+			board->second.gamerPage = page;
+		}
+		if (viewed) {
+			Prefetch(board->second, page);
+		}
+	}
+
+	int CLeaderboardCache::Intern(const char *value) {
+		if (!value) {
+			return -1;
+		}
+		std::map<cstring, int>::iterator it = mStringIndexes.find(value);
+		if (it != mStringIndexes.end()) {
+			return it->second;
+		}
+		int index = (int) mStrings.size();
+		mStrings.push_back(value);
+		mStringIndexes[value] = index;
+		return index;
+	}
+
+	void CLeaderboardCache::Store(Board &board, int page, const CHJSON *json) {
+		if (mStrings.size() > MAX_STRINGS) {
+			// Indexes are about to be reused
+			for (std::map<cstring, Board>::iterator it = mBoards.begin(); it != mBoards.end(); ++it) {
+				it->second.pages.clear();
+				it->second.gamerPage = 0;
+			}
+			mStrings.clear();
+			mStringIndexes.clear();
+		}
+
+		Page &dest = board.pages[page];
+		dest = Page();
+		dest.fetchedAt = MonotonicMilliseconds();
+		dest.rankOfFirst = json->GetInt("rankOfFirst", 1);
+		board.maxPage = json->GetInt("maxpage");
+		int gamer = mGamerId ? Intern(mGamerId) : -1;
+		const CHJSON *scores = json->GetSafe("scores");
+		for (CHJSON::Iterator it = scores->begin(); it != scores->end(); ++it) {
+			const CHJSON *score = (*it)->GetSafe("score");
+			dest.ranks.push_back((*it)->GetInt("rank"));
+			dest.scores.push_back(score->GetDouble("score"));
+			dest.timestamps.push_back(score->Has("timestamp") ? Intern(score->Get("timestamp")->print()) : -1);
+			dest.infos.push_back(Intern(score->GetString("info")));
+			dest.gamers.push_back(Intern((*it)->GetString("gamer_id")));
+			dest.profiles.push_back((*it)->Has("profile") ? Intern((*it)->Get("profile")->print()) : -1);
+			dest.extras.push_back(Intern(Extras(*it)));
+			if (dest.gamers.back() == gamer) {
+				board.gamerPage = page;
+			}
+		}
+	}
+
+	cstring CLeaderboardCache::Extras(const CHJSON *entry) {
+		CHJSON extras, *entryFields = new CHJSON, *scoreFields = new CHJSON;
+		for (CHJSON::Iterator it = entry->begin(); it != entry->end(); ++it) {
+			if (!IsEqual((*it)->name(), "gamer_id") && !IsEqual((*it)->name(), "profile") && !IsEqual((*it)->name(), "score") && !IsEqual((*it)->name(), "rank")) {
+				entryFields->Put((*it)->name(), (*it)->Duplicate());
+			}
+		}
+		const CHJSON *score = entry->GetSafe("score");
+		for (CHJSON::Iterator it = score->begin(); it != score->end(); ++it) {
+			if (!IsEqual((*it)->name(), "score") && !IsEqual((*it)->name(), "info") && !IsEqual((*it)->name(), "timestamp")) {
+				scoreFields->Put((*it)->name(), (*it)->Duplicate());
+			}
+		}
+		if (entryFields->size() == 0 && scoreFields->size() == 0) {
+			delete entryFields;
+			delete scoreFields;
+			return cstring();
+		}
+		extras.Put("entry", entryFields);
+		extras.Put("score", scoreFields);
+		return extras.print();
+	}
+
+	static void putFields(CHJSON *dest, const CHJSON *fields) {
+		for (CHJSON::Iterator it = fields->begin(); it != fields->end(); ++it) {
+			dest->Put((*it)->name(), (*it)->Duplicate());
+		}
+	}
+
+	CHJSON *CLeaderboardCache::Build(const Board &board, int page) const {
+		const Page &source = board.pages.find(page)->second;
+		CHJSON *json = new CHJSON, *content = new CHJSON, *scores = CHJSON::Array();
+		for (size_t i = 0; i < source.size(); i++) {
+			CHJSON *entry = new CHJSON, *score = new CHJSON;
+			owned_ref<CHJSON> extras (source.extras[i] >= 0 ? CHJSON::parse(String(source.extras[i])) : NULL);
+			entry->Put("gamer_id", String(source.gamers[i]));
+			if (source.profiles[i] >= 0) {
+				entry->Put("profile", CHJSON::parse(String(source.profiles[i])));
+			}
+			score->Put("score", source.scores[i]);
+			if (source.infos[i] >= 0) {
+				score->Put("info", String(source.infos[i]));
+			}
+			if (source.timestamps[i] >= 0) {
+				score->Put("timestamp", CHJSON::parse(String(source.timestamps[i])));
+			}
+			if (extras) {
+				putFields(score, extras->GetSafe("score"));
+			}
+			entry->Put("score", score);
+			entry->Put("rank", source.ranks[i]);
+			if (extras) {
+				putFields(entry, extras->GetSafe("entry"));
+			}
+			scores->Add(entry);
+		}
+		content->Put("maxpage", board.maxPage);
+		content->Put("page", page);
+		content->Put("rankOfFirst", source.rankOfFirst);
+		content->Put("scores", scores);
+		json->Put(board.mode, content);
+		return json;
+	}
+
+	void CLeaderboardCache::ScorePosted(const char *domain, const char *mode, long long score, const char *info, int rank) {
+		CheckGamer();
+		for (std::map<cstring, Board>::iterator it = mBoards.begin(); it != mBoards.end(); ++it) {
+			Board &board = it->second;
+			if (!IsEqual(board.domain, domainName(domain)) || !IsEqual(board.mode, mode)) {
+				continue;
+			}
+			if (board.type == Best && rank > 0) {
+				Splice(board, score, info, rank);
+			} else {
+				// Ranks among friends are not known
+				for (std::map<int, Page>::iterator page = board.pages.begin(); page != board.pages.end(); ++page) {
+					page->second.fetchedAt = 0;
+				}
+				board.gamerPage = 0;
+			}
+		}
+	}
+
+	cstring CLeaderboardCache::Now(const char *like) {
+		cstring now;
+		time_t seconds = time(NULL);
+		if (like && like[0] == '"') {
+			// ISO 8601, as in "2014-09-12T15:30:56.938Z"
+			char buffer[32];
+			strftime(buffer, sizeof(buffer), "\"%Y-%m-%dT%H:%M:%S.000Z\"", gmtime(&seconds));
+			now = buffer;
+		} else {
+			// Milliseconds since the epoch
+			csprintf(now, "%.0f", (double) seconds * 1000);
+		}
+		return now;
+	}
+
+	void CLeaderboardCache::Splice(Board &board, long long score, const char *info, int rank) {
+		int gamer = -1, oldPage = 0;
+		size_t oldIndex = 0;
+		if (mGamerId) {
+			std::map<cstring, int>::iterator interned = mStringIndexes.find(mGamerId);
+			if (interned != mStringIndexes.end()) {
+				gamer = interned->second;
+			}
+		}
+		for (std::map<int, Page>::iterator it = board.pages.begin(); gamer >= 0 && !oldPage && it != board.pages.end(); ++it) {
+			for (size_t i = 0; i < it->second.size(); i++) {
+				if (it->second.gamers[i] == gamer) {
+					oldPage = it->first;
+					oldIndex = i;
+					break;
+				}
+			}
+		}
+
+		// The pages between the previous score and the new one change; all of them must be known to move the score
+		int oldRank = oldPage ? board.pages[oldPage].ranks[oldIndex] : INT_MAX;
+		int firstPage = ((rank < oldRank ? rank : oldRank) - 1) / board.count + 1;
+		int lastPage = oldPage ? ((rank > oldRank ? rank : oldRank) - 1) / board.count + 1 : board.maxPage;
+		bool known = oldPage != 0;
+		for (int page = firstPage; known && page <= lastPage; page++) {
+			std::map<int, Page>::iterator it = board.pages.find(page);
+			known = it != board.pages.end() && it->second.size() == (size_t) board.count;
+		}
+		if (!known) {
+			CONSOLE_VERBOSE("Score of the gamer not spliced into %s, pages fetched again at the next view\n", board.key.c_str());
+			for (std::map<int, Page>::iterator it = board.pages.lower_bound(firstPage); it != board.pages.end() && it->first <= lastPage; ++it) {
+				it->second.fetchedAt = 0;
+			}
+			board.gamerPage = 0;
+			return;
+		}
+
+		// Flatten the pages without the previous score, add the new one at its rank, then split them again
+		const Page &previous = board.pages[oldPage];
+		Page entry;
+		entry.ranks.push_back(rank);
+		entry.scores.push_back((double) score);
+		entry.timestamps.push_back(Intern(Now(String(previous.timestamps[oldIndex]))));
+		entry.gamers.push_back(gamer);
+		entry.profiles.push_back(previous.profiles[oldIndex]);
+		entry.infos.push_back(Intern(info));
+		entry.extras.push_back(previous.extras[oldIndex]);
+
+		Page run;
+		size_t insertAt = rank - ((firstPage - 1) * board.count + 1);
+		for (int page = firstPage; page <= lastPage; page++) {
+			const Page &source = board.pages[page];
+			for (size_t i = 0; i < source.size(); i++) {
+				if (run.size() == insertAt) { run.Append(entry, 0); }
+				if (page != oldPage || i != oldIndex) { run.Append(source, i); }
+			}
+		}
+		if (run.size() == insertAt) { run.Append(entry, 0); }
+
+		size_t next = 0;
+		for (int page = firstPage; page <= lastPage; page++) {
+			Page &dest = board.pages[page];
+			Page rows;
+			rows.fetchedAt = dest.fetchedAt;
+			rows.rankOfFirst = dest.rankOfFirst;
+			for (int i = 0; i < board.count; i++, next++) {
+				rows.Append(run, next);
+				rows.ranks.back() = rows.rankOfFirst + i;
+			}
+			dest = rows;
+		}
+		board.gamerPage = (rank - 1) / board.count + 1;
+	}
+}
@@ -0,0 +1,108 @@
+//
+//  CLeaderboardCache.h
+//  CloudBuilder
+//
+//  Created by florian on 20/10/16.
+//  Copyright (c) 2016 Clan of the Cloud. All rights reserved.
+//
+
+#ifndef CloudBuilder_CLeaderboardCache_h
+#define CloudBuilder_CLeaderboardCache_h
+
+#include <map>
+#include <list>
+#include <vector>
+#include "CCallback.h"
+#include "helpers.h"
+
+namespace CloudBuilder {
+
+	/**
+	 * Pages of scores (CGameManager::BestHighScore and CenteredScore, CTribeManager::FriendsBestHighScore) kept in
+	 * memory, enabled with the "leaderboardCacheTTL" setup option. A page viewed again within the TTL is answered
+	 * locally, and the pages next to the one viewed are fetched in the background. A score of the gamer accepted by
+	 * the server is spliced into the cached pages when they hold the previous score of the gamer; the pages it
+	 * affects otherwise are fetched again at their next view.
+	 *
+	 * Pages are stored by column, the gamer ids, profiles, infos and timestamps being interned. Fields of the entries
+	 * not handled here are kept as they are, so that cached pages have the same form as those of the server. Meant
+	 * to be used from the thread running the callbacks, like the managers.
+	 */
+	class CLeaderboardCache {
+	public:
+		CLeaderboardCache();
+		~CLeaderboardCache();
+
+		/**
+		 * @param options setup options: leaderboardCacheTTL (s), leaderboardPrefetch
+		 */
+		void Configure(const CotCHelpers::CHJSON *options);
+		bool IsEnabled() const { return mTtlMs > 0; }
+
+		void BestHighScore(int count, int page, const char *mode, const char *domain, CResultHandler *handler);
+		void CenteredScore(int count, const char *mode, const char *domain, CResultHandler *handler);
+		void FriendsBestHighScore(int count, int page, const char *mode, const char *domain, CResultHandler *handler);
+		/**
+		 * Records a score of the gamer accepted by the server.
+		 * @param rank rank of the score, as answered by the server
+		 */
+		void ScorePosted(const char *domain, const char *mode, long long score, const char *info, int rank);
+
+	private:
+		enum Type { Best, Friends };
+		struct Page {
+			long long fetchedAt;
+			int rankOfFirst;
+			std::vector<int> ranks;
+			std::vector<double> scores;
+			// Indexes in mStrings; -1 for none. Profiles and timestamps are printed JSON, extras the other fields of
+			// the entry and of its score ({"entry": {...}, "score": {...}})
+			std::vector<int> gamers, profiles, infos, timestamps, extras;
+			Page() : fetchedAt(0), rankOfFirst(1) {}
+			size_t size() const { return ranks.size(); }
+			void Append(const Page &from, size_t index);
+		};
+		struct Board {
+			Type type;
+			CotCHelpers::cstring key, domain, mode;
+			int count, maxPage;
+			// Page holding the score of the gamer, 0 if unknown
+			int gamerPage;
+			std::map<int, Page> pages;
+			Board() : type(Best), count(0), maxPage(0), gamerPage(0) {}
+		};
+		struct Call;
+
+		long long mTtlMs;
+		bool mPrefetch;
+		// Incremented by Clear, so that the results of requests made before are ignored
+		unsigned mGeneration;
+		CotCHelpers::cstring mGamerId;
+		std::map<CotCHelpers::cstring, Board> mBoards;
+		// Handlers waiting for a page being fetched, by generation, board and page (0 for the page of the gamer)
+		std::map<CotCHelpers::cstring, std::list<CResultHandler*> > mWaiting;
+		std::vector<CotCHelpers::cstring> mStrings;
+		std::map<CotCHelpers::cstring, int> mStringIndexes;
+
+		void Clear();
+		void CheckGamer();
+		Board &BoardFor(Type type, const char *domain, const char *mode, int count);
+		void Get(Board &board, int page, CResultHandler *handler);
+		void Fetch(Board &board, int page, CResultHandler *handler);
+		void Prefetch(Board &board, int page);
+		bool IsFresh(const Board &board, int page) const;
+		int Intern(const char *value);
+		const char *String(int index) const { return index >= 0 ? mStrings[index].c_str() : NULL; }
+		void Store(Board &board, int page, const CotCHelpers::CHJSON *json);
+		CotCHelpers::CHJSON *Build(const Board &board, int page) const;
+		// Fields of an entry not stored in the other columns, as JSON; NULL if none
+		static CotCHelpers::cstring Extras(const CotCHelpers::CHJSON *entry);
+		// Timestamp of a score posted now, of the same form as another one (printed JSON)
+		static CotCHelpers::cstring Now(const char *like);
+		void Splice(Board &board, long long score, const char *info, int rank);
+
+		void PageFetched(const CCloudResult *result, Call *call);
+	};
+}
+
+#endif
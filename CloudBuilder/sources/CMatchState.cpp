@@ -0,0 +1,196 @@
+//
+//  CMatchState.cpp
+//  CloudBuilder
+//
+//  Created by florian on 20/10/16.
+//  Copyright (c) 2016 Clan of the Cloud. All rights reserved.
+//
+
+#include <algorithm>
+#include "CMatchState.h"
+#include "CloudBuilder_private.h"
+#include "CFilesystem.h"
+
+#define MATCH_PATH_PREFIX "cotcsystem/Match-"
+
+using namespace CotCHelpers;
+
+namespace CloudBuilder {
+
+	CMatchState::CMatchState() {
+		mPlayers <<= CHJSON::Array();
+	}
+
+	CMatchState::~CMatchState() {
+		for (size_t i = 0; i < mMoves.size(); i++) {
+			delete mMoves[i];
+		}
+	}
+
+	void CMatchState::Update(const CHJSON *match) {
+		if (match->Has("_id")) { mId = match->GetString("_id"); }
+		if (match->Has("domain")) { mDomain = match->GetString("domain"); }
+		if (match->Has("status")) { mStatus = match->GetString("status"); }
+		if (match->Has("creator")) { mCreatorId = match->GetSafe("creator")->GetString("gamer_id"); }
+		// May be 0 before the first event
+		if (match->Has("lastEventId")) { mLastEventId = match->GetString("lastEventId"); }
+
+		if (match->Has("players")) {
+			// Players are rarely changed, only those who joined or left are
+			std::set<cstring> current, left;
+			FOR_EACH (const CHJSON *player, *match->GetSafe("players")) {
+				current.insert(player->GetString("gamer_id", ""));
+				AddPlayer(player);
+			}
+			for (std::set<cstring>::iterator it = mPlayerIds.begin(); it != mPlayerIds.end(); ++it) {
+				if (current.find(*it) == current.end()) { left.insert(*it); }
+			}
+			RemovePlayers(left);
+		}
+
+		// Pending events of the match, some of which may be known already
+		FOR_EACH (const CHJSON *entry, *match->GetSafe("events")) {
+			const char *type = entry->GetString("type");
+			const CHJSON *event = entry->Has("event") ? entry->Get("event") : entry;
+			if ((!type || IsEqual(type, "match.move")) && event->Has("move")) {
+				AddMove(event);
+			}
+		}
+	}
+
+	bool CMatchState::Apply(const char *type, const CHJSON *event) {
+		mLastEventId = event->GetString("_id");
+		if (IsEqual(type, "match.join")) {
+			FOR_EACH (const CHJSON *player, *event->GetSafe("playersJoined")) {
+				AddPlayer(player);
+			}
+		} else if (IsEqual(type, "match.leave")) {
+			std::set<cstring> left;
+			FOR_EACH (const CHJSON *player, *event->GetSafe("playersLeft")) {
+				left.insert(player->GetString("gamer_id", ""));
+			}
+			RemovePlayers(left);
+		} else if (IsEqual(type, "match.finish")) {
+			mStatus = "finished";
+		} else if (IsEqual(type, "match.move")) {
+			// Echo of a move of the gamer, which was applied when queued
+			if (!mPending.empty() && IsEqual(event->GetString("player_id"), mPending.front()->GetString("player_id"))) {
+				MoveConfirmed(event->GetString("_id"));
+				return false;
+			}
+			return AddMove(event);
+		}
+		return true;
+	}
+
+	void CMatchState::MoveQueued(const char *gamerId, CHJSON *move) {
+		CHJSON *event = new CHJSON;
+		event->Put("player_id", gamerId);
+		event->Put("move", move);
+		mMoves.push_back(event);
+		mPending.push_back(event);
+	}
+
+	void CMatchState::MoveConfirmed(const char *eventId) {
+		if (mPending.empty() || (eventId && !mMoveIds.insert(eventId).second)) {
+			return;
+		}
+		if (eventId) { mPending.front()->Put("_id", eventId); }
+		mPending.pop_front();
+	}
+
+	void CMatchState::RollBackMoves(int kept) {
+		while (!mPending.empty() && (int) mPending.size() > kept) {
+			CHJSON *event = mPending.back();
+			mPending.pop_back();
+			mMoves.erase(std::find(mMoves.begin(), mMoves.end(), event));
+			delete event;
+		}
+	}
+
+	const CHJSON *CMatchState::Move(int index) const {
+		return index >= 0 && index < (int) mMoves.size() ? mMoves[index] : NULL;
+	}
+
+	void CMatchState::AddPlayer(const CHJSON *player) {
+		const char *gamerId = player->GetString("gamer_id", "");
+		if (mPlayerIds.insert(gamerId).second) {
+			mPlayers->Add(player->Duplicate());
+		}
+	}
+
+	void CMatchState::RemovePlayers(const std::set<cstring> &gamerIds) {
+		std::vector<int> indexes;
+		int index = 0;
+		FOR_EACH (const CHJSON *player, *mPlayers) {
+			if (gamerIds.find(player->GetString("gamer_id", "")) != gamerIds.end()) {
+				indexes.push_back(index);
+			}
+			index++;
+		}
+		// From the end, so that the indexes stay valid
+		for (int i = (int) indexes.size() - 1; i >= 0; i--) {
+			delete mPlayers->Extract(indexes[i]);
+		}
+		for (std::set<cstring>::const_iterator it = gamerIds.begin(); it != gamerIds.end(); ++it) {
+			mPlayerIds.erase(*it);
+		}
+	}
+
+	bool CMatchState::AddMove(const CHJSON *event) {
+		const char *eventId = event->GetString("_id");
+		if (eventId && !mMoveIds.insert(eventId).second) {
+			return false;
+		}
+		mMoves.push_back(event->Duplicate());
+		return true;
+	}
+
+	cstring &CMatchState::SavePath(cstring &dest) const {
+		return csprintf(dest, MATCH_PATH_PREFIX "%s.json", (const char*) mId);
+	}
+
+	void CMatchState::Save() const {
+		if (!mId) {
+			return;
+		}
+		cstring path;
+		if (IsEqual(mStatus, "finished") || mMoves.empty()) {
+			CFilesystemManager::Instance()->Delete(SavePath(path));
+			return;
+		}
+		CHJSON json, *moves = CHJSON::Array();
+		for (size_t i = 0; i < mMoves.size(); i++) {
+			// Pending moves have no ID, and are not known to the server yet
+			if (mMoves[i]->Has("_id")) { moves->Add(mMoves[i]->Duplicate()); }
+		}
+		json.Put("_id", mId.c_str());
+		json.Put("moves", moves);
+		CFilesystemManager::Instance()->WriteJson(SavePath(path), &json);
+	}
+
+	void CMatchState::Restore() {
+		if (!mId) {
+			return;
+		}
+		cstring path;
+		owned_ref<CHJSON> saved (CFilesystemManager::Instance()->ReadJson(SavePath(path)));
+		if (!saved || !IsEqual(saved->GetString("_id"), mId)) {
+			return;
+		}
+		// The saved moves come first; those still pending on the server are known already
+		owned_ref<CHJSON> moves (saved->Extract("moves"));
+		std::vector<CHJSON*> restored;
+		CHJSON *event;
+		while (moves && (event = moves->Extract(0))) {
+			const char *eventId = event->GetString("_id");
+			if (eventId && !mMoveIds.insert(eventId).second) {
+				delete event;
+				continue;
+			}
+			restored.push_back(event);
+		}
+		CONSOLE_VERBOSE("Restored %d moves of match %s\n", (int) restored.size(), (const char*) mId);
+		mMoves.insert(mMoves.begin(), restored.begin(), restored.end());
+	}
+}
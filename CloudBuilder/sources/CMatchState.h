@@ -0,0 +1,99 @@
+//
+//  CMatchState.h
+//  CloudBuilder
+//
+//  Created by florian on 20/10/16.
+//  Copyright (c) 2016 Clan of the Cloud. All rights reserved.
+//
+
+#ifndef CloudBuilder_CMatchState_h
+#define CloudBuilder_CMatchState_h
+
+#include <deque>
+#include <set>
+#include <vector>
+#include "CotCHelpers.h"
+#include "helpers.h"
+
+namespace CloudBuilder {
+
+	/**
+	 * State of a match as seen by a CMatch. Built from the match returned by the server, then updated in place with the
+	 * events received: players are indexed by gamer id and moves are appended to a log, so that only what changes is
+	 * copied. The log holds the moves known since the match was joined or fetched (the server drops the older ones when
+	 * a global state is posted) and can be saved to disk so that it survives CMatchManager::HLRestoreMatch.
+	 *
+	 * Moves of the gamer are logged as soon as they are queued, and stay pending until the server gives them an event
+	 * ID; their echoes are recognized and not applied twice.
+	 */
+	class CMatchState {
+	public:
+		CMatchState();
+		~CMatchState();
+
+		/**
+		 * Takes what changed from a match object returned by the server.
+		 */
+		void Update(const CotCHelpers::CHJSON *match);
+		/**
+		 * Applies the "event" node of a match event.
+		 * @param type type of the event, such as "match.move"
+		 * @return false if the event was known already (a move of the gamer, or one received twice)
+		 */
+		bool Apply(const char *type, const CotCHelpers::CHJSON *event);
+		/**
+		 * Logs a move of the gamer before it is posted, as pending.
+		 * @param move taken over
+		 */
+		void MoveQueued(const char *gamerId, CotCHelpers::CHJSON *move);
+		/**
+		 * Gives its event ID to the oldest pending move, unless its echo did already.
+		 */
+		void MoveConfirmed(const char *eventId);
+		/**
+		 * Removes the pending moves, newest first.
+		 * @param kept number of pending moves to keep (the oldest ones)
+		 */
+		void RollBackMoves(int kept);
+		/**
+		 * Overrides the last event ID, when events were received after the result carrying it.
+		 */
+		void SetLastEventId(const char *eventId) { mLastEventId = eventId; }
+
+		const char *Id() const { return mId; }
+		const char *Domain() const { return mDomain; }
+		const char *Status() const { return mStatus; }
+		const char *CreatorId() const { return mCreatorId; }
+		const char *LastEventId() const { return mLastEventId; }
+		const CotCHelpers::CHJSON *Players() const { return mPlayers; }
+		int MoveCount() const { return (int) mMoves.size(); }
+		int PendingMoveCount() const { return (int) mPending.size(); }
+		const CotCHelpers::CHJSON *Move(int index) const;
+
+		/**
+		 * Saves the state to disk, or removes the saved one once the match is finished.
+		 */
+		void Save() const;
+		/**
+		 * Puts the moves saved for this match before those known yet.
+		 */
+		void Restore();
+
+	private:
+		CotCHelpers::cstring mId, mDomain, mStatus, mCreatorId, mLastEventId;
+		owned_ref<CotCHelpers::CHJSON> mPlayers;
+		std::set<CotCHelpers::cstring> mPlayerIds;
+		// Events of type match.move ({_id, player_id, move}), owned
+		std::vector<CotCHelpers::CHJSON*> mMoves;
+		std::set<CotCHelpers::cstring> mMoveIds;
+		// Moves of the gamer in mMoves, without an ID yet, oldest first
+		std::deque<CotCHelpers::CHJSON*> mPending;
+
+		void AddPlayer(const CotCHelpers::CHJSON *player);
+		void RemovePlayers(const std::set<CotCHelpers::cstring> &gamerIds);
+		bool AddMove(const CotCHelpers::CHJSON *event);
+		CotCHelpers::cstring &SavePath(CotCHelpers::cstring &dest) const;
+	};
+}
+
+#endif
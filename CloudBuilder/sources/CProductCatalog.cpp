@@ -0,0 +1,187 @@
+//
+//  CProductCatalog.cpp
+//  CloudBuilder
+//
+//  Created by florian on 20/10/16.
+//  Copyright (c) 2016 Clan of the Cloud. All rights reserved.
+//
+
+#include "CProductCatalog.h"
+#include "CloudBuilder_private.h"
+#include "CClannishRESTProxy.h"
+#include "CClientContext_private.h"
+#include "CFilesystem.h"
+#include "CStoreGlue.h"
+#include "cotc_thread.h"
+
+#define CATALOG_PATH "cotcsystem/ProductCatalog.json"
+// Saved catalogs with another version are ignored
+#define CATALOG_VERSION 1
+
+using namespace CotCHelpers;
+
+namespace CloudBuilder {
+
+	static const char *savedNames[] = { "products", "information" };
+
+	/**
+	 * Result of a request for one of the lists. Not stored if the list has been dropped meanwhile.
+	 */
+	struct CProductCatalog::Call: CInternalResultHandler {
+		typedef void (CProductCatalog::*Method)(const CCloudResult*, Call*);
+		CProductCatalog *catalog;
+		Method method;
+		Kind kind;
+		unsigned generation;
+
+		Call(CProductCatalog *catalog, Method method, Kind kind)
+			: CInternalResultHandler(this, &Call::Done), catalog(catalog), method(method), kind(kind),
+			generation(catalog->mEntries[kind].generation) {}
+
+		bool IsCurrent() const { return generation == catalog->mEntries[kind].generation; }
+		void Done(const CCloudResult *result) {
+			(catalog->*method)(result, this);
+		}
+	};
+
+	CProductCatalog::CProductCatalog() : mTtlMs(0), mLoaded(false) {}
+
+	CProductCatalog::~CProductCatalog() {
+		// Like the other callbacks at termination
+		for (int kind = 0; kind < KindCount; kind++) {
+			std::list<CInternalResultHandler*> &waiting = mEntries[kind].waiting;
+			for (std::list<CInternalResultHandler*>::iterator it = waiting.begin(); it != waiting.end(); ++it) {
+				delete *it;
+			}
+		}
+	}
+
+	void CProductCatalog::Configure(const CHJSON *options) {
+		mTtlMs = options->GetInt("productCatalogTTL") * 1000LL;
+	}
+
+	void CProductCatalog::FetchProductInformation(CInternalResultHandler *handler) {
+		Get(Information, handler);
+	}
+
+	void CProductCatalog::GetProductList(CInternalResultHandler *handler) {
+		Get(Products, handler);
+	}
+
+	void CProductCatalog::GetPurchaseHistory(CInternalResultHandler *handler) {
+		CheckGamer();
+		Get(History, handler);
+	}
+
+	void CProductCatalog::PurchaseAttempted() {
+		Drop(History);
+	}
+
+	void CProductCatalog::Get(Kind kind, CInternalResultHandler *handler) {
+		Load();
+		Entry &entry = mEntries[kind];
+		bool fresh = entry.json && !entry.saved && MonotonicMilliseconds() - entry.fetchedAt < mTtlMs;
+		// The saved information is good enough for a store screen, until the new one arrives
+		if (fresh || (entry.json && entry.saved && kind == Information)) {
+			if (!fresh) { Fetch(kind); }
+			CCloudResult result(enNoErr, entry.json->Duplicate());
+			return InvokeHandler(handler, &result);
+		}
+		entry.waiting.push_back(handler);
+		Fetch(kind);
+	}
+
+	void CProductCatalog::Fetch(Kind kind) {
+		Entry &entry = mEntries[kind];
+		if (entry.fetching) {
+			return;
+		}
+		entry.fetching = true;
+		CHJSON config;
+		switch (kind) {
+			case Products:
+				return CClannishRESTProxy::Instance()->GetProductList(&config, new Call(this, &CProductCatalog::Fetched, Products));
+			case Information:
+				// Completed by the platform store
+				return Get(Products, new Call(this, &CProductCatalog::ProductsListed, Information));
+			default:
+				return CClannishRESTProxy::Instance()->GetPurchaseHistory(&config, new Call(this, &CProductCatalog::Fetched, History));
+		}
+	}
+
+	void CProductCatalog::Drop(Kind kind) {
+		Entry &entry = mEntries[kind];
+		entry.generation++;
+		entry.json <<= NULL;
+		entry.saved = false;
+	}
+
+	void CProductCatalog::CheckGamer() {
+		const char *gamerId = CClannishRESTProxy::Instance()->GetGamerID();
+		if (!IsEqual(mGamerId, gamerId)) {
+			Drop(History);
+			mGamerId = gamerId;
+		}
+	}
+
+	void CProductCatalog::ProductsListed(const CCloudResult *result, Call *call) {
+		if (result->GetErrorCode() != enNoErr) {
+			return Fetched(result, call);
+		}
+		CStoreGlue::Instance()->GetInformationAboutProducts(result->GetJSON()->GetSafe("products"),
+			new Call(this, &CProductCatalog::Fetched, Information));
+	}
+
+	void CProductCatalog::Fetched(const CCloudResult *result, Call *call) {
+		Entry &entry = mEntries[call->kind];
+		entry.fetching = false;
+		if (!call->IsCurrent()) {
+			// Those waiting may have asked after the list was dropped
+			if (!entry.waiting.empty()) { Fetch(call->kind); }
+			return;
+		}
+		if (result->GetErrorCode() == enNoErr) {
+			entry.json <<= result->GetJSON()->Duplicate();
+			entry.fetchedAt = MonotonicMilliseconds();
+			entry.saved = false;
+			if (call->kind != History) { Save(); }
+		}
+		std::list<CInternalResultHandler*> waiting;
+		waiting.swap(entry.waiting);
+		for (std::list<CInternalResultHandler*>::iterator it = waiting.begin(); it != waiting.end(); ++it) {
+			InvokeHandler(*it, result);
+		}
+	}
+
+	void CProductCatalog::Load() {
+		// Only the app's own context uses the disk, like the saved session
+		if (mLoaded || !CClientContext::Current()->IsDefault()) {
+			return;
+		}
+		mLoaded = true;
+		owned_ref<CHJSON> saved (CFilesystemManager::Instance()->ReadJson(CATALOG_PATH));
+		if (!saved || saved->GetInt("version") != CATALOG_VERSION) {
+			return;
+		}
+		for (int kind = Products; kind <= Information; kind++) {
+			const CHJSON *json = saved->Get(savedNames[kind]);
+			if (json && !mEntries[kind].json) {
+				mEntries[kind].json <<= json->Duplicate();
+				mEntries[kind].saved = true;
+			}
+		}
+		CONSOLE_VERBOSE("Loaded the product catalog saved before\n");
+	}
+
+	void CProductCatalog::Save() {
+		if (!CClientContext::Current()->IsDefault()) {
+			return;
+		}
+		CHJSON json;
+		json.Put("version", CATALOG_VERSION);
+		for (int kind = Products; kind <= Information; kind++) {
+			json.Put(savedNames[kind], (const CHJSON*) mEntries[kind].json);
+		}
+		CFilesystemManager::Instance()->WriteJson(CATALOG_PATH, &json);
+	}
+}
@@ -0,0 +1,85 @@
+//
+//  CProductCatalog.h
+//  CloudBuilder
+//
+//  Created by florian on 20/10/16.
+//  Copyright (c) 2016 Clan of the Cloud. All rights reserved.
+//
+
+#ifndef CloudBuilder_CProductCatalog_h
+#define CloudBuilder_CProductCatalog_h
+
+#include <list>
+#include "CCallback.h"
+#include "helpers.h"
+
+namespace CloudBuilder {
+
+	/**
+	 * Products of the store and purchase history kept in memory, enabled with the "productCatalogTTL" setup option.
+	 * Each list is fetched at most once per TTL, callers asking for it meanwhile waiting for the same request rather
+	 * than being refused. The product information (products configured on the server, completed by the platform
+	 * store) is also saved to disk by the default context: at the next start, it is answered at once from there
+	 * while being fetched again in the background.
+	 *
+	 * The purchase history is dropped when a purchase is attempted and when the gamer changes. Meant to be used from
+	 * the thread running the callbacks, like the managers.
+	 */
+	class CProductCatalog {
+	public:
+		CProductCatalog();
+		~CProductCatalog();
+
+		/**
+		 * @param options setup options: productCatalogTTL (s)
+		 */
+		void Configure(const CotCHelpers::CHJSON *options);
+		bool IsEnabled() const { return mTtlMs > 0; }
+
+		/**
+		 * Same as CStoreManager::FetchProductInformation.
+		 */
+		void FetchProductInformation(CInternalResultHandler *handler);
+		/**
+		 * Same as CClannishRESTProxy::GetProductList: {products: [...]} as configured on the server.
+		 */
+		void GetProductList(CInternalResultHandler *handler);
+		void GetPurchaseHistory(CInternalResultHandler *handler);
+		/**
+		 * To be called when a purchase has been attempted, whatever the result.
+		 */
+		void PurchaseAttempted();
+
+	private:
+		enum Kind { Products, Information, History, KindCount };
+		struct Entry {
+			owned_ref<CotCHelpers::CHJSON> json;
+			long long fetchedAt;
+			// Loaded from the disk, to be fetched again
+			bool saved;
+			bool fetching;
+			// Incremented when dropped, so that a request made before isn't stored
+			unsigned generation;
+			std::list<CInternalResultHandler*> waiting;
+			Entry() : fetchedAt(0), saved(false), fetching(false), generation(0) {}
+		};
+		struct Call;
+
+		long long mTtlMs;
+		bool mLoaded;
+		CotCHelpers::cstring mGamerId;
+		Entry mEntries[KindCount];
+
+		void Get(Kind kind, CInternalResultHandler *handler);
+		void Fetch(Kind kind);
+		void Drop(Kind kind);
+		void CheckGamer();
+		void Load();
+		void Save();
+
+		void ProductsListed(const CCloudResult *result, Call *call);
+		void Fetched(const CCloudResult *result, Call *call);
+	};
+}
+
+#endif
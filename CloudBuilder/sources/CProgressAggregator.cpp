@@ -0,0 +1,264 @@
+//
+//  CProgressAggregator.cpp
+//  CloudBuilder
+//
+//  Created by florian on 20/10/16.
+//  Copyright (c) 2016 Clan of the Cloud. All rights reserved.
+//
+
+#include <string.h>
+#include "CProgressAggregator.h"
+#include "CloudBuilder_private.h"
+#include "CClannishRESTProxy.h"
+
+using namespace CotCHelpers;
+
+namespace CloudBuilder {
+
+	static const char *domainName(const char *domain) {
+		return (domain && domain[0]) ? domain : "private";
+	}
+
+	static cstring &scoreKey(cstring &dest, const char *domain, const char *mode) {
+		return csprintf(dest, "%s/%s", domainName(domain), mode);
+	}
+
+	// Result of a score which was not sent because a better one is known
+	static void answerNotBest(CResultHandler *handler) {
+		CHJSON *json = new CHJSON;
+		json->Put("done", 0);
+		CCloudResult result(enNoErr, json);
+		InvokeHandler(handler, &result);
+	}
+
+	/**
+	 * Request made by the aggregator, deleted once its result has been processed. Known scores are not updated if
+	 * the gamer has changed meanwhile.
+	 */
+	struct CProgressAggregator::Call {
+		typedef void (CProgressAggregator::*Method)(const CCloudResult*, Call*);
+		CProgressAggregator *aggregator;
+		Method method;
+		unsigned generation;
+		cstring domain, mode, order;
+		long long score;
+		// Handlers of all the increments carried by a transaction; a single one otherwise
+		std::list<CResultHandler*> *handlers;
+		CResultHandler *handler;
+
+		Call(CProgressAggregator *aggregator, Method method, CResultHandler *handler)
+			: aggregator(aggregator), method(method), generation(aggregator->mGeneration),
+			score(0), handlers(NULL), handler(handler) {}
+		~Call() { delete handlers; }
+
+		bool IsCurrent() const { return generation == aggregator->mGeneration; }
+		// To pass to the proxy
+		CInternalResultHandler *Handler() { return MakeDelegate(this, &Call::Done); }
+		void Done(const CCloudResult *result) {
+			(aggregator->*method)(result, this);
+			delete this;
+		}
+	};
+
+	CProgressAggregator::CProgressAggregator() : mEnabled(false), mGeneration(0), mFlushDelayMs(5000), mThreshold(50), mPendingCount(0) {}
+
+	CProgressAggregator::~CProgressAggregator() {
+		CancelScheduledFlush();
+		// Like the other callbacks at termination
+		for (std::list<CResultHandler*>::iterator it = mIncrementHandlers.begin(); it != mIncrementHandlers.end(); ++it) {
+			delete *it;
+		}
+		for (PendingScores::iterator it = mScores.begin(); it != mScores.end(); ++it) {
+			delete it->second.handler;
+		}
+	}
+
+	void CProgressAggregator::Configure(const CHJSON *options) {
+		mEnabled = options->GetBool("aggregateProgress");
+		mFlushDelayMs = options->GetInt("aggregateProgressDelay", 5000);
+		mThreshold = options->GetInt("aggregateProgressThreshold", 50);
+	}
+
+	void CProgressAggregator::Clear() {
+		CancelScheduledFlush();
+		mGeneration++;
+		mPendingCount = 0;
+		mIncrements.clear();
+		mBestScores.clear();
+		while (!mIncrementHandlers.empty()) {
+			CResultHandler *handler = mIncrementHandlers.front();
+			mIncrementHandlers.pop_front();
+			InvokeHandler(handler, enNotLogged);
+		}
+		PendingScores scores;
+		scores.swap(mScores);
+		for (PendingScores::iterator it = scores.begin(); it != scores.end(); ++it) {
+			InvokeHandler(it->second.handler, enNotLogged);
+		}
+	}
+
+	void CProgressAggregator::EarnAchievement(const char *unit, int increment, CResultHandler *handler) {
+		mIncrements[unit] += increment;
+		if (handler) {
+			mIncrementHandlers.push_back(handler);
+		}
+		Held();
+	}
+
+	bool CProgressAggregator::IsBetter(long long score, long long than, const char *order) {
+		return IsEqual(order, "lowtohigh") ? score < than : score > than;
+	}
+
+	void CProgressAggregator::Score(long long score, const char *mode, const char *order, const char *info, const char *domain, CResultHandler *handler) {
+		cstring key;
+		scoreKey(key, domain, mode);
+		std::map<cstring, BestScore>::iterator best = mBestScores.find(key);
+		if (best != mBestScores.end() && IsEqual(best->second.order, order) && !IsBetter(score, best->second.score, order)) {
+			return answerNotBest(handler);
+		}
+
+		PendingScores::iterator pending = mScores.find(key);
+		if (pending != mScores.end()) {
+			if (!IsEqual(pending->second.order, order)) {
+				// Not comparable, the previous one goes first
+				Flush();
+			} else if (!IsBetter(score, pending->second.score, order)) {
+				return answerNotBest(handler);
+			} else {
+				// Replaced by this one
+				answerNotBest(pending->second.handler);
+				mScores.erase(pending);
+			}
+		}
+		PendingScore &entry = mScores[key];
+		entry.score = score;
+		entry.order = order;
+		entry.info = info;
+		entry.handler = handler;
+		Held();
+	}
+
+	void CProgressAggregator::ForgetBestScore(const char *domain, const char *mode) {
+		cstring key;
+		mBestScores.erase(scoreKey(key, domain, mode));
+	}
+
+	void CProgressAggregator::UserBestScores(const char *domain, CResultHandler *handler) {
+		Call *call = new Call(this, &CProgressAggregator::BestScoresRead, handler);
+		call->domain = domainName(domain);
+		CClannishRESTProxy::Instance()->UserBestScore(call->domain, call->Handler());
+	}
+
+	void CProgressAggregator::BestScoresRead(const CCloudResult *result, Call *call) {
+		if (call->IsCurrent() && result->GetErrorCode() == enNoErr) {
+			const CHJSON *modes = result->GetJSON();
+			for (CHJSON::Iterator it = modes->begin(); it != modes->end(); ++it) {
+				if ((*it)->name()[0] == '_' || !(*it)->Has("score")) {
+					continue;
+				}
+				cstring key;
+				BestScore &best = mBestScores[scoreKey(key, call->domain, (*it)->name())];
+				best.score = (long long) (*it)->GetDouble("score");
+				best.order = (*it)->GetString("order");
+			}
+		}
+		InvokeHandler(call->handler, result);
+	}
+
+	void CProgressAggregator::Held() {
+		if (++mPendingCount >= mThreshold) {
+			return Flush();
+		}
+		ScheduleFlush();
+	}
+
+	void CProgressAggregator::ScheduleFlush() {
+		if (mFlushDelayMs <= 0) {
+			return Flush();
+		}
+		if (mTimer && !mTimer->HasFinished()) {
+			return;
+		}
+		mTimer <<= new CCallbackTimer(MakeDelegate(this, &CProgressAggregator::TimerElapsed));
+		mTimer->Start(mFlushDelayMs);
+	}
+
+	void CProgressAggregator::CancelScheduledFlush() {
+		if (mTimer) {
+			mTimer->Cancel();
+			mTimer <<= NULL;
+		}
+	}
+
+	void CProgressAggregator::TimerElapsed(const CCloudResult *result) {
+		Flush();
+	}
+
+	void CProgressAggregator::Flush() {
+		CancelScheduledFlush();
+		mPendingCount = 0;
+
+		// All the units in one transaction, as EarnAchievement would have done for each of them
+		if (!mIncrements.empty() || !mIncrementHandlers.empty()) {
+			Call *call = new Call(this, &CProgressAggregator::TransactionDone, NULL);
+			call->handlers = new std::list<CResultHandler*>;
+			call->handlers->swap(mIncrementHandlers);
+			CHJSON config, *tx = new CHJSON;
+			cstring desc ("Earned achievement");
+			for (std::map<cstring, int>::iterator it = mIncrements.begin(); it != mIncrements.end(); ++it) {
+				if (it->second != 0) {
+					tx->Put(it->first, it->second);
+					csprintf(desc, "%s%s %s by %d", desc.c_str(), tx->size() > 1 ? "," : "", it->first.c_str(), it->second);
+				}
+			}
+			mIncrements.clear();
+			if (tx->size() == 0) {
+				// Increments cancelling each other
+				delete tx;
+				InvokeHandler(call->Handler(), enNoErr);
+			} else {
+				CONSOLE_VERBOSE("Sending %d aggregated achievement increments\n", (int) call->handlers->size());
+				config.Put("transaction", tx);
+				config.Put("description", desc.c_str());
+				CClannishRESTProxy::Instance()->Transaction(&config, true, call->Handler());
+			}
+		}
+
+		PendingScores scores;
+		scores.swap(mScores);
+		for (PendingScores::iterator it = scores.begin(); it != scores.end(); ++it) {
+			const char *separator = strchr(it->first, '/');
+			Call *call = new Call(this, &CProgressAggregator::ScoreDone, it->second.handler);
+			csprintf(call->domain, "%.*s", (int) (separator - it->first.c_str()), it->first.c_str());
+			call->mode = separator + 1;
+			call->order = it->second.order;
+			call->score = it->second.score;
+			CHJSON json;
+			json.Put("score", (double) call->score);
+			json.Put("mode", call->mode.c_str());
+			json.Put("order", call->order.c_str());
+			json.Put("domain", call->domain.c_str());
+			if (it->second.info) {
+				json.Put("info", it->second.info.c_str());
+			}
+			CClannishRESTProxy::Instance()->Score(&json, call->Handler());
+		}
+	}
+
+	void CProgressAggregator::TransactionDone(const CCloudResult *result, Call *call) {
+		for (std::list<CResultHandler*>::iterator it = call->handlers->begin(); it != call->handlers->end(); ++it) {
+			InvokeHandler(*it, result);
+		}
+	}
+
+	void CProgressAggregator::ScoreDone(const CCloudResult *result, Call *call) {
+		if (call->IsCurrent() && result->GetErrorCode() == enNoErr &&
+			(result->GetJSON()->GetInt("done") || result->GetJSON()->GetBool("done"))) {
+			cstring key;
+			BestScore &best = mBestScores[scoreKey(key, call->domain, call->mode)];
+			best.score = call->score;
+			best.order = call->order;
+		}
+		InvokeHandler(call->handler, result);
+	}
+}
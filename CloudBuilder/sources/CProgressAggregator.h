@@ -0,0 +1,103 @@
+//
+//  CProgressAggregator.h
+//  CloudBuilder
+//
+//  Created by florian on 20/10/16.
+//  Copyright (c) 2016 Clan of the Cloud. All rights reserved.
+//
+
+#ifndef CloudBuilder_CProgressAggregator_h
+#define CloudBuilder_CProgressAggregator_h
+
+#include <map>
+#include <list>
+#include "CCallback.h"
+#include "helpers.h"
+
+namespace CloudBuilder {
+
+	/**
+	 * Holds the progress of the gamer (CUserManager::EarnAchievement and CGameManager::Score) for a while, enabled
+	 * with the "aggregateProgress" setup option. Achievement increments are summed per unit and sent as a single
+	 * transaction; of the scores posted to a mode, only the best is sent. Pending progress is sent when the delay
+	 * elapses, when enough of it has piled up, and on suspension or logout.
+	 *
+	 * The best score of the gamer for each mode is remembered once known (from CGameManager::UserBestScores or
+	 * from a score accepted by the server), so that scores which can't beat it are answered without a request.
+	 * Meant to be used from the thread running the callbacks, like the managers.
+	 */
+	class CProgressAggregator {
+	public:
+		CProgressAggregator();
+		~CProgressAggregator();
+
+		/**
+		 * @param options setup options: aggregateProgress, aggregateProgressDelay (ms), aggregateProgressThreshold
+		 */
+		void Configure(const CotCHelpers::CHJSON *options);
+		bool IsEnabled() const { return mEnabled; }
+		/**
+		 * Forgets everything, as when another gamer logs in. Pending progress is dropped, with enNotLogged.
+		 */
+		void Clear();
+
+		/**
+		 * @param handler called with the result of the transaction carrying the increment
+		 */
+		void EarnAchievement(const char *unit, int increment, CResultHandler *handler);
+		/**
+		 * Same parameters as CGameManager::Score, mayVary excepted (such scores are not to be aggregated).
+		 */
+		void Score(long long score, const char *mode, const char *order, const char *info, const char *domain, CResultHandler *handler);
+		/**
+		 * Forgets the best score known for a mode, e.g. when a score is forced.
+		 */
+		void ForgetBestScore(const char *domain, const char *mode);
+		void UserBestScores(const char *domain, CResultHandler *handler);
+		/**
+		 * Sends the pending progress now.
+		 */
+		void Flush();
+		/**
+		 * Ends the wait of the flush timer, so that the tasks of the context can be drained.
+		 */
+		void CancelScheduledFlush();
+
+	private:
+		struct PendingScore {
+			long long score;
+			CotCHelpers::cstring order, info;
+			CResultHandler *handler;
+		};
+		struct BestScore {
+			long long score;
+			CotCHelpers::cstring order;
+		};
+		// By domain and mode, separated with a '/'
+		typedef std::map<CotCHelpers::cstring, PendingScore> PendingScores;
+		struct Call;
+
+		bool mEnabled;
+		// Incremented by Clear, so that the results of requests made for a previous gamer are ignored
+		unsigned mGeneration;
+		int mFlushDelayMs, mThreshold;
+		// Number of calls held since the last flush
+		int mPendingCount;
+		std::map<CotCHelpers::cstring, int> mIncrements;
+		std::list<CResultHandler*> mIncrementHandlers;
+		PendingScores mScores;
+		std::map<CotCHelpers::cstring, BestScore> mBestScores;
+		autoref<CCallbackTimer> mTimer;
+
+		void Held();
+		void ScheduleFlush();
+		static bool IsBetter(long long score, long long than, const char *order);
+
+		void TransactionDone(const CCloudResult *result, Call *call);
+		void ScoreDone(const CCloudResult *result, Call *call);
+		void BestScoresRead(const CCloudResult *result, Call *call);
+		void TimerElapsed(const CCloudResult *result);
+	};
+}
+
+#endif
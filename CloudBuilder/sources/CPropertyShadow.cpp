@@ -0,0 +1,314 @@
+//
+//  CPropertyShadow.cpp
+//  CloudBuilder
+//
+//  Created by florian on 20/10/16.
+//  Copyright (c) 2016 Clan of the Cloud. All rights reserved.
+//
+
+#include <vector>
+#include "CPropertyShadow.h"
+#include "CloudBuilder_private.h"
+#include "CClannishRESTProxy.h"
+
+// Beyond that many changed keys, sending the whole object at once is cheaper
+#define MAX_DELTA_REQUESTS 4
+
+using namespace CotCHelpers;
+
+namespace CloudBuilder {
+
+	static const char *domainName(const char *domain) {
+		return (domain && domain[0]) ? domain : "private";
+	}
+
+	/**
+	 * Set of per-key requests standing for a SetProperties. The handler gets the result once all of them are done.
+	 */
+	struct CPropertyShadow::DeltaCall {
+		int pending;
+		owned_ref<CHJSON> properties;
+		owned_ref<CCloudResult> error;
+		CResultHandler *handler;
+		DeltaCall(CHJSON *properties, CResultHandler *handler) : pending(0), properties(properties), handler(handler) {}
+	};
+
+	/**
+	 * Result of a request. The shadow isn't updated if the gamer has changed meanwhile.
+	 */
+	struct CPropertyShadow::Call {
+		typedef void (CPropertyShadow::*Method)(const CCloudResult*, Call*);
+		CPropertyShadow *shadow;
+		Method method;
+		unsigned generation;
+		cstring domain, key;
+		// What was sent, recorded once acknowledged
+		owned_ref<CHJSON> sent;
+		CResultHandler *handler;
+		DeltaCall *delta;
+
+		Call(CPropertyShadow *shadow, Method method, const char *domain, CResultHandler *handler)
+			: shadow(shadow), method(method), generation(shadow->mGeneration),
+			domain(domain), handler(handler), delta(NULL) {
+			shadow->mPending[PendingKey()]++;
+		}
+
+		bool IsCurrent() const { return generation == shadow->mGeneration; }
+		// The profile is counted under an empty domain
+		const char *PendingKey() const { return domain ? domain.c_str() : ""; }
+		// To pass to the proxy
+		CInternalResultHandler *Handler() { return MakeDelegate(this, &Call::Done); }
+		void Done(const CCloudResult *result) {
+			if (IsCurrent() && --shadow->mPending[PendingKey()] == 0) {
+				shadow->mPending.erase(PendingKey());
+			}
+			(shadow->*method)(result, this);
+			delete this;
+		}
+	};
+
+	CPropertyShadow::CPropertyShadow() : mEnabled(false), mGeneration(0) {}
+
+	CPropertyShadow::~CPropertyShadow() {}
+
+	void CPropertyShadow::Configure(const CHJSON *options) {
+		mEnabled = options->GetBool("deltaUpdates");
+	}
+
+	void CPropertyShadow::Clear() {
+		mGeneration++;
+		mProperties.clear();
+		mProfile.clear();
+		mPending.clear();
+	}
+
+	bool CPropertyShadow::IsPending(const char *domain) const {
+		return mPending.find(domain ? domain : "") != mPending.end();
+	}
+
+	void CPropertyShadow::Record(Values &dest, const CHJSON *values) {
+		for (CHJSON::Iterator it = values->begin(); it != values->end(); ++it) {
+			const char *key = (*it)->name();
+			// Not part of the data (_error and co.)
+			if (key && key[0] != '_') {
+				dest[key] = (*it)->print();
+			}
+		}
+	}
+
+	void CPropertyShadow::GetProperties(const char *domain, CResultHandler *handler) {
+		CClannishRESTProxy::Instance()->UserGetProperties(domainName(domain), (new Call(this, &CPropertyShadow::PropertiesRead, domainName(domain), handler))->Handler());
+	}
+
+	void CPropertyShadow::PropertiesRead(const CCloudResult *result, Call *call) {
+		if (call->IsCurrent() && result->GetErrorCode() == enNoErr) {
+			Values &known = mProperties[call->domain];
+			known.clear();
+			Record(known, result->GetJSON()->GetSafe("properties"));
+		}
+		InvokeHandler(call->handler, result);
+	}
+
+	void CPropertyShadow::SetProperties(const char *domain, CHJSON *properties, CResultHandler *handler) {
+		owned_ref<CHJSON> owned (properties);
+		std::map<cstring, Values>::iterator known = mProperties.find(domainName(domain));
+		// Unknown yet, or about to be changed by the requests in progress: the whole object must be sent
+		if (known == mProperties.end() || IsPending(domainName(domain))) {
+			Call *call = new Call(this, &CPropertyShadow::PropertiesSet, domainName(domain), handler);
+			call->sent <<= owned.detachOwnership();
+			return CClannishRESTProxy::Instance()->UserSetProperties(call->domain, (const CHJSON*) call->sent, call->Handler());
+		}
+
+		// Compare with what the server has, in one pass over each side
+		Values next;
+		std::vector<const CHJSON*> changed;
+		std::vector<cstring> removed;
+		for (CHJSON::Iterator it = owned->begin(); it != owned->end(); ++it) {
+			cstring &value = next[(*it)->name()];
+			value = (*it)->print();
+			Values::iterator previous = known->second.find((*it)->name());
+			if (previous == known->second.end() || !IsEqual(previous->second, value)) {
+				changed.push_back(*it);
+			}
+		}
+		for (Values::iterator it = known->second.begin(); it != known->second.end(); ++it) {
+			if (next.find(it->first) == next.end()) {
+				removed.push_back(it->first);
+			}
+		}
+
+		size_t changeCount = changed.size() + removed.size();
+		if (changeCount == 0) {
+			CHJSON *json = new CHJSON;
+			json->Put("properties", owned.detachOwnership());
+			CCloudResult result(enNoErr, json);
+			return InvokeHandler(handler, &result);
+		}
+		if (changeCount > MAX_DELTA_REQUESTS || changeCount >= next.size()) {
+			Call *call = new Call(this, &CPropertyShadow::PropertiesSet, domainName(domain), handler);
+			call->sent <<= owned.detachOwnership();
+			return CClannishRESTProxy::Instance()->UserSetProperties(call->domain, (const CHJSON*) call->sent, call->Handler());
+		}
+
+		CONSOLE_VERBOSE("Sending %d changed properties out of %d\n", (int) changeCount, (int) next.size());
+		// The views in changed belong to it; owned before the requests, which may be answered at once
+		DeltaCall *delta = new DeltaCall(owned.detachOwnership(), handler);
+		delta->pending = (int) changeCount;
+		for (size_t i = 0; i < changed.size(); i++) {
+			Call *call = new Call(this, &CPropertyShadow::DeltaPartDone, domainName(domain), NULL);
+			call->delta = delta;
+			call->key = changed[i]->name();
+			CHJSON property;
+			property.Put("key", changed[i]->name());
+			property.Put("value", changed[i]->Duplicate());
+			CClannishRESTProxy::Instance()->UserSetProperty(call->domain, std::move(property), call->Handler());
+		}
+		for (size_t i = 0; i < removed.size(); i++) {
+			Call *call = new Call(this, &CPropertyShadow::DeltaPartDone, domainName(domain), NULL);
+			call->delta = delta;
+			call->key = removed[i];
+			CClannishRESTProxy::Instance()->UserDelProperty(call->domain, removed[i], call->Handler());
+		}
+	}
+
+	void CPropertyShadow::PropertiesSet(const CCloudResult *result, Call *call) {
+		if (call->IsCurrent()) {
+			if (result->GetErrorCode() == enNoErr) {
+				Values &known = mProperties[call->domain];
+				known.clear();
+				Record(known, call->sent);
+			} else {
+				mProperties.erase(call->domain);
+			}
+		}
+		InvokeHandler(call->handler, result);
+	}
+
+	void CPropertyShadow::DeltaPartDone(const CCloudResult *result, Call *call) {
+		DeltaCall *delta = call->delta;
+		if (result->GetErrorCode() != enNoErr && !delta->error) {
+			delta->error <<= result->Duplicate();
+		}
+		if (--delta->pending > 0) {
+			return;
+		}
+
+		if (call->IsCurrent()) {
+			if (delta->error) {
+				// Partly applied
+				mProperties.erase(call->domain);
+			} else {
+				Values &known = mProperties[call->domain];
+				known.clear();
+				Record(known, delta->properties);
+			}
+		}
+		if (delta->error) {
+			InvokeHandler(delta->handler, delta->error);
+		} else {
+			CHJSON *json = new CHJSON;
+			json->Put("properties", delta->properties.detachOwnership());
+			CCloudResult merged(enNoErr, json);
+			InvokeHandler(delta->handler, &merged);
+		}
+		delete delta;
+	}
+
+	void CPropertyShadow::SetProperty(const char *domain, CHJSON *property, CResultHandler *handler) {
+		std::map<cstring, Values>::iterator known = mProperties.find(domainName(domain));
+		// The requests in progress may still change it
+		if (known != mProperties.end() && !IsPending(domainName(domain))) {
+			Values::iterator previous = known->second.find(property->GetString("key"));
+			if (previous != known->second.end() && IsEqual(previous->second, property->GetSafe("value")->print())) {
+				CHJSON *properties = new CHJSON, *json = new CHJSON;
+				properties->Put(property->GetString("key"), property->Get("value"));
+				json->Put("properties", properties);
+				delete property;
+				CCloudResult result(enNoErr, json);
+				return InvokeHandler(handler, &result);
+			}
+		}
+		Call *call = new Call(this, &CPropertyShadow::PropertySet, domainName(domain), handler);
+		call->sent <<= property;
+		call->key = property->GetString("key");
+		CClannishRESTProxy::Instance()->UserSetProperty(call->domain, (const CHJSON*) call->sent, call->Handler());
+	}
+
+	void CPropertyShadow::PropertySet(const CCloudResult *result, Call *call) {
+		std::map<cstring, Values>::iterator known = mProperties.find(call->domain);
+		if (call->IsCurrent() && known != mProperties.end()) {
+			if (result->GetErrorCode() == enNoErr) {
+				known->second[call->key] = call->sent->GetSafe("value")->print();
+			} else {
+				mProperties.erase(known);
+			}
+		}
+		InvokeHandler(call->handler, result);
+	}
+
+	void CPropertyShadow::DeleteProperty(const char *domain, const char *key, CResultHandler *handler) {
+		Call *call = new Call(this, &CPropertyShadow::PropertyDeleted, domainName(domain), handler);
+		call->key = key;
+		CClannishRESTProxy::Instance()->UserDelProperty(call->domain, key, call->Handler());
+	}
+
+	void CPropertyShadow::PropertyDeleted(const CCloudResult *result, Call *call) {
+		std::map<cstring, Values>::iterator known = mProperties.find(call->domain);
+		if (call->IsCurrent() && known != mProperties.end()) {
+			if (result->GetErrorCode() == enNoErr) {
+				known->second.erase(call->key);
+			} else {
+				mProperties.erase(known);
+			}
+		}
+		InvokeHandler(call->handler, result);
+	}
+
+	void CPropertyShadow::GetProfile(CResultHandler *handler) {
+		CHJSON emptyJson;
+		CClannishRESTProxy::Instance()->GetUserProfile(&emptyJson, (new Call(this, &CPropertyShadow::ProfileRead, NULL, handler))->Handler());
+	}
+
+	void CPropertyShadow::ProfileRead(const CCloudResult *result, Call *call) {
+		if (call->IsCurrent() && result->GetErrorCode() == enNoErr) {
+			mProfile.clear();
+			Record(mProfile, result->GetJSON());
+		}
+		InvokeHandler(call->handler, result);
+	}
+
+	void CPropertyShadow::SetProfile(CHJSON *profile, CResultHandler *handler) {
+		owned_ref<CHJSON> owned (profile);
+		CHJSON *changed = new CHJSON;
+		// The requests in progress may still change any field
+		bool pending = IsPending(NULL);
+		for (CHJSON::Iterator it = owned->begin(); it != owned->end(); ++it) {
+			Values::iterator previous = mProfile.find((*it)->name());
+			if (pending || previous == mProfile.end() || !IsEqual(previous->second, (*it)->print())) {
+				changed->Put((*it)->name(), (*it)->Duplicate());
+			}
+		}
+
+		if (changed->size() == 0) {
+			delete changed;
+			CHJSON *json = new CHJSON;
+			json->Put("done", 1);
+			CCloudResult result(enNoErr, json);
+			return InvokeHandler(handler, &result);
+		}
+		Call *call = new Call(this, &CPropertyShadow::ProfileSet, NULL, handler);
+		call->sent <<= changed;
+		CClannishRESTProxy::Instance()->SetUserProfile((const CHJSON*) call->sent, call->Handler());
+	}
+
+	void CPropertyShadow::ProfileSet(const CCloudResult *result, Call *call) {
+		if (call->IsCurrent()) {
+			if (result->GetErrorCode() == enNoErr) {
+				Record(mProfile, call->sent);
+			} else {
+				mProfile.clear();
+			}
+		}
+		InvokeHandler(call->handler, result);
+	}
+}
@@ -0,0 +1,95 @@
+//
+//  CPropertyShadow.h
+//  CloudBuilder
+//
+//  Created by florian on 20/10/16.
+//  Copyright (c) 2016 Clan of the Cloud. All rights reserved.
+//
+
+#ifndef CloudBuilder_CPropertyShadow_h
+#define CloudBuilder_CPropertyShadow_h
+
+#include <map>
+#include "CCallback.h"
+#include "helpers.h"
+
+namespace CloudBuilder {
+
+	/**
+	 * Last properties (CUserManager::SetProperties and co.) and profile fields acknowledged by the server, enabled
+	 * with the "deltaUpdates" setup option. Once the properties of a domain are known, setting them only sends the
+	 * keys which changed, through the per-key endpoints; the profile is handled the same way, only the fields which
+	 * changed being sent. While requests are in progress for a domain (or the profile), changes are sent in full,
+	 * since what the server ends up with isn't known yet.
+	 *
+	 * Changes made by other means (server hooks, batches, other devices) are only seen when the properties or the
+	 * profile are read again. Meant to be used from the thread running the callbacks, like the managers.
+	 */
+	class CPropertyShadow {
+	public:
+		CPropertyShadow();
+		~CPropertyShadow();
+
+		/**
+		 * @param options setup options: deltaUpdates
+		 */
+		void Configure(const CotCHelpers::CHJSON *options);
+		bool IsEnabled() const { return mEnabled; }
+		/**
+		 * Forgets everything, as when another gamer logs in. Results of requests in progress are not recorded.
+		 */
+		void Clear();
+
+		void GetProperties(const char *domain, CResultHandler *handler);
+		/**
+		 * @param properties validated properties, owned from now on
+		 */
+		void SetProperties(const char *domain, CotCHelpers::CHJSON *properties, CResultHandler *handler);
+		/**
+		 * @param property validated property ({key, value}), owned from now on
+		 */
+		void SetProperty(const char *domain, CotCHelpers::CHJSON *property, CResultHandler *handler);
+		void DeleteProperty(const char *domain, const char *key, CResultHandler *handler);
+
+		void GetProfile(CResultHandler *handler);
+		/**
+		 * @param profile profile fields, owned from now on
+		 */
+		void SetProfile(CotCHelpers::CHJSON *profile, CResultHandler *handler);
+		/**
+		 * Forgets the profile, changed by other means (e.g. ChangeEmail).
+		 */
+		void ForgetProfile() { mProfile.clear(); }
+
+	private:
+		struct Call;
+		struct DeltaCall;
+
+		// Values by key, printed as JSON
+		typedef std::map<CotCHelpers::cstring, CotCHelpers::cstring> Values;
+
+		bool mEnabled;
+		// Incremented by Clear, so that the results of requests made for a previous gamer are ignored
+		unsigned mGeneration;
+		// Properties by domain, only for the domains whose properties are all known
+		std::map<CotCHelpers::cstring, Values> mProperties;
+		// Profile fields known so far
+		Values mProfile;
+		// Number of requests in progress by domain ("" for the profile). What they change isn't known until they are
+		// answered, so changes are not compared with the known values meanwhile.
+		std::map<CotCHelpers::cstring, int> mPending;
+
+		static void Record(Values &dest, const CotCHelpers::CHJSON *values);
+		bool IsPending(const char *domain) const;
+
+		void PropertiesRead(const CCloudResult *result, Call *call);
+		void PropertiesSet(const CCloudResult *result, Call *call);
+		void PropertySet(const CCloudResult *result, Call *call);
+		void PropertyDeleted(const CCloudResult *result, Call *call);
+		void DeltaPartDone(const CCloudResult *result, Call *call);
+		void ProfileRead(const CCloudResult *result, Call *call);
+		void ProfileSet(const CCloudResult *result, Call *call);
+	};
+}
+
+#endif
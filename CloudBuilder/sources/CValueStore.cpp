@@ -0,0 +1,449 @@
+//
+//  CValueStore.cpp
+//  CloudBuilder
+//
+//  Created by florian on 20/10/16.
+//  Copyright (c) 2016 Clan of the Cloud. All rights reserved.
+//
+
+#include <string.h>
+#include "CValueStore.h"
+#include "CloudBuilder_private.h"
+#include "CClannishRESTProxy.h"
+#include "CFilesystem.h"
+
+#define VALUES_PATH_PREFIX "cotcsystem/Values-"
+// Rewrite the file once that many records have been appended, and more of them than keys are known
+#define COMPACTION_THRESHOLD 64
+
+using namespace CotCHelpers;
+
+namespace CloudBuilder {
+
+	static const char *domainName(const char *domain) {
+		return (domain && domain[0]) ? domain : "private";
+	}
+
+	static bool sameValue(const CHJSON *a, const CHJSON *b) {
+		if (!a || !b) return a == b;
+		return IsEqual(a->print(), b->print());
+	}
+
+	static CHJSON *duplicate(const CHJSON *json) {
+		return json ? json->Duplicate() : NULL;
+	}
+
+	/**
+	 * Request made for a key, deleted once its result has been processed. The result is dropped if the gamer has
+	 * changed meanwhile, except for the handler of the application which still gets it.
+	 */
+	struct CValueStore::Call {
+		typedef void (CValueStore::*Method)(const CCloudResult*, Call*);
+		CValueStore *store;
+		Method method;
+		unsigned generation;
+		cstring domain, key;
+		int seq;
+		CResultHandler *handler;
+
+		Call(CValueStore *store, Method method, const char *domain, const char *key)
+			: store(store), method(method), generation(store->mGeneration), domain(domain), key(key), seq(0), handler(NULL) {}
+
+		// To pass to the proxy
+		CInternalResultHandler *Handler() { return MakeDelegate(this, &Call::Done); }
+		void Done(const CCloudResult *result) {
+			if (generation == store->mGeneration) {
+				(store->*method)(result, this);
+			}
+			else {
+				InvokeHandler(handler, result);
+			}
+			delete this;
+		}
+	};
+
+	CValueStore::CValueStore() : mEnabled(false), mGeneration(0), mFlushDelayMs(2000), mRevalidateAfterMs(300 * 1000),
+		mSeq(0), mInFlight(0), mFlushError(enNoErr), mFile(NULL), mAppendedRecords(0) {}
+
+	CValueStore::~CValueStore() {
+		CancelScheduledFlush();
+		delete mFile;
+		// Like the other callbacks at termination
+		for (std::list<CResultHandler*>::iterator it = mFlushHandlers.begin(); it != mFlushHandlers.end(); ++it) {
+			delete *it;
+		}
+	}
+
+	void CValueStore::Configure(const CHJSON *options) {
+		mEnabled = options->GetBool("localValues");
+		mFlushDelayMs = options->GetInt("localValuesFlushDelay", 2000);
+		mRevalidateAfterMs = options->GetInt("localValuesRevalidateAfter", 300) * 1000;
+	}
+
+	void CValueStore::Open(const char *gamerId) {
+		if (IsEqual(mGamerId, gamerId)) {
+			return;
+		}
+		Close();
+		mGamerId = gamerId;
+
+		// Data kept from a previous session, replayed record after record
+		owned_ref<CInputFile> file (CFilesystemManager::Instance()->OpenFileForReading(FileName()));
+		if (file->IsOpen()) {
+			cstring contents (file->ReadAll(), true);
+			for (char *line = (char*) contents.c_str(), *end; line && *line; line = end) {
+				end = strchr(line, '\n');
+				if (end) { *end++ = '\0'; }
+				owned_ref<CHJSON> record (CHJSON::parse(line));
+				// A partial record may be left by the death of the process
+				if (!record || !record->GetString("domain")) {
+					continue;
+				}
+				if (record->GetBool("forgotten")) {
+					mDomains.erase(record->GetString("domain"));
+				} else if (record->GetString("key")) {
+					Load(record->GetString("domain"), record->GetString("key"), record);
+				}
+			}
+			file->Close();
+		}
+		Rewrite();
+
+		// Changes not sent during the previous session are sent right away
+		bool hasChanges = false;
+		for (std::map<cstring, Domain>::iterator d = mDomains.begin(); d != mDomains.end(); ++d) {
+			for (Domain::iterator k = d->second.begin(); k != d->second.end(); ++k) {
+				if (k->second.dirty) {
+					k->second.seq = ++mSeq;
+					hasChanges = true;
+				}
+			}
+		}
+		if (hasChanges) {
+			Flush(NULL);
+		}
+	}
+
+	void CValueStore::Load(const char *domain, const char *key, const CHJSON *record) {
+		if (!record->Has("value") && !record->GetBool("dirty")) {
+			std::map<cstring, Domain>::iterator d = mDomains.find(domain);
+			if (d != mDomains.end()) {
+				d->second.erase(key);
+			}
+			return;
+		}
+		Entry &entry = EntryFor(domain, key);
+		entry.value <<= duplicate(record->Get("value"));
+		entry.dirty = record->GetBool("dirty");
+		entry.base <<= entry.dirty ? duplicate(record->Get("base")) : NULL;
+	}
+
+	void CValueStore::Close() {
+		CancelScheduledFlush();
+		delete mFile;
+		mFile = NULL;
+		mDomains.clear();
+		mGamerId = NULL;
+		mGeneration++;
+		mInFlight = 0;
+		mFlushError = enNoErr;
+		while (!mFlushHandlers.empty()) {
+			CResultHandler *handler = mFlushHandlers.front();
+			mFlushHandlers.pop_front();
+			InvokeHandler(handler, enNotLogged);
+		}
+	}
+
+	CValueStore::Entry &CValueStore::EntryFor(const char *domain, const char *key) {
+		return mDomains[domainName(domain)][key];
+	}
+
+	void CValueStore::Get(const char *domain, const char *key, CResultHandler *handler) {
+		Entry &entry = EntryFor(domain, key);
+		if (!entry.value && !entry.dirty) {
+			// Not known locally (keys missing on the server are not remembered)
+			Call *call = new Call(this, &CValueStore::ReadDone, domainName(domain), key);
+			call->handler = handler;
+			entry.fetchedAt = MonotonicMilliseconds();
+			CClannishRESTProxy::Instance()->vfsReadv3(domainName(domain), key, call->Handler());
+			return;
+		}
+
+		if (!entry.fetchedAt || MonotonicMilliseconds() - entry.fetchedAt >= mRevalidateAfterMs) {
+			Revalidate(domain, key);
+		}
+		// Same form as the response of the server
+		CHJSON *json = new CHJSON, *values = new CHJSON;
+		if (entry.value) {
+			values->Put(key, (const CHJSON*) entry.value);
+		}
+		json->Put("result", values);
+		CCloudResult result(enNoErr, json);
+		InvokeHandler(handler, &result);
+	}
+
+	void CValueStore::ReadDone(const CCloudResult *result, Call *call) {
+		if (result->GetErrorCode() == enNoErr) {
+			Entry &entry = EntryFor(call->domain, call->key);
+			const CHJSON *remote = result->GetJSON()->GetSafe("result")->Get(call->key);
+			// A local change made meanwhile prevails
+			if (!entry.dirty && remote) {
+				entry.value <<= remote->Duplicate();
+				Persist(call->domain, call->key, entry);
+			}
+		}
+		InvokeHandler(call->handler, result);
+	}
+
+	void CValueStore::Revalidate(const char *domain, const char *key) {
+		EntryFor(domain, key).fetchedAt = MonotonicMilliseconds();
+		CClannishRESTProxy::Instance()->vfsReadv3(domainName(domain), key, (new Call(this, &CValueStore::RevalidateDone, domainName(domain), key))->Handler());
+	}
+
+	void CValueStore::RevalidateDone(const CCloudResult *result, Call *call) {
+		if (result->GetErrorCode() != enNoErr) {
+			return;
+		}
+		Entry &entry = EntryFor(call->domain, call->key);
+		const CHJSON *remote = result->GetJSON()->GetSafe("result")->Get(call->key);
+		if (!entry.dirty) {
+			if (!sameValue(entry.value, remote)) {
+				entry.value <<= duplicate(remote);
+				Persist(call->domain, call->key, entry);
+			}
+			return;
+		}
+		// Changed on both sides since the local change was made
+		if (!sameValue(entry.base, remote) && !sameValue(entry.value, remote)) {
+			CValueConflictEventArgs args(call->domain, call->key, entry.value, remote);
+			if (mConflictHandler) {
+				mConflictHandler->Invoke(args);
+			}
+			switch (args.mResolution) {
+				case CValueConflictEventArgs::Local:
+					break;
+				case CValueConflictEventArgs::Remote:
+					entry.value <<= duplicate(remote);
+					entry.dirty = false;
+					entry.seq = ++mSeq;
+					break;
+				case CValueConflictEventArgs::Merged:
+					entry.value <<= args.mMerged.detachOwnership();
+					entry.seq = ++mSeq;
+					ScheduleFlush();
+					break;
+			}
+		}
+		// Further conflicts are detected against what was just seen
+		entry.base <<= duplicate(remote);
+		Persist(call->domain, call->key, entry);
+	}
+
+	void CValueStore::Set(const char *domain, const char *key, CHJSON *value, CResultHandler *handler) {
+		Change(domain, key, value);
+		CHJSON *json = new CHJSON;
+		json->Put("done", 1);
+		CCloudResult result(enNoErr, json);
+		InvokeHandler(handler, &result);
+	}
+
+	void CValueStore::Delete(const char *domain, const char *key, CResultHandler *handler) {
+		Change(domain, key, NULL);
+		CHJSON *json = new CHJSON;
+		json->Put("done", 1);
+		CCloudResult result(enNoErr, json);
+		InvokeHandler(handler, &result);
+	}
+
+	void CValueStore::Change(const char *domain, const char *key, CHJSON *value) {
+		Entry &entry = EntryFor(domain, key);
+		if (!entry.dirty) {
+			// What the server is known to hold, unless the key has never been read
+			entry.base <<= duplicate(entry.value);
+			entry.dirty = true;
+		}
+		entry.value <<= value;
+		entry.seq = ++mSeq;
+		Persist(domainName(domain), key, entry);
+		ScheduleFlush();
+	}
+
+	void CValueStore::Forget(const char *domain) {
+		mDomains.erase(domainName(domain));
+		CHJSON record;
+		record.Put("domain", domainName(domain));
+		record.Put("forgotten", true);
+		Append(&record);
+	}
+
+	void CValueStore::ScheduleFlush() {
+		if (mFlushDelayMs <= 0) {
+			return Flush(NULL);
+		}
+		if (mTimer && !mTimer->HasFinished()) {
+			return;
+		}
+		mTimer <<= new CCallbackTimer(MakeDelegate(this, &CValueStore::TimerElapsed));
+		mTimer->Start(mFlushDelayMs);
+	}
+
+	void CValueStore::CancelScheduledFlush() {
+		if (mTimer) {
+			mTimer->Cancel();
+			mTimer <<= NULL;
+		}
+	}
+
+	void CValueStore::TimerElapsed(const CCloudResult *result) {
+		Flush(NULL);
+	}
+
+	void CValueStore::Flush(CResultHandler *handler) {
+		if (!IsOpen()) {
+			return InvokeHandler(handler, enNotLogged);
+		}
+		CancelScheduledFlush();
+		if (handler) {
+			mFlushHandlers.push_back(handler);
+		}
+
+		// Only the last change of each key is sent; the requests are processed in order by the HTTP queue
+		for (std::map<cstring, Domain>::iterator d = mDomains.begin(); d != mDomains.end(); ++d) {
+			for (Domain::iterator k = d->second.begin(); k != d->second.end(); ++k) {
+				Entry &entry = k->second;
+				if (!entry.dirty || entry.sentSeq == entry.seq) {
+					continue;
+				}
+				Call *call = new Call(this, &CValueStore::WriteDone, d->first, k->first);
+				call->seq = entry.sentSeq = entry.seq;
+				mInFlight++;
+				if (entry.value) {
+					CClannishRESTProxy::Instance()->vfsWritev3(d->first, k->first, (const CHJSON*) entry.value, false, call->Handler());
+				}
+				else {
+					CClannishRESTProxy::Instance()->vfsDelete(d->first, k->first, false, call->Handler());
+				}
+			}
+		}
+		FinishFlushIfDone();
+	}
+
+	void CValueStore::WriteDone(const CCloudResult *result, Call *call) {
+		mInFlight--;
+		eErrorCode error = result->GetErrorCode();
+		std::map<cstring, Domain>::iterator d = mDomains.find(call->domain);
+		Domain::iterator k;
+		if (d != mDomains.end() && (k = d->second.find(call->key)) != d->second.end()) {
+			Entry &entry = k->second;
+			if (entry.sentSeq == call->seq) {
+				entry.sentSeq = 0;
+			}
+			int httpCode = result->GetHttpStatusCode();
+			if (error != enNoErr && httpCode >= 400 && httpCode < 500) {
+				// Rejected by the server, retrying would not help; the value will be read again
+				CONSOLE_ERROR("Dropping local change of %s/%s rejected by the server: %s\n", (const char*) call->domain, (const char*) call->key, result->GetErrorString());
+				if (entry.seq == call->seq) {
+					entry.dirty = false;
+					entry.fetchedAt = 0;
+					entry.value <<= NULL;
+				}
+			}
+			else if (error != enNoErr) {
+				// Sent again later
+				ScheduleFlush();
+			}
+			else if (entry.seq == call->seq) {
+				entry.dirty = false;
+				entry.base <<= NULL;
+			}
+			Persist(call->domain, call->key, entry);
+		}
+		if (error != enNoErr && mFlushError == enNoErr) {
+			mFlushError = error;
+		}
+		FinishFlushIfDone();
+	}
+
+	void CValueStore::FinishFlushIfDone() {
+		if (mInFlight > 0) {
+			return;
+		}
+		eErrorCode error = mFlushError;
+		mFlushError = enNoErr;
+		while (!mFlushHandlers.empty()) {
+			CResultHandler *handler = mFlushHandlers.front();
+			mFlushHandlers.pop_front();
+			InvokeHandler(handler, error);
+		}
+	}
+
+	const char *CValueStore::FileName() {
+		return csprintf(mFileName, VALUES_PATH_PREFIX "%s.journal", (const char*) mGamerId);
+	}
+
+	void CValueStore::Describe(CHJSON *record, const Entry &entry) {
+		if (entry.value) {
+			record->Put("value", (const CHJSON*) entry.value);
+		}
+		if (entry.dirty) {
+			record->Put("dirty", true);
+			record->Put("base", (const CHJSON*) entry.base);
+		}
+	}
+
+	void CValueStore::Persist(const char *domain, const char *key, const Entry &entry) {
+		CHJSON record;
+		record.Put("domain", domain);
+		record.Put("key", key);
+		Describe(&record, entry);
+		Append(&record);
+	}
+
+	void CValueStore::Append(const CHJSON *record) {
+		if (!mFile) {
+			return;
+		}
+		if (++mAppendedRecords >= COMPACTION_THRESHOLD) {
+			size_t keyCount = 0;
+			for (std::map<cstring, Domain>::iterator d = mDomains.begin(); d != mDomains.end(); ++d) {
+				keyCount += d->second.size();
+			}
+			if ((size_t) mAppendedRecords > keyCount) {
+				// The record is part of the keys written again
+				return Rewrite();
+			}
+		}
+		WriteLine(record);
+	}
+
+	void CValueStore::WriteLine(const CHJSON *record) {
+		if (mFile->IsOpen()) {
+			cstring line;
+			record->print(line);
+			mFile->Write(line.c_str(), strlen(line));
+			mFile->Write("\n", 1);
+			mFile->Flush();
+		}
+	}
+
+	void CValueStore::Rewrite() {
+		delete mFile;
+		mFile = CFilesystemManager::Instance()->OpenFileForWriting(FileName());
+		if (!mFile->IsOpen()) {
+			CONSOLE_ERROR("Could not open the local values %s\n", mFileName.c_str());
+		}
+		for (std::map<cstring, Domain>::iterator d = mDomains.begin(); d != mDomains.end(); ++d) {
+			for (Domain::iterator k = d->second.begin(); k != d->second.end(); ++k) {
+				if (!k->second.value && !k->second.dirty) {
+					continue;
+				}
+				CHJSON record;
+				record.Put("domain", d->first.c_str());
+				record.Put("key", k->first.c_str());
+				Describe(&record, k->second);
+				WriteLine(&record);
+			}
+		}
+		mAppendedRecords = 0;
+	}
+}
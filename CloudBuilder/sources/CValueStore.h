@@ -0,0 +1,129 @@
+//
+//  CValueStore.h
+//  CloudBuilder
+//
+//  Created by florian on 20/10/16.
+//  Copyright (c) 2016 Clan of the Cloud. All rights reserved.
+//
+
+#ifndef CloudBuilder_CValueStore_h
+#define CloudBuilder_CValueStore_h
+
+#include <map>
+#include <list>
+#include "CCallback.h"
+#include "CValueConflictEventArgs.h"
+#include "helpers.h"
+
+namespace CloudBuilder {
+	class COutputFile;
+
+	/**
+	 * Local copy of the gamer key/value storage (CUserManager::GetValue and co.), enabled with the "localValues"
+	 * setup option. Reads are answered locally once a key is known, and revalidated in the background. Writes are
+	 * applied locally, journaled to the disk through the CFilesystemManager and sent to the server later, only
+	 * the last change of each key being sent. The journal survives restarts and is resumed at the next login of
+	 * the same gamer.
+	 *
+	 * The file is made of one JSON record per line, describing a key as it changed (or a domain forgotten), and is
+	 * rewritten with the known keys only when it is opened or when most records are obsolete.
+	 *
+	 * Meant to be used from the thread running the callbacks, like the managers.
+	 */
+	class CValueStore {
+	public:
+		CValueStore();
+		~CValueStore();
+
+		/**
+		 * @param options setup options: localValues, localValuesFlushDelay (ms) and localValuesRevalidateAfter (s)
+		 */
+		void Configure(const CotCHelpers::CHJSON *options);
+		bool IsEnabled() const { return mEnabled; }
+		bool IsOpen() const { return mGamerId != NULL; }
+		/**
+		 * Loads the data kept for a gamer, sending the changes left from a previous session.
+		 */
+		void Open(const char *gamerId);
+		/**
+		 * Forgets the data of the current gamer (kept on the disk). Flushes in progress fail with enNotLogged.
+		 */
+		void Close();
+
+		void Get(const char *domain, const char *key, CResultHandler *handler);
+		void Set(const char *domain, const char *key, CotCHelpers::CHJSON *value, CResultHandler *handler);
+		void Delete(const char *domain, const char *key, CResultHandler *handler);
+		/**
+		 * Forgets everything known for a domain, including the local changes. Called when the whole domain is
+		 * replaced or deleted on the server.
+		 */
+		void Forget(const char *domain);
+		/**
+		 * Sends the pending changes now. The handler is called once all of them have been acknowledged.
+		 */
+		void Flush(CResultHandler *handler);
+		void SetConflictHandler(CDelegate<void (CValueConflictEventArgs&)> *handler) { mConflictHandler <<= handler; }
+		/**
+		 * Ends the wait of the flush timer, so that the tasks of the context can be drained.
+		 */
+		void CancelScheduledFlush();
+
+	private:
+		struct Entry {
+			// Local view of the value; NULL if absent
+			owned_ref<CotCHelpers::CHJSON> value;
+			// Last time the value was read from the server during this session (monotonic ms), 0 if never
+			long long fetchedAt;
+			// Whether the local value must be written to the server (or deleted if value is NULL)
+			bool dirty;
+			// Identifies the last local change, so that an acknowledgment only clears the change that was sent
+			int seq;
+			// Change being sent to the server, 0 if none
+			int sentSeq;
+			// Value on the server when the key was changed locally (NULL if absent), to detect conflicts
+			owned_ref<CotCHelpers::CHJSON> base;
+			Entry() : fetchedAt(0), dirty(false), seq(0), sentSeq(0) {}
+		};
+		typedef std::map<CotCHelpers::cstring, Entry> Domain;
+		struct Call;
+
+		bool mEnabled;
+		// Incremented by Close, so that the results of requests made for a previous gamer are ignored
+		unsigned mGeneration;
+		int mFlushDelayMs, mRevalidateAfterMs;
+		CotCHelpers::cstring mGamerId;
+		std::map<CotCHelpers::cstring, Domain> mDomains;
+		int mSeq;
+		// Number of changes being sent
+		int mInFlight;
+		eErrorCode mFlushError;
+		std::list<CResultHandler*> mFlushHandlers;
+		autoref<CCallbackTimer> mTimer;
+		// Journal of the current gamer, NULL once closed
+		COutputFile *mFile;
+		CotCHelpers::cstring mFileName;
+		// Records appended since the file was last rewritten
+		int mAppendedRecords;
+		owned_ref<CDelegate<void (CValueConflictEventArgs&)>> mConflictHandler;
+
+		Entry &EntryFor(const char *domain, const char *key);
+		void Change(const char *domain, const char *key, CotCHelpers::CHJSON *value);
+		void ScheduleFlush();
+		const char *FileName();
+		void Load(const char *domain, const char *key, const CotCHelpers::CHJSON *record);
+		static void Describe(CotCHelpers::CHJSON *record, const Entry &entry);
+		void Persist(const char *domain, const char *key, const Entry &entry);
+		void Append(const CotCHelpers::CHJSON *record);
+		void WriteLine(const CotCHelpers::CHJSON *record);
+		void Rewrite();
+		void Revalidate(const char *domain, const char *key);
+		void FinishFlushIfDone();
+
+		void ReadDone(const CCloudResult *result, Call *call);
+		void RevalidateDone(const CCloudResult *result, Call *call);
+		void WriteDone(const CCloudResult *result, Call *call);
+		void TimerElapsed(const CCloudResult *result);
+	};
+}
+
+#endif
@@ -69,17 +69,24 @@ void setuuid(char *dest);
 
 extern LOG_LEVEL g_debugLevel;
 
-#ifdef __ANDROID__
-	#include <android/log.h>
-	#define CONSOLE(...)   __android_log_print(ANDROID_LOG_ERROR, "CloudBuilder[stderr]", __VA_ARGS__);
+// Formats the message and queues it for the logging thread (see logging.h)
+#if defined(__GNUC__)
+void cotc_log(LOG_LEVEL level, const char *format, ...) __attribute__((format(printf, 2, 3)));
 #else
-    #define CONSOLE(...)    fprintf(stderr, __VA_ARGS__);
+void cotc_log(LOG_LEVEL level, const char *format, ...);
 #endif
 
-#define CONSOLE_ERROR(...) 		{ if (g_debugLevel>=LOG_LEVEL_ERROR)  CONSOLE( __VA_ARGS__) }
-#define CONSOLE_WARNING(...) 	{ if (g_debugLevel>=LOG_LEVEL_WARNING) CONSOLE( __VA_ARGS__) }
-#define CONSOLE_VERBOSE(...) 	{ if (g_debugLevel>=LOG_LEVEL_VERBOSE) CONSOLE( __VA_ARGS__) }
-#define CONSOLE_EXTRA(...) 		{ if (g_debugLevel>=LOG_LEVEL_EXTRA) CONSOLE( __VA_ARGS__) }
+// Define to a lower level to compile out the more verbose messages entirely
+#ifndef COTC_MAX_LOG_LEVEL
+	#define COTC_MAX_LOG_LEVEL	LOG_LEVEL_EXTRA
+#endif
+
+#define CONSOLE(...)    cotc_log(LOG_LEVEL_ERROR, __VA_ARGS__);
+
+#define CONSOLE_ERROR(...) 		{ if (COTC_MAX_LOG_LEVEL>=LOG_LEVEL_ERROR && g_debugLevel>=LOG_LEVEL_ERROR) cotc_log(LOG_LEVEL_ERROR, __VA_ARGS__); }
+#define CONSOLE_WARNING(...) 	{ if (COTC_MAX_LOG_LEVEL>=LOG_LEVEL_WARNING && g_debugLevel>=LOG_LEVEL_WARNING) cotc_log(LOG_LEVEL_WARNING, __VA_ARGS__); }
+#define CONSOLE_VERBOSE(...) 	{ if (COTC_MAX_LOG_LEVEL>=LOG_LEVEL_VERBOSE && g_debugLevel>=LOG_LEVEL_VERBOSE) cotc_log(LOG_LEVEL_VERBOSE, __VA_ARGS__); }
+#define CONSOLE_EXTRA(...) 		{ if (COTC_MAX_LOG_LEVEL>=LOG_LEVEL_EXTRA && g_debugLevel>=LOG_LEVEL_EXTRA) cotc_log(LOG_LEVEL_EXTRA, __VA_ARGS__); }
 
 #if defined(__WINDOWS_32__)
 #if _MSC_VER < 1900
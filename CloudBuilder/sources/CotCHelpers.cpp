@@ -31,7 +31,7 @@ namespace CotCHelpers {
 
 	CRefClass::~CRefClass() noexcept(false) {
 #ifndef COTC_DISABLE_EXCEPTIONS
-		if ((int) __ref_count > 0) throw "Freeing an object that is still retained elsewhere";
+		if (__ref_count.load() > 0) throw "Freeing an object that is still retained elsewhere";
 #endif
 	}
 }
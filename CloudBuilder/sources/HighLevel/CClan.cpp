@@ -20,6 +20,15 @@
 #include "CStoreManager.h"
 #include "curltool.h"
 #include "cotc_thread.h"
+#include "logging.h"
+#include "metrics.h"
+#include "CClientContext_private.h"
+#include "CValueStore.h"
+#include "CPropertyShadow.h"
+#include "CProgressAggregator.h"
+#include "CLeaderboardCache.h"
+#include "CFriendsCache.h"
+#include "CProductCatalog.h"
 
 using namespace CotCHelpers;
 
@@ -55,19 +64,27 @@ namespace CloudBuilder {
 		/**
 		 * This is a very simple thread that checks whether a call to ProcessIdleTasks is
 		 * done and issues a warning otherwise. Set the boolean member to true when called.
+		 * Call Stop to wake it up and have it exit without warning.
 		 */
 		struct CClan_ProcessIdleTasksCheckThread: CotCHelpers::CThread {
 			volatile bool hasCalledProcessIdleTasksOnce, shouldStop;
+			CConditionVariable stopCondition;
 			CClan_ProcessIdleTasksCheckThread() : hasCalledProcessIdleTasksOnce(false), shouldStop(false) {}
 			virtual void Run() {
-				// Wait for a total of 100x100ms (10 sec)
-				for (int i = 0; i < 100 && !shouldStop; i++) {
-					usleep(100 * 1000);
-				}
+				// Sleep for 10 sec unless stopped in the meantime (Wait returns false upon timeout)
+				stopCondition.LockVar();
+				while (!shouldStop && stopCondition.Wait(10 * 1000)) {}
+				stopCondition.UnlockVar();
 				if (!hasCalledProcessIdleTasksOnce && !shouldStop) {
 					CONSOLE_ERROR("!!!! You have not called CClan::ProcessIdleTasks, thus no async operation can complete !!!!");
 				}
 			}
+			void Stop() {
+				stopCondition.LockVar();
+				shouldStop = true;
+				stopCondition.SignalAll();
+				stopCondition.UnlockVar();
+			}
 		};
 		CClan_ProcessIdleTasksCheckThread *checkThread;
 #	endif
@@ -79,9 +96,6 @@ namespace CloudBuilder {
 		userLoged
 	};
 
-	static singleton_holder<CClan> managerSingleton;
-	extern owned_ref<CDelegate<void(CHttpFailureEventArgs&)>> g_failureDelegate;
-	
 	CClan::CClan() :
 		restoreLoginHandler(*(new CGloballyKeptHandler<CResultHandler>))
 	{
@@ -93,8 +107,11 @@ namespace CloudBuilder {
 		isActive = true;
 
 #ifdef DEBUG
-		checkThread = new CClan_ProcessIdleTasksCheckThread;
-		checkThread->Start();
+		// Shared by the whole process, the other contexts are typically processed by the host in its own way
+		if (CClientContext::Current()->IsDefault()) {
+			checkThread = new CClan_ProcessIdleTasksCheckThread;
+			checkThread->Start();
+		}
 #endif
 	}
 
@@ -103,18 +120,33 @@ namespace CloudBuilder {
 		// Terminate other tasks and release memory
 #ifdef DEBUG
 		// Terminate the check thread
-		checkThread->shouldStop = true;
-		checkThread->Join();
-		checkThread->Release(), checkThread = NULL;
+		if (CClientContext::Current()->IsDefault() && checkThread) {
+			checkThread->Stop();
+			checkThread->Join();
+			checkThread->Release(), checkThread = NULL;
+		}
 #endif
 	}
 	
 	CClan* CClan::Instance() {
-		return managerSingleton.Instance();
+		return CClientContext::Current()->Internals().clan.Instance();
 	}
 
 	void CClan::Terminate() {
+		CClientContext *context = CClientContext::Current();
+		// Callbacks are not delivered anymore from here on
+		CallbackStack::setDispatch(enCallbackDispatchIdle, NULL);
+		// Local values not sent yet are kept on the disk for the next session
+		CUserManager::Instance()->mValueStore->CancelScheduledFlush();
+		// Held progress is queued and journaled if enabled; without the journal, it is discarded with the queue below
+		CUserManager::Instance()->mProgress->Flush();
 		http_terminate();
+		// Let the internal tasks of this context finish; their callbacks are discarded below
+		context->Internals().WaitForTasks();
+		// The workers are shared, other contexts may still be using them
+		if (context->IsDefault()) {
+			CTaskExecutor::StopIfIdle();
+		}
 		CallbackStack::removeAllPendingCallbacksWithoutCallingThem();
 		// Important: all these managers shouldn't do anything sensible in their terminate method,
 		// since the managers are destroyed in a random order. They shouldn't rely on any other
@@ -124,9 +156,14 @@ namespace CloudBuilder {
 		CGameManager::Instance()->Terminate();
 		CTribeManager::Instance()->Terminate();
 		CUserManager::Instance()->Terminate();
-		CFilesystemManager::Instance()->Terminate();
 		CStoreManager::Instance()->Terminate();
-		managerSingleton.Release();
+		context->Internals().clan.Release();
+		// Process-wide resources, possibly used by other contexts
+		if (context->IsDefault()) {
+			CFilesystemManager::Instance()->Terminate();
+			ReleasePooledMemory();
+		}
+		log_flush();
 	}
 	
 	bool CClan::isUserLogged() {
@@ -144,10 +181,12 @@ namespace CloudBuilder {
 
 		hasCalledHandleUrl = false;
 
-		// Set the app folder
-		const char *appFolder = aConfiguration->GetString("appFolder");
-		if (!appFolder) { appFolder = "CotC/untitledApp"; }
-		CFilesystemManager::Instance()->SetFolderHint(appFolder);
+		// Set the app folder (shared by all contexts)
+		if (CClientContext::Current()->IsDefault()) {
+			const char *appFolder = aConfiguration->GetString("appFolder");
+			if (!appFolder) { appFolder = "CotC/untitledApp"; }
+			CFilesystemManager::Instance()->SetFolderHint(appFolder);
+		}
 
 		// After the CClannishDBProxy::Setup, call CUserManager::DoSetupProcesses
 		struct CallUserManagerSetup: CInternalResultHandler {
@@ -158,7 +197,18 @@ namespace CloudBuilder {
 		};
 		
 		// Pass the request
-		mAutoresume = aConfiguration->GetBool("autoresume");
+		// Restoring the session saved on the disk only makes sense for the app's own user
+		mAutoresume = CClientContext::Current()->IsDefault() && aConfiguration->GetBool("autoresume");
+		// The workers are shared, other contexts only change their number when asked explicitly
+		if (CClientContext::Current()->IsDefault() || aConfiguration->Has("workerThreads")) {
+			CTaskExecutor::Configure(aConfiguration->GetInt("workerThreads"));
+		}
+		CUserManager::Instance()->mValueStore->Configure(aConfiguration);
+		CUserManager::Instance()->mPropertyShadow->Configure(aConfiguration);
+		CUserManager::Instance()->mProgress->Configure(aConfiguration);
+		CGameManager::Instance()->mLeaderboards->Configure(aConfiguration);
+		CTribeManager::Instance()->mFriends->Configure(aConfiguration);
+		CStoreManager::Instance()->mCatalog->Configure(aConfiguration);
 		
 		owned_ref<CHJSON> json (aConfiguration->Duplicate());
 		json->Put("sdkVersion", SDKVERSION);
@@ -172,6 +222,26 @@ namespace CloudBuilder {
 		g_debugLevel = logLevel;
 	}
 
+	void CClan::SetLogSink(LOG_SINK sink, void *userData) {
+		log_set_sink(sink, userData);
+	}
+
+	void CClan::SetLogRateLimit(int messagesPerSecond) {
+		log_set_rate_limit(messagesPerSecond);
+	}
+
+	bool CClan::SetAllocator(const CAllocator *aAllocator) {
+		return InstallAllocator(aAllocator);
+	}
+
+	void CClan::GetMemoryStats(eMemoryCategory aCategory, CMemoryStats *aDest) {
+		ReadMemoryStats(aCategory, aDest);
+	}
+
+	CHJSON *CClan::GetHttpMetrics(bool aReset) {
+		return metrics_snapshot(aReset);
+	}
+
 	void CClan::Ping(CResultHandler *handler) {
 		CClannishRESTProxy::Instance()->Ping(MakeBridgeDelegate(handler));
 	}
@@ -180,6 +250,8 @@ namespace CloudBuilder {
 		// App suspended
 		CONSOLE_VERBOSE("Suspended\n");
 		isActive = false;
+		// The app may not come back
+		CUserManager::Instance()->mProgress->Flush();
 		CClannishRESTProxy::Instance()->Suspend();
 	}
 	
@@ -218,15 +290,38 @@ namespace CloudBuilder {
 	
 	void CClan::ProcessIdleTasks() {
 #ifdef DEBUG
-		checkThread->hasCalledProcessIdleTasksOnce = true;
+		if (checkThread) {
+			checkThread->hasCalledProcessIdleTasksOnce = true;
+		}
 #endif
-		while (CallbackStack::popCallback()) {
-			// Unstack all pending callbacks at once
+		while (CallbackStack::popAllCallbacks() > 0) {
+			// Unstack all pending callbacks, including the ones pushed by the callbacks themselves
+		}
+	}
+
+	void CClan::SetCallbackDispatch(eCallbackDispatch aMode, CDelegate<void ()> *aNotifier) {
+		if (aMode == enCallbackDispatchHost && !aNotifier) {
+			CONSOLE_ERROR("SetCallbackDispatch: enCallbackDispatchHost requires a notifier\n");
+			return;
+		}
+		if (aMode != enCallbackDispatchHost) {
+			delete aNotifier, aNotifier = NULL;
+		}
+#ifdef DEBUG
+		// Not calling ProcessIdleTasks is expected now
+		if (checkThread && aMode != enCallbackDispatchIdle) {
+			checkThread->hasCalledProcessIdleTasksOnce = true;
 		}
+#endif
+		CallbackStack::setDispatch(aMode, aNotifier);
+	}
+
+	int CClan::GetCallbackNotificationFd() {
+		return CallbackStack::notificationFd();
 	}
 
 	void CClan::SetHttpFailureCallback(CDelegate<void(CHttpFailureEventArgs&)> *aCallback) {
-		g_failureDelegate <<= aCallback;
+		http_set_failure_callback(aCallback);
 	}
 
 }
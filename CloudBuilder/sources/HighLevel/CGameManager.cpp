@@ -9,35 +9,65 @@
 #include <string.h>
 #include <stdlib.h>
 #include <stdio.h>
+#include <utility>
 #include "CloudBuilder_private.h"
 #include "CClan.h"
 #include "CGameManager.h"
 #include "CClannishRESTProxy.h"
+#include "CClientContext_private.h"
+#include "CUserManager.h"
+#include "CProgressAggregator.h"
+#include "CLeaderboardCache.h"
 
 using namespace CotCHelpers;
 
 namespace CloudBuilder {
 	
-	static singleton_holder<CGameManager> managerSingleton;
-
-	CGameManager::CGameManager() {
+	CGameManager::CGameManager() : mLeaderboards(new CLeaderboardCache) {
 	}
 	
 	CGameManager::~CGameManager() {
+		delete mLeaderboards;
 	}
 
 	CGameManager *CGameManager::Instance() {
-		return managerSingleton.Instance();
+		return CClientContext::Current()->Internals().gameManager.Instance();
 	}
 
 	void CGameManager::Terminate() {
-		managerSingleton.Release();
+		CClientContext::Current()->Internals().gameManager.Release();
 	}
 	
 	void CGameManager::Score(long long aHighScore, const char *aMode, const char *aScoreType, const char *aInfoScore, bool aForce, const char *aDomain, CResultHandler *aHandler)
     {
-		if (!CClan::Instance()->isSetup()) { InvokeHandler(aHandler, enSetupNotCalled); }
-		if (!CClan::Instance()->isUserLogged()) { InvokeHandler(aHandler, enNotLogged); }
+		if (!CClan::Instance()->isSetup()) { InvokeHandler(aHandler, enSetupNotCalled); return; }
+		if (!CClan::Instance()->isUserLogged()) { InvokeHandler(aHandler, enNotLogged); return; }
+		if (mLeaderboards->IsEnabled()) {
+			// Has the cached pages of scores updated with a score accepted by the server; deleted once done
+			struct ScoreBridge {
+				CResultHandler *aHandler;
+				cstring domain, mode, info;
+				long long score;
+				ScoreBridge(CResultHandler *aHandler, const char *domain, const char *mode, const char *info, long long score)
+					: aHandler(aHandler), domain(domain), mode(mode), info(info), score(score) {}
+				void Done(eErrorCode code, const CCloudResult *result) {
+					const CHJSON *json = result->GetJSON();
+					if (code == enNoErr && (json->GetInt("done") || json->GetBool("done")) && json->GetInt("rank") > 0) {
+						CGameManager::Instance()->mLeaderboards->ScorePosted(domain, mode, score, info, json->GetInt("rank"));
+					}
+					InvokeHandler(aHandler, result);
+					delete this;
+				}
+			};
+			aHandler = MakeDelegate(new ScoreBridge(aHandler, aDomain, aMode, aInfoScore, aHighScore), &ScoreBridge::Done);
+		}
+		
+		CProgressAggregator *progress = CUserManager::Instance()->mProgress;
+		if (progress->IsEnabled()) {
+			// A forced score may be lower than the best one
+			if (aForce) { progress->ForgetBestScore(aDomain, aMode); }
+			else { return progress->Score(aHighScore, aMode, aScoreType, aInfoScore, aDomain, aHandler); }
+		}
 		
 		CHJSON json;
 		json.Put("score", (double)aHighScore);
@@ -75,10 +105,11 @@ namespace CloudBuilder {
         this->GetRank(aScore, aMode, aDomain, aHandler);
     }
     
-    void CGameManager::CenteredScore(CResultHandler *aHandler, int aCount, const char *aMode, const char *aDomain)
+    void CGameManager::CenteredScore(int aCount, const char *aMode, const char *aDomain, CResultHandler *aHandler)
     {
-		if (!CClan::Instance()->isSetup()) { InvokeHandler(aHandler, enSetupNotCalled); }
-		if (!CClan::Instance()->isUserLogged()) { InvokeHandler(aHandler, enNotLogged); }
+		if (!CClan::Instance()->isSetup()) { InvokeHandler(aHandler, enSetupNotCalled); return; }
+		if (!CClan::Instance()->isUserLogged()) { InvokeHandler(aHandler, enNotLogged); return; }
+		if (mLeaderboards->IsEnabled()) { return mLeaderboards->CenteredScore(aCount, aMode, aDomain, aHandler); }
 		
 		CHJSON json;
 		json.Put("count", aCount);
@@ -88,15 +119,16 @@ namespace CloudBuilder {
 		CClannishRESTProxy::Instance()->CenteredScore(&json, MakeBridgeDelegate(aHandler));
 	}
 	
-    void CGameManager::CenteredScore(int aCount, const char *aMode, const char *aDomain, CResultHandler *aHandler)
+    void CGameManager::CenteredScore(CResultHandler *aHandler, int aCount, const char *aMode, const char *aDomain)
     {
         this->CenteredScore(aCount, aMode, aDomain, aHandler);
     }
     
     void CGameManager::BestHighScore(int aCount,int aPage, const char *aMode, const char *aDomain, CResultHandler *aHandler)
     {
-		if (!CClan::Instance()->isSetup()) { InvokeHandler(aHandler, enSetupNotCalled); }
-		if (!CClan::Instance()->isUserLogged()) { InvokeHandler(aHandler, enNotLogged); }
+		if (!CClan::Instance()->isSetup()) { InvokeHandler(aHandler, enSetupNotCalled); return; }
+		if (!CClan::Instance()->isUserLogged()) { InvokeHandler(aHandler, enNotLogged); return; }
+		if (mLeaderboards->IsEnabled()) { return mLeaderboards->BestHighScore(aCount, aPage, aMode, aDomain, aHandler); }
 		
 		CHJSON json;
 		json.Put("count", aCount);
@@ -114,7 +146,9 @@ namespace CloudBuilder {
 
     void CGameManager::UserBestScores(const char *aDomain, CResultHandler *aHandler)
     {
-		if (!CClan::Instance()->isUserLogged()) { InvokeHandler(aHandler, enNotLogged); }
+		if (!CClan::Instance()->isUserLogged()) { InvokeHandler(aHandler, enNotLogged); return; }
+		// Seeds the best scores known locally
+		if (CUserManager::Instance()->mProgress->IsEnabled()) { return CUserManager::Instance()->mProgress->UserBestScores(aDomain, aHandler); }
 		CClannishRESTProxy::Instance()->UserBestScore(aDomain, MakeBridgeDelegate(aHandler));
 	}
 
@@ -221,5 +255,10 @@ namespace CloudBuilder {
 		CClannishRESTProxy::Instance()->BatchGame(aConfiguration, aParameters, MakeBridgeDelegate(aHandler));
 	}
 
+	void CGameManager::Batch(CResultHandler *aHandler, const CotCHelpers::CHJSON *aConfiguration, CotCHelpers::CHJSON &&aParameters) {
+		if (!CClan::Instance()->isSetup()) { InvokeHandler(aHandler, enSetupNotCalled); return; }
+		CClannishRESTProxy::Instance()->BatchGame(aConfiguration, std::move(aParameters), MakeBridgeDelegate(aHandler));
+	}
+
 }
 
@@ -9,17 +9,18 @@
 #include <string.h>
 #include <stdlib.h>
 #include <stdio.h>
+#include <deque>
+#include <utility>
 #include "CloudBuilder_private.h"
 #include "CClan.h"
 #include "CIndexManager.h"
 #include "CClannishRESTProxy.h"
+#include "CClientContext_private.h"
 
 using namespace CotCHelpers;
 
 namespace CloudBuilder {
 	
-	static singleton_holder<CIndexManager> managerSingleton;
-
 	CIndexManager::CIndexManager() {
 	}
 	
@@ -27,35 +28,156 @@ namespace CloudBuilder {
 	}
 
 	CIndexManager *CIndexManager::Instance() {
-		return managerSingleton.Instance();
+		return CClientContext::Current()->Internals().indexManager.Instance();
 	}
 
 	void CIndexManager::Terminate() {
-		managerSingleton.Release();
+		CClientContext::Current()->Internals().indexManager.Release();
 	}
 
 	void CIndexManager::DeleteObject(const CotCHelpers::CHJSON *aConfiguration, CResultHandler *aHandler) {
-		if (!CClan::Instance()->isSetup()) { InvokeHandler(aHandler, enSetupNotCalled); }
+		if (!CClan::Instance()->isSetup()) { InvokeHandler(aHandler, enSetupNotCalled); return; }
 
 		CClannishRESTProxy::Instance()->DeleteIndexedObject(aConfiguration, MakeBridgeDelegate(aHandler));
 	}
 
 	void CIndexManager::FetchObject(const CotCHelpers::CHJSON *aConfiguration, CResultHandler *aHandler) {
-		if (!CClan::Instance()->isSetup()) { InvokeHandler(aHandler, enSetupNotCalled); }
+		if (!CClan::Instance()->isSetup()) { InvokeHandler(aHandler, enSetupNotCalled); return; }
 
 		CClannishRESTProxy::Instance()->GetIndexedObject(aConfiguration, MakeBridgeDelegate(aHandler));
 	}
 
 	void CIndexManager::IndexObject(const CotCHelpers::CHJSON *aConfiguration, CResultHandler *aHandler) {
-		if (!CClan::Instance()->isSetup()) { InvokeHandler(aHandler, enSetupNotCalled); }
+		if (!CClan::Instance()->isSetup()) { InvokeHandler(aHandler, enSetupNotCalled); return; }
 
 		CClannishRESTProxy::Instance()->IndexObject(aConfiguration, MakeBridgeDelegate(aHandler));
 	}
 
+	void CIndexManager::IndexObject(CotCHelpers::CHJSON &&aConfiguration, CResultHandler *aHandler) {
+		if (!CClan::Instance()->isSetup()) { InvokeHandler(aHandler, enSetupNotCalled); return; }
+
+		CClannishRESTProxy::Instance()->IndexObject(std::move(aConfiguration), MakeBridgeDelegate(aHandler));
+	}
+
 	void CIndexManager::Search(const CotCHelpers::CHJSON *aConfiguration, CResultHandler *aHandler) {
-		if (!CClan::Instance()->isSetup()) { InvokeHandler(aHandler, enSetupNotCalled); }
+		if (!CClan::Instance()->isSetup()) { InvokeHandler(aHandler, enSetupNotCalled); return; }
 
 		CClannishRESTProxy::Instance()->SearchIndexedObjects(aConfiguration, MakeBridgeDelegate(aHandler));
 	}
+
+	CSearchCursor *CIndexManager::OpenSearch(const CotCHelpers::CHJSON *aConfiguration) {
+		return new CSearchCursor(aConfiguration);
+	}
+
+	//////////////////////////// Search cursor ////////////////////////////
+	struct CSearchCursor::Hits {
+		std::deque<CHJSON*> list;
+		~Hits() {
+			for (size_t i = 0; i < list.size(); i++) { delete list[i]; }
+		}
+	};
+
+	CSearchCursor::CSearchCursor(const CHJSON *aConfiguration)
+		: expectedManager(CIndexManager::Instance()), config(aConfiguration->Duplicate()), hits(*(new Hits)),
+		pendingHandler(NULL), pendingCount(0), requested(0), total(-1), fetching(false), exhausted(false) {
+		pageSize = config->GetInt("limit", 30);
+		if (pageSize <= 0) { pageSize = 30; }
+		window = config->GetInt("window", pageSize * 2);
+		if (window < pageSize) { window = pageSize; }
+		skip = config->GetInt("skip");
+	}
+
+	CSearchCursor::~CSearchCursor() {
+		delete config;
+		delete &hits;
+	}
+
+	bool CSearchCursor::CheckManager() {
+		return CIndexManager::Instance() == expectedManager;
+	}
+
+	bool CSearchCursor::IsDone() const {
+		return exhausted && hits.list.empty();
+	}
+
+	void CSearchCursor::Next(int aCount, CResultHandler *aHandler) {
+		if (!CClan::Instance()->isSetup()) { return InvokeHandler(aHandler, enSetupNotCalled); }
+		if (!CheckManager()) { return InvokeHandler(aHandler, enObjectDestroyed); }
+		if (pendingHandler) { return InvokeHandler(aHandler, enOperationAlreadyInProgress, "Wait for the previous call to Next"); }
+
+		int count = aCount < window ? aCount : window;
+		if (count < 1) { count = 1; }
+		if (exhausted || (int) hits.list.size() >= count) {
+			return PassHits(aHandler, count);
+		}
+		pendingHandler = aHandler, pendingCount = count;
+		if (!fetching) { FetchPage(); }
+	}
+
+	void CSearchCursor::FetchPage() {
+		struct Fetched: CInternalResultHandler {
+			_BLOCK1(Fetched, CInternalResultHandler,
+				CSearchCursor*, self);
+			void Done(const CCloudResult *result) {
+				self->PageFetched(result);
+			}
+		};
+
+		// Smaller than a page if the window doesn't allow more
+		int room = window - (int) hits.list.size();
+		requested = room < pageSize ? room : pageSize;
+		fetching = true;
+		config->Put("skip", skip);
+		config->Put("limit", requested);
+		// Kept until the page arrives
+		Retain();
+		CClannishRESTProxy::Instance()->SearchIndexedObjects(config, new Fetched(this));
+	}
+
+	void CSearchCursor::PageFetched(const CCloudResult *result) {
+		fetching = false;
+		if (result->GetErrorCode() == enNoErr) {
+			int received = 0;
+			FOR_EACH (const CHJSON *hit, *result->GetJSON()->GetSafe("hits")) {
+				hits.list.push_back(hit->Duplicate());
+				received++;
+			}
+			total = result->GetJSON()->GetInt("total");
+			skip += received;
+			exhausted = received < requested || skip >= total;
+
+			if (pendingHandler && (exhausted || (int) hits.list.size() >= pendingCount)) {
+				CResultHandler *handler = pendingHandler;
+				pendingHandler = NULL;
+				PassHits(handler, pendingCount);
+			} else if (pendingHandler) {
+				FetchPage();
+			}
+		} else if (pendingHandler) {
+			// A failed prefetch is made again by the next call
+			CResultHandler *handler = pendingHandler;
+			pendingHandler = NULL;
+			InvokeHandler(handler, result);
+		}
+		Release();
+	}
+
+	void CSearchCursor::PassHits(CResultHandler *handler, int count) {
+		CHJSON *json = new CHJSON, *passed = CHJSON::Array();
+		for (int i = 0; i < count && !hits.list.empty(); i++) {
+			passed->Add(hits.list.front());
+			hits.list.pop_front();
+		}
+		json->Put("total", total);
+		json->Put("hits", passed);
+
+		// Next page requested when the consumer gets close to the end of this one, if the window allows
+		int left = (int) hits.list.size();
+		if (!fetching && !exhausted && left <= pageSize / 2 && left + pageSize <= window) {
+			FetchPage();
+		}
+		CCloudResult result(enNoErr, json);
+		InvokeHandler(handler, &result);
+	}
 }
 
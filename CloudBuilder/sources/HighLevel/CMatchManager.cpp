@@ -1,14 +1,16 @@
+#include <deque>
+#include <utility>
 #include "CloudBuilder_private.h"
 #include "CClan.h"
 #include "CClannishRESTProxy.h"
 #include "CMatchManager.h"
 #include "helpers.h"
+#include "CClientContext_private.h"
+#include "CMatchState.h"
 
 using namespace CotCHelpers;
 using namespace CloudBuilder;
 
-static singleton_holder<CMatchManager> managerSingleton;
-
 //////////////////////////// Basic ////////////////////////////
 namespace CloudBuilder {
 	void InvokeHandler(CMatchResultHandler *handler, const CCloudResult *result, CMatch *match);
@@ -20,8 +22,8 @@ static CClannishRESTProxy *REST() { return CClannishRESTProxy::Instance(); }
 //////////////////////////// Common manager stuff ////////////////////////////
 CMatchManager::CMatchManager() {}
 CMatchManager::~CMatchManager() {}
-CMatchManager* CMatchManager::Instance() { return managerSingleton.Instance(); }
-void CMatchManager::Terminate() { managerSingleton.Release(); }
+CMatchManager* CMatchManager::Instance() { return CClientContext::Current()->Internals().matchManager.Instance(); }
+void CMatchManager::Terminate() { CClientContext::Current()->Internals().matchManager.Release(); }
 
 //////////////////////////// High-level matches ////////////////////////////
 void CMatchManager::HLCreateMatch(CMatchResultHandler *handler, const CHJSON *matchConfig) {
@@ -63,7 +65,10 @@ void CMatchManager::HLRestoreMatch(CMatchResultHandler *handler, const CHJSON *c
 			if (result->GetErrorCode() == enNoErr &&
 				(result->GetJSON()->GetSafe("matches")->size() > 0 || result->GetJSON()->Has("match")))
 			{
-				InvokeHandler(handler, result, new CMatch(self, result));
+				CMatch *match = new CMatch(self, result);
+				// Moves known before, which the server may have dropped since
+				match->state.Restore();
+				InvokeHandler(handler, result, match);
 			} else {
 				InvokeHandler(handler, enNoMatchToResume, "Unable to fetch match");
 			}
@@ -106,19 +111,37 @@ void CMatchManager::HLDestroyMatch(CMatch *match) {
 }
 
 //////////////////////////// CMatch public ////////////////////////////
-CMatch::CMatch(CMatchManager *matchManager, const CCloudResult *result) : expectedManager(matchManager), eventListeners(*(new chain<CMatchEventListener>)) {
-	playerData <<= new CHJSON;
-	matchData <<= new CHJSON;
+/**
+ * Moves posted and not done yet. The server gives its ID to the event of a move, and expects the last one with the next
+ * move, so they are sent one after the other as soon as the previous is answered. The match is retained for each.
+ */
+struct CMatch::MoveQueue {
+	struct Entry {
+		CMatchResultHandler *handler;
+		// Handed over to the request when sent
+		CHJSON *config;
+	};
+	std::deque<Entry> entries;
+	// Whether the first entry has been sent, after the event below
+	bool sending;
+	cstring sentAfter;
+	MoveQueue() : sending(false) {}
+};
+
+CMatch::CMatch(CMatchManager *matchManager, const CCloudResult *result) : expectedManager(matchManager), eventListeners(*(new chain<CMatchEventListener>)), state(*(new CMatchState)), moves(*(new MoveQueue)) {
 	UpdateFromMatchData(result->GetJSON());
 }
 
 CMatch::~CMatch() {
 	REST()->UnregisterEventListener(GetDomain(), this);
+	state.Save();
 	delete &eventListeners;
+	delete &state;
+	delete &moves;
 }
 
 const char *CMatch::GetDomain() {
-	return matchData->GetString("domain");
+	return state.Domain();
 }
 
 const char* CMatch::GetGamerId() {
@@ -126,27 +149,34 @@ const char* CMatch::GetGamerId() {
 }
 
 const char* CMatch::GetLastEventId() {
-	return lastEventId;
+	return state.LastEventId();
 }
 
 const char* CMatch::GetMatchId() {
-	return matchData->GetString("_id");
+	return state.Id();
 }
 
 const CHJSON * CMatch::GetPlayers() {
-	return playerData;
+	return state.Players();
+}
+
+int CMatch::GetMoveCount() {
+	return state.MoveCount();
+}
+
+const CHJSON *CMatch::GetMove(int index) {
+	return state.Move(index);
 }
 
 CMatch::State CMatch::GetStatus() {
-	const char *status = matchData->GetString("status", "finished");
-	if (IsEqual(status, "running")) {
+	if (IsEqual(state.Status(), "running")) {
 		return RUNNING;
 	}
 	return FINISHED;
 }
 
 bool CMatch::IsCreator() {
-	return IsEqual(matchData->GetSafe("creator")->GetString("gamer_id"), CUserManager::Instance()->GetGamerID());
+	return IsEqual(state.CreatorId(), CUserManager::Instance()->GetGamerID());
 }
 
 void CMatch::RegisterEventListener(CMatchEventListener *eventListener) {
@@ -166,26 +196,15 @@ void CMatch::UnregisterEventListener(CMatchEventListener *eventListener) {
 void CMatch::PostMove(CMatchResultHandler *handler, const CHJSON *moveData, const CHJSON *optionalUpdatedGameState, const CHJSON *optionalAdditionalData) {
 	if (!CheckManager()) { return InvokeHandler(handler, enObjectDestroyed); }
 
-	struct PostedMove: CInternalResultHandler {
-		_BLOCK2(PostedMove, CInternalResultHandler,
-			CMatch*, self,
-			CMatchResultHandler*, handler);
-		void Done(const CCloudResult *result) {
-			if (result->GetErrorCode() == enNoErr) {
-				// Keep the updated match
-				self->UpdateFromMatchData(result->GetJSON());
-			}
-			return InvokeHandler(handler, result, self);
-		}
-	};
-
-	CHJSON config;
-	config.Put("id", GetMatchId());
-	config.Put("lastEventId", GetLastEventId());
-	config.Put("move", moveData);
-	config.Put("globalState", optionalUpdatedGameState);
-	if (optionalAdditionalData) { config.Put("osn", optionalAdditionalData->Get("osn")); }
-	REST()->PostMove(&config, new PostedMove(this, handler));
+	// Applied at once, then confirmed or rolled back with the result
+	state.MoveQueued(GetGamerId(), moveData ? moveData->Duplicate() : new CHJSON);
+	MoveQueue::Entry entry = { handler, new CHJSON };
+	entry.config->Put("move", moveData);
+	entry.config->Put("globalState", optionalUpdatedGameState);
+	if (optionalAdditionalData) { entry.config->Put("osn", optionalAdditionalData->Get("osn")); }
+	Retain();
+	moves.entries.push_back(entry);
+	if (!moves.sending) { PostNextMove(); }
 }
 
 void CMatch::DrawFromShoe(CMatchResultHandler *handler, int count, const CHJSON *optionalAdditionalData) {
@@ -277,15 +296,69 @@ bool CMatch::CheckManager() {
 }
 
 void CMatch::UpdateFromMatchData(const CHJSON *json) {
-	// Copy match data to matchData -- only keep parts of the match to save memory
-	FOR_EACH (const CHJSON *node, *json->GetSafe("match")) {
-		if (IsEqual(node->name(), "players")) {
-			playerData <<= node->Duplicate();
-		} else if (!IsEqual(node->name(), "globalState") && !IsEqual(node->name(), "events")) {
-			matchData->Put(node->name(), node->Duplicate());
+	state.Update(json->GetSafe("match"));
+}
+
+void CMatch::PostNextMove() {
+	struct PostedMove: CInternalResultHandler {
+		_BLOCK1(PostedMove, CInternalResultHandler,
+			CMatch*, self);
+		void Done(const CCloudResult *result) {
+			self->MovePosted(result);
 		}
+	};
+
+	MoveQueue::Entry &entry = moves.entries.front();
+	CHJSON config (std::move(*entry.config));
+	delete entry.config;
+	entry.config = NULL;
+	moves.sending = true;
+	moves.sentAfter = GetLastEventId();
+	config.Put("id", GetMatchId());
+	config.Put("lastEventId", GetLastEventId());
+	REST()->PostMove(std::move(config), new PostedMove(this));
+}
+
+void CMatch::MovePosted(const CCloudResult *result) {
+	if (result->GetErrorCode() == enNoErr) {
+		cstring lastEventId (GetLastEventId());
+		// Before the events pending in the match, which may include this one
+		state.MoveConfirmed(result->GetJSON()->GetSafe("match")->GetString("lastEventId"));
+		UpdateFromMatchData(result->GetJSON());
+		// Events received meanwhile came after the move
+		if (!IsEqual(lastEventId, moves.sentAfter)) { state.SetLastEventId(lastEventId); }
+	} else {
+		// Most likely another event came first: the moves decided before it are undone
+		state.RollBackMoves(0);
+		CancelQueuedMoves(1);
+	}
+
+	MoveQueue::Entry done = moves.entries.front();
+	moves.entries.pop_front();
+	InvokeHandler(done.handler, result, this);
+	moves.sending = false;
+	if (!moves.entries.empty()) { PostNextMove(); }
+	Release();
+}
+
+void CMatch::CancelQueuedMoves(size_t kept) {
+	if (moves.entries.size() <= kept) {
+		return;
+	}
+	// The moves sent may have been confirmed already, by their events
+	state.RollBackMoves(state.PendingMoveCount() - (int) (moves.entries.size() - kept));
+	// Taken out first, as the handlers may post other moves
+	std::deque<MoveQueue::Entry> canceled;
+	while (moves.entries.size() > kept) {
+		canceled.push_front(moves.entries.back());
+		moves.entries.pop_back();
+	}
+	CCloudResult result(enCanceled, "The match changed before the move could be posted");
+	for (size_t i = 0; i < canceled.size(); i++) {
+		delete canceled[i].config;
+		InvokeHandler(canceled[i].handler, &result, this);
+		Release();
 	}
-	lastEventId = matchData->GetString("lastEventId");
 }
 
 //////////////////////////// CEventListener interface ////////////////////////////
@@ -296,32 +369,14 @@ void CMatch::onEventReceived(const char *domain, const CCloudResult *event) {
 		// Is this event for us?
 		const CHJSON *eventNode = event->GetJSON()->GetSafe("event");
 		if (IsEqual(eventNode->GetString("match_id"), GetMatchId())) {
-			// Handle it for ourselves
-			const char *type = event->GetJSON()->GetString("type");
-			// Keep for subsequent requests
-			lastEventId = eventNode->GetString("_id");
-			if (IsEqual(type, "match.join")) {
-				// Add joined players to the list
-				FOR_EACH (const CHJSON *node, *eventNode->GetSafe("playersJoined")) {
-					playerData->Add(node->Duplicate());
-				}
-			}
-			else if (IsEqual(type, "match.leave")) {
-				// Remove players who left from the list
-				CHJSON *players = CHJSON::Array();
-				FOR_EACH(const CHJSON *existing, *playerData) {
-					bool wasDeleted = false;
-					FOR_EACH (const CHJSON *left, *eventNode->GetSafe("playersLeft")) {
-						if (IsEqual(existing->GetString("gamer_id"), left->GetString("gamer_id"))) { wasDeleted = true; }
-					}
-					if (!wasDeleted) {
-						players->Add(existing->Duplicate());
-					}
-				}
-				playerData <<= players;
+			// Handle it for ourselves (players, moves, status and last event ID kept for subsequent requests)
+			if (!state.Apply(type, eventNode)) {
+				// Our own move, or received twice
+				return;
 			}
-			else if (IsEqual(type, "match.finish")) {
-				matchData->Put("status", "finished");
+			if (IsEqual(type, "match.move")) {
+				// The moves not sent yet were decided before this one
+				CancelQueuedMoves(1);
 			}
 
 			// And broadcast it to the listeners
@@ -341,6 +396,10 @@ void CMatchManager::CreateMatch(const CHJSON *configuration, CResultHandler *han
     return REST()->CreateMatch(configuration, MakeBridgeDelegate(handler));
 }
 
+void CMatchManager::CreateMatch(CHJSON &&configuration, CResultHandler *handler) {
+    return REST()->CreateMatch(std::move(configuration), MakeBridgeDelegate(handler));
+}
+
 void CMatchManager::CreateMatch(CResultHandler *handler, const CHJSON *configuration) {
     this->CreateMatch(configuration, handler);
 }
@@ -389,6 +448,10 @@ void CMatchManager::PostMove(const CHJSON *configuration, CResultHandler *handle
     return REST()->PostMove(configuration, MakeBridgeDelegate(handler));
 }
 
+void CMatchManager::PostMove(CHJSON &&configuration, CResultHandler *handler) {
+    return REST()->PostMove(std::move(configuration), MakeBridgeDelegate(handler));
+}
+
 void CMatchManager::PostMove(CResultHandler *handler, const CHJSON *configuration) {
     this->PostMove(configuration, handler);
 }
@@ -3,21 +3,23 @@
 #include "CClannishRESTProxy.h"
 #include "CStoreManager.h"
 #include "CStoreGlue.h"
+#include "CProductCatalog.h"
 #include "helpers.h"
+#include "CClientContext_private.h"
 
 using namespace CotCHelpers;
 using namespace CloudBuilder;
 
-static singleton_holder<CStoreManager> managerSingleton;
-
 //////////////////////////// Common manager stuff ////////////////////////////
-CStoreManager::CStoreManager() : currentlyProcessesProduct(false) {}
-CStoreManager::~CStoreManager() {}
-CStoreManager* CStoreManager::Instance() { return managerSingleton.Instance(); }
-void CStoreManager::Terminate() { managerSingleton.Release(); }
+CStoreManager::CStoreManager() : currentlyProcessesProduct(false), mCatalog(new CProductCatalog) {}
+CStoreManager::~CStoreManager() { delete mCatalog; }
+CStoreManager* CStoreManager::Instance() { return CClientContext::Current()->Internals().storeManager.Instance(); }
+void CStoreManager::Terminate() { CClientContext::Current()->Internals().storeManager.Release(); }
 
 //////////////////////////// Product & purchase ////////////////////////////
 void CStoreManager::FetchProductInformation(CResultHandler *onComplete, const CHJSON *configuration) {
+	// Concurrent calls then share the same request
+	if (mCatalog->IsEnabled()) { return mCatalog->FetchProductInformation(MakeBridgeDelegate(onComplete)); }
 	if (currentlyProcessesProduct) { return InvokeHandler(onComplete, enOperationAlreadyInProgress, "The Store is busy with another operation"); }
 	currentlyProcessesProduct = true;
 	CInternalResultHandler *handler = BuildExclusiveHandler(onComplete);
@@ -42,13 +44,24 @@ void CStoreManager::FetchProductInformation(CResultHandler *onComplete, const CH
 }
 
 void CStoreManager::GetPurchaseHistory(CResultHandler *aHandler, const CHJSON *aConfiguration) {
+	if (mCatalog->IsEnabled()) { return mCatalog->GetPurchaseHistory(MakeBridgeDelegate(aHandler)); }
 	CClannishRESTProxy::Instance()->GetPurchaseHistory(aConfiguration, MakeBridgeDelegate(aHandler));
 }
 
 void CStoreManager::LaunchPurchase(CResultHandler *onComplete, const CHJSON *configuration) {
 	if (currentlyProcessesProduct) { return InvokeHandler(onComplete, enOperationAlreadyInProgress, "The Store is busy with another operation"); }
 	currentlyProcessesProduct = true;
-	CInternalResultHandler *handler = BuildExclusiveHandler(onComplete);
+	// The purchase history changes, whatever the outcome seen here
+	struct Purchased: CInternalResultHandler {
+		_BLOCK2(Purchased, CInternalResultHandler,
+				CStoreManager*, self,
+				CInternalResultHandler*, handler);
+		void Done(const CCloudResult *result) {
+			self->mCatalog->PurchaseAttempted();
+			InvokeHandler(handler, result);
+		}
+	};
+	CInternalResultHandler *handler = new Purchased(this, BuildExclusiveHandler(onComplete));
 
 	const char *productId = configuration->GetString("productId");
 	if (!productId) { return InvokeHandler(handler, enBadParameters, "Missing productId"); }
@@ -83,7 +96,9 @@ void CStoreManager::LaunchPurchase(CResultHandler *onComplete, const CHJSON *con
 		}
 	};
 	
-	CClannishRESTProxy::Instance()->GetProductList(configuration, new ListOfProductsReceived(this, productId, handler));
+	CInternalResultHandler *listed = new ListOfProductsReceived(this, productId, handler);
+	if (mCatalog->IsEnabled()) { return mCatalog->GetProductList(listed); }
+	CClannishRESTProxy::Instance()->GetProductList(configuration, listed);
 }
 
 // Private
@@ -15,26 +15,30 @@
 #include "CTribeManager.h"
 #include "CClannishRESTProxy.h"
 #include "GameCenterHandler.h"
+#include "CClientContext_private.h"
+#include "CGameManager.h"
+#include "CLeaderboardCache.h"
+#include "CFriendsCache.h"
 
 using namespace CotCHelpers;
 
 namespace CloudBuilder {
 
-	static singleton_holder<CTribeManager> managerSingleton;
-	
-	CTribeManager::CTribeManager() : friendHandler(*(new CGloballyKeptHandler<CResultHandler>)) {
+	CTribeManager::CTribeManager() : friendHandler(*(new CGloballyKeptHandler<CResultHandler>)), mFriends(new CFriendsCache) {
 	}
 	
 	CTribeManager::~CTribeManager() {
 		delete &friendHandler;
+		// Also retained by the event loop it listens to, until stopped
+		mFriends->Release();
 	}
 	
 	CTribeManager *CTribeManager::Instance() {
-		return managerSingleton.Instance();
+		return CClientContext::Current()->Internals().tribeManager.Instance();
 	}
 
 	void CTribeManager::Terminate() {
-		managerSingleton.Release();
+		CClientContext::Current()->Internals().tribeManager.Release();
 	}
 
     void CTribeManager::ListUsers(const char *aContainsString, int aLimit, int aSkip, CResultHandler *aHandler)
@@ -54,6 +58,7 @@ namespace CloudBuilder {
     
     void CTribeManager::ListFriends(const char *aDomain, CResultHandler *aHandler) {
         if (!CClan::Instance()->isUserLogged()) { InvokeHandler(aHandler, enNotLogged); return; }
+        if (mFriends->IsEnabled()) { return mFriends->ListFriends(aDomain, aHandler); }
         CHJSON json;
         json.Put("domain", aDomain);
         CClannishRESTProxy::Instance()->ListFriends(&json, MakeBridgeDelegate(aHandler));
@@ -65,6 +70,7 @@ namespace CloudBuilder {
 			
     void CTribeManager::BlacklistFriends(const char *aDomain, CResultHandler *aHandler) {
         if (!CClan::Instance()->isUserLogged()) { InvokeHandler(aHandler, enNotLogged); return; }
+        if (mFriends->IsEnabled()) { return mFriends->BlacklistFriends(aDomain, aHandler); }
         CHJSON json;
         json.Put("domain", aDomain);
         CClannishRESTProxy::Instance()->BlacklistFriends(&json, MakeBridgeDelegate(aHandler));
@@ -78,6 +84,7 @@ namespace CloudBuilder {
         if (!CClan::Instance()->isUserLogged()) { InvokeHandler(aHandler, enNotLogged); return; }
         if (aOptions == NULL) { InvokeHandler(aHandler, enBadParameters); return; }
         if (IsEqual(aOptions->GetString("id", ""), CClannishRESTProxy::Instance()->GetGamerID())) { InvokeHandler(aHandler, enFriendYourself); return; }
+        if (mFriends->IsEnabled()) { return mFriends->ChangeRelationshipStatus(aOptions, aHandler); }
         CClannishRESTProxy::Instance()->ChangeRelationshipStatus(aOptions, MakeBridgeDelegate(aHandler));
     }
     
@@ -157,6 +164,8 @@ namespace CloudBuilder {
 
     void CTribeManager::FriendsBestHighScore(int aCount, int aPage, const char *aMode, const char *aDomain, CResultHandler *aHandler)
     {
+        CLeaderboardCache *leaderboards = CGameManager::Instance()->mLeaderboards;
+        if (leaderboards->IsEnabled()) { return leaderboards->FriendsBestHighScore(aCount, aPage, aMode, aDomain, aHandler); }
         CHJSON json;
         json.Put("count", aCount);
         json.Put("mode", aMode);
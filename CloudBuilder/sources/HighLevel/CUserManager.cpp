@@ -10,6 +10,7 @@
 #include <ctype.h>
 #include <stdlib.h>
 #include <stdio.h>
+#include <utility>
 #include "CClan.h"
 #include "CUserManager.h"
 #include "CloudBuilder_private.h"
@@ -19,22 +20,30 @@
 #include "CClannishRESTProxy.h"
 #include "GameCenterHandler.h"
 #include "CStoreGlue.h"
+#include "CClientContext_private.h"
+#include "CValueStore.h"
+#include "CPropertyShadow.h"
+#include "CProgressAggregator.h"
 
 #define LOGIN_PARAMS_PATH "cotcsystem/LoginParams.json"
 
 using namespace CotCHelpers;
 
 namespace CloudBuilder {
-	static singleton_holder<CUserManager> managerSingleton;
-
 	CUserManager::CUserManager() :
 	loginDoneHandler(*(new CGloballyKeptHandler<CResultHandler>)),
 	linkDoneHandler(*(new CGloballyKeptHandler<CResultHandler>)),
 	convertDoneHandler(*(new CGloballyKeptHandler<CResultHandler>)),
-	binaryDoneHandler(*(new CGloballyKeptHandler<CResultHandler>)) {
+	binaryDoneHandler(*(new CGloballyKeptHandler<CResultHandler>)),
+	mValueStore(new CValueStore),
+	mPropertyShadow(new CPropertyShadow),
+	mProgress(new CProgressAggregator) {
 	}
 	
 	CUserManager::~CUserManager() {
+		delete mValueStore;
+		delete mPropertyShadow;
+		delete mProgress;
 		delete &linkDoneHandler;
 		delete &loginDoneHandler;
 		delete &convertDoneHandler;
@@ -42,11 +51,11 @@ namespace CloudBuilder {
 	}
 
 	CUserManager *CUserManager::Instance() {
-		return managerSingleton.Instance();
+		return CClientContext::Current()->Internals().userManager.Instance();
 	}
 
 	void CUserManager::Terminate() {
-		managerSingleton.Release();
+		CClientContext::Current()->Internals().userManager.Release();
 	}
 
 	const char *CUserManager::GetDisplayName()
@@ -77,6 +86,8 @@ namespace CloudBuilder {
 		if (CClannishRESTProxy::Instance()->isLinkedWith("gamecenter")) {
 			GameCenter::logout(NULL);
 		}
+		// Sent before the logout, with the credentials of the gamer
+		mProgress->Flush();
 		
 		CClannishRESTProxy::Instance()->Logout(NULL, MakeBridgeDelegate(this, &CUserManager::LogoutDone, aHandler));
 	}
@@ -90,15 +101,24 @@ namespace CloudBuilder {
 		persistedLoginParams.mGamerSecret = NULL;
 		mAccountNetwork = NULL;
 		CommitLoginParams();
+		mValueStore->Close();
+		mPropertyShadow->Clear();
+		mProgress->Clear();
 		//CloudBuilder::CClannishRESTProxy::Instance()->Suspend(); mainthread ?
 	}
 
 	void CUserManager::didLogin(const CCloudResult *result) {
 		if (result->GetErrorCode() == enNoErr) {
+			// Progress held for another gamer can't be sent anymore
+			if (!IsEqual(persistedLoginParams.mGamerId, result->GetJSON()->GetString("gamer_id")))
+				mProgress->Clear();
 			persistedLoginParams.mGamerId = result->GetJSON()->GetString("gamer_id");
 			persistedLoginParams.mGamerSecret = result->GetJSON()->GetString("gamer_secret");
 			mAccountNetwork = result->GetJSON()->GetString("network");
 			CommitLoginParams();
+			if (mValueStore->IsEnabled())
+				mValueStore->Open(persistedLoginParams.mGamerId);
+			mPropertyShadow->Clear();
 			// If we're effectively logged in, launch a listener for the private event domain
 			if (CClannishRESTProxy::Instance()->autoRegisterForNotification())
 				this->RegisterForNotification();
@@ -282,6 +302,7 @@ namespace CloudBuilder {
 
 	void CUserManager::ChangeEmail(const char *aNewEmail, CResultHandler *aHandler) {
 		if (!CClan::Instance()->isUserLogged()) { InvokeHandler(aHandler, enNotLogged); return; }
+		mPropertyShadow->ForgetProfile();
 		CClannishRESTProxy::Instance()->ChangeEmail(aNewEmail, MakeBridgeDelegate(aHandler));
 	}
 
@@ -444,6 +465,8 @@ namespace CloudBuilder {
 	}
 	
 	void CUserManager::linkDone(const CCloudResult *res) {
+		// May have brought a display name or picture
+		mPropertyShadow->ForgetProfile();
 		linkDoneHandler.Invoke(res);
 	}
 	
@@ -517,6 +540,7 @@ namespace CloudBuilder {
 	}
 	
 	void CUserManager::convertDone(const CloudBuilder::CCloudResult *res) {
+		mPropertyShadow->ForgetProfile();
 		convertDoneHandler.Invoke(res);
 	}
 	
@@ -577,39 +601,60 @@ namespace CloudBuilder {
 		if (!CClan::Instance()->isSetup()) { InvokeHandler(aHandler, enSetupNotCalled); return; }
 		if (!CClan::Instance()->isUserLogged()) { InvokeHandler(aHandler, enNotLogged); return; }
 		
+		if (mPropertyShadow->IsEnabled()) { return mPropertyShadow->SetProfile(aJson->Duplicate(), aHandler); }
 		CClannishRESTProxy::Instance()->SetUserProfile(aJson, MakeBridgeDelegate(aHandler));
 	}
+
+	void CUserManager::SetProfile(CotCHelpers::CHJSON &&aJson, CResultHandler *aHandler) {
+		if (!CClan::Instance()->isSetup()) { InvokeHandler(aHandler, enSetupNotCalled); return; }
+		if (!CClan::Instance()->isUserLogged()) { InvokeHandler(aHandler, enNotLogged); return; }
+		
+		if (mPropertyShadow->IsEnabled()) { return mPropertyShadow->SetProfile(new CHJSON(std::move(aJson)), aHandler); }
+		CClannishRESTProxy::Instance()->SetUserProfile(std::move(aJson), MakeBridgeDelegate(aHandler));
+	}
 		
 	void CUserManager::GetProfile(CResultHandler *aHandler) {
 		if (!CClan::Instance()->isSetup()) { InvokeHandler(aHandler, enSetupNotCalled); return; }
 		if (!CClan::Instance()->isUserLogged()) { InvokeHandler(aHandler, enNotLogged); return; }
 
+		if (mPropertyShadow->IsEnabled()) { return mPropertyShadow->GetProfile(aHandler); }
 		CHJSON emptyJson;
 		CClannishRESTProxy::Instance()->GetUserProfile(&emptyJson, MakeBridgeDelegate(aHandler));
 	}
 	
 
-	void CUserManager::SetProperties(const CotCHelpers::CHJSON* aPropertiesList, const char *aDomain, CResultHandler *aHandler) {
-		if (!CClan::Instance()->isSetup()) { InvokeHandler(aHandler, enSetupNotCalled); return; }
-		if (!CClan::Instance()->isUserLogged()) { InvokeHandler(aHandler, enNotLogged); return; }
+	// Checks the arguments common to both variants of SetProperties; invokes the handler and returns false if they are invalid
+	static bool CheckSetProperties(const CHJSON *aPropertiesList, CResultHandler *aHandler) {
+		if (!CClan::Instance()->isSetup()) { InvokeHandler(aHandler, enSetupNotCalled); return false; }
+		if (!CClan::Instance()->isUserLogged()) { InvokeHandler(aHandler, enNotLogged); return false; }
 		
 		if (aPropertiesList->type() != CHJSON::jsonObject) {
 			InvokeHandler(aHandler, enBadParameters, "Malformed properties JSON (must be an object)");
-			return;
+			return false;
 		}
 			
-		int nb = aPropertiesList->size();
-		for (int i=0; i<nb; i++) {
-			const CHJSON * j = aPropertiesList->GetSafe(i);
-			CHJSON::jsonType t = j->type();
+		// Iterating avoids walking the list again for each property
+		for (CHJSON::Iterator it = aPropertiesList->begin(); it != aPropertiesList->end(); ++it) {
+			CHJSON::jsonType t = (*it)->type();
 			if (t != CHJSON::jsonTrue && t != CHJSON::jsonFalse && t != CHJSON::jsonString && t != CHJSON::jsonNumber) {
 				InvokeHandler(aHandler, enBadParameters, "Malformed properties JSON (unrecognized property type)");
-				return;
+				return false;
 			}
 		}
-			  
+		return true;
+	}
+
+	void CUserManager::SetProperties(const CotCHelpers::CHJSON* aPropertiesList, const char *aDomain, CResultHandler *aHandler) {
+		if (!CheckSetProperties(aPropertiesList, aHandler)) { return; }
+		if (mPropertyShadow->IsEnabled()) { return mPropertyShadow->SetProperties(aDomain, aPropertiesList->Duplicate(), aHandler); }
 		CClannishRESTProxy::Instance()->UserSetProperties(aDomain, aPropertiesList, MakeBridgeDelegate(aHandler));
 	}
+
+	void CUserManager::SetProperties(CotCHelpers::CHJSON &&aPropertiesList, const char *aDomain, CResultHandler *aHandler) {
+		if (!CheckSetProperties(&aPropertiesList, aHandler)) { return; }
+		if (mPropertyShadow->IsEnabled()) { return mPropertyShadow->SetProperties(aDomain, new CHJSON(std::move(aPropertiesList)), aHandler); }
+		CClannishRESTProxy::Instance()->UserSetProperties(aDomain, std::move(aPropertiesList), MakeBridgeDelegate(aHandler));
+	}
 	
     void CUserManager::SetProperties(CResultHandler *aHandler, const CotCHelpers::CHJSON* aPropertiesList, const char *aDomain) {
         this->SetProperties(aPropertiesList, aDomain, aHandler);
@@ -619,6 +664,7 @@ namespace CloudBuilder {
 		if (!CClan::Instance()->isSetup()) { InvokeHandler(aHandler, enSetupNotCalled); return; }
 		if (!CClan::Instance()->isUserLogged()) { InvokeHandler(aHandler, enNotLogged); return; }
 
+		if (mPropertyShadow->IsEnabled()) { return mPropertyShadow->GetProperties(aDomain, aHandler); }
 		CClannishRESTProxy::Instance()->UserGetProperties(aDomain, MakeBridgeDelegate(aHandler));
    }
 
@@ -626,29 +672,41 @@ namespace CloudBuilder {
         return GetProperties(aDomain, aHandler);
     }
     
-	void CUserManager::SetProperty(const CotCHelpers::CHJSON* aProperty, const char *aDomain, CResultHandler *aHandler) {
-		if (!CClan::Instance()->isSetup()) { InvokeHandler(aHandler, enSetupNotCalled); return; }
-		if (!CClan::Instance()->isUserLogged()) { InvokeHandler(aHandler, enNotLogged); return; }
+	// Same as CheckSetProperties for SetProperty
+	static bool CheckSetProperty(const CHJSON *aProperty, CResultHandler *aHandler) {
+		if (!CClan::Instance()->isSetup()) { InvokeHandler(aHandler, enSetupNotCalled); return false; }
+		if (!CClan::Instance()->isUserLogged()) { InvokeHandler(aHandler, enNotLogged); return false; }
 		
 		if (aProperty->type() != CHJSON::jsonObject) {
 			InvokeHandler(aHandler, enBadParameters, "Malformed properties JSON (must be an object)");
-			return;
+			return false;
 		}
 		
-		if (!aProperty->Has("key")) return InvokeHandler(aHandler, enBadParameters, "Malformed properties JSON (key not found)");
+		if (!aProperty->Has("key")) { InvokeHandler(aHandler, enBadParameters, "Malformed properties JSON (key not found)"); return false; }
 		
-		if (!aProperty->Has("value")) return InvokeHandler(aHandler, enBadParameters, "Malformed properties JSON (value not found)");
+		if (!aProperty->Has("value")) { InvokeHandler(aHandler, enBadParameters, "Malformed properties JSON (value not found)"); return false; }
 
 		const CHJSON * j = aProperty->GetSafe("value");
 		CHJSON::jsonType t = j->type();
 		if (t != CHJSON::jsonTrue && t != CHJSON::jsonFalse && t != CHJSON::jsonString && t != CHJSON::jsonNumber) {
 			InvokeHandler(aHandler, enBadParameters, "Malformed properties JSON (unrecognized property type)");
-			return;
+			return false;
 		}
-		
+		return true;
+	}
+
+	void CUserManager::SetProperty(const CotCHelpers::CHJSON* aProperty, const char *aDomain, CResultHandler *aHandler) {
+		if (!CheckSetProperty(aProperty, aHandler)) { return; }
+		if (mPropertyShadow->IsEnabled()) { return mPropertyShadow->SetProperty(aDomain, aProperty->Duplicate(), aHandler); }
 		CClannishRESTProxy::Instance()->UserSetProperty(aDomain, aProperty, MakeBridgeDelegate(aHandler));
 	}
 
+	void CUserManager::SetProperty(CotCHelpers::CHJSON &&aProperty, const char *aDomain, CResultHandler *aHandler) {
+		if (!CheckSetProperty(&aProperty, aHandler)) { return; }
+		if (mPropertyShadow->IsEnabled()) { return mPropertyShadow->SetProperty(aDomain, new CHJSON(std::move(aProperty)), aHandler); }
+		CClannishRESTProxy::Instance()->UserSetProperty(aDomain, std::move(aProperty), MakeBridgeDelegate(aHandler));
+	}
+
     void CUserManager::SetProperty(CResultHandler *aHandler, const CotCHelpers::CHJSON* aProperty, const char *aDomain) {
         this->SetProperty(aProperty, aDomain, aHandler);
     }
@@ -667,6 +725,7 @@ namespace CloudBuilder {
     void CUserManager::DeleteProperty(const char *aField, const char *aDomain, CResultHandler *aHandler) {
 		if (!CClan::Instance()->isSetup()) { InvokeHandler(aHandler, enSetupNotCalled); return; }
 		if (!CClan::Instance()->isUserLogged()) { InvokeHandler(aHandler, enNotLogged); return; }
+		if (mPropertyShadow->IsEnabled()) { return mPropertyShadow->DeleteProperty(aDomain, aField, aHandler); }
 		CClannishRESTProxy::Instance()->UserDelProperty(aDomain, aField, MakeBridgeDelegate(aHandler));
 		
 	}
@@ -712,6 +771,7 @@ namespace CloudBuilder {
         if (!CClan::Instance()->isUserLogged()) { InvokeHandler(aHandler, enNotLogged); return; }
         const char *domain = aConfiguration->GetString("domain");
         const char *key = aConfiguration->GetString("key");
+        if (mValueStore->IsOpen() && key && *key) { return mValueStore->Get(domain, key, aHandler); }
         
         CClannishRESTProxy::Instance()->vfsReadv3(domain, key, MakeBridgeDelegate(aHandler));
     }
@@ -722,16 +782,49 @@ namespace CloudBuilder {
         const char *key = aConfiguration->GetString("key");
         const CHJSON *value = aConfiguration->Get("data");
         if (!value) { InvokeHandler(aHandler, enBadParameters, "Missing data"); return; }
+        if (mValueStore->IsOpen()) {
+            if (key && *key) { return mValueStore->Set(domain, key, value->Duplicate(), aHandler); }
+            mValueStore->Forget(domain);
+        }
         
         CClannishRESTProxy::Instance()->vfsWritev3(domain, key, value, false, MakeBridgeDelegate(aHandler));
     }
     
+    void CUserManager::SetValue(CHJSON &&aConfiguration, CResultHandler *aHandler) {
+        if (!CClan::Instance()->isUserLogged()) { InvokeHandler(aHandler, enNotLogged); return; }
+        const char *domain = aConfiguration.GetString("domain");
+        const char *key = aConfiguration.GetString("key");
+        CHJSON *value = aConfiguration.Extract("data");
+        if (!value) { InvokeHandler(aHandler, enBadParameters, "Missing data"); return; }
+        if (mValueStore->IsOpen()) {
+            if (key && *key) { return mValueStore->Set(domain, key, value, aHandler); }
+            mValueStore->Forget(domain);
+        }
+        
+        CClannishRESTProxy::Instance()->vfsWritev3(domain, key, std::move(*value), false, MakeBridgeDelegate(aHandler));
+        delete value;
+    }
+    
     void CUserManager::DeleteValue(const CHJSON *aConfiguration, CResultHandler *aHandler) {
         if (!CClan::Instance()->isUserLogged()) { InvokeHandler(aHandler, enNotLogged); return; }
         const char *domain = aConfiguration->GetString("domain");
         const char *key = aConfiguration->GetString("key");
+        if (mValueStore->IsOpen()) {
+            if (key && *key) { return mValueStore->Delete(domain, key, aHandler); }
+            mValueStore->Forget(domain);
+        }
         CClannishRESTProxy::Instance()->vfsDelete(domain, key, false, MakeBridgeDelegate(aHandler));
     }
+
+    void CUserManager::FlushValues(CResultHandler *aHandler) {
+        if (!CClan::Instance()->isUserLogged()) { InvokeHandler(aHandler, enNotLogged); return; }
+        if (!mValueStore->IsOpen()) { InvokeHandler(aHandler, enNoErr); return; }
+        mValueStore->Flush(aHandler);
+    }
+
+    void CUserManager::SetValueConflictHandler(CDelegate<void (CValueConflictEventArgs&)> *aHandler) {
+        mValueStore->SetConflictHandler(aHandler);
+    }
     
 	void CUserManager::KeyValueDelete(const CHJSON *aConfiguration, CResultHandler *aHandler) {
         this->DeleteValue(aConfiguration, aHandler);
@@ -848,6 +941,11 @@ namespace CloudBuilder {
 	}
 
 	void CUserManager::EarnAchievement(const char *unit, int increment, const CHJSON *gamerData, CResultHandler *handler) {
+		if (mProgress->IsEnabled() && !gamerData) {
+			if (!CClan::Instance()->isUserLogged()) { InvokeHandler(handler, enNotLogged); return; }
+			return mProgress->EarnAchievement(unit, increment, handler);
+		}
+
 		struct TransactionDone: CInternalResultHandler {
 			_BLOCK1(TransactionDone, CInternalResultHandler,
 					CResultHandler*, resultHandler);
@@ -914,15 +1012,15 @@ namespace CloudBuilder {
 	}
 	
 	void CUserManager::PushEvent(const char *aDomain, const char* aGamerid, const CotCHelpers::CHJSON *aEvent, const CotCHelpers::CHJSON *aNotification, CResultHandler *aHandler) {
-		CHJSON *message = new CHJSON();
-		message->Put("type", "user");
-		message->Put("event", aEvent);
-		message->Put("from", this->GetGamerID());
-		message->Put("name", this->GetDisplayName());
-		message->Put("to" , aGamerid);
+		CHJSON message;
+		message.Put("type", "user");
+		message.Put("event", aEvent);
+		message.Put("from", this->GetGamerID());
+		message.Put("name", this->GetDisplayName());
+		message.Put("to" , aGamerid);
 		if (aNotification)
-			message->Put("osn", aNotification);
-		CClannishRESTProxy::Instance()->PushEvent(aDomain, aGamerid, message, MakeBridgeDelegate(aHandler));
+			message.Put("osn", aNotification);
+		CClannishRESTProxy::Instance()->PushEvent(aDomain, aGamerid, std::move(message), MakeBridgeDelegate(aHandler));
 	}
 
 	void CUserManager::DoSetupProcesses(CResultHandler *aHandler) {
@@ -954,6 +1052,11 @@ namespace CloudBuilder {
 		CClannishRESTProxy::Instance()->BatchUser(aConfiguration, aParameters, MakeBridgeDelegate(aHandler));
 	}
 
+	void CUserManager::Batch(const CotCHelpers::CHJSON *aConfiguration, CotCHelpers::CHJSON &&aParameters, CResultHandler *aHandler) {
+		if (!CClan::Instance()->isUserLogged()) { InvokeHandler(aHandler, enNotLogged); return; }
+		CClannishRESTProxy::Instance()->BatchUser(aConfiguration, std::move(aParameters), MakeBridgeDelegate(aHandler));
+	}
+
     void CUserManager::Batch(CResultHandler *aHandler, const CotCHelpers::CHJSON *aConfiguration, const CotCHelpers::CHJSON *aParameters) {
         this->Batch(aConfiguration, aParameters, aHandler);
     }
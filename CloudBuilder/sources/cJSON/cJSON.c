@@ -44,8 +44,14 @@ static int cJSON_strcasecmp(const char *s1,const char *s2)
 }
 
 //	CLOUDBUILDER COTC MODIFICATION	//
-static void *(*cJSON_malloc)(size_t sz) = malloc;
-static void (*cJSON_free)(void *ptr) = free;
+// Nodes go through the SDK allocator (CAllocator.cpp). Printed text however is handed over to the caller,
+// who releases it with free(), so it keeps using the C library.
+extern void *cotc_json_malloc(size_t sz);
+extern void cotc_json_free(void *ptr);
+static void *(*cJSON_malloc)(size_t sz) = cotc_json_malloc;
+static void (*cJSON_free)(void *ptr) = cotc_json_free;
+#define print_malloc	malloc
+#define print_free		free
 //	CLOUDBUILDER COTC MODIFICATION	//
 
 static char* cJSON_strdup(const char* str)
@@ -59,11 +65,22 @@ static char* cJSON_strdup(const char* str)
 	  return copy;
 }
 
+//	CLOUDBUILDER COTC MODIFICATION	//
+static char* print_strdup(const char* str)
+{
+	  size_t len = strlen(str) + 1;
+	  char* copy;
+	  if (!(copy = (char*)print_malloc(len))) return 0;
+	  memcpy(copy,str,len);
+	  return copy;
+}
+//	CLOUDBUILDER COTC MODIFICATION	//
+
 void cJSON_InitHooks(cJSON_Hooks* hooks)
 {
 	if (!hooks) { /* Reset hooks */
-		cJSON_malloc = malloc;
-		cJSON_free = free;
+		cJSON_malloc = cotc_json_malloc;	// CLOUDBUILDER COTC MODIFICATION
+		cJSON_free = cotc_json_free;		// CLOUDBUILDER COTC MODIFICATION
 		return;
 	}
 
@@ -124,12 +141,12 @@ static char *print_number(cJSON *item)
 	double d=item->valuedouble;
 	if (fabs(((double)item->valueint)-d)<=DBL_EPSILON && d<=INT_MAX && d>=INT_MIN)
 	{
-		str=(char*)cJSON_malloc(21);	/* 2^64+1 can be represented in 21 chars. */
+		str=(char*)print_malloc(21);	/* 2^64+1 can be represented in 21 chars. */
 		if (str) sprintf(str,"%d",item->valueint);
 	}
 	else
 	{
-		str=(char*)cJSON_malloc(64);	/* This is a nice tradeoff. */
+		str=(char*)print_malloc(64);	/* This is a nice tradeoff. */
 		if (str)
 		{
 			if (fabs(floor(d)-d)<=DBL_EPSILON)			sprintf(str,"%.0f",d);
@@ -194,10 +211,10 @@ static char *print_string_ptr(const char *str)
 {
 	const char *ptr;char *ptr2,*out;int len=0;unsigned char token;
 	
-	if (!str) return cJSON_strdup("");
+	if (!str) return print_strdup("");
 	ptr=str;while ((token=*ptr) && ++len) {if (strchr("\"\\\b\f\n\r\t",token)) len++; else if (token<32) len+=5;ptr++;}
 	
-	out=(char*)cJSON_malloc(len+3);
+	out=(char*)print_malloc(len+3);
 	if (!out) return 0;
 
 	ptr2=out;ptr=str;
@@ -275,9 +292,9 @@ static char *print_value(cJSON *item,int depth,int fmt)
 	if (!item) return 0;
 	switch ((item->type)&255)
 	{
-		case cJSON_NULL:	out=cJSON_strdup("null");	break;
-		case cJSON_False:	out=cJSON_strdup("false");break;
-		case cJSON_True:	out=cJSON_strdup("true"); break;
+		case cJSON_NULL:	out=print_strdup("null");	break;
+		case cJSON_False:	out=print_strdup("false");break;
+		case cJSON_True:	out=print_strdup("true"); break;
 		case cJSON_Number:	out=print_number(item);break;
 		case cJSON_String:	out=print_string(item);break;
 		case cJSON_Array:	out=print_array(item,depth,fmt);break;
@@ -325,7 +342,7 @@ static char *print_array(cJSON *item,int depth,int fmt)
 	/* How many entries in the array? */
 	while (child) numentries++,child=child->next;
 	/* Allocate an array to hold the values for each */
-	entries=(char**)cJSON_malloc(numentries*sizeof(char*));
+	entries=(char**)print_malloc(numentries*sizeof(char*));
 	if (!entries) return 0;
 	memset(entries,0,numentries*sizeof(char*));
 	/* Retrieve all the results: */
@@ -339,15 +356,15 @@ static char *print_array(cJSON *item,int depth,int fmt)
 	}
 	
 	/* If we didn't fail, try to malloc the output string */
-	if (!fail) out=(char*)cJSON_malloc(len);
+	if (!fail) out=(char*)print_malloc(len);
 	/* If that fails, we fail. */
 	if (!out) fail=1;
 
 	/* Handle failure. */
 	if (fail)
 	{
-		for (i=0;i<numentries;i++) if (entries[i]) cJSON_free(entries[i]);
-		cJSON_free(entries);
+		for (i=0;i<numentries;i++) if (entries[i]) print_free(entries[i]);
+		print_free(entries);
 		return 0;
 	}
 	
@@ -358,9 +375,9 @@ static char *print_array(cJSON *item,int depth,int fmt)
 	{
 		strcpy(ptr,entries[i]);ptr+=strlen(entries[i]);
 		if (i!=numentries-1) {*ptr++=',';if(fmt)*ptr++=' ';*ptr=0;}
-		cJSON_free(entries[i]);
+		print_free(entries[i]);
 	}
-	cJSON_free(entries);
+	print_free(entries);
 	*ptr++=']';*ptr++=0;
 	return out;	
 }
@@ -411,10 +428,10 @@ static char *print_object(cJSON *item,int depth,int fmt)
 	/* Count the number of entries. */
 	while (child) numentries++,child=child->next;
 	/* Allocate space for the names and the objects */
-	entries=(char**)cJSON_malloc(numentries*sizeof(char*));
+	entries=(char**)print_malloc(numentries*sizeof(char*));
 	if (!entries) return 0;
-	names=(char**)cJSON_malloc(numentries*sizeof(char*));
-	if (!names) {cJSON_free(entries);return 0;}
+	names=(char**)print_malloc(numentries*sizeof(char*));
+	if (!names) {print_free(entries);return 0;}
 	memset(entries,0,sizeof(char*)*numentries);
 	memset(names,0,sizeof(char*)*numentries);
 
@@ -429,14 +446,14 @@ static char *print_object(cJSON *item,int depth,int fmt)
 	}
 	
 	/* Try to allocate the output string */
-	if (!fail) out=(char*)cJSON_malloc(len);
+	if (!fail) out=(char*)print_malloc(len);
 	if (!out) fail=1;
 
 	/* Handle failure */
 	if (fail)
 	{
-		for (i=0;i<numentries;i++) {if (names[i]) cJSON_free(names[i]);if (entries[i]) cJSON_free(entries[i]);}
-		cJSON_free(names);cJSON_free(entries);
+		for (i=0;i<numentries;i++) {if (names[i]) print_free(names[i]);if (entries[i]) print_free(entries[i]);}
+		print_free(names);print_free(entries);
 		return 0;
 	}
 	
@@ -450,10 +467,10 @@ static char *print_object(cJSON *item,int depth,int fmt)
 		strcpy(ptr,entries[i]);ptr+=strlen(entries[i]);
 		if (i!=numentries-1) *ptr++=',';
 		if (fmt) *ptr++='\n';*ptr=0;
-		cJSON_free(names[i]);cJSON_free(entries[i]);
+		print_free(names[i]);print_free(entries[i]);
 	}
 	
-	cJSON_free(names);cJSON_free(entries);
+	print_free(names);print_free(entries);
 	if (fmt) for (i=0;i<depth-1;i++) *ptr++='\t';
 	*ptr++='}';*ptr++=0;
 	return out;	
@@ -487,6 +504,36 @@ void   cJSON_ReplaceItemInArray(cJSON *array,int which,cJSON *newitem)		{cJSON *
 	if (c==array->child) array->child=newitem; else newitem->prev->next=newitem;c->next=c->prev=0;cJSON_Delete(c);}
 void   cJSON_ReplaceItemInObject(cJSON *object,const char *string,cJSON *newitem){int i=0;cJSON *c=object->child;while(c && cJSON_strcasecmp(c->string,string))i++,c=c->next;if(c){newitem->string=cJSON_strdup(string);cJSON_ReplaceItemInArray(object,i,newitem);}}
 
+//	CLOUDBUILDER COTC MODIFICATION	//
+/* Duplication */
+cJSON *cJSON_Duplicate(cJSON *item,int recurse)
+{
+	cJSON *newitem,*cptr,*nptr=0,*newchild;
+	/* Bail on bad ptr */
+	if (!item) return 0;
+	/* Create new item */
+	newitem=cJSON_New_Item();
+	if (!newitem) return 0;
+	/* Copy over all vars */
+	newitem->type=item->type&(~cJSON_IsReference),newitem->valueint=item->valueint,newitem->valuedouble=item->valuedouble;
+	if (item->valuestring)	{newitem->valuestring=cJSON_strdup(item->valuestring);	if (!newitem->valuestring)	{cJSON_Delete(newitem);return 0;}}
+	if (item->string)		{newitem->string=cJSON_strdup(item->string);			if (!newitem->string)		{cJSON_Delete(newitem);return 0;}}
+	/* If non-recursive, then we're done! */
+	if (!recurse) return newitem;
+	/* Walk the ->next chain for the child. */
+	cptr=item->child;
+	while (cptr)
+	{
+		newchild=cJSON_Duplicate(cptr,1);		/* Duplicate (with recurse) each item in the ->next chain */
+		if (!newchild) {cJSON_Delete(newitem);return 0;}
+		if (nptr)	{nptr->next=newchild,newchild->prev=nptr;nptr=newchild;}	/* If newitem->child already set, then crosswire ->prev and ->next and move on */
+		else		{newitem->child=newchild;nptr=newchild;}					/* Set newitem->child and move to it */
+		cptr=cptr->next;
+	}
+	return newitem;
+}
+//	CLOUDBUILDER COTC MODIFICATION	//
+
 /* Create basic types: */
 cJSON *cJSON_CreateNull(void)						{cJSON *item=cJSON_New_Item();if(item)item->type=cJSON_NULL;return item;}
 cJSON *cJSON_CreateTrue(void)						{cJSON *item=cJSON_New_Item();if(item)item->type=cJSON_True;return item;}
@@ -114,6 +114,14 @@ void   cJSON_DeleteItemFromObject(cJSON *object,const char *string);
 void cJSON_ReplaceItemInArray(cJSON *array,int which,cJSON *newitem);
 void cJSON_ReplaceItemInObject(cJSON *object,const char *string,cJSON *newitem);
 
+//	CLOUDBUILDER COTC MODIFICATION	//
+/* Duplicate a cJSON item (backported from later versions of cJSON) */
+cJSON *cJSON_Duplicate(cJSON *item,int recurse);
+/* Duplicate will create a new, identical cJSON item to the one you pass, in new memory that will
+need to be released. With recurse!=0, it will duplicate any children connected to the item.
+The item->next and ->prev pointers are always zero on return from Duplicate. */
+//	CLOUDBUILDER COTC MODIFICATION	//
+
 #define cJSON_AddNullToObject(object,name)	cJSON_AddItemToObject(object, name, cJSON_CreateNull())
 #define cJSON_AddTrueToObject(object,name)	cJSON_AddItemToObject(object, name, cJSON_CreateTrue())
 #define cJSON_AddFalseToObject(object,name)		cJSON_AddItemToObject(object, name, cJSON_CreateFalse())
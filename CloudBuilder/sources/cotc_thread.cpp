@@ -10,8 +10,14 @@
 #include <stdlib.h>
 #include "cotc_thread.h"
 #include "CloudBuilder_private.h"
+#include "CClientContext_private.h"
 #include <pthread.h>
 #include <time.h>
+#include <deque>
+#include <map>
+#include <vector>
+#include <thread>
+#include <chrono>
 
 using namespace CotCHelpers;
 
@@ -115,7 +121,16 @@ void *CThread::startupRoutine(void *class_cotcThread) {
 //////////////////////////// Condition variable //////////////////////////////////////////////
 CConditionVariable::CConditionVariable() {
 	mVars = new CConditionVariableVars;
+#if defined(WIN32) || defined(__APPLE__)
 	pthread_cond_init(&mVars->cond, NULL);
+#else
+	// Measure timed waits on the monotonic clock
+	pthread_condattr_t attr;
+	pthread_condattr_init(&attr);
+	pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+	pthread_cond_init(&mVars->cond, &attr);
+	pthread_condattr_destroy(&attr);
+#endif
 }
 
 CConditionVariable::~CConditionVariable() {
@@ -142,20 +157,310 @@ void CConditionVariable::SignalOne() {
 bool CConditionVariable::Wait(int timeoutMilliseconds) {
 	if (timeoutMilliseconds == 0) {
 		return pthread_cond_wait(&mVars->cond, &mMutex.mVars->mutex) == 0;
-	} else {
-		timeval tv;
-		timespec ts;
-		gettimeofday(&tv, NULL);
-		ts.tv_sec = time(NULL) + timeoutMilliseconds / 1000;
-		ts.tv_nsec = tv.tv_usec * 1000 + 1000 * 1000 * (timeoutMilliseconds % 1000);
-		ts.tv_sec += ts.tv_nsec / (1000 * 1000 * 1000);
-		ts.tv_nsec %= (1000 * 1000 * 1000);
-		return pthread_cond_timedwait(&mVars->cond, &mMutex.mVars->mutex, &ts) == 0;
+	}
+	timespec ts;
+#if defined(__APPLE__)
+	// Relative waits are not affected by changes of the system time
+	ts.tv_sec = timeoutMilliseconds / 1000;
+	ts.tv_nsec = 1000 * 1000 * (timeoutMilliseconds % 1000);
+	return pthread_cond_timedwait_relative_np(&mVars->cond, &mMutex.mVars->mutex, &ts) == 0;
+#else
+#	ifdef WIN32
+	// No monotonic clock available for the deadline
+	timeval tv;
+	gettimeofday(&tv, NULL);
+	ts.tv_sec = tv.tv_sec;
+	ts.tv_nsec = tv.tv_usec * 1000;
+#	else
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+#	endif
+	ts.tv_sec += timeoutMilliseconds / 1000;
+	ts.tv_nsec += 1000 * 1000 * (timeoutMilliseconds % 1000);
+	ts.tv_sec += ts.tv_nsec / (1000 * 1000 * 1000);
+	ts.tv_nsec %= (1000 * 1000 * 1000);
+	return pthread_cond_timedwait(&mVars->cond, &mMutex.mVars->mutex, &ts) == 0;
+#endif
+}
+
+//////////////////////////// Monotonic sleeps //////////////////////////////////////////////
+long long CloudBuilder::MonotonicMilliseconds() {
+	using namespace std::chrono;
+	return duration_cast<milliseconds>(steady_clock::now().time_since_epoch()).count();
+}
+
+unsigned CloudBuilder::CWakeUpSignal::Token() {
+	mCondition.LockVar();
+	unsigned token = mWakeUpCount;
+	mCondition.UnlockVar();
+	return token;
+}
+
+bool CloudBuilder::CWakeUpSignal::Sleep(int milliseconds, unsigned token) {
+	long long deadline = MonotonicMilliseconds() + milliseconds;
+	bool elapsed = false;
+	mCondition.LockVar();
+	// Spurious wakeups are ignored; the remaining time is computed from the deadline
+	while (mWakeUpCount == token && !elapsed) {
+		long long remaining = deadline - MonotonicMilliseconds();
+		if (milliseconds == 0) {
+			mCondition.Wait();
+		} else if (remaining > 0) {
+			mCondition.Wait((int) remaining);
+		} else {
+			elapsed = true;
+		}
+	}
+	mCondition.UnlockVar();
+	return elapsed;
+}
+
+void CloudBuilder::CWakeUpSignal::WakeUp() {
+	mCondition.LockVar();
+	mWakeUpCount++;
+	mCondition.SignalAll();
+	mCondition.UnlockVar();
+}
+
+//////////////////////////// Task executor //////////////////////////////////////////////
+namespace CloudBuilder {
+
+	// Only the minimum is used when the hardware concurrency is unknown
+	static const int MIN_DEFAULT_WORKERS = 2, MAX_DEFAULT_WORKERS = 8;
+
+	struct TaskWorker: CThread {
+		virtual void Run();
+	};
+
+	// Queues the delayed tasks once due, so that no worker is held while waiting
+	struct TaskTimer: CThread {
+		virtual void Run();
+	};
+
+	// A single condition variable protects the whole state. It is signaled when a task is queued, when one
+	// completes (if someone waits for it), when a delayed task is added and when the executor is drained.
+	struct ExecutorState {
+		CConditionVariable condition;
+		std::deque<CTask*> queue;
+		std::vector<TaskWorker*> workers;
+		// Tasks submitted with a delay, by due time (monotonic milliseconds)
+		std::multimap<long long, CTask*> delayed;
+		TaskTimer *timer;
+		int maxWorkers, idleWorkers, waitingThreads;
+		bool stopping, timerWaiting;
+		ExecutorState() : timer(NULL), maxWorkers(0), idleWorkers(0), waitingThreads(0), stopping(false), timerWaiting(false) {}
+	};
+
+	static ExecutorState &executorState() {
+		// Never destroyed: workers may still wait on it when the process exits without a Terminate
+		static ExecutorState *state = new ExecutorState;
+		return *state;
+	}
+
+	static int defaultWorkerCount() {
+		int count = (int) std::thread::hardware_concurrency();
+		return count < MIN_DEFAULT_WORKERS ? MIN_DEFAULT_WORKERS : (count > MAX_DEFAULT_WORKERS ? MAX_DEFAULT_WORKERS : count);
+	}
+
+	void TaskWorker::Run() {
+		ExecutorState &s = executorState();
+		s.condition.LockVar();
+		while (true) {
+			s.idleWorkers++;
+			while (s.queue.empty() && !s.stopping) {
+				s.condition.Wait();
+			}
+			s.idleWorkers--;
+			// Only stop once everything has been run
+			if (s.queue.empty()) { break; }
+
+			CTask *task = s.queue.front();
+			CClientContext *context = task->mContext;
+			s.queue.pop_front();
+			s.condition.UnlockVar();
+			{
+				CClientContext::Scope scope(context);
+				task->Run();
+			}
+			s.condition.LockVar();
+			task->mFinished = true;
+			if (s.waitingThreads > 0) {
+				s.condition.SignalAll();
+			}
+			s.condition.UnlockVar();
+			task->Release();
+			context->Internals().TaskFinished();
+			context->Release();
+			s.condition.LockVar();
+		}
+		s.condition.UnlockVar();
+	}
+
+	void CTaskExecutor::Prepare(CTask *task) {
+		task->Retain();
+		task->mContext = CClientContext::Current();
+		task->mContext->Retain();
+		task->mContext->Internals().TaskSubmitted();
+	}
+
+	// Call with the condition locked
+	static void enqueueTask(ExecutorState &s, CTask *task) {
+		s.queue.push_back(task);
+		// Start a new worker if all are busy
+		int maxWorkers = s.maxWorkers > 0 ? s.maxWorkers : defaultWorkerCount();
+		if (s.idleWorkers < (int) s.queue.size() && (int) s.workers.size() < maxWorkers) {
+			TaskWorker *worker = new TaskWorker;
+			if (worker->Start()) {
+				s.workers.push_back(worker);
+			} else {
+				CONSOLE_ERROR("Failed to start a worker thread\n");
+				worker->Release();
+			}
+		}
+		// Threads waiting for a task and the timer share the condition, so make sure that a worker is woken up
+		if (s.waitingThreads > 0 || s.timerWaiting) {
+			s.condition.SignalAll();
+		} else {
+			s.condition.SignalOne();
+		}
+	}
+
+	void TaskTimer::Run() {
+		ExecutorState &s = executorState();
+		s.condition.LockVar();
+		// Tasks still delayed when the executor is drained are run once due, like the queued ones
+		while (!s.stopping || !s.delayed.empty()) {
+			long long remaining = s.delayed.empty() ? 0 : s.delayed.begin()->first - MonotonicMilliseconds();
+			if (!s.delayed.empty() && remaining <= 0) {
+				CTask *task = s.delayed.begin()->second;
+				s.delayed.erase(s.delayed.begin());
+				enqueueTask(s, task);
+				continue;
+			}
+			s.timerWaiting = true;
+			s.condition.Wait((int) remaining);
+			s.timerWaiting = false;
+		}
+		s.condition.UnlockVar();
+	}
+
+	void CTaskExecutor::Configure(int workerCount) {
+		ExecutorState &s = executorState();
+		s.condition.LockVar();
+		s.maxWorkers = workerCount;
+		s.condition.UnlockVar();
+	}
+
+	void CTaskExecutor::Submit(CTask *task) {
+		ExecutorState &s = executorState();
+		Prepare(task);
+		s.condition.LockVar();
+		enqueueTask(s, task);
+		s.condition.UnlockVar();
+	}
+
+	void CTaskExecutor::SubmitAfter(CTask *task, int delayMilliseconds) {
+		ExecutorState &s = executorState();
+		Prepare(task);
+		s.condition.LockVar();
+		std::multimap<long long, CTask*>::iterator entry = s.delayed.insert(std::make_pair(MonotonicMilliseconds() + delayMilliseconds, task));
+		if (!s.timer) {
+			s.timer = new TaskTimer;
+			if (!s.timer->Start()) {
+				CONSOLE_ERROR("Failed to start the timer thread\n");
+				s.timer->Release(), s.timer = NULL;
+				// Run early rather than never
+				s.delayed.erase(entry);
+				enqueueTask(s, task);
+			}
+		}
+		// Lets the timer check whether the new task is the next one due
+		s.condition.SignalAll();
+		s.condition.UnlockVar();
+	}
+
+	bool CTaskExecutor::Hasten(CTask *task) {
+		ExecutorState &s = executorState();
+		bool found = false;
+		s.condition.LockVar();
+		for (std::multimap<long long, CTask*>::iterator it = s.delayed.begin(); it != s.delayed.end(); ++it) {
+			if (it->second == task) {
+				s.delayed.erase(it);
+				enqueueTask(s, task);
+				found = true;
+				break;
+			}
+		}
+		s.condition.UnlockVar();
+		return found;
+	}
+
+	// Call with the condition locked
+	static void stopWorkers(ExecutorState &s) {
+		std::vector<TaskWorker*> workers;
+		s.stopping = true;
+		s.condition.SignalAll();
+		// Tasks run meanwhile may submit others, starting new workers which are joined at the next iteration
+		while (!s.workers.empty() || s.timer) {
+			TaskTimer *timer = s.timer;
+			s.timer = NULL;
+			workers.swap(s.workers);
+			s.condition.UnlockVar();
+			if (timer) {
+				timer->Join();
+				timer->Release();
+			}
+			for (size_t i = 0; i < workers.size(); i++) {
+				workers[i]->Join();
+				workers[i]->Release();
+			}
+			workers.clear();
+			s.condition.LockVar();
+		}
+		s.stopping = false;
+	}
+
+	void CTaskExecutor::Drain() {
+		ExecutorState &s = executorState();
+		s.condition.LockVar();
+		stopWorkers(s);
+		s.condition.UnlockVar();
+	}
+
+	bool CTaskExecutor::StopIfIdle() {
+		ExecutorState &s = executorState();
+		s.condition.LockVar();
+		bool idle = s.queue.empty() && s.delayed.empty() && s.idleWorkers == (int) s.workers.size();
+		if (idle) {
+			stopWorkers(s);
+		}
+		s.condition.UnlockVar();
+		return idle;
+	}
+
+	bool CTask::Wait(int timeoutMilliseconds) {
+		ExecutorState &s = executorState();
+		long long deadline = MonotonicMilliseconds() + timeoutMilliseconds, remaining;
+		s.condition.LockVar();
+		s.waitingThreads++;
+		// Other tasks completing signal the condition as well, only the remaining time is waited for
+		while (!mFinished) {
+			if (timeoutMilliseconds == 0) {
+				s.condition.Wait();
+			} else if ((remaining = deadline - MonotonicMilliseconds()) > 0) {
+				s.condition.Wait((int) remaining);
+			} else {
+				break;
+			}
+		}
+		s.waitingThreads--;
+		bool finished = mFinished;
+		s.condition.UnlockVar();
+		return finished;
 	}
 }
 
 //////////////////////////// Emulation for old CotCThread model //////////////////////////////////////////////
-class CotThunkThread : public CThread {
+class CotThunkThread : public CloudBuilder::CTask {
 	struct cotc_actual_call {
 		void* (*func)(void *);
 		void *arg;
@@ -165,10 +470,13 @@ class CotThunkThread : public CThread {
 	void *mResult;
 
 public:
+	bool mStarted;
+
 	CotThunkThread(void *(*func) (void*), void *arg) {
 		mCall.func = func;
 		mCall.arg = arg;
 		mResult = NULL;
+		mStarted = false;
 	}
 
 	virtual void Run() {
@@ -187,7 +495,11 @@ CloudBuilder::CotCThread::CotCThread(void *(*func) (void*), void *arg)
 
 void CloudBuilder::CotCThread::Start(void)
 {
-	thread->Start();
+	// Like a thread, it can only be started once
+	if (!thread->mStarted) {
+		thread->mStarted = true;
+		CTaskExecutor::Submit(thread);
+	}
 }
 
 void CloudBuilder::CotCThread::Lock(void)
@@ -202,7 +514,9 @@ void CloudBuilder::CotCThread::Unlock(void)
 
 void* CloudBuilder::CotCThread::Join(void)
 {
-	thread->Join();
+	if (thread->mStarted) {
+		thread->Wait();
+	}
 	return thread->getResult();
 }
 
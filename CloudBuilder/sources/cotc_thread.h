@@ -11,7 +11,6 @@
 
 #include "cloudbuilder.h"
 #include "CotCHelpers.h"
-#include "CCallback.h"
 
 #if defined(__WINDOWS_32__) || defined(__WP8__)
 	extern int usleep(long usec);
@@ -28,6 +27,120 @@
 class CotThunkThread;
 
 namespace CloudBuilder {
+	class CClientContext;
+
+	/**
+	 * Unit of work run by CTaskExecutor. Override Run and pass an instance to CTaskExecutor::Submit. The task is
+	 * retained while queued and running, so you may release your reference right after submitting it. It runs in
+	 * the scope of the CClientContext from which it was submitted.
+	 */
+	class CTask : public CotCHelpers::CRefClass {
+		friend struct TaskWorker;
+		friend class CTaskExecutor;
+		volatile bool mFinished;
+		// Context in scope when submitted, retained until run
+		CClientContext *mContext;
+
+	protected:
+		/**
+		 * Override and implement the work in this method. Runs on one of the workers of the executor.
+		 */
+		virtual void Run() = 0;
+
+	public:
+		CTask() : mFinished(false), mContext(NULL) {}
+		/**
+		 * @return whether the task has completed its work.
+		 */
+		bool HasFinished() { return mFinished; }
+		/**
+		 * Blocks until the task has been run. Do not call from a task, as all workers may be waiting.
+		 * @param timeoutMilliseconds maximum time to wait, or 0 to wait indefinitely
+		 * @return whether the task has completed (false upon timeout)
+		 */
+		bool Wait(int timeoutMilliseconds = 0);
+	};
+
+	/**
+	 * Runs short-lived internal tasks on a fixed set of worker threads, rather than starting a thread for each.
+	 * Workers are started on demand, up to the configured count, and shared by all the CClientContext's. Event
+	 * loops keep their own thread, as they would hold a worker indefinitely. Tasks must not wait on a worker
+	 * either: those to be run later are submitted with SubmitAfter, whose delays are kept by a single timer thread.
+	 */
+	class CTaskExecutor {
+	public:
+		/**
+		 * Sets the maximum number of workers. Defaults to the number of processors (with a minimum of 2).
+		 * Workers already running are kept until the next Drain.
+		 * @param workerCount maximum number of workers, or 0 to use the default
+		 */
+		static void Configure(int workerCount);
+		/**
+		 * Queues a task for execution.
+		 * @param task task to run; retained until it has been run
+		 */
+		static void Submit(CTask *task);
+		/**
+		 * Queues a task once a delay has elapsed. It counts as submitted right away, for the CClientContext waiting
+		 * for its tasks and for Drain.
+		 * @param task task to run; retained until it has been run
+		 * @param delayMilliseconds time to wait before queuing the task
+		 */
+		static void SubmitAfter(CTask *task, int delayMilliseconds);
+		/**
+		 * Queues right away a task waiting for the delay given to SubmitAfter.
+		 * @return whether the task was waiting (false if it is queued, running or done already)
+		 */
+		static bool Hasten(CTask *task);
+		/**
+		 * Runs all queued and delayed tasks, then stops the workers. Tasks submitted afterwards start new workers.
+		 * To be called from the main thread.
+		 */
+		static void Drain();
+		/**
+		 * Stops the workers if no task is queued, delayed or running, as when the last session is terminated.
+		 * Otherwise they are left running the tasks of the other contexts.
+		 * @return whether the workers were stopped
+		 */
+		static bool StopIfIdle();
+
+	private:
+		// Accounts for a task about to be queued or delayed
+		static void Prepare(CTask *task);
+	};
+
+	/**
+	 * @return milliseconds elapsed since an arbitrary point, on a clock that is not affected by changes of the system time
+	 */
+	long long MonotonicMilliseconds();
+
+	/**
+	 * Lets threads sleep for a given time, unless woken up earlier. Used for the holds and retry delays of the
+	 * HTTP layer, so that they all end as soon as the app resumes or the network is back.
+	 */
+	class CWakeUpSignal {
+		CotCHelpers::CConditionVariable mCondition;
+		unsigned mWakeUpCount;
+
+	public:
+		CWakeUpSignal() : mWakeUpCount(0) {}
+		/**
+		 * @return a token to pass to Sleep, so that a WakeUp happening between this call and Sleep is not missed
+		 */
+		unsigned Token();
+		/**
+		 * Sleeps for a given time unless WakeUp is called.
+		 * @param milliseconds time to sleep, or 0 to sleep until woken up
+		 * @param token value returned by Token() before checking the condition that led to sleeping
+		 * @return whether the whole time has elapsed (false if woken up)
+		 */
+		bool Sleep(int milliseconds, unsigned token);
+		bool Sleep(int milliseconds) { return Sleep(milliseconds, Token()); }
+		/**
+		 * Ends all ongoing sleeps.
+		 */
+		void WakeUp();
+	};
 
 	// Emulation for the old CotCThread model
 	class CotCThread {
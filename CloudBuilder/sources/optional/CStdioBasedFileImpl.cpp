@@ -61,3 +61,9 @@ bool COutputFileStdio::IsOpen() {
 size_t COutputFileStdio::Write(const void *sourceBuffer, size_t numBytes) {
 	return fwrite(sourceBuffer, 1, numBytes, underlyingFile);
 }
+
+void COutputFileStdio::Flush() {
+	if (underlyingFile) {
+		fflush(underlyingFile);
+	}
+}
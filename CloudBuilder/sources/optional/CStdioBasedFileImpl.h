@@ -37,6 +37,7 @@ namespace CloudBuilder {
 		virtual void Close();
 		virtual bool IsOpen();
 		virtual size_t Write(const void *sourceBuffer, size_t numBytes);
+		virtual void Flush();
 
 	public:
 		COutputFileStdio(const char *fileName);
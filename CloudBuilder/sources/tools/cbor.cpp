@@ -0,0 +1,357 @@
+//
+//  cbor.cpp
+//  CloudBuilder
+//
+//  Created by florian on 19/10/16.
+//  Copyright (c) 2016 Clan of the Cloud. All rights reserved.
+//
+
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include "cbor.h"
+#include "cJSON.h"
+
+namespace CotCHelpers {
+
+	const char *CBOR_CONTENT_TYPE = "application/cbor";
+
+	// Major types (3 upper bits of the initial byte)
+	enum {
+		MT_UNSIGNED = 0,
+		MT_NEGATIVE = 1,
+		MT_BYTES = 2,
+		MT_TEXT = 3,
+		MT_ARRAY = 4,
+		MT_MAP = 5,
+		MT_TAG = 6,
+		MT_SIMPLE = 7,
+	};
+
+	// Values for the additional information (5 lower bits)
+	enum {
+		AI_1BYTE = 24,
+		AI_2BYTES = 25,
+		AI_4BYTES = 26,
+		AI_8BYTES = 27,
+		AI_INDEFINITE = 31,
+		SIMPLE_FALSE = 20,
+		SIMPLE_TRUE = 21,
+		SIMPLE_NULL = 22,
+		SIMPLE_UNDEFINED = 23,
+		BREAK = 0xff,
+	};
+
+	// Protects from stack exhaustion on hostile input
+	static const int MAX_NESTING = 512;
+
+	//////////////////////////// Encoder ////////////////////////////
+	struct Encoder {
+		unsigned char *buffer;
+		size_t size, capacity;
+		bool failed;
+
+		Encoder() : buffer(NULL), size(0), capacity(0), failed(false) {}
+
+		unsigned char *Reserve(size_t bytes) {
+			if (failed) { return NULL; }
+			if (size + bytes > capacity) {
+				size_t newCapacity = capacity ? capacity * 2 : 256;
+				while (newCapacity < size + bytes) { newCapacity *= 2; }
+				unsigned char *newBuffer = (unsigned char*) realloc(buffer, newCapacity);
+				if (!newBuffer) { failed = true; return NULL; }
+				buffer = newBuffer;
+				capacity = newCapacity;
+			}
+			unsigned char *p = buffer + size;
+			size += bytes;
+			return p;
+		}
+
+		void WriteHeader(int majorType, unsigned long long value) {
+			unsigned char mt = (unsigned char) (majorType << 5);
+			unsigned char *p;
+			if (value < AI_1BYTE) {
+				if ((p = Reserve(1))) { p[0] = mt | (unsigned char) value; }
+			} else if (value <= 0xff) {
+				if ((p = Reserve(2))) { p[0] = mt | AI_1BYTE; p[1] = (unsigned char) value; }
+			} else if (value <= 0xffff) {
+				if ((p = Reserve(3))) { p[0] = mt | AI_2BYTES; WriteBigEndian(p + 1, value, 2); }
+			} else if (value <= 0xffffffffULL) {
+				if ((p = Reserve(5))) { p[0] = mt | AI_4BYTES; WriteBigEndian(p + 1, value, 4); }
+			} else {
+				if ((p = Reserve(9))) { p[0] = mt | AI_8BYTES; WriteBigEndian(p + 1, value, 8); }
+			}
+		}
+
+		static void WriteBigEndian(unsigned char *dest, unsigned long long value, int bytes) {
+			for (int i = bytes - 1; i >= 0; i--) {
+				dest[i] = (unsigned char) (value & 0xff);
+				value >>= 8;
+			}
+		}
+
+		void WriteText(const char *str) {
+			size_t len = str ? strlen(str) : 0;
+			WriteHeader(MT_TEXT, len);
+			unsigned char *p = Reserve(len);
+			if (p && len) { memcpy(p, str, len); }
+		}
+
+		void WriteNumber(double value) {
+			// Integral values are much more compact as integers (typical for scores, counters, timestamps)
+			if (value == floor(value) && fabs(value) < 9007199254740992.0) {
+				if (value >= 0) {
+					WriteHeader(MT_UNSIGNED, (unsigned long long) value);
+				} else {
+					WriteHeader(MT_NEGATIVE, (unsigned long long) (-1 - value));
+				}
+				return;
+			}
+
+			unsigned char *p;
+			float single = (float) value;
+			if ((double) single == value) {
+				unsigned int bits;
+				memcpy(&bits, &single, sizeof(bits));
+				if ((p = Reserve(5))) { p[0] = (MT_SIMPLE << 5) | AI_4BYTES; WriteBigEndian(p + 1, bits, 4); }
+			} else {
+				unsigned long long bits;
+				memcpy(&bits, &value, sizeof(bits));
+				if ((p = Reserve(9))) { p[0] = (MT_SIMPLE << 5) | AI_8BYTES; WriteBigEndian(p + 1, bits, 8); }
+			}
+		}
+
+		void WriteItem(const cJSON *item) {
+			switch (item->type & 0xff) {
+				case cJSON_False:	WriteHeader(MT_SIMPLE, SIMPLE_FALSE); break;
+				case cJSON_True:	WriteHeader(MT_SIMPLE, SIMPLE_TRUE); break;
+				case cJSON_NULL:	WriteHeader(MT_SIMPLE, SIMPLE_NULL); break;
+				case cJSON_Number:	WriteNumber(item->valuedouble); break;
+				case cJSON_String:	WriteText(item->valuestring); break;
+				case cJSON_Array:
+				case cJSON_Object: {
+					bool isObject = (item->type & 0xff) == cJSON_Object;
+					unsigned long long count = 0;
+					for (const cJSON *c = item->child; c; c = c->next) { count++; }
+					WriteHeader(isObject ? MT_MAP : MT_ARRAY, count);
+					for (const cJSON *c = item->child; c && !failed; c = c->next) {
+						if (isObject) { WriteText(c->string); }
+						WriteItem(c);
+					}
+					break;
+				}
+				default:
+					WriteHeader(MT_SIMPLE, SIMPLE_NULL);
+					break;
+			}
+		}
+	};
+
+	unsigned char *cbor_encode(const cJSON *item, size_t *outLength) {
+		Encoder e;
+		e.WriteItem(item);
+		if (e.failed) {
+			free(e.buffer);
+			*outLength = 0;
+			return NULL;
+		}
+		*outLength = e.size;
+		return e.buffer;
+	}
+
+	//////////////////////////// Decoder ////////////////////////////
+	struct Decoder {
+		const unsigned char *ptr, *end;
+		// Used to NUL-terminate strings before handing them to cJSON
+		char *scratch;
+		size_t scratchCapacity;
+
+		Decoder(const void *data, size_t length) : ptr((const unsigned char*) data), end((const unsigned char*) data + length), scratch(NULL), scratchCapacity(0) {}
+		~Decoder() { free(scratch); }
+
+		bool ReadBigEndian(int bytes, unsigned long long *value) {
+			if (end - ptr < bytes) { return false; }
+			*value = 0;
+			for (int i = 0; i < bytes; i++) { *value = (*value << 8) | *ptr++; }
+			return true;
+		}
+
+		// Reads the argument following an initial byte (length, count or value depending on the major type)
+		bool ReadArgument(int info, unsigned long long *value) {
+			if (info < AI_1BYTE) { *value = info; return true; }
+			switch (info) {
+				case AI_1BYTE:	return ReadBigEndian(1, value);
+				case AI_2BYTES:	return ReadBigEndian(2, value);
+				case AI_4BYTES:	return ReadBigEndian(4, value);
+				case AI_8BYTES:	return ReadBigEndian(8, value);
+				default:		return false;
+			}
+		}
+
+		bool AppendScratch(size_t at, const unsigned char *data, size_t length) {
+			if (at + length + 1 > scratchCapacity) {
+				size_t newCapacity = scratchCapacity ? scratchCapacity : 256;
+				while (newCapacity < at + length + 1) { newCapacity *= 2; }
+				char *newScratch = (char*) realloc(scratch, newCapacity);
+				if (!newScratch) { return false; }
+				scratch = newScratch;
+				scratchCapacity = newCapacity;
+			}
+			memcpy(scratch + at, data, length);
+			scratch[at + length] = '\0';
+			return true;
+		}
+
+		// Reads a text string into the scratch buffer; handles the chunked (indefinite length) form too
+		bool ReadText(int info) {
+			unsigned long long length;
+			if (info != AI_INDEFINITE) {
+				if (!ReadArgument(info, &length) || length > (unsigned long long) (end - ptr)) { return false; }
+				if (!AppendScratch(0, ptr, (size_t) length)) { return false; }
+				ptr += length;
+				return true;
+			}
+
+			size_t total = 0;
+			if (!AppendScratch(0, ptr, 0)) { return false; }
+			while (ptr < end && *ptr != BREAK) {
+				int initial = *ptr++;
+				if ((initial >> 5) != MT_TEXT || (initial & 0x1f) == AI_INDEFINITE) { return false; }
+				if (!ReadArgument(initial & 0x1f, &length) || length > (unsigned long long) (end - ptr)) { return false; }
+				if (!AppendScratch(total, ptr, (size_t) length)) { return false; }
+				ptr += length;
+				total += (size_t) length;
+			}
+			return ptr++ < end;
+		}
+
+		static double HalfToDouble(unsigned int half) {
+			int exponent = (half >> 10) & 0x1f, mantissa = half & 0x3ff;
+			double value;
+			if (exponent == 0) { value = ldexp(mantissa, -24); }
+			else if (exponent != 31) { value = ldexp(mantissa + 1024, exponent - 25); }
+			else { value = mantissa == 0 ? HUGE_VAL : NAN; }
+			return (half & 0x8000) ? -value : value;
+		}
+
+		// Appends a node to its parent without walking the sibling list (unlike cJSON_AddItemToArray)
+		static void Link(cJSON *parent, cJSON **tail, cJSON *item) {
+			if (*tail) { (*tail)->next = item; item->prev = *tail; }
+			else { parent->child = item; }
+			*tail = item;
+		}
+
+		cJSON *ReadContainer(bool isObject, int info, int depth) {
+			cJSON *container = isObject ? cJSON_CreateObject() : cJSON_CreateArray();
+			cJSON *tail = NULL;
+			bool indefinite = info == AI_INDEFINITE;
+			unsigned long long count = 0;
+			if (!container) { return NULL; }
+			if (!indefinite && !ReadArgument(info, &count)) { cJSON_Delete(container); return NULL; }
+
+			for (unsigned long long i = 0; indefinite || i < count; i++) {
+				if (ptr >= end) { cJSON_Delete(container); return NULL; }
+				if (indefinite && *ptr == BREAK) { ptr++; break; }
+
+				char *key = NULL;
+				if (isObject) {
+					// Keys are copied through cJSON in order to be released with the right allocator
+					int initial = *ptr++;
+					cJSON *keyHolder;
+					if ((initial >> 5) != MT_TEXT || !ReadText(initial & 0x1f) || !(keyHolder = cJSON_CreateString(scratch))) {
+						cJSON_Delete(container);
+						return NULL;
+					}
+					key = keyHolder->valuestring;
+					keyHolder->valuestring = NULL;
+					cJSON_Delete(keyHolder);
+				}
+
+				cJSON *item = ReadItem(depth + 1);
+				if (!item) {
+					if (key) { cJSON_Delete(Wrap(key)); }
+					cJSON_Delete(container);
+					return NULL;
+				}
+				item->string = key;
+				Link(container, &tail, item);
+			}
+			return container;
+		}
+
+		// Gives ownership of a cJSON allocated string to a node so that it gets released along with it
+		static cJSON *Wrap(char *string) {
+			cJSON *holder = cJSON_CreateNull();
+			if (holder) { holder->valuestring = string; }
+			return holder;
+		}
+
+		cJSON *ReadItem(int depth) {
+			if (ptr >= end || depth > MAX_NESTING) { return NULL; }
+			int initial = *ptr++;
+			int majorType = initial >> 5, info = initial & 0x1f;
+			unsigned long long value;
+
+			switch (majorType) {
+				case MT_UNSIGNED:
+					if (!ReadArgument(info, &value)) { return NULL; }
+					return cJSON_CreateNumber((double) value);
+				case MT_NEGATIVE:
+					if (!ReadArgument(info, &value)) { return NULL; }
+					return cJSON_CreateNumber(-1.0 - (double) value);
+				case MT_TEXT:
+					if (!ReadText(info)) { return NULL; }
+					return cJSON_CreateString(scratch);
+				case MT_ARRAY:
+					return ReadContainer(false, info, depth);
+				case MT_MAP:
+					return ReadContainer(true, info, depth);
+				case MT_TAG:
+					// Semantics of tags (dates, bignums...) are not representable, keep the tagged value as is
+					if (!ReadArgument(info, &value)) { return NULL; }
+					return ReadItem(depth + 1);
+				case MT_SIMPLE:
+					switch (info) {
+						case SIMPLE_FALSE:		return cJSON_CreateFalse();
+						case SIMPLE_TRUE:		return cJSON_CreateTrue();
+						case SIMPLE_NULL:
+						case SIMPLE_UNDEFINED:	return cJSON_CreateNull();
+						case AI_2BYTES:
+							if (!ReadBigEndian(2, &value)) { return NULL; }
+							return cJSON_CreateNumber(HalfToDouble((unsigned int) value));
+						case AI_4BYTES: {
+							float single;
+							unsigned int bits;
+							if (!ReadBigEndian(4, &value)) { return NULL; }
+							bits = (unsigned int) value;
+							memcpy(&single, &bits, sizeof(single));
+							return cJSON_CreateNumber(single);
+						}
+						case AI_8BYTES: {
+							double dbl;
+							if (!ReadBigEndian(8, &value)) { return NULL; }
+							memcpy(&dbl, &value, sizeof(dbl));
+							return cJSON_CreateNumber(dbl);
+						}
+						default:
+							return NULL;
+					}
+				case MT_BYTES:
+				default:
+					return NULL;
+			}
+		}
+	};
+
+	cJSON *cbor_decode(const void *data, size_t length) {
+		Decoder d(data, length);
+		cJSON *result = d.ReadItem(0);
+		// Trailing garbage means that the document is not what we expect
+		if (result && d.ptr != d.end) {
+			cJSON_Delete(result);
+			return NULL;
+		}
+		return result;
+	}
+}
@@ -0,0 +1,43 @@
+//
+//  cbor.h
+//  CloudBuilder
+//
+//  Created by florian on 19/10/16.
+//  Copyright (c) 2016 Clan of the Cloud. All rights reserved.
+//
+
+#ifndef CloudBuilder_cbor_h
+#define CloudBuilder_cbor_h
+
+#include <stddef.h>
+
+struct cJSON;
+
+namespace CotCHelpers {
+
+	/**
+	 * MIME type used when exchanging CBOR documents with the server.
+	 */
+	extern const char *CBOR_CONTENT_TYPE;
+
+	/**
+	 * Serializes a JSON tree to CBOR (RFC 7049). Every JSON node has a direct CBOR counterpart, so that
+	 * decoding the result gives back the same tree. Integral numbers are written as integers, other numbers
+	 * as single precision floats when it is lossless, double precision otherwise.
+	 * @param item node to serialize
+	 * @param outLength receives the size of the encoded data, in bytes
+	 * @return a buffer that must be released using free(), or NULL if the memory could not be allocated
+	 */
+	unsigned char *cbor_encode(const cJSON *item, size_t *outLength);
+
+	/**
+	 * Builds a JSON tree from a CBOR document. Tags are ignored and the undefined value is read as null.
+	 * Byte strings have no counterpart in the JSON model and cause the document to be rejected.
+	 * @param data CBOR data
+	 * @param length size of the data, in bytes
+	 * @return the root node, to be released using cJSON_Delete, or NULL if the document is malformed
+	 */
+	cJSON *cbor_decode(const void *data, size_t length);
+}
+
+#endif
@@ -14,6 +14,12 @@
 #include "curl/curl.h"
 #include "cotc_thread.h"
 #include "CHttpFailureEventArgs.h"
+#include "cbor.h"
+#include "CAllocator.h"
+#include "metrics.h"
+#include "transport.h"
+#include "requestjournal.h"
+#include "CClientContext_private.h"
 
 using std::list;
 using CotCHelpers::CHJSON;
@@ -22,104 +28,21 @@ using CloudBuilder::CCloudResult;
 
 namespace CloudBuilder {
 	
-    /**
-	 * Used to store the credentials passed to http_init.
-	 */
-	struct CRESTAppCredentials {
-		CRESTAppCredentials() : loadBalancerId(0), loadBalancerCount(0), needsChooseNewLoadBalancer(true) {}
-
-		int loadBalancerId;					// selected load balancer (1..loadBalancerCount)
-		int loadBalancerCount;				// maximum number of load balancers
-		cstring serverBaseName;				// templated, with [id] being the load balancer ID
-		bool needsChooseNewLoadBalancer;	// set to true to choose a new balancer at the next request
-	};
-
-	/// IOBuf structure
-	typedef struct IOBuf 
-	{
-		char* 	buffer;
-		size_t 	size;
-		size_t 	capacity;
-
-		char* 	result;
-		char* 	lastMod;
-		char* 	eTag;
-		int 	contentLen;
-		int 	len;
-		int 	code;
-		bool    binary;
-		bool	obsolete;
-	} IOBuf;
-
-
-	IOBuf *curl_iobuf_new();
-	void curl_iobuf_free(IOBuf *bf);
-
-	/**
-	 * HTTP request dispatcher. Call enqueueRequest and it will be processed.
-	 */
-	class RequestDispatcher : public CotCHelpers::CThread {
-		// Pending requests; memory is owned here until they are processed
-		CotCHelpers::CProtectedVariable< list<CHttpRequest*> > mRequestGuard;
-		bool mAlreadyStarted, mActive;
-		int threadId;
-
-		RequestDispatcher() : mAlreadyStarted(false), mActive(false) {}
-		RequestDispatcher(const RequestDispatcher &copy_not_allowed);
-		~RequestDispatcher() { 	CONSOLE_VERBOSE("Destroying request dispatcher object %d\n", threadId); }
-
-		void DequeueProcessedRequest();
-		virtual void Run();
-
-	public:
-		// Set this to meaningful values before running
-		static CRESTAppCredentials mCredentials;
-
-		/**
-		 * To be called from the main thread.
-		 */
-		static RequestDispatcher *Instance();
-
-		/**
-		 * To be called from the main thread. Indicates that there is a request to process.
-		 */
-		void EnqueueRequest(CHttpRequest *request);
-		/**
-		 * Blocking method, meant to be called internally.
-		 */
-		static CCloudResult *PerformRequest(CURL *ch, CHttpRequest *req);
-		static bool ShouldChangeLoadBalancer(const CCloudResult *result);
-		static bool ShouldRetryRequest(CHttpRequest *request, const CCloudResult *result);
-		void Terminate();
-		/**
-		 * Call from the main thread. If the thread is running but waiting for the next request, unblocks it.
-		 */
-		void UnblockThread();
-	};
-
-	CRESTAppCredentials RequestDispatcher::mCredentials;
-	static autoref<RequestDispatcher> requestDispatcherInstance;
-	// This ID indicates the ID of the current (active) HTTP thread, disallowing old ones (which aren't yet deleted because they have pending requests ongoing) to call callbacks related to older CClan instances. Does only apply to enqueued requests (that is http_perform).
-	static int g_activeRequestDispatcherThreadId = 0;
 	char g_curlUserAgent[128];
-	static int g_defaultTimeout, g_defaultConnectTimeout;
-	// g_httpInited is set to false to stop any HTTP request
-	static bool g_httpVerbose, g_httpInited = false;
-	static CConditionVariable *g_synchronousCancelVariable;
-	owned_ref<CDelegate<void(CHttpFailureEventArgs&)>> g_failureDelegate;
+	static autoref<CHttpTransport> g_transport;
+	static CotCHelpers::CMutex g_transportMutex;
 	// First we retry immediately (1 ms) on the other load balancer, then we delay a bit. Do not put a zero in there (means infinite).
 	static const int RETRY_DELAYS_MILLISEC[] = {1, 1, 400, 400, 800, 800, 1600, 1600, 3200, 3200, 6400, 6400};
-	static size_t _currentDelayId = 0;	// index in DELAYS_MILLISEC
 	void SSLBIO_SetCustomCertificate();
 
-	static void shouldRetryDefaultRoutine(CHttpFailureEventArgs &e) {
-		_currentDelayId++;
+	void RequestDispatcher::ShouldRetryDefaultRoutine(CHttpFailureEventArgs &e) {
+		mCurrentDelayId++;
 		// Check that we didn't fail too many times
-		if (_currentDelayId < numberof(RETRY_DELAYS_MILLISEC)) {
-			e.RetryIn(RETRY_DELAYS_MILLISEC[_currentDelayId]);
+		if (mCurrentDelayId < numberof(RETRY_DELAYS_MILLISEC)) {
+			e.RetryIn(RETRY_DELAYS_MILLISEC[mCurrentDelayId]);
 		} else {
 			// Give up but do not retry too soon, reset the delay at its last iteration
-			_currentDelayId = numberof(RETRY_DELAYS_MILLISEC) - 1;
+			mCurrentDelayId = numberof(RETRY_DELAYS_MILLISEC) - 1;
 			e.Abort();
 		}
 	}
@@ -159,34 +82,76 @@ namespace CloudBuilder {
 		return QueryParam(name, buffer);
 	}
 
-	CHttpRequest::CHttpRequest(const char *url) : url(url), method(NULL), callback(NULL), connectTimeout(g_defaultConnectTimeout), timeout(g_defaultTimeout), retryPolicy(NonpermanentErrors), binaryUpload(false), binaryDownload(false), cancellationFlag(NULL) {}
+	const char *CHttpWireRequest::GetHeader(const char *name) const {
+		size_t length = strlen(name);
+		for (size_t i = 0; i < headers.size(); i++) {
+			const char *header = headers[i];
+			if (!strncmp(header, name, length) && header[length] == ':') {
+				header += length + 1;
+				while (*header == ' ') { header++; }
+				return header;
+			}
+		}
+		return NULL;
+	}
+
+	void http_set_transport(CHttpTransport *transport) {
+		CotCHelpers::CMutex::ScopedLock lock(g_transportMutex);
+		g_transport <<= Retain(transport);
+	}
+
+	autoref<CHttpTransport> http_transport() {
+		CotCHelpers::CMutex::ScopedLock lock(g_transportMutex);
+		if (!g_transport) {
+			g_transport <<= new CCurlTransport;
+		}
+		return g_transport;
+	}
+
+	CHttpRequest::CHttpRequest(const char *url) : url(url), method(NULL), callback(NULL), connectTimeout(RequestDispatcher::Instance()->mDefaultConnectTimeout), timeout(RequestDispatcher::Instance()->mDefaultTimeout), retryPolicy(NonpermanentErrors), binaryUpload(false), binaryDownload(false), cancellationFlag(NULL), queuedAt(0), startedAt(0), attemptCount(0), bytesSent(0), bytesReceived(0), replayable(false) {}
 }
 
 #define CAPACITY 4096
 
-bool g_networkState = true;
-
 /// Create a new I/O buffer
 /// \return a newly allocated I/O buffer
 CloudBuilder::IOBuf *CloudBuilder::curl_iobuf_new() {
-	IOBuf *bf = (IOBuf*) malloc(sizeof(IOBuf));
+	IOBuf *bf = (IOBuf*) CotCHelpers::AllocateMemory(sizeof(IOBuf), enMemoryHTTP);
 	memset(bf, 0, sizeof(IOBuf));
 	
 	bf->capacity = CAPACITY;
-	bf->buffer = (char *) malloc(bf->capacity);
+	bf->buffer = (char *) CotCHelpers::AllocateMemory(bf->capacity, enMemoryHTTP);
 	bf->binary = false;
 	return bf;
 }
 
+bool CloudBuilder::curl_iobuf_append(IOBuf *rec, const void *data, size_t bytes) {
+	// Check the buffer size
+	if ((rec->size + bytes) >= rec->capacity) { // == for the trailing '0'
+		// Reallocate the buffer
+		size_t capacity = 2 * (rec->size + bytes) + CAPACITY;
+		char* buf = (char*) CotCHelpers::ReallocateMemory(rec->buffer, capacity, CloudBuilder::enMemoryHTTP);
+		if (!buf) return false;
+		rec->buffer = buf;
+		rec->capacity = capacity;
+	}
+	
+	// Copy the buffer contents
+	memcpy(rec->buffer + rec->size, data, bytes);
+	rec->size += bytes;
+	if (!rec->binary) rec->buffer[rec->size] = 0; // C string ending
+	return true;
+}
+
 /// Release IO Buffer
 /// \param  bf I/O buffer to be deleted
 void CloudBuilder::curl_iobuf_free(IOBuf *bf) { 
 	/// Release Things
-	if ( bf->buffer  != NULL ) free ( bf->buffer  );
-	if ( bf->result  != NULL ) free ( bf->result  );
-	if ( bf->lastMod != NULL ) free ( bf->lastMod );
-	if ( bf->eTag	!= NULL ) free ( bf->eTag	);
-	free (bf);
+	CotCHelpers::ReleaseMemory ( bf->buffer  );
+	CotCHelpers::ReleaseMemory ( bf->result  );
+	CotCHelpers::ReleaseMemory ( bf->lastMod );
+	CotCHelpers::ReleaseMemory ( bf->eTag	);
+	CotCHelpers::ReleaseMemory ( bf );
 }
 
 /// Chomp (remove the trailing '\n' from the string
@@ -208,24 +173,9 @@ static void __chomp(char *str) {
 /// \param stream pointer to I/O buffer
 /// \return number of bytes processed
 static size_t writefunc(void * ptr, size_t size, size_t nmemb, void * stream) {
-	CloudBuilder::IOBuf* rec = (CloudBuilder::IOBuf*) stream;
 	size_t bytes = size * nmemb;
-	
-	// Check the buffer size
-	if ((rec->size + bytes) >= rec->capacity) { // == for the trailing '0'
-		// Reallocate the buffer
-		rec->capacity = 2 * (rec->size + bytes) + CAPACITY;
-		char* buf = (char*) malloc(rec->capacity);
-		memcpy(buf, rec->buffer, rec->size);
-		free(rec->buffer);
-		rec->buffer = buf;
-	}
-	
-	// Copy the buffer contents
-	memcpy(rec->buffer + rec->size, ptr, bytes);
-	rec->size += bytes;
-	if (!rec->binary) rec->buffer[rec->size] = 0; // C string ending
-	return bytes;
+	// Returning less aborts the transfer
+	return CloudBuilder::curl_iobuf_append((CloudBuilder::IOBuf*) stream, ptr, bytes) ? bytes : 0;
 }
 
 /// Handles sending of the data
@@ -234,11 +184,17 @@ static size_t writefunc(void * ptr, size_t size, size_t nmemb, void * stream) {
 /// \param nmemb number of data memebers
 /// \param stream pointer to I/O buffer
 /// \return number of bytes written
+struct UploadReader {
+	const char *data;
+	size_t length, position;
+};
+
 static size_t readfunc(void * ptr, size_t size, size_t nmemb, void * stream) {
-	CloudBuilder::CHttpRequest *req = (CloudBuilder::CHttpRequest *) stream;
-	
-	size_t sz = req->getNextSize(size*nmemb);
-	memcpy(ptr, req->getNextData(sz), sz);
+	UploadReader *reader = (UploadReader *) stream;
+	size_t sz = reader->length - reader->position;
+	if (sz > size * nmemb) { sz = size * nmemb; }
+	memcpy(ptr, reader->data + reader->position, sz);
+	reader->position += sz;
 	return sz;
 }
 
@@ -251,68 +207,151 @@ static size_t readfunc(void * ptr, size_t size, size_t nmemb, void * stream) {
 static size_t header(char *ptr, size_t size, size_t nmemb, void *stream) {
 	CloudBuilder::IOBuf *b = (CloudBuilder::IOBuf*) stream;
 	if (!strncmp(ptr, "HTTP/1.1", 8)) {
-		b->result = strdup ( ptr + 9 );
+		b->result = CotCHelpers::DuplicateString ( ptr + 9, CloudBuilder::enMemoryHTTP );
 		__chomp(b->result);
 		b->code   = atoi ( ptr + 9 );
 	} else if (!strncmp(ptr, "ETag: ", 6)) {
-		b->eTag = strdup ( ptr + 6 );
+		b->eTag = CotCHelpers::DuplicateString ( ptr + 6, CloudBuilder::enMemoryHTTP );
 		__chomp(b->eTag);
 	} else if (!strncmp(ptr, "Last-Modified: ", 14)) {
-		b->lastMod = strdup ( ptr + 15 );
+		b->lastMod = CotCHelpers::DuplicateString ( ptr + 15, CloudBuilder::enMemoryHTTP );
 		__chomp(b->lastMod);
 	} else if (!strncmp(ptr, "Content-Length: ", 15)) {
 		b->contentLen = atoi ( ptr + 16 );
 	} else if (!strncmp(ptr, "X-Obsolete: ", 12)) {
 		b->obsolete = true;
+	} else if (!strncmp(ptr, "Content-Type: ", 14)) {
+		b->cbor = !strncmp(ptr + 14, CotCHelpers::CBOR_CONTENT_TYPE, strlen(CotCHelpers::CBOR_CONTENT_TYPE));
 	}
 	
 	return nmemb * size;
 }
 
 // Abort process ASAP when the lib is de-inited
-static int progresscallback(bool *cancellationFlag, double dltotal, double dlnow, double ultotal, double ulnow) {
-	if (!CloudBuilder::g_httpInited || (cancellationFlag && *cancellationFlag)) { return -1; }
+static int progresscallback(CloudBuilder::CHttpWireRequest *req, double dltotal, double dlnow, double ultotal, double ulnow) {
+	if ((req->sessionActive && !*req->sessionActive) || (req->cancellationFlag && *req->cancellationFlag)) { return -1; }
 	return 0;
 }
 
 //////////////////////////// Request dispatcher ////////////////////////////
+CloudBuilder::RequestDispatcher::RequestDispatcher() : mScheduled(false), mActive(true), mCurrentDelayId(0), mNeedNewBalancer(true), mFailureUserData(0), mSynchronousFailedLastTime(false), mCurrentRequest(NULL),
+	mDefaultTimeout(0), mDefaultConnectTimeout(0), mVerbose(false), mInited(false), mBinaryWireFormat(false), mNetworkState(true), mSynchronousCancelVariable(NULL) {}
+
+CloudBuilder::RequestDispatcher::~RequestDispatcher() {
+	// Requests which could not be processed before the termination
+	list<CHttpRequest*> *pendingRequests = mRequestGuard.LockVar();
+	for (list<CHttpRequest*>::iterator it = pendingRequests->begin(); it != pendingRequests->end(); ++it) {
+		delete (*it)->callback;
+		for (list<CCallback*>::iterator cb = (*it)->supersededCallbacks.begin(); cb != (*it)->supersededCallbacks.end(); ++cb) {
+			delete *cb;
+		}
+		delete *it;
+	}
+	pendingRequests->clear();
+	mRequestGuard.UnlockVar();
+}
+
 void CloudBuilder::RequestDispatcher::DequeueProcessedRequest() {
 	list<CHttpRequest*> *pendingRequests = mRequestGuard.LockVar();
 	// First request has been processed, free memory
 	delete pendingRequests->front();
 	pendingRequests->pop_front();
+	mCurrentRequest = NULL;
 	pendingRequests = mRequestGuard.UnlockVar();
 }
 
+void CloudBuilder::RequestDispatcher::FinishRequest(CHttpRequest *req, CCloudResult *result) {
+	CompleteRequest(req, result);
+	if (mJournal) {
+		mJournal->Complete(req, result);
+	}
+	// Do not call callbacks once terminated
+	for (list<CCallback*>::iterator it = req->supersededCallbacks.begin(); it != req->supersededCallbacks.end(); ++it) {
+		if (mActive) {
+			CallbackStack::pushCallback(*it, result->Duplicate());
+		} else {
+			delete *it;
+		}
+	}
+	if (mActive && req->callback) {
+		CallbackStack::pushCallback(req->callback, result);
+	} else {
+		delete req->callback;
+		delete result;
+	}
+	DequeueProcessedRequest();
+}
+
 void CloudBuilder::RequestDispatcher::EnqueueRequest(CHttpRequest *request) {
 	// Sanity check
-	if (!g_httpInited) {
+	if (!mInited) {
 		CONSOLE_VERBOSE("Discarding HTTP call because the HTTP layer is not initialized.\n");
 		return;
 	}
 
-	// Enqueue request and signal worker thread
+	// Enqueue request and make sure that it will be processed
+	request->queuedAt = MonotonicMilliseconds();
 	list<CHttpRequest*> *pendingRequests = mRequestGuard.LockVar();
+	// With the journal, only the last change of a given value needs to be sent
+	if (mJournal && request->supersedeKey) {
+		for (list<CHttpRequest*>::iterator it = pendingRequests->begin(); it != pendingRequests->end(); ) {
+			CHttpRequest *old = *it;
+			if (old != mCurrentRequest && old->supersedeKey == request->supersedeKey) {
+				request->supersededCallbacks.splice(request->supersededCallbacks.end(), old->supersededCallbacks);
+				if (old->callback) { request->supersededCallbacks.push_back(old->callback); }
+				delete old;
+				it = pendingRequests->erase(it);
+			} else {
+				++it;
+			}
+		}
+	}
+	// Journaled in the order of the queue
+	if (mJournal) {
+		mJournal->Append(request);
+	}
 	pendingRequests->push_back(request);
-	if (!mAlreadyStarted) {
-		// Start thread on first time
-		mAlreadyStarted = mActive = true;
-		Start();
-	} else {
-		// Or signal that it has data to process
-		mRequestGuard.SignalAll();
+	Schedule();
+	mRequestGuard.UnlockVar();
+}
+
+void CloudBuilder::RequestDispatcher::OpenJournal(const char *fileName) {
+	list<CHttpRequest*> replay;
+	mJournal <<= new CRequestJournal(fileName);
+	mJournal->Open(replay);
+
+	list<CHttpRequest*> *pendingRequests = mRequestGuard.LockVar();
+	for (list<CHttpRequest*>::iterator it = replay.begin(); it != replay.end(); ++it) {
+		(*it)->queuedAt = MonotonicMilliseconds();
+	}
+	pendingRequests->splice(pendingRequests->end(), replay);
+	if (!pendingRequests->empty()) {
+		Schedule();
+	}
+	mRequestGuard.UnlockVar();
+}
+
+void CloudBuilder::RequestDispatcher::Schedule() {
+	// Unless already queued, processing (in which case the new request will be seen) or waiting for a retry
+	if (!mScheduled && mActive) {
+		mScheduled = true;
+		CTaskExecutor::Submit(this);
 	}
-	pendingRequests = mRequestGuard.UnlockVar();
 }
 
 CloudBuilder::RequestDispatcher * CloudBuilder::RequestDispatcher::Instance() {
-	return requestDispatcherInstance ? requestDispatcherInstance : (requestDispatcherInstance <<= new RequestDispatcher);
+	autoref<RequestDispatcher> &dispatcher = CClientContext::Current()->Internals().dispatcher;
+	return dispatcher ? dispatcher : (dispatcher <<= new RequestDispatcher);
 }
 
-CCloudResult *CloudBuilder::RequestDispatcher::PerformRequest(CURL *ch, CHttpRequest *req) {
+CCloudResult *CloudBuilder::RequestDispatcher::PerformRequest(CHttpRequest *req) {
 	char fullurl[1024], lb_id_str[16], buffer[1024];
 	static long g_reqCount = 0;
 	long gcount = ++g_reqCount;
+
+	if (req->attemptCount++ == 0) {
+		req->startedAt = MonotonicMilliseconds();
+	}
 	
 #ifdef DEBUG
 	if (!strncmp(req->url, "http", 4)) {
@@ -333,86 +372,80 @@ CCloudResult *CloudBuilder::RequestDispatcher::PerformRequest(CURL *ch, CHttpReq
 		safe::strcpy(fullurl, mCredentials.serverBaseName);
 		safe::sprintf(lb_id_str, "%02d", mCredentials.loadBalancerId);
 		safe::replace_string(fullurl, "[id]", lb_id_str);
-		if (g_httpVerbose) {
+		if (mVerbose) {
 			CONSOLE_VERBOSE("Building URL with base %s -> %s\n", (const char *) mCredentials.serverBaseName, fullurl); 
 		}
 		safe::strcat(fullurl, req->url);
-		if (g_httpVerbose) {
+		if (mVerbose) {
 			CONSOLE_VERBOSE("Appending %s -> %s\n", (const char *)req->url, fullurl);
 		}
 	}
 
 	IOBuf *b = curl_iobuf_new();
-	curl_easy_reset(ch);
-	struct curl_slist *slist = NULL;
+	CHttpWireRequest wire;
+	wire.url = fullurl;
+	wire.path = req->url;
 
-	// Has JSON body?
+	// Has JSON body? Sent in the binary form when enabled
 	cstring jsonBody;
+	void *cborBody = NULL;
+	size_t cborBodyLength = 0;
 	if (req->json) {
-		req->json->print(jsonBody);
-		slist = curl_slist_append(slist, "Content-Type: application/json");
+		wire.json = req->json;
+		if (mBinaryWireFormat && (cborBody = req->json->printBinary(&cborBodyLength))) {
+			wire.headers.push_back("Content-Type: application/cbor");
+			wire.body = cborBody;
+			wire.bodyLength = cborBodyLength;
+		} else {
+			req->json->print(jsonBody);
+			wire.headers.push_back("Content-Type: application/json");
+			wire.body = jsonBody.c_str();
+			wire.bodyLength = strlen(jsonBody.c_str());
+		}
+	} else if (req->binaryUpload) {
+		wire.upload = true;
+		wire.body = req->data;
+		wire.bodyLength = req->dataLength;
+	}
+	// The server may still answer in JSON, the response is decoded according to its Content-Type
+	if (mBinaryWireFormat && !req->binaryDownload) {
+		wire.headers.push_back("Accept: application/cbor, application/json;q=0.9");
 	}
 	
 	// Plus additional headers defined in the request
 	for (std::map<const char*, cstring>::iterator it = req->headers.begin(); it != req->headers.end(); ++it) {
 		safe::sprintf(buffer, "%s: %s", it->first, it->second.c_str());
-		slist = curl_slist_append(slist, buffer);
+		wire.headers.push_back(buffer);
 	}
 	
 	print_current_time(buffer);
-	const char *method = req->method ? req->method : (jsonBody ? "POST" : "GET");
-	CONSOLE_VERBOSE("%s - %s URL[%ld]: %s\n", buffer, method, gcount,fullurl);
-	curl_easy_setopt(ch, CURLOPT_URL, fullurl);
-//	curl_easy_setopt(ch, CURLOPT_ACCEPT_ENCODING, "gzip");
-	curl_easy_setopt(ch, CURLOPT_USERAGENT, g_curlUserAgent);
-	curl_easy_setopt(ch, CURLOPT_HTTPHEADER, slist);
-	curl_easy_setopt(ch, CURLOPT_HEADERFUNCTION, header);
-	curl_easy_setopt(ch, CURLOPT_HEADERDATA, b);
-	curl_easy_setopt(ch, CURLOPT_WRITEFUNCTION, writefunc);
-	curl_easy_setopt(ch, CURLOPT_WRITEDATA, b);
-	curl_easy_setopt(ch, CURLOPT_PROGRESSDATA, req->cancellationFlag);
-	curl_easy_setopt(ch, CURLOPT_PROGRESSFUNCTION, progresscallback);
-	curl_easy_setopt(ch, CURLOPT_NOPROGRESS, 0);
-	configureCurlCerts(ch);
-
-	// Bypass OpenSSL checks
-// 	curl_easy_setopt(ch, CURLOPT_SSL_VERIFYHOST, 0);
-// 	curl_easy_setopt(ch, CURLOPT_SSL_VERIFYPEER, 0);
-	// Post if JSON body is provided
-	if (jsonBody) {
-		curl_easy_setopt(ch, CURLOPT_POST, 1);
-		curl_easy_setopt(ch, CURLOPT_POSTFIELDS, jsonBody.c_str());
-	} else if (req->binaryUpload) {
-		curl_easy_setopt(ch, CURLOPT_POST, 1);
-		curl_easy_setopt(ch, CURLOPT_READDATA, req );
-		curl_easy_setopt(ch, CURLOPT_READFUNCTION, readfunc );
-		curl_easy_setopt(ch, CURLOPT_UPLOAD, 1 );
-		curl_easy_setopt(ch, CURLOPT_INFILESIZE, req->dataLength );
-		curl_easy_setopt(ch, CURLOPT_SSL_VERIFYPEER, false); // AWS fix
-	} else if (req->binaryDownload) {
-		curl_easy_setopt(ch, CURLOPT_SSL_VERIFYPEER, false); // AWS fix
-	}
-	
-	curl_easy_setopt(ch, CURLOPT_CONNECTTIMEOUT, req->connectTimeout);
-	curl_easy_setopt(ch, CURLOPT_TIMEOUT, req->timeout);
-	if (req->method) {
-		curl_easy_setopt(ch, CURLOPT_CUSTOMREQUEST, req->method);
-	}
-
-	if (g_httpVerbose) {
-		curl_easy_setopt(ch, CURLOPT_VERBOSE, 1L);
+	wire.method = req->method ? req->method : ((jsonBody || cborBody) ? "POST" : "GET");
+	wire.customMethod = req->method != NULL;
+	wire.binaryDownload = req->binaryDownload;
+	wire.connectTimeout = req->connectTimeout;
+	wire.timeout = req->timeout;
+	wire.verbose = mVerbose;
+	wire.cancellationFlag = req->cancellationFlag;
+	wire.sessionActive = &mInited;
+	CONSOLE_VERBOSE("%s - %s URL[%ld]: %s\n", buffer, wire.method, gcount,fullurl);
+
+	if (mVerbose) {
 		if (jsonBody) {
 			CONSOLE_VERBOSE("JSON body: %s\n", jsonBody.c_str());
+		} else if (cborBody) {
+			cstring printed;
+			CONSOLE_VERBOSE("CBOR body (%ld bytes): %s\n", (long) cborBodyLength, req->json->print(printed).c_str());
 		}
 	}
 
-	CURLcode retCode = curl_easy_perform(ch);
+	CRequestTimings attempt = CRequestTimings();
+	int retCode = http_transport()->Perform(wire, b, &attempt);
 
 	CONSOLE_VERBOSE("response URL[%ld] %d: '%s':\n", gcount , retCode, b->result);
-	if (g_httpVerbose) {
+	if (mVerbose) {
 		if (retCode != CURLE_OK)
-			CONSOLE_VERBOSE("Error: %s\n", curl_easy_strerror(retCode));
-		if (b->size > 0 && !req->binaryDownload) {
+			CONSOLE_VERBOSE("Error: %s\n", curl_easy_strerror((CURLcode) retCode));
+		if (b->size > 0 && !req->binaryDownload && !b->cbor) {
 			CONSOLE_VERBOSE("size: %ld\n'%s'\n", b->size, b->buffer);
 		} else {
 			CONSOLE_VERBOSE("size: %ld\n", b->size);
@@ -422,7 +455,6 @@ CCloudResult *CloudBuilder::RequestDispatcher::PerformRequest(CURL *ch, CHttpReq
 	// Query info about the result
 	CCloudResult *result = NULL;
 	if (retCode == 0) {
-		long httpCode = 0;
 		if (b->result) {
 			if (req->binaryDownload && b->code==200) {
 				CotCHelpers::CHJSON *resjson = new CotCHelpers::CHJSON();
@@ -435,7 +467,7 @@ CCloudResult *CloudBuilder::RequestDispatcher::PerformRequest(CURL *ch, CHttpReq
 				resjson->Put("url", req->url);
 				result = new CCloudResult(enNoErr, resjson);
 			} else {
-				CHJSON *resjson = CHJSON::parse(b->buffer);
+				CHJSON *resjson = b->cbor ? CHJSON::parseBinary(b->buffer, b->size) : CHJSON::parse(b->buffer);
 				if (resjson == NULL) resjson = new CHJSON();
 				result = new CCloudResult(enNoErr, resjson);
 			}
@@ -447,11 +479,9 @@ CCloudResult *CloudBuilder::RequestDispatcher::PerformRequest(CURL *ch, CHttpReq
 		if (!result) {
 			result = new CCloudResult();
 		}
-		if (curl_easy_getinfo(ch, CURLINFO_RESPONSE_CODE, &httpCode) == CURLE_OK) {
-			result->SetHttpStatusCode((int) httpCode);
-			if (httpCode >= 400) {
-				result->SetErrorCode(CloudBuilder::enServerError);
-			}
+		result->SetHttpStatusCode(b->code);
+		if (b->code >= 400) {
+			result->SetErrorCode(CloudBuilder::enServerError);
 		}
 	} else {
 		result = new CCloudResult();
@@ -459,108 +489,211 @@ CCloudResult *CloudBuilder::RequestDispatcher::PerformRequest(CURL *ch, CHttpReq
 		result->SetErrorCode(CloudBuilder::enNetworkError);
 	}
 
-	curl_slist_free_all(slist);
-//	curl_easy_cleanup(ch);
+	CRequestTimings &timings = result->Timings();
+	timings.dnsMs = attempt.dnsMs;
+	timings.connectMs = attempt.connectMs;
+	timings.tlsMs = attempt.tlsMs;
+	timings.firstByteMs = attempt.firstByteMs;
+	timings.transferMs = attempt.transferMs;
+	req->bytesSent += attempt.bytesSent;
+	req->bytesReceived += attempt.bytesReceived;
+
+	// 415 Unsupported Media Type: the server doesn't know about CBOR, use JSON from now on and replay the request
+	if (cborBody && result->GetHttpStatusCode() == 415) {
+		CONSOLE_WARNING("Binary wire format not supported by the server, falling back to JSON\n");
+		mBinaryWireFormat = false;
+		delete result;
+		result = NULL;
+	}
+
+	free(cborBody);
 	curl_iobuf_free(b);
-	return (CCloudResult*) result;
+	return result ? result : PerformRequest(req);
+}
+
+//////////////////////////// Curl transport ////////////////////////////
+CloudBuilder::CCurlTransport::~CCurlTransport() {
+	for (size_t i = 0; i < mIdleHandles.size(); i++) {
+		curl_easy_cleanup(mIdleHandles[i]);
+	}
+}
+
+int CloudBuilder::CCurlTransport::Perform(const CHttpWireRequest &req, IOBuf *b, CRequestTimings *timings) {
+	// Reuse an idle handle, so that its connections are reused as well
+	CURL *ch = NULL;
+	mHandlesMutex.Lock();
+	if (!mIdleHandles.empty()) {
+		ch = mIdleHandles.back();
+		mIdleHandles.pop_back();
+	}
+	mHandlesMutex.Unlock();
+	if (ch) {
+		curl_easy_reset(ch);
+	} else {
+		ch = curl_easy_init();
+	}
+
+	struct curl_slist *slist = NULL;
+	for (size_t i = 0; i < req.headers.size(); i++) {
+		slist = curl_slist_append(slist, req.headers[i]);
+	}
+	UploadReader reader = { (const char*) req.body, req.bodyLength, 0 };
+
+	curl_easy_setopt(ch, CURLOPT_URL, req.url);
+//	curl_easy_setopt(ch, CURLOPT_ACCEPT_ENCODING, "gzip");
+	curl_easy_setopt(ch, CURLOPT_USERAGENT, g_curlUserAgent);
+	curl_easy_setopt(ch, CURLOPT_HTTPHEADER, slist);
+	curl_easy_setopt(ch, CURLOPT_HEADERFUNCTION, header);
+	curl_easy_setopt(ch, CURLOPT_HEADERDATA, b);
+	curl_easy_setopt(ch, CURLOPT_WRITEFUNCTION, writefunc);
+	curl_easy_setopt(ch, CURLOPT_WRITEDATA, b);
+	curl_easy_setopt(ch, CURLOPT_PROGRESSDATA, &req);
+	curl_easy_setopt(ch, CURLOPT_PROGRESSFUNCTION, progresscallback);
+	curl_easy_setopt(ch, CURLOPT_NOPROGRESS, 0);
+	configureCurlCerts(ch);
+
+	// Bypass OpenSSL checks
+// 	curl_easy_setopt(ch, CURLOPT_SSL_VERIFYHOST, 0);
+// 	curl_easy_setopt(ch, CURLOPT_SSL_VERIFYPEER, 0);
+	// Post if a body is provided
+	if (req.upload) {
+		curl_easy_setopt(ch, CURLOPT_POST, 1);
+		curl_easy_setopt(ch, CURLOPT_READDATA, &reader );
+		curl_easy_setopt(ch, CURLOPT_READFUNCTION, readfunc );
+		curl_easy_setopt(ch, CURLOPT_UPLOAD, 1 );
+		curl_easy_setopt(ch, CURLOPT_INFILESIZE, (long) req.bodyLength );
+		curl_easy_setopt(ch, CURLOPT_SSL_VERIFYPEER, false); // AWS fix
+	} else if (req.body) {
+		curl_easy_setopt(ch, CURLOPT_POST, 1);
+		curl_easy_setopt(ch, CURLOPT_POSTFIELDSIZE, (long) req.bodyLength);
+		curl_easy_setopt(ch, CURLOPT_POSTFIELDS, req.body);
+	} else if (req.binaryDownload) {
+		curl_easy_setopt(ch, CURLOPT_SSL_VERIFYPEER, false); // AWS fix
+	}
+	
+	curl_easy_setopt(ch, CURLOPT_CONNECTTIMEOUT, req.connectTimeout);
+	curl_easy_setopt(ch, CURLOPT_TIMEOUT, req.timeout);
+	if (req.customMethod) {
+		curl_easy_setopt(ch, CURLOPT_CUSTOMREQUEST, req.method);
+	}
+	if (req.verbose) {
+		curl_easy_setopt(ch, CURLOPT_VERBOSE, 1L);
+	}
+
+	CURLcode retCode = curl_easy_perform(ch);
+
+	long httpCode = 0;
+	if (retCode == CURLE_OK && curl_easy_getinfo(ch, CURLINFO_RESPONSE_CODE, &httpCode) == CURLE_OK) {
+		b->code = (int) httpCode;
+	}
+
+	// Breakdown of this attempt; curl gives times in seconds, each one cumulated from the start
+	double nameLookup = 0, connect = 0, appConnect = 0, startTransfer = 0, total = 0;
+	curl_off_t uploaded = 0, downloaded = 0;
+	curl_easy_getinfo(ch, CURLINFO_NAMELOOKUP_TIME, &nameLookup);
+	curl_easy_getinfo(ch, CURLINFO_CONNECT_TIME, &connect);
+	curl_easy_getinfo(ch, CURLINFO_APPCONNECT_TIME, &appConnect);
+	curl_easy_getinfo(ch, CURLINFO_STARTTRANSFER_TIME, &startTransfer);
+	curl_easy_getinfo(ch, CURLINFO_TOTAL_TIME, &total);
+	curl_easy_getinfo(ch, CURLINFO_SIZE_UPLOAD_T, &uploaded);
+	curl_easy_getinfo(ch, CURLINFO_SIZE_DOWNLOAD_T, &downloaded);
+	timings->dnsMs = nameLookup * 1000;
+	timings->connectMs = connect > nameLookup ? (connect - nameLookup) * 1000 : 0;
+	timings->tlsMs = appConnect > connect ? (appConnect - connect) * 1000 : 0;
+	timings->firstByteMs = startTransfer * 1000;
+	timings->transferMs = total * 1000;
+	timings->bytesSent = (double) uploaded;
+	timings->bytesReceived = (double) downloaded;
+
+	curl_slist_free_all(slist);
+	mHandlesMutex.Lock();
+	mIdleHandles.push_back(ch);
+	mHandlesMutex.Unlock();
+	return retCode;
 }
 
 void CloudBuilder::RequestDispatcher::Run() {
 	list<CHttpRequest*> *pendingRequests = mRequestGuard.LockVar();
-	bool needNewBalancer = true;	// if needed to change the load-balancer at next attempt
-	intptr_t lastRequestData = 0;
-	bool needsFreeRequestData = false;
+	// Upon custom error delegate, process requests anyway
+	bool process = mNetworkState || mFailureDelegate;
 	int retryIn = 0;
 
-	Retain(this);
-	threadId = ++g_activeRequestDispatcherThreadId;
-	CONSOLE_VERBOSE("Starting HTTP thread %d\n", threadId);
-
-	CURL *ch = curl_easy_init();
-
-	while (mActive) {
-		// Upon custom error delegate, process requests anyway
-		bool process = g_networkState || g_failureDelegate;
-		// Process requests as they come
-		while (!pendingRequests->empty() && mActive && process) {
-			CHttpRequest *req = pendingRequests->front();
-			// Allow other threads to push additional requests while we handle them
-			pendingRequests = mRequestGuard.UnlockVar();
-			CCloudResult *result = PerformRequest(ch, req);
-			retryIn = 0;
-
-			// If the request failed due to a recoverable error, pause for a while
-			if (ShouldRetryRequest(req, result)) {
-				// Each delay is tested twice on a different load-balancer
-				if (needNewBalancer)  {
-					mCredentials.needsChooseNewLoadBalancer = true;
-					needNewBalancer = false;
-				} else {
-					needNewBalancer = true;
-				}
-
-				CHttpFailureEventArgs e(req->url, lastRequestData);
-				if (g_failureDelegate)
-					(*g_failureDelegate)(e);
-				else
-					shouldRetryDefaultRoutine(e);
-				lastRequestData = e.UserData();
-				if (e.retryDelay == -2) {
-					CONSOLE_ERROR("The HTTP failure delegate did not call Abort or RetryIn. Aborting\n");
-					e.Abort();
-				}
-
-				if (e.retryDelay != -1) {
-					CONSOLE_VERBOSE("Request failed, will retry in %dms\n", e.retryDelay);
-					retryIn = e.retryDelay;
-				}
-				else {
-					CONSOLE_VERBOSE("Giving up request to %s, failed to many times\n", req->url.c_str());
-					// Do not call callbacks for old threads
-					if (threadId == g_activeRequestDispatcherThreadId) {
-						CallbackStack::pushCallback(req->callback, result);
-					}
-					DequeueProcessedRequest();
-				}
-				
-				// Acquire lock for next loop iteration
-				pendingRequests = mRequestGuard.LockVar();
-				break;
-			} else if (ShouldChangeLoadBalancer(result)) {
-				// Even if the policy doesn't tell to retry, we might want to try another load balancer next time
+	if (!pendingRequests->empty() && mActive && process) {
+		CHttpRequest *req = mCurrentRequest = pendingRequests->front();
+		// Allow other threads to push additional requests while we handle it
+		pendingRequests = mRequestGuard.UnlockVar();
+		CCloudResult *result = PerformRequest(req);
+
+		// If the request failed due to a recoverable error, pause for a while
+		if (ShouldRetryRequest(req, result)) {
+			// Each delay is tested twice on a different load-balancer
+			if (mNeedNewBalancer)  {
 				mCredentials.needsChooseNewLoadBalancer = true;
+				mNeedNewBalancer = false;
+			} else {
+				mNeedNewBalancer = true;
 			}
 
-			// Once finished (reset error/delay variables)
-			_currentDelayId = 0;
-			needNewBalancer = true;
-			// Do not call callbacks for old threads
-			if (threadId == g_activeRequestDispatcherThreadId) {
-				CallbackStack::pushCallback(req->callback, result);
+			CHttpFailureEventArgs e(req->url, mFailureUserData);
+			if (mFailureDelegate)
+				(*mFailureDelegate)(e);
+			else
+				ShouldRetryDefaultRoutine(e);
+			mFailureUserData = e.UserData();
+			if (e.retryDelay == -2) {
+				CONSOLE_ERROR("The HTTP failure delegate did not call Abort or RetryIn. Aborting\n");
+				e.Abort();
 			}
-			DequeueProcessedRequest();
-			// Acquire lock for next loop iteration
-			pendingRequests = mRequestGuard.LockVar();
-		}
 
-		// We won't need the object data anymore
-		if (retryIn == 0) {
-			if (needsFreeRequestData) { delete (void*)lastRequestData; }
-			lastRequestData = 0;
+			if (e.retryDelay != -1) {
+				CONSOLE_VERBOSE("Request failed, will retry in %dms\n", e.retryDelay);
+				retryIn = e.retryDelay;
+				delete result;
 			}
-
-		// Wait for the next job
-		if (mActive) {
-			// Wait indefinitely unless there is an error
-			mRequestGuard.Wait(retryIn);
+			else {
+				CONSOLE_VERBOSE("Giving up request to %s, failed to many times\n", req->url.c_str());
+				FinishRequest(req, result);
+			}
+		} else {
+			// Even if the policy doesn't tell to retry, we might want to try another load balancer next time
+			if (ShouldChangeLoadBalancer(result)) {
+				mCredentials.needsChooseNewLoadBalancer = true;
+			}
+			// Once finished (reset error/delay variables)
+			mCurrentDelayId = 0;
+			mNeedNewBalancer = true;
+			FinishRequest(req, result);
 		}
+		pendingRequests = mRequestGuard.LockVar();
 	}
 
-	curl_easy_cleanup(ch);
-	
-	CONSOLE_VERBOSE("Finished HTTP thread %d\n", threadId);
+	// We won't need the object data anymore
+	if (retryIn == 0) {
+		mFailureUserData = 0;
+	}
+	if (mActive && retryIn > 0) {
+		// Retry once the delay has elapsed, regardless of new requests, unless the network is back (UnblockThread)
+		CTaskExecutor::SubmitAfter(this, retryIn);
+	} else if (mActive && process && !pendingRequests->empty()) {
+		// Behind the tasks queued meanwhile, possibly by other contexts
+		CTaskExecutor::Submit(this);
+	} else {
+		// Nothing left to do for now; lets Terminate know that the dispatcher is no longer in use
+		mCurrentRequest = NULL;
+		mScheduled = false;
+		mRequestGuard.SignalAll();
+	}
 	mRequestGuard.UnlockVar();
-	Release(this);
+}
+
+void CloudBuilder::RequestDispatcher::CompleteRequest(CHttpRequest *req, CCloudResult *result) {
+	CRequestTimings &timings = result->Timings();
+	timings.queueMs = (double) (req->startedAt - req->queuedAt);
+	timings.totalMs = (double) (MonotonicMilliseconds() - req->queuedAt);
+	timings.retryCount = req->attemptCount - 1;
+	timings.bytesSent = req->bytesSent;
+	timings.bytesReceived = req->bytesReceived;
+	metrics_record_request(req->url, timings, result->GetErrorCode() != enNoErr);
 }
 
 bool CloudBuilder::RequestDispatcher::ShouldChangeLoadBalancer(const CCloudResult *result) {
@@ -592,33 +725,54 @@ bool CloudBuilder::RequestDispatcher::ShouldRetryRequest(CHttpRequest *request,
 }
 
 void CloudBuilder::RequestDispatcher::Terminate() {
-	// Wait for the end of the thread
-	if (mAlreadyStarted) {
-		// Wake up the thread and make it exit from its loop
-		mActive = false;
-		// Mark it as inactive
-		g_activeRequestDispatcherThreadId++;
-		mRequestGuard.SignalAll();
+	// Make the current run stop there and wait for it
+	mRequestGuard.LockVar();
+	mActive = false;
+	// A retry delay is not waited for
+	CTaskExecutor::Hasten(this);
+	while (mScheduled) {
+		mRequestGuard.Wait();
 	}
-	Join();
-	requestDispatcherInstance <<= NULL;
+	mRequestGuard.UnlockVar();
 }
 
 void CloudBuilder::RequestDispatcher::UnblockThread() {
-	if (mAlreadyStarted) {
-		mRequestGuard.SignalAll();
+	list<CHttpRequest*> *pendingRequests = mRequestGuard.LockVar();
+	// Ends the wait before a retry
+	CTaskExecutor::Hasten(this);
+	// Send again the journaled requests which could not reach the server
+	if (mJournal) {
+		list<CHttpRequest*> resend;
+		mJournal->TakeRequestsToResend(resend);
+		for (list<CHttpRequest*>::iterator it = resend.begin(); it != resend.end(); ++it) {
+			(*it)->queuedAt = MonotonicMilliseconds();
+		}
+		pendingRequests->splice(pendingRequests->end(), resend);
+	}
+	// Requests may have been held while the network was down
+	if (!pendingRequests->empty()) {
+		Schedule();
 	}
+	mRequestGuard.UnlockVar();
+}
+
+void CloudBuilder::http_init(const char *serverUrl, int loadBalancerCount, int connectTimeout, int timeout, bool httpVerbose, CWakeUpSignal *synchronousWaitAborter) {
+	RequestDispatcher *dispatcher = RequestDispatcher::Instance();
+	dispatcher->mCredentials.serverBaseName = serverUrl;
+	dispatcher->mCredentials.loadBalancerCount = loadBalancerCount;
+	dispatcher->mDefaultConnectTimeout = connectTimeout;
+	dispatcher->mDefaultTimeout = timeout;
+	dispatcher->mVerbose = httpVerbose;
+	dispatcher->mSynchronousCancelVariable = synchronousWaitAborter;
+	dispatcher->mInited = true;
 }
 
-void CloudBuilder::http_init(const char *serverUrl, int loadBalancerCount, int connectTimeout, int timeout, bool httpVerbose, CConditionVariable *synchronousWaitAborter) {
-	CRESTAppCredentials &creds = RequestDispatcher::Instance()->mCredentials;
-	creds.serverBaseName = serverUrl;
-	creds.loadBalancerCount = loadBalancerCount;
-	g_defaultConnectTimeout = connectTimeout;
-	g_defaultTimeout = timeout;
-	g_httpVerbose = httpVerbose;
-	g_synchronousCancelVariable = synchronousWaitAborter;
-	g_httpInited = true;
+void CloudBuilder::http_set_binary_wire_format(bool enabled) {
+	RequestDispatcher::Instance()->mBinaryWireFormat = enabled;
+}
+
+void CloudBuilder::http_open_journal(const char *fileName) {
+	RequestDispatcher::Instance()->OpenJournal(fileName);
 }
 
 void CloudBuilder::http_perform(CloudBuilder::CHttpRequest *request) {
@@ -626,21 +780,21 @@ void CloudBuilder::http_perform(CloudBuilder::CHttpRequest *request) {
 }
 
 CCloudResult *CloudBuilder::http_perform_synchronous(CHttpRequest *request) {
+	// Kept alive even if the session is terminated meanwhile
+	autoref<RequestDispatcher> dispatcher(RequestDispatcher::Instance());
 	// Sanity check
-	if (!g_httpInited) {
+	if (!dispatcher->mInited) {
 		CONSOLE_VERBOSE("Discarding HTTP call because the HTTP layer is not initialized.\n");
 		return new CCloudResult(enLogicError, "HTTP request performed after a Terminate");
 	}
 
-	CRESTAppCredentials &creds = RequestDispatcher::Instance()->mCredentials;
+	CRESTAppCredentials &creds = dispatcher->mCredentials;
 	bool needNewBalancer = true;	// if needed to change the load-balancer at next attempt
-	// Do not retry too often if the last synchronous request has failed
-	static bool failedLastTime = false;
-	size_t currentDelayId = failedLastTime ? numberof(RETRY_DELAYS_MILLISEC) - 1 : 0;
-	CURL *ch = curl_easy_init();
+	size_t currentDelayId = dispatcher->mSynchronousFailedLastTime ? numberof(RETRY_DELAYS_MILLISEC) - 1 : 0;
+	request->queuedAt = MonotonicMilliseconds();
 
 	while (true) {
-		CCloudResult *result = RequestDispatcher::PerformRequest(ch, request);
+		CCloudResult *result = dispatcher->PerformRequest(request);
 		if (RequestDispatcher::ShouldRetryRequest(request, result)) {
 			// Each delay is tested twice on a different load-balancer
 			if (needNewBalancer)  {
@@ -654,11 +808,12 @@ CCloudResult *CloudBuilder::http_perform_synchronous(CHttpRequest *request) {
 			// Check that we didn't fail too many times
 			if (currentDelayId < numberof(RETRY_DELAYS_MILLISEC)) {
 				CONSOLE_VERBOSE("Request failed, will retry in %dms\n", RETRY_DELAYS_MILLISEC[currentDelayId]);
-				g_synchronousCancelVariable->Wait(RETRY_DELAYS_MILLISEC[currentDelayId]);
+				delete result;
+				dispatcher->mSynchronousCancelVariable->Sleep(RETRY_DELAYS_MILLISEC[currentDelayId]);
 			} else {
 				CONSOLE_VERBOSE("Giving up request to %s, failed to many times\n", request->url.c_str());
-				failedLastTime = true;
-				curl_easy_cleanup(ch);
+				dispatcher->mSynchronousFailedLastTime = true;
+				RequestDispatcher::CompleteRequest(request, result);
 				return result;
 			}
 		} else {
@@ -666,19 +821,34 @@ CCloudResult *CloudBuilder::http_perform_synchronous(CHttpRequest *request) {
 			if (RequestDispatcher::ShouldChangeLoadBalancer(result)) {
 				creds.needsChooseNewLoadBalancer = true;
 			}
-			failedLastTime = false;
-			curl_easy_cleanup(ch);
+			dispatcher->mSynchronousFailedLastTime = false;
+			RequestDispatcher::CompleteRequest(request, result);
 			return result;
 		}
 	}
 }
 
 void CloudBuilder::http_terminate() {
-	g_httpInited = false;
-	RequestDispatcher::Instance()->Terminate();
+	autoref<RequestDispatcher> &dispatcher = CClientContext::Current()->Internals().dispatcher;
+	if (dispatcher) {
+		dispatcher->mInited = false;
+		dispatcher->Terminate();
+		dispatcher <<= NULL;
+	}
 }
 
 void CloudBuilder::http_trigger_pending() {
 	RequestDispatcher::Instance()->UnblockThread();
 }
 
+void CloudBuilder::http_set_network_state(bool on) {
+	RequestDispatcher::Instance()->mNetworkState = on;
+}
+
+bool CloudBuilder::http_network_state() {
+	return RequestDispatcher::Instance()->mNetworkState;
+}
+
+void CloudBuilder::http_set_failure_callback(CDelegate<void(CHttpFailureEventArgs&)> *callback) {
+	RequestDispatcher::Instance()->mFailureDelegate <<= callback;
+}
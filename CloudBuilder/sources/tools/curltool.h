@@ -11,16 +11,20 @@
 
 #include "CloudBuilder.h"
 #include <map>
+#include <list>
 #include "CCallback.h"
+#include "cotc_thread.h"
 #include "helpers.h"
+#include "CAllocator.h"
+#include "CHttpFailureEventArgs.h"
 
 namespace CotCHelpers {
 	class CHJSON;
 }
 
 namespace CloudBuilder {
-	struct CRESTAppCredentials;
 	class CCloudResult;
+	class CRequestJournal;
 
     extern char g_curlUserAgent[128];
     
@@ -28,6 +32,8 @@ namespace CloudBuilder {
 	 * Description of an HTTP request to be performed.
 	 */
 	struct CHttpRequest {
+		COTC_ALLOCATED_AS(enMemoryHTTP)
+
 		enum RetryPolicy {
 			NonpermanentErrors,			// Retry when a 5xx range HTTP code has been received and if the host can not be reached (recommended)
 			AllErrors,					// Retry when any response more than 2xx is received or if any connection anomaly happens
@@ -84,6 +90,14 @@ namespace CloudBuilder {
 		 * @param setToTrueFromAnyThreadToAbort sets the cancellation flag for this request
 		 */
 		void SetCancellationFlag(bool *setToTrueFromAnyThreadToAbort) { cancellationFlag = setToTrueFromAnyThreadToAbort; }
+		/**
+		 * Marks a request changing the state of the gamer as safe to send again later, should it fail to reach the
+		 * server. When the request journal is enabled, such a request is kept on the disk until answered, and
+		 * carries an idempotency key. Requests with a binary body are never journaled.
+		 * @param supersedeKey with the journal, requests with the same key replace each other, only the last one
+		 * queued is sent (typically the path of a value being set); NULL if the request can't be replaced by a later one
+		 */
+		void SetReplayable(const char *supersedeKey = NULL) { replayable = true; this->supersedeKey = supersedeKey; }
 
 		void *getNextData(size_t size) { char *p = (char*)this->data + this->currentPos; this->currentPos += size; return p;}
 		size_t getNextSize(size_t maxSize) { return (maxSize >= this->dataLength-this->currentPos) ? this->dataLength-this->currentPos : maxSize; }
@@ -102,14 +116,125 @@ namespace CloudBuilder {
 		bool binaryDownload;
 		size_t currentPos;
 		bool *cancellationFlag;
+		// For CRequestTimings (monotonic times)
+		long long queuedAt, startedAt;
+		int attemptCount;
+		double bytesSent, bytesReceived;
+		// For CRequestJournal
+		bool replayable;
+		cstring supersedeKey, journalId;
+		// Callbacks of the requests superseded by this one, called with the same result
+		std::list<CCallback*> supersededCallbacks;
 		
 		// Not allowed
 		CHttpRequest(const CHttpRequest &other);
 		CHttpRequest& operator = (const CHttpRequest &);
 		friend class RequestDispatcher;
+		friend class CRequestJournal;
 		friend CCloudResult *http_perform_synchronous(CHttpRequest *request);
 	};
 
+	/**
+	 * Used to store the credentials passed to http_init.
+	 */
+	struct CRESTAppCredentials {
+		CRESTAppCredentials() : loadBalancerId(0), loadBalancerCount(0), needsChooseNewLoadBalancer(true) {}
+
+		int loadBalancerId;					// selected load balancer (1..loadBalancerCount)
+		int loadBalancerCount;				// maximum number of load balancers
+		cstring serverBaseName;				// templated, with [id] being the load balancer ID
+		bool needsChooseNewLoadBalancer;	// set to true to choose a new balancer at the next request
+	};
+
+	/**
+	 * HTTP request queue of a CClientContext, along with its settings. Requests are processed one after the other
+	 * by a task that is run on the CTaskExecutor whenever there is something to do, so that the contexts share the
+	 * worker threads. Each run performs a single request then submits the task again, so that the contexts take
+	 * turns on the workers, and the delay before a retry is left to CTaskExecutor::SubmitAfter rather than waited
+	 * for on a worker. The http_* functions work on the dispatcher of the context in scope.
+	 */
+	class RequestDispatcher : public CTask {
+		// Pending requests; memory is owned here until they are processed
+		CotCHelpers::CProtectedVariable< std::list<CHttpRequest*> > mRequestGuard;
+		// Whether a run is queued, delayed for a retry or ongoing on the executor
+		bool mScheduled;
+		bool mActive;
+		// Index in RETRY_DELAYS_MILLISEC for the default failure handling
+		size_t mCurrentDelayId;
+		// Kept between the attempts of the first request: each delay is tried on two load balancers, and the
+		// failure delegate gets back its user data
+		bool mNeedNewBalancer;
+		intptr_t mFailureUserData;
+		// Do not retry too often if the last synchronous request has failed
+		bool mSynchronousFailedLastTime;
+		// Request being processed by Run (first of the queue), which can't be superseded anymore
+		CHttpRequest *mCurrentRequest;
+		// Set by http_open_journal
+		owned_ref<CRequestJournal> mJournal;
+
+		RequestDispatcher(const RequestDispatcher &copy_not_allowed);
+
+		void DequeueProcessedRequest();
+		// Delivers the final result of the first request and dequeues it
+		void FinishRequest(CHttpRequest *req, CCloudResult *result);
+		// Call with the queue locked
+		void Schedule();
+		void ShouldRetryDefaultRoutine(CHttpFailureEventArgs &e);
+		virtual void Run();
+		friend CCloudResult *http_perform_synchronous(CHttpRequest *request);
+
+	public:
+		// Set by http_init
+		CRESTAppCredentials mCredentials;
+		int mDefaultTimeout, mDefaultConnectTimeout;
+		bool mVerbose;
+		// Set to false to stop any HTTP request
+		bool mInited;
+		// Requests bodies as CBOR and lets the server answer with it
+		bool mBinaryWireFormat;
+		// While false, queued requests wait for http_trigger_pending, unless there is a failure delegate
+		bool mNetworkState;
+		CWakeUpSignal *mSynchronousCancelVariable;
+		owned_ref<CDelegate<void(CHttpFailureEventArgs&)>> mFailureDelegate;
+
+		RequestDispatcher();
+		~RequestDispatcher();
+
+		/**
+		 * @return the dispatcher of the context in scope, created if needed
+		 */
+		static RequestDispatcher *Instance();
+
+		/**
+		 * Queues a request and makes sure that it will be processed. With the journal, queued requests superseded by
+		 * this one are removed, their callbacks being called with the result of this one.
+		 */
+		void EnqueueRequest(CHttpRequest *request);
+		/**
+		 * Starts journaling the replayable requests, and queues the ones left by a previous session.
+		 */
+		void OpenJournal(const char *fileName);
+		/**
+		 * Blocking method, meant to be called internally.
+		 */
+		CCloudResult *PerformRequest(CHttpRequest *req);
+		/**
+		 * Fills the timings of the final result of a request and accounts for it in the metrics.
+		 */
+		static void CompleteRequest(CHttpRequest *req, CCloudResult *result);
+		static bool ShouldChangeLoadBalancer(const CCloudResult *result);
+		static bool ShouldRetryRequest(CHttpRequest *request, const CCloudResult *result);
+		/**
+		 * Stops processing requests, waiting for the ongoing one to finish.
+		 */
+		void Terminate();
+		/**
+		 * Ends the wait before a retry, and resumes the processing of requests held while the network was down.
+		 * The journaled requests which failed to reach the server meanwhile are queued again.
+		 */
+		void UnblockThread();
+	};
+
 	/**
 	 * Utility class that allows to build URLs more easily.
 	 */
@@ -151,9 +276,22 @@ namespace CloudBuilder {
 	 * @param connectTimeout pass 0 for default
 	 * @param timeout pass 0 for default
 	 * @param httpVerbose
-	 * @param sharedSynchronousWaitAborter you can signal this condition variable in order to abort waiting on synchronous operations
+	 * @param sharedSynchronousWaitAborter wake this signal up in order to abort waiting on synchronous operations
+	 */
+	void http_init(const char *serverUrl, int loadBalancerCount, int connectTimeout, int timeout, bool httpVerbose, CWakeUpSignal *sharedSynchronousWaitAborter);
+	/**
+	 * Enables the compact binary wire format. JSON bodies are then sent as CBOR and the server is told that it may
+	 * answer the same way (responses are decoded according to their Content-Type anyway). If the server rejects a
+	 * CBOR body, the format is disabled for the rest of the session and the request is replayed as JSON.
+	 * @param enabled whether to use CBOR instead of JSON
+	 */
+	void http_set_binary_wire_format(bool enabled);
+	/**
+	 * Enables the request journal (see CRequestJournal) for the context in scope. The requests it holds are queued
+	 * right away, so call it after http_init.
+	 * @param fileName path of the journal, relative to the CFilesystemManager folder
 	 */
-	void http_init(const char *serverUrl, int loadBalancerCount, int connectTimeout, int timeout, bool httpVerbose, CotCHelpers::CConditionVariable *sharedSynchronousWaitAborter);
+	void http_open_journal(const char *fileName);
 	/**
 	 * Performs an HTTP request.
 	 * @param request information about the request; the object will be owned by this function, so pass a 'new' reference and do not release it yourself
@@ -174,12 +312,22 @@ namespace CloudBuilder {
 	 * Call this function to indicate that a retry should be done.
 	 */
 	void http_trigger_pending();
+	/**
+	 * Tells whether the network is available. While it isn't, queued requests are held until http_trigger_pending,
+	 * unless a failure callback has been set.
+	 */
+	void http_set_network_state(bool on);
+	bool http_network_state();
+	/**
+	 * Sets the callback deciding what to do when a queued request fails (see CClan::SetHttpFailureCallback).
+	 * @param callback callback, owned from now on; NULL to restore the default behaviour
+	 */
+	void http_set_failure_callback(CDelegate<void(CHttpFailureEventArgs&)> *callback);
 
 	// Internal
 	void configureCurlCerts(void *ch);
 }
 
-extern bool g_networkState;
 
 #endif
 
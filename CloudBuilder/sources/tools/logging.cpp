@@ -0,0 +1,233 @@
+//
+//  logging.cpp
+//  CloudBuilder
+//
+//  Created by florian on 20/10/16.
+//  Copyright (c) 2016 Clan of the Cloud. All rights reserved.
+//
+
+#include <stdio.h>
+#include <stdarg.h>
+#include <atomic>
+
+#include "CloudBuilder_private.h"
+#include "logging.h"
+#include "cotc_thread.h"
+#include "CAllocator.h"
+
+#ifdef __ANDROID__
+#	include <android/log.h>
+#endif
+
+using namespace CotCHelpers;
+
+namespace CloudBuilder {
+
+	// Power of two. Messages that don't fit in a slot are allocated separately.
+	static const unsigned SLOT_COUNT = 128;
+	static const int SLOT_TEXT_SIZE = 256;
+
+	// Bounded multi-producer queue: a slot is free for the producer at position p when its sequence is p,
+	// and holds a message for the consumer when it is p + 1.
+	struct LogSlot {
+		std::atomic<unsigned> sequence;
+		LOG_LEVEL level;
+		char *longText;
+		char text[SLOT_TEXT_SIZE];
+	};
+
+	struct LogWriter: CThread {
+		virtual void Run();
+	};
+
+	struct LoggerState {
+		LogSlot slots[SLOT_COUNT];
+		std::atomic<unsigned> enqueuePos, dequeuePos;
+		std::atomic<unsigned> droppedCount;
+		std::atomic<int> rateLimit, rateWindow, rateCount;
+		// 0: not started, 1: running, -1: could not start (messages written synchronously)
+		std::atomic<int> writerState;
+		std::atomic<bool> writerSleeping;
+		int flushWaiters;
+		CConditionVariable condition;
+		CMutex sinkMutex;
+		LOG_SINK sink;
+		void *sinkUserData;
+
+		LoggerState() : enqueuePos(0), dequeuePos(0), droppedCount(0), rateLimit(0), rateWindow(-1), rateCount(0),
+			writerState(0), writerSleeping(false), flushWaiters(0), sink(NULL), sinkUserData(NULL) {
+			for (unsigned i = 0; i < SLOT_COUNT; i++) {
+				slots[i].sequence.store(i, std::memory_order_relaxed);
+				slots[i].longText = NULL;
+			}
+		}
+	};
+
+	// Never destroyed, as the writer thread keeps running until the end of the process
+	static LoggerState &loggerState() {
+		static LoggerState *state = new LoggerState;
+		return *state;
+	}
+
+	static void defaultSink(LOG_LEVEL level, const char *message, void *) {
+#ifdef __ANDROID__
+		__android_log_write(ANDROID_LOG_ERROR, "CloudBuilder[stderr]", message);
+#else
+		fputs(message, stderr);
+#endif
+	}
+
+	// Call with sinkMutex locked, which also makes the caller the only consumer of the queue
+	static void writeToSink(LoggerState &s, LOG_LEVEL level, const char *message) {
+		unsigned dropped = s.droppedCount.exchange(0);
+		LOG_SINK sink = s.sink ? s.sink : defaultSink;
+		if (dropped > 0) {
+			char notice[64];
+			snprintf(notice, sizeof(notice), "[%u log messages dropped]\n", dropped);
+			sink(LOG_LEVEL_WARNING, notice, s.sinkUserData);
+		}
+		sink(level, message, s.sinkUserData);
+	}
+
+	// Single consumer. Returns false if there is no message ready.
+	static bool writeNextMessage(LoggerState &s) {
+		unsigned pos = s.dequeuePos.load(std::memory_order_relaxed);
+		LogSlot &slot = s.slots[pos & (SLOT_COUNT - 1)];
+		if ((int) (slot.sequence.load(std::memory_order_acquire) - (pos + 1)) < 0) { return false; }
+
+		writeToSink(s, slot.level, slot.longText ? slot.longText : slot.text);
+		ReleaseMemory(slot.longText), slot.longText = NULL;
+		slot.sequence.store(pos + SLOT_COUNT, std::memory_order_release);
+		s.dequeuePos.store(pos + 1, std::memory_order_release);
+		return true;
+	}
+
+	void LogWriter::Run() {
+		LoggerState &s = loggerState();
+		while (true) {
+			s.sinkMutex.Lock();
+			while (writeNextMessage(s)) {}
+			s.sinkMutex.Unlock();
+
+			s.condition.LockVar();
+			if (s.flushWaiters > 0) {
+				s.condition.SignalAll();
+			}
+			// Producers only take the lock to wake us up, after checking this flag
+			s.writerSleeping = true;
+			unsigned pos = s.dequeuePos.load();
+			if ((int) (s.slots[pos & (SLOT_COUNT - 1)].sequence.load() - (pos + 1)) < 0) {
+				s.condition.Wait();
+			}
+			s.writerSleeping = false;
+			s.condition.UnlockVar();
+		}
+	}
+
+	static void startWriter(LoggerState &s) {
+		int expected = 0;
+		if (s.writerState.compare_exchange_strong(expected, 1)) {
+			LogWriter *writer = new LogWriter;
+			if (!writer->Start()) {
+				s.writerState = -1;
+			}
+			// Runs until the end of the process
+			writer->Release();
+		}
+	}
+
+	static bool allowedByRateLimit(LoggerState &s, LOG_LEVEL level) {
+		int limit = s.rateLimit.load(std::memory_order_relaxed);
+		if (limit <= 0 || level <= LOG_LEVEL_ERROR) { return true; }
+		int second = (int) (MonotonicMilliseconds() / 1000);
+		int window = s.rateWindow.load(std::memory_order_relaxed);
+		if (window != second && s.rateWindow.compare_exchange_strong(window, second)) {
+			s.rateCount = 0;
+		}
+		return ++s.rateCount <= limit;
+	}
+
+	void log_set_sink(LOG_SINK sink, void *userData) {
+		LoggerState &s = loggerState();
+		CMutex::ScopedLock lock(s.sinkMutex);
+		s.sink = sink;
+		s.sinkUserData = userData;
+	}
+
+	void log_set_rate_limit(int messagesPerSecond) {
+		loggerState().rateLimit = messagesPerSecond;
+	}
+
+	void log_flush() {
+		LoggerState &s = loggerState();
+		if (s.writerState.load() != 1) { return; }
+		unsigned target = s.enqueuePos.load();
+		s.condition.LockVar();
+		s.flushWaiters++;
+		while ((int) (s.dequeuePos.load() - target) < 0) {
+			s.condition.SignalAll();
+			s.condition.Wait(100);
+		}
+		s.flushWaiters--;
+		s.condition.UnlockVar();
+	}
+}
+
+void cotc_log(LOG_LEVEL level, const char *format, ...) {
+	using namespace CloudBuilder;
+	LoggerState &s = loggerState();
+	va_list args;
+
+	if (!allowedByRateLimit(s, level)) {
+		s.droppedCount++;
+		return;
+	}
+	startWriter(s);
+
+	// Reserve a slot
+	unsigned pos = s.enqueuePos.load(std::memory_order_relaxed);
+	LogSlot *slot = NULL;
+	while (s.writerState.load() > 0) {
+		slot = &s.slots[pos & (SLOT_COUNT - 1)];
+		int diff = (int) (slot->sequence.load(std::memory_order_acquire) - pos);
+		if (diff == 0) {
+			if (s.enqueuePos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) { break; }
+		} else if (diff < 0) {
+			// Full: the writer is behind, write synchronously rather than losing messages
+			slot = NULL;
+			break;
+		} else {
+			pos = s.enqueuePos.load(std::memory_order_relaxed);
+		}
+	}
+
+	if (!slot) {
+		char text[SLOT_TEXT_SIZE];
+		va_start(args, format);
+		vsnprintf(text, sizeof(text), format, args);
+		va_end(args);
+		CMutex::ScopedLock lock(s.sinkMutex);
+		while (writeNextMessage(s)) {}
+		writeToSink(s, level, text);
+		return;
+	}
+
+	// Format in place, then publish
+	slot->level = level;
+	va_start(args, format);
+	int length = vsnprintf(slot->text, SLOT_TEXT_SIZE, format, args);
+	va_end(args);
+	if (length >= SLOT_TEXT_SIZE && (slot->longText = (char*) AllocateMemory(length + 1, enMemoryStrings))) {
+		va_start(args, format);
+		vsnprintf(slot->longText, length + 1, format, args);
+		va_end(args);
+	}
+	// Sequentially consistent, so that the writer can't be seen awake after it went to sleep on an empty queue
+	slot->sequence.store(pos + 1);
+
+	if (s.writerSleeping.load()) {
+		s.condition.LockVar();
+		s.condition.SignalAll();
+		s.condition.UnlockVar();
+	}
+}
@@ -0,0 +1,37 @@
+//
+//  logging.h
+//  CloudBuilder
+//
+//  Created by florian on 20/10/16.
+//  Copyright (c) 2016 Clan of the Cloud. All rights reserved.
+//
+
+#ifndef CloudBuilder_logging_h
+#define CloudBuilder_logging_h
+
+#include "CLogLevel.h"
+
+namespace CloudBuilder {
+
+	/**
+	 * Messages logged through the CONSOLE_* macros are formatted on the calling thread into a lock-free ring
+	 * buffer, and written to the sink by a background thread. When the buffer is full, the calling thread
+	 * writes the pending messages itself. Messages exceeding the rate limit are dropped, and their count is
+	 * reported with the next message written.
+	 * @param sink function receiving the messages, called on the logging thread; NULL to restore the default
+	 * (stderr, or logcat on Android)
+	 * @param userData passed as is to the sink
+	 */
+	void log_set_sink(LOG_SINK sink, void *userData);
+	/**
+	 * @param messagesPerSecond maximum number of messages written per second, or 0 for no limit. Errors are
+	 * never limited.
+	 */
+	void log_set_rate_limit(int messagesPerSecond);
+	/**
+	 * Blocks until all the messages logged so far have been passed to the sink.
+	 */
+	void log_flush();
+}
+
+#endif
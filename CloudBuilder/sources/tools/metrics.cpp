@@ -0,0 +1,142 @@
+//
+//  metrics.cpp
+//  CloudBuilder
+//
+//  Created by florian on 20/10/16.
+//  Copyright (c) 2016 Clan of the Cloud. All rights reserved.
+//
+
+#include <string.h>
+#include <map>
+
+#include "metrics.h"
+#include "cotc_thread.h"
+#include "helpers.h"
+
+using namespace CotCHelpers;
+
+namespace CloudBuilder {
+
+	// Upper bounds of the latency buckets, in milliseconds. A last bucket holds anything above.
+	static const double BUCKET_BOUNDS_MS[] = {10, 25, 50, 100, 250, 500, 1000, 2500, 5000, 10000};
+	static const int BUCKET_COUNT = sizeof(BUCKET_BOUNDS_MS) / sizeof(BUCKET_BOUNDS_MS[0]) + 1;
+	// Number of path components making the family of an endpoint
+	static const int FAMILY_COMPONENTS = 3;
+
+	struct Histogram {
+		unsigned counts[BUCKET_COUNT];
+		double sumMs, maxMs;
+
+		Histogram() { Clear(); }
+		void Clear() { memset(counts, 0, sizeof(counts)); sumMs = maxMs = 0; }
+		void Add(double ms) {
+			int bucket = 0;
+			while (bucket < BUCKET_COUNT - 1 && ms > BUCKET_BOUNDS_MS[bucket]) { bucket++; }
+			counts[bucket]++;
+			sumMs += ms;
+			if (ms > maxMs) { maxMs = ms; }
+		}
+		CHJSON *ToJson() const {
+			CHJSON *json = new CHJSON, *buckets = CHJSON::Array();
+			for (int i = 0; i < BUCKET_COUNT; i++) {
+				buckets->Add(new CHJSON((double) counts[i]));
+			}
+			json->Put("buckets", buckets);
+			json->Put("sumMs", sumMs);
+			json->Put("maxMs", maxMs);
+			return json;
+		}
+	};
+
+	struct FamilyStats {
+		unsigned count, errors, retries;
+		double bytesSent, bytesReceived, queueMs;
+		Histogram latency;
+
+		FamilyStats() : count(0), errors(0), retries(0), bytesSent(0), bytesReceived(0), queueMs(0) {}
+	};
+
+	struct MetricsState {
+		CMutex mutex;
+		std::map<cstring, FamilyStats> families;
+		Histogram callbackWait;
+		long long periodStart;
+
+		MetricsState() : periodStart(MonotonicMilliseconds()) {}
+	};
+
+	static MetricsState &metricsState() {
+		static MetricsState state;
+		return state;
+	}
+
+	static void endpointFamily(const char *url, char *dest, size_t size) {
+		// Full URLs (debug builds) are reduced to their path
+		const char *scheme = strstr(url, "://");
+		if (scheme) {
+			url = strchr(scheme + 3, '/');
+			if (!url) { url = "/"; }
+		}
+		int components = 0;
+		size_t length = 0;
+		for (; url[length] && url[length] != '?' && length < size - 1; length++) {
+			if (url[length] == '/' && length > 0 && ++components >= FAMILY_COMPONENTS) { break; }
+			dest[length] = url[length];
+		}
+		dest[length] = '\0';
+	}
+
+	void metrics_record_request(const char *url, const CRequestTimings &timings, bool failed) {
+		char family[128];
+		endpointFamily(url, family, sizeof(family));
+
+		MetricsState &s = metricsState();
+		CMutex::ScopedLock lock(s.mutex);
+		FamilyStats &stats = s.families[family];
+		stats.count++;
+		if (failed) { stats.errors++; }
+		stats.retries += timings.retryCount;
+		stats.bytesSent += timings.bytesSent;
+		stats.bytesReceived += timings.bytesReceived;
+		stats.queueMs += timings.queueMs;
+		stats.latency.Add(timings.totalMs);
+	}
+
+	void metrics_record_callback_wait(double waitMs) {
+		MetricsState &s = metricsState();
+		CMutex::ScopedLock lock(s.mutex);
+		s.callbackWait.Add(waitMs);
+	}
+
+	CHJSON *metrics_snapshot(bool reset) {
+		MetricsState &s = metricsState();
+		CHJSON *result = new CHJSON, *families = new CHJSON;
+		CHJSON *bounds = CHJSON::Array((double*) BUCKET_BOUNDS_MS, BUCKET_COUNT - 1);
+
+		CMutex::ScopedLock lock(s.mutex);
+		long long now = MonotonicMilliseconds();
+		for (std::map<cstring, FamilyStats>::const_iterator it = s.families.begin(); it != s.families.end(); ++it) {
+			const FamilyStats &stats = it->second;
+			CHJSON *family = new CHJSON;
+			family->Put("count", (int) stats.count);
+			family->Put("errors", (int) stats.errors);
+			family->Put("retries", (int) stats.retries);
+			family->Put("bytesSent", stats.bytesSent);
+			family->Put("bytesReceived", stats.bytesReceived);
+			family->Put("queueMs", stats.queueMs);
+			family->Put("latency", stats.latency.ToJson());
+			families->Put(it->first, family);
+		}
+		result->Put("periodMs", (double) (now - s.periodStart));
+		result->Put("bucketBoundsMs", bounds);
+		result->Put("families", families);
+		result->Put("callbackWait", s.callbackWait.ToJson());
+
+		if (reset) {
+			s.families.clear();
+			s.callbackWait.Clear();
+			s.periodStart = now;
+		}
+		return result;
+	}
+}
@@ -0,0 +1,35 @@
+//
+//  metrics.h
+//  CloudBuilder
+//
+//  Created by florian on 20/10/16.
+//  Copyright (c) 2016 Clan of the Cloud. All rights reserved.
+//
+
+#ifndef CloudBuilder_metrics_h
+#define CloudBuilder_metrics_h
+
+#include "CDelegate.h"
+
+namespace CloudBuilder {
+
+	/**
+	 * Accounts for a completed HTTP request. Requests are aggregated by endpoint family, which is made of the
+	 * first three components of the path (e.g. /v1/gamer/vfs for /v1/gamer/vfs/private/key).
+	 * @param url URL of the request (path, or full URL in debug)
+	 * @param timings timings of the request, as attached to its result
+	 * @param failed whether the request ended with an error
+	 */
+	void metrics_record_request(const char *url, const CRequestTimings &timings, bool failed);
+	/**
+	 * Accounts for the time a result spent in the callback queue before being delivered.
+	 */
+	void metrics_record_callback_wait(double waitMs);
+	/**
+	 * @param reset whether to start a new aggregation period once the snapshot has been taken
+	 * @return the aggregated metrics since the last reset, as described in CClan::GetHttpMetrics (to be deleted)
+	 */
+	CotCHelpers::CHJSON *metrics_snapshot(bool reset);
+}
+
+#endif
@@ -0,0 +1,216 @@
+//
+//  requestjournal.cpp
+//  CloudBuilder
+//
+//  Created by florian on 20/10/16.
+//  Copyright (c) 2016 Clan of the Cloud. All rights reserved.
+//
+
+#include <string.h>
+#include <stdlib.h>
+#include <time.h>
+#include "CloudBuilder_private.h"
+#include "requestjournal.h"
+#include "curltool.h"
+#include "CFilesystem.h"
+#include "CHJSON.h"
+#include "curl/curl.h"
+
+using std::list;
+using CotCHelpers::CHJSON;
+using CotCHelpers::CMutex;
+
+#define IDEMPOTENCY_HEADER "Idempotency-Key"
+// Rewrite the file once it holds that many obsolete records, and more of them than pending requests
+#define COMPACTION_THRESHOLD 64
+
+namespace CloudBuilder {
+
+	// The request expects literals for the method and header names
+	static const char *KNOWN_METHODS[] = { "GET", "POST", "PUT", "DELETE" };
+	static const char *KNOWN_HEADERS[] = { "x-apikey", "x-apisecret", "x-sdkversion", "Authorization", IDEMPOTENCY_HEADER };
+
+	static const char *findLiteral(const char **literals, size_t count, const char *value) {
+		for (size_t i = 0; value && i < count; i++) {
+			if (!strcmp(literals[i], value)) { return literals[i]; }
+		}
+		return NULL;
+	}
+
+	CRequestJournal::CRequestJournal(const char *fileName) : mFileName(fileName), mFile(NULL), mObsoleteRecords(0), mIdCounter(0) {}
+
+	CRequestJournal::~CRequestJournal() {
+		for (list<Entry*>::iterator it = mEntries.begin(); it != mEntries.end(); ++it) {
+			delete *it;
+		}
+		delete mFile;
+	}
+
+	void CRequestJournal::Open(list<CHttpRequest*> &replay) {
+		CMutex::ScopedLock lock(mMutex);
+		owned_ref<CInputFile> file (CFilesystemManager::Instance()->OpenFileForReading(mFileName));
+		if (file->IsOpen()) {
+			cstring contents (file->ReadAll(), true);
+			for (char *line = (char*) contents.c_str(), *end; line && *line; line = end) {
+				end = strchr(line, '\n');
+				if (end) { *end++ = '\0'; }
+				owned_ref<CHJSON> record (CHJSON::parse(line));
+				// A partial record may be left by the death of the process
+				if (!record) { continue; }
+				if (record->Has("done")) {
+					Forget(record->GetString("done"));
+				} else if (record->GetString("id") && record->GetString("url")) {
+					Entry *entry = new Entry;
+					entry->id = record->GetString("id");
+					entry->supersedeKey = record->GetString("supersedes");
+					entry->line = line;
+					entry->queued = false;
+					for (list<Entry*>::iterator it = mEntries.begin(); it != mEntries.end(); ) {
+						if ((*it)->supersedeKey == entry->supersedeKey) {
+							delete *it;
+							it = mEntries.erase(it);
+						} else {
+							++it;
+						}
+					}
+					mEntries.push_back(entry);
+				}
+			}
+			file->Close();
+		}
+		Rewrite();
+		if (!mEntries.empty()) {
+			CONSOLE_VERBOSE("Replaying %d journaled requests\n", (int) mEntries.size());
+		}
+		for (list<Entry*>::iterator it = mEntries.begin(); it != mEntries.end(); ++it) {
+			(*it)->queued = true;
+			replay.push_back(MakeRequest(*it));
+		}
+	}
+
+	void CRequestJournal::Append(CHttpRequest *request) {
+		if (!request->replayable || request->binaryUpload || request->journalId) {
+			return;
+		}
+
+		CMutex::ScopedLock lock(mMutex);
+		Entry *entry = new Entry;
+		csprintf(entry->id, "%lx-%x-%x", (unsigned long) time(NULL), ++mIdCounter, (unsigned) rand());
+		entry->supersedeKey = request->supersedeKey;
+		entry->queued = true;
+		request->journalId = entry->id;
+		request->SetHeader(IDEMPOTENCY_HEADER, entry->id);
+
+		CHJSON record;
+		record.Put("id", entry->id.c_str());
+		if (request->method) { record.Put("method", request->method); }
+		record.Put("url", request->url.c_str());
+		if (entry->supersedeKey) { record.Put("supersedes", entry->supersedeKey.c_str()); }
+		CHJSON *headers = new CHJSON;
+		for (std::map<const char*, cstring>::iterator it = request->headers.begin(); it != request->headers.end(); ++it) {
+			headers->Put(it->first, it->second.c_str());
+		}
+		record.Put("headers", headers);
+		if (request->json) { record.Put("body", request->json->Duplicate()); }
+		record.print(entry->line);
+
+		// The requests replaced by this one are not worth sending anymore
+		if (entry->supersedeKey) {
+			for (list<Entry*>::iterator it = mEntries.begin(); it != mEntries.end(); ) {
+				Entry *old = *it++;
+				if (old->supersedeKey == entry->supersedeKey) {
+					Forget(old->id);
+				}
+			}
+		}
+		mEntries.push_back(entry);
+		WriteLine(entry->line);
+	}
+
+	void CRequestJournal::Complete(CHttpRequest *request, const CCloudResult *result) {
+		if (!request->journalId) {
+			return;
+		}
+
+		CMutex::ScopedLock lock(mMutex);
+		// Not answered by the server (or interrupted by a Terminate): keep it for later
+		if (result->GetCurlErrorCode() == CURLE_ABORTED_BY_CALLBACK || RequestDispatcher::ShouldChangeLoadBalancer(result)) {
+			for (list<Entry*>::iterator it = mEntries.begin(); it != mEntries.end(); ++it) {
+				if ((*it)->id == request->journalId) {
+					CONSOLE_VERBOSE("Keeping request to %s in the journal\n", request->url.c_str());
+					(*it)->queued = false;
+				}
+			}
+			return;
+		}
+		Forget(request->journalId);
+	}
+
+	void CRequestJournal::TakeRequestsToResend(list<CHttpRequest*> &replay) {
+		CMutex::ScopedLock lock(mMutex);
+		for (list<Entry*>::iterator it = mEntries.begin(); it != mEntries.end(); ++it) {
+			if (!(*it)->queued) {
+				(*it)->queued = true;
+				replay.push_back(MakeRequest(*it));
+			}
+		}
+	}
+
+	void CRequestJournal::Forget(const char *entryId) {
+		// May belong to the entry
+		cstring id (entryId);
+		for (list<Entry*>::iterator it = mEntries.begin(); it != mEntries.end(); ++it) {
+			if ((*it)->id == id) {
+				delete *it;
+				mEntries.erase(it);
+				// Both the request and the record below
+				mObsoleteRecords += 2;
+				if (!mFile) {
+					// Still loading
+				} else if (mObsoleteRecords >= COMPACTION_THRESHOLD && mObsoleteRecords > (int) mEntries.size()) {
+					Rewrite();
+				} else {
+					cstring line;
+					WriteLine(csprintf(line, "{\"done\":\"%s\"}", id.c_str()));
+				}
+				return;
+			}
+		}
+	}
+
+	void CRequestJournal::WriteLine(const char *line) {
+		if (mFile->IsOpen()) {
+			mFile->Write(line, strlen(line));
+			mFile->Write("\n", 1);
+			mFile->Flush();
+		}
+	}
+
+	void CRequestJournal::Rewrite() {
+		delete mFile;
+		mFile = CFilesystemManager::Instance()->OpenFileForWriting(mFileName);
+		if (!mFile->IsOpen()) {
+			CONSOLE_ERROR("Could not open the request journal %s\n", mFileName.c_str());
+		}
+		for (list<Entry*>::iterator it = mEntries.begin(); it != mEntries.end(); ++it) {
+			WriteLine((*it)->line);
+		}
+		mObsoleteRecords = 0;
+	}
+
+	CHttpRequest *CRequestJournal::MakeRequest(const Entry *entry) {
+		owned_ref<CHJSON> record (CHJSON::parse(entry->line));
+		CHttpRequest *request = new CHttpRequest(record->GetString("url"));
+		const char *method = findLiteral(KNOWN_METHODS, numberof(KNOWN_METHODS), record->GetString("method"));
+		if (method) { request->SetMethod(method); }
+		for (CHJSON::Iterator it = record->GetSafe("headers")->begin(); it != record->GetSafe("headers")->end(); ++it) {
+			const char *name = findLiteral(KNOWN_HEADERS, numberof(KNOWN_HEADERS), (*it)->name());
+			if (name) { request->SetHeader(name, (*it)->valueString()); }
+		}
+		if (record->Has("body")) { request->SetBody(record->Extract("body")); }
+		request->replayable = true;
+		request->supersedeKey = entry->supersedeKey;
+		request->journalId = entry->id;
+		return request;
+	}
+}
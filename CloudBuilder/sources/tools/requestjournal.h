@@ -0,0 +1,85 @@
+//
+//  requestjournal.h
+//  CloudBuilder
+//
+//  Created by florian on 20/10/16.
+//  Copyright (c) 2016 Clan of the Cloud. All rights reserved.
+//
+
+#ifndef CloudBuilder_requestjournal_h
+#define CloudBuilder_requestjournal_h
+
+#include <list>
+#include "helpers.h"
+#include "cotc_thread.h"
+
+namespace CloudBuilder {
+	class COutputFile;
+	class CCloudResult;
+	struct CHttpRequest;
+
+	/**
+	 * On-disk journal of the requests marked replayable (CHttpRequest::SetReplayable), so that the changes they
+	 * carry survive a loss of network or the death of the process. A request is journaled when queued, and
+	 * forgotten once the server has answered it, or when a later request supersedes it. Requests which could not
+	 * reach the server are sent again at the next start, or when the network comes back.
+	 *
+	 * The file is made of one JSON record per line, either a request or the id of a request that is done, and
+	 * is rewritten with the pending requests only when it is opened or when most records are obsolete.
+	 * Thread safe.
+	 */
+	class CRequestJournal {
+	public:
+		/**
+		 * @param fileName path of the journal, relative to the CFilesystemManager folder
+		 */
+		CRequestJournal(const char *fileName);
+		~CRequestJournal();
+
+		/**
+		 * Reads the requests left by a previous session and compacts the file.
+		 * @param replay receives the requests to send again, in order (to be queued by the caller)
+		 */
+		void Open(std::list<CHttpRequest*> &replay);
+		/**
+		 * Journals a request marked replayable, giving it an idempotency key. The requests it supersedes are
+		 * forgotten, whether they are still queued or not. Does nothing for other requests.
+		 */
+		void Append(CHttpRequest *request);
+		/**
+		 * Records the final result of a request. The request stays in the journal if it failed to reach the
+		 * server, to be sent again by TakeRequestsToResend.
+		 */
+		void Complete(CHttpRequest *request, const CCloudResult *result);
+		/**
+		 * @param replay receives the journaled requests which are not queued anymore, in order
+		 */
+		void TakeRequestsToResend(std::list<CHttpRequest*> &replay);
+
+	private:
+		struct Entry {
+			cstring id, supersedeKey;
+			// As written to the file
+			cstring line;
+			// Whether a request for this entry is in the dispatcher queue
+			bool queued;
+		};
+
+		CotCHelpers::CMutex mMutex;
+		cstring mFileName;
+		COutputFile *mFile;
+		std::list<Entry*> mEntries;
+		// Records in the file which don't describe a pending request anymore
+		int mObsoleteRecords;
+		unsigned mIdCounter;
+
+		CRequestJournal(const CRequestJournal &copy_not_allowed);
+		// Call with the mutex held
+		void Forget(const char *id);
+		void WriteLine(const char *line);
+		void Rewrite();
+		static CHttpRequest *MakeRequest(const Entry *entry);
+	};
+}
+
+#endif
@@ -0,0 +1,263 @@
+//
+//  transport.cpp
+//  CloudBuilder
+//
+//  Created by florian on 20/10/16.
+//  Copyright (c) 2016 Clan of the Cloud. All rights reserved.
+//
+
+#include <stdlib.h>
+#include <string.h>
+#include <thread>
+#include <chrono>
+
+#include "CloudBuilder_private.h"
+#include "transport.h"
+#include "curl/curl.h"
+#include "CFilesystem.h"
+#include "CAllocator.h"
+#include "helpers.h"
+#include "cbor.h"
+
+using namespace CotCHelpers;
+
+namespace CloudBuilder {
+
+	static const char HEX_DIGITS[] = "0123456789abcdef";
+
+	static void putHex(CHJSON *dest, const char *key, const void *data, size_t size) {
+		const unsigned char *bytes = (const unsigned char*) data;
+		char *hex = (char*) AllocateMemory(size * 2 + 1, enMemoryStrings);
+		if (!hex) { return; }
+		for (size_t i = 0; i < size; i++) {
+			hex[i * 2] = HEX_DIGITS[bytes[i] >> 4];
+			hex[i * 2 + 1] = HEX_DIGITS[bytes[i] & 0xf];
+		}
+		hex[size * 2] = '\0';
+		dest->Put(key, hex);
+		ReleaseMemory(hex);
+	}
+
+	static int hexValue(char c) {
+		if (c >= '0' && c <= '9') { return c - '0'; }
+		if (c >= 'a' && c <= 'f') { return c - 'a' + 10; }
+		if (c >= 'A' && c <= 'F') { return c - 'A' + 10; }
+		return 0;
+	}
+
+	// Key under which the responses to a request are stored
+	static cstring exchangeKey(const char *method, const char *path, size_t pathLength) {
+		cstring key;
+		csprintf(key, "%s %.*s", method, (int) pathLength, path);
+		return key;
+	}
+
+	//////////////////////////// Recording ////////////////////////////
+	CRecordingTransport::CRecordingTransport(CHttpTransport *inner, const char *fileName) : mInner(inner) {
+		mFile = CFilesystemManager::Instance()->OpenFileForWriting(fileName);
+		if (!mFile->IsOpen()) {
+			CONSOLE_ERROR("Could not open %s to record the HTTP traffic\n", fileName);
+		}
+	}
+
+	CRecordingTransport::~CRecordingTransport() {
+		delete mFile;
+	}
+
+	int CRecordingTransport::Perform(const CHttpWireRequest &request, IOBuf *response, CRequestTimings *timings) {
+		int code = mInner->Perform(request, response, timings);
+
+		CHJSON exchange;
+		exchange.Put("method", request.method);
+		exchange.Put("path", request.path);
+		if (request.json) {
+			exchange.Put("request", request.json);
+		}
+		if (code != CURLE_OK) {
+			exchange.Put("error", code);
+		} else {
+			exchange.Put("status", response->code);
+			if (response->obsolete) { exchange.Put("obsolete", true); }
+			// Decoded bodies are stored as JSON, so that they can be served in either format
+			CHJSON *body = NULL;
+			if (response->size > 0 && !request.binaryDownload) {
+				body = response->cbor ? CHJSON::parseBinary(response->buffer, response->size) : CHJSON::parse(response->buffer);
+			}
+			if (body) {
+				exchange.Put("body", body);
+			} else if (response->size > 0) {
+				putHex(&exchange, "bodyHex", response->buffer, response->size);
+			}
+		}
+		exchange.Put("durationMs", timings->transferMs);
+
+		cstring line;
+		exchange.print(line);
+		CMutex::ScopedLock lock(mFileMutex);
+		if (mFile->IsOpen()) {
+			mFile->Write(line.c_str(), strlen(line.c_str()));
+			mFile->Write("\n", 1);
+		}
+		return code;
+	}
+
+	//////////////////////////// Replay ////////////////////////////
+	CReplayTransport::CReplayTransport() : mMinLatencyMs(0), mMaxLatencyMs(0), mNetworkErrorRate(0), mServerErrorRate(0), mRandomState(1) {}
+
+	CReplayTransport::~CReplayTransport() {
+		for (std::map<cstring, Exchanges>::iterator it = mExchanges.begin(); it != mExchanges.end(); ++it) {
+			for (size_t i = 0; i < it->second.responses.size(); i++) {
+				delete it->second.responses[i];
+			}
+		}
+	}
+
+	bool CReplayTransport::LoadRecording(const char *fileName) {
+		owned_ref<CInputFile> file (CFilesystemManager::Instance()->OpenFileForReading(fileName));
+		if (!file->IsOpen()) {
+			CONSOLE_ERROR("Could not open the HTTP recording %s\n", fileName);
+			return false;
+		}
+
+		cstring contents (file->ReadAll(), true);
+		int count = 0;
+		for (char *line = (char*) contents.c_str(), *end; line && *line; line = end) {
+			end = strchr(line, '\n');
+			if (end) { *end++ = '\0'; }
+			CHJSON *exchange = CHJSON::parse(line);
+			if (!exchange) { continue; }
+			const char *method = exchange->GetString("method"), *path = exchange->GetString("path");
+			if (method && path) {
+				AddExchange(method, path, exchange);
+				count++;
+			} else {
+				delete exchange;
+			}
+		}
+		CONSOLE_VERBOSE("Loaded %d HTTP exchanges from %s\n", count, fileName);
+		return true;
+	}
+
+	void CReplayTransport::AddResponse(const char *method, const char *path, int httpCode, const CHJSON *body) {
+		CHJSON *exchange = new CHJSON;
+		exchange->Put("status", httpCode);
+		if (body) { exchange->Put("body", body); }
+		AddExchange(method, path, exchange);
+	}
+
+	void CReplayTransport::AddExchange(const char *method, const char *path, CHJSON *exchange) {
+		CMutex::ScopedLock lock(mMutex);
+		mExchanges[exchangeKey(method, path, strlen(path))].responses.push_back(exchange);
+	}
+
+	void CReplayTransport::SetLatency(int minMs, int maxMs) {
+		CMutex::ScopedLock lock(mMutex);
+		mMinLatencyMs = minMs;
+		mMaxLatencyMs = maxMs > minMs ? maxMs : minMs;
+	}
+
+	void CReplayTransport::SetFailureRate(double networkErrorRate, double serverErrorRate) {
+		CMutex::ScopedLock lock(mMutex);
+		mNetworkErrorRate = networkErrorRate;
+		mServerErrorRate = serverErrorRate;
+	}
+
+	void CReplayTransport::SetSeed(unsigned seed) {
+		CMutex::ScopedLock lock(mMutex);
+		mRandomState = seed ? seed : 1;
+	}
+
+	// Between 0 and 1 (excluded); call with the mutex locked
+	double CReplayTransport::NextRandom() {
+		// xorshift32
+		mRandomState ^= mRandomState << 13;
+		mRandomState ^= mRandomState >> 17;
+		mRandomState ^= mRandomState << 5;
+		return (mRandomState & 0xffffff) / (double) 0x1000000;
+	}
+
+	int CReplayTransport::Perform(const CHttpWireRequest &request, IOBuf *response, CRequestTimings *timings) {
+		int latencyMs;
+		bool networkError, serverError;
+		{
+			CMutex::ScopedLock lock(mMutex);
+			latencyMs = mMinLatencyMs + (int) (NextRandom() * (mMaxLatencyMs - mMinLatencyMs + 1));
+			if (latencyMs > mMaxLatencyMs) { latencyMs = mMaxLatencyMs; }
+			networkError = NextRandom() < mNetworkErrorRate;
+			serverError = NextRandom() < mServerErrorRate;
+		}
+		if (latencyMs > 0) {
+			std::this_thread::sleep_for(std::chrono::milliseconds(latencyMs));
+		}
+		timings->firstByteMs = timings->transferMs = latencyMs;
+		if (request.cancellationFlag && *request.cancellationFlag) { return CURLE_ABORTED_BY_CALLBACK; }
+		if (networkError) { return CURLE_COULDNT_CONNECT; }
+
+		owned_ref<CHJSON> body;
+		{
+			CMutex::ScopedLock lock(mMutex);
+			const CHJSON *exchange = NULL;
+			if (serverError) {
+				response->code = 503;
+				body <<= CHJSON::parse("{\"name\":\"ServiceUnavailable\",\"message\":\"Simulated server error\"}");
+			} else {
+				// Exact match first, then without the query string
+				const char *query = strchr(request.path, '?');
+				std::map<cstring, Exchanges>::iterator it = mExchanges.find(exchangeKey(request.method, request.path, strlen(request.path)));
+				if (it == mExchanges.end() && query) {
+					it = mExchanges.find(exchangeKey(request.method, request.path, query - request.path));
+				}
+				if (it != mExchanges.end()) {
+					Exchanges &exchanges = it->second;
+					exchange = exchanges.responses[exchanges.next];
+					if (exchanges.next + 1 < exchanges.responses.size()) { exchanges.next++; }
+				}
+			}
+
+			if (exchange && exchange->Has("error")) {
+				return exchange->GetInt("error");
+			} else if (exchange) {
+				response->code = exchange->GetInt("status", 200);
+				response->obsolete = exchange->GetBool("obsolete");
+				if (exchange->Has("body")) {
+					body <<= exchange->Get("body")->Duplicate();
+				}
+				const char *bodyHex = exchange->GetString("bodyHex");
+				if (bodyHex) {
+					response->binary = true;
+					for (const char *hex = bodyHex; hex[0] && hex[1]; hex += 2) {
+						char byte = (char) (hexValue(hex[0]) << 4 | hexValue(hex[1]));
+						if (!curl_iobuf_append(response, &byte, 1)) { break; }
+					}
+				}
+			} else if (!serverError) {
+				CONSOLE_WARNING("No recorded response for %s %s\n", request.method, request.path);
+				response->code = 404;
+				body <<= CHJSON::parse("{\"name\":\"NotFound\",\"message\":\"No recorded response\"}");
+			}
+		}
+
+		// Serve the body the way the server would, as per the Accept header
+		if (body) {
+			const char *accept = request.GetHeader("Accept");
+			size_t length = 0;
+			void *binary = NULL;
+			if (accept && strstr(accept, CBOR_CONTENT_TYPE) && !request.binaryDownload && (binary = body->printBinary(&length))) {
+				response->cbor = true;
+				curl_iobuf_append(response, binary, length);
+				free(binary);
+			} else {
+				cstring text;
+				body->print(text);
+				curl_iobuf_append(response, text.c_str(), strlen(text.c_str()));
+			}
+		}
+
+		char status[16];
+		safe::sprintf(status, "%d", response->code);
+		response->result = DuplicateString(status, enMemoryHTTP);
+		timings->bytesSent = (double) request.bodyLength;
+		timings->bytesReceived = (double) response->size;
+		return CURLE_OK;
+	}
+}
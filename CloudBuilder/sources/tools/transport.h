@@ -0,0 +1,203 @@
+//
+//  transport.h
+//  CloudBuilder
+//
+//  Created by florian on 20/10/16.
+//  Copyright (c) 2016 Clan of the Cloud. All rights reserved.
+//
+
+#ifndef CloudBuilder_transport_h
+#define CloudBuilder_transport_h
+
+#include <map>
+#include <vector>
+#include "CDelegate.h"
+#include "cotc_thread.h"
+
+namespace CloudBuilder {
+
+	class COutputFile;
+
+	/// Response of an HTTP request, filled by the transport
+	typedef struct IOBuf
+	{
+		char* 	buffer;
+		size_t 	size;
+		size_t 	capacity;
+
+		char* 	result;
+		char* 	lastMod;
+		char* 	eTag;
+		int 	contentLen;
+		int 	len;
+		int 	code;
+		bool    binary;
+		bool	obsolete;
+		bool	cbor;
+	} IOBuf;
+
+	IOBuf *curl_iobuf_new();
+	void curl_iobuf_free(IOBuf *bf);
+	/**
+	 * Appends data to the body of a response.
+	 * @return false if out of memory
+	 */
+	bool curl_iobuf_append(IOBuf *bf, const void *data, size_t size);
+
+	/**
+	 * A request as sent on the wire, built by the dispatcher from a CHttpRequest.
+	 */
+	struct CHttpWireRequest {
+		/// Effective method
+		const char *method;
+		/// Whether the method was set explicitly on the request, rather than deduced from the presence of a body
+		bool customMethod;
+		/// Full URL, including the server
+		const char *url;
+		/// URL as passed to the CHttpRequest (a path, unless it is a full URL)
+		const char *path;
+		/// Headers, formatted as "Name: value"
+		std::vector<CotCHelpers::cstring> headers;
+		/// JSON body, when there is one (sent as JSON or CBOR as per the headers)
+		const CotCHelpers::CHJSON *json;
+		/// Body as sent on the wire
+		const void *body;
+		size_t bodyLength;
+		/// The body is a file uploaded to a storage URL rather than posted to the API
+		bool upload;
+		/// The response is a file, not to be decoded
+		bool binaryDownload;
+		int connectTimeout, timeout;
+		bool verbose;
+		/// The transfer should be aborted as soon as the flag is set, or as soon as the session is no longer active
+		bool *cancellationFlag;
+		const bool *sessionActive;
+
+		CHttpWireRequest() : method(NULL), customMethod(false), url(NULL), path(NULL), json(NULL), body(NULL), bodyLength(0), upload(false),
+			binaryDownload(false), connectTimeout(0), timeout(0), verbose(false), cancellationFlag(NULL), sessionActive(NULL) {}
+		/**
+		 * @return the value of a header, or NULL if not set
+		 */
+		const char *GetHeader(const char *name) const;
+	};
+
+	/**
+	 * Performs the HTTP requests on behalf of the dispatcher. The default one goes to the network through
+	 * libcurl; others allow to record the traffic and to serve it back without a network, for tests and
+	 * benchmarks.
+	 */
+	class CHttpTransport : public CotCHelpers::CRefClass {
+	public:
+		virtual ~CHttpTransport() {}
+		/**
+		 * Sends a request and waits for its response. Called from the HTTP thread and from callers of
+		 * http_perform_synchronous, possibly at the same time.
+		 * @param request request to send
+		 * @param response to be filled with the status (code and result) and the body of the response
+		 * @param timings to be filled with the network figures (DNS to transfer) and the body bytes exchanged
+		 * @return 0 if a response was received, whatever its status, or a CURLcode telling why it wasn't
+		 */
+		virtual int Perform(const CHttpWireRequest &request, IOBuf *response, CRequestTimings *timings) = 0;
+	};
+
+	/**
+	 * Goes to the network through libcurl. Keeps a few handles around so that connections are reused.
+	 */
+	class CCurlTransport : public CHttpTransport {
+	public:
+		CCurlTransport() {}
+		~CCurlTransport();
+		virtual int Perform(const CHttpWireRequest &request, IOBuf *response, CRequestTimings *timings);
+
+	private:
+		CotCHelpers::CMutex mHandlesMutex;
+		std::vector<void*> mIdleHandles;
+	};
+
+	/**
+	 * Forwards the requests to another transport and writes each exchange to a file, one JSON per line, as
+	 * read back by CReplayTransport.
+	 */
+	class CRecordingTransport : public CHttpTransport {
+	public:
+		/**
+		 * @param inner transport performing the requests
+		 * @param fileName file to write, through the CFilesystemManager (replaced if it exists)
+		 */
+		CRecordingTransport(CHttpTransport *inner, const char *fileName);
+		~CRecordingTransport();
+		virtual int Perform(const CHttpWireRequest &request, IOBuf *response, CRequestTimings *timings);
+
+	private:
+		CotCHelpers::autoref<CHttpTransport> mInner;
+		CotCHelpers::CMutex mFileMutex;
+		COutputFile *mFile;
+	};
+
+	/**
+	 * Serves responses without a network, from a recording and/or responses defined by hand. Requests are
+	 * matched on their method and path (with, then without the query string); when several responses exist
+	 * for a request, they are served in turn, the last one being repeated. Unmatched requests get a 404.
+	 * Latency and failures can be simulated.
+	 */
+	class CReplayTransport : public CHttpTransport {
+	public:
+		CReplayTransport();
+		~CReplayTransport();
+		/**
+		 * Adds the exchanges written by a CRecordingTransport.
+		 * @param fileName file to read, through the CFilesystemManager
+		 * @return whether the file could be read
+		 */
+		bool LoadRecording(const char *fileName);
+		/**
+		 * Adds a response.
+		 * @param method method of the request, e.g. "GET"
+		 * @param path path of the request, with or without the query string
+		 * @param httpCode status of the response
+		 * @param body body of the response (may be NULL)
+		 */
+		void AddResponse(const char *method, const char *path, int httpCode, const CotCHelpers::CHJSON *body);
+		/**
+		 * Delays each response by a random duration in the given range.
+		 */
+		void SetLatency(int minMs, int maxMs);
+		/**
+		 * @param networkErrorRate proportion of requests failing as if the server couldn't be reached (0 to 1)
+		 * @param serverErrorRate proportion of requests answered with a 503 (0 to 1)
+		 */
+		void SetFailureRate(double networkErrorRate, double serverErrorRate);
+		/**
+		 * Seeds the generator used for the latency and failures, so that runs can be reproduced.
+		 */
+		void SetSeed(unsigned seed);
+		virtual int Perform(const CHttpWireRequest &request, IOBuf *response, CRequestTimings *timings);
+
+	private:
+		struct Exchanges {
+			std::vector<CotCHelpers::CHJSON*> responses;
+			size_t next;
+			Exchanges() : next(0) {}
+		};
+		CotCHelpers::CMutex mMutex;
+		std::map<CotCHelpers::cstring, Exchanges> mExchanges;
+		int mMinLatencyMs, mMaxLatencyMs;
+		double mNetworkErrorRate, mServerErrorRate;
+		unsigned mRandomState;
+
+		void AddExchange(const char *method, const char *path, CotCHelpers::CHJSON *exchange);
+		double NextRandom();
+	};
+
+	/**
+	 * Replaces the transport used for all requests. Takes effect for the next request.
+	 * @param transport transport to use from now on (retained), or NULL for the default curl based one
+	 */
+	void http_set_transport(CHttpTransport *transport);
+	/**
+	 * @return the transport currently in use
+	 */
+	CotCHelpers::autoref<CHttpTransport> http_transport();
+}
+
+#endif
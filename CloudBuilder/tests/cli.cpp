@@ -37,6 +37,7 @@ const char *loremipsum = "Lorem ipsum dolor sit amet, consectetur adipiscing eli
 
 #include "cli.h"
 #include "CotCHelpers.h"
+#include "CClientContext.h"
 
 #ifdef __ANDROID__
 #include <android/log.h>
@@ -48,6 +49,9 @@ const char *loremipsum = "Lorem ipsum dolor sit amet, consectetur adipiscing eli
 #include <sys/time.h>
 #include <map>
 #include <string>
+#include <vector>
+#include <algorithm>
+#include <random>
 
 using std::map;
 using std::string;
@@ -1143,6 +1147,9 @@ CLI::CLI()
 	mModeScript = false;
 	mWorking = false;
 	mFlowScript = 0;
+	mSetupOverrides = NULL;
+	mQuiet = false;
+	*mCurrentCommand = 0;
 
 	CotCHelpers::Init();
 
@@ -1152,7 +1159,9 @@ CLI::CLI()
 
 	qsort(CMD, nb, sizeof(method), compar);
 
-	initFav();
+	// Simulated gamers of the load mode are CLIs as well
+	if (gFavcount == 0)
+		initFav();
 
 	gCLI = this;
 
@@ -1160,6 +1169,7 @@ CLI::CLI()
 
 CLI::~CLI()
 {
+	delete mSetupOverrides;
 }
 
 eErrorCode CLI::execute(const char *li)
@@ -1208,10 +1218,14 @@ void CLI::endCmd(eErrorCode ec, const CCloudResult *res) {
 	   if (res) consoleJson(">> ",res->GetJSON());
 		stopActivity(ec);
 	}
-	else if (mExpected)
-		checkExpected(res);
-	else
-		if (res) consoleJson(">> ", res->GetJSON());
+	else {
+		int missed = mMissed;
+		if (mExpected)
+			checkExpected(res);
+		else
+			if (res && !mQuiet) consoleJson(">> ", res->GetJSON());
+		commandEnded(mCurrentCommand, ec, mMissed != missed, millisecondsElapsedSinceLastExecute());
+	}
 	mWorking = false;
 }
 
@@ -1507,6 +1521,7 @@ void CLI::abortScript(const char *error)
 	if (mMissedLog) delete mMissedLog;
 	mMissedLog  = NULL;
 
+	scriptEnded(error);
 	stopActivity(enNoErr);
 }
 
@@ -1641,6 +1656,9 @@ void CLI::idle() {
 
 				if (run) {
 					mWorking = true;
+					struct timeval tv; gettimeofday(&tv, NULL);
+					mLastExecuteStartTime = tv.tv_sec*1000.+(double)tv.tv_usec/1000.;
+					snprintf(mCurrentCommand, sizeof(mCurrentCommand), "%s", argc ? argv[0] : "");
 					eErrorCode ec = this->parse(argc, (const char **)argv);
 
 					for (int c=0; c<argc; c++) free(argv[c]);
@@ -1662,6 +1680,12 @@ void CLI::idle() {
 	}
 }
 
+bool CLI::nextScriptLineIsCommand() {
+	if (!mModeScript || mLine >= mSize) return false;
+	const char *line = mScript[mLine];
+	return *line != 0 && *line != '@' && *line != '#' && !(line[0] == '-' && line[1] == '-');
+}
+
 int CLI::tokenize(char *line, int *argc, char *argv[])
 {
 	char *word = (char *)malloc(strlen(line)+1);
@@ -1834,6 +1858,10 @@ eErrorCode CLI::parse(int argc, const char **argv)
 		return this->setup2(--argc, argv+1);
 	else if (EQL(0, "script"))
 		return this->script(--argc, argv+1);
+	else if (EQL(0, "load"))
+		return this->load(--argc, argv+1);
+	else if (EQL(0, "setupoptions"))
+		return this->setupOptions(--argc, argv+1);
 	else if (EQL(0, "context"))
 		return this->context(--argc, argv+1);
 	else if (EQL(0, "cd"))
@@ -1884,6 +1912,21 @@ void CLI::resume()
 	CClan::Instance()->Resume();
 }
 
+eErrorCode CLI::setupOptions(int argc, const char **argv)
+{
+	CHJSON *options = argc > 0 ? CHJSON::parse(argv[0]) : NULL;
+	if (argc > 0 && !options)
+	{
+		logger("setupoptions [options]\n"
+			"  JSON merged into the configuration of the next setup of this session, e.g. {\"httpReplayFile\": \"server.rec\"}.\n"
+			"  Without options, the next setup uses the default configuration.", kERR);
+		return (eErrorCode)-1;
+	}
+	delete mSetupOverrides;
+	mSetupOverrides = options;
+	return (eErrorCode)-1;
+}
+
 eErrorCode CLI::cd(int argc, const char **argv)
 {
 	if (argc == 0)
@@ -2043,6 +2086,297 @@ eErrorCode CLI::script(int argc, const char **argv)
 	return (eErrorCode)-1;
 }
 
+//////////////////////////// Load mode ////////////////////////////
+static double nowMs() {
+	struct timeval tv; gettimeofday(&tv, NULL);
+	return tv.tv_sec*1000.+(double)tv.tv_usec/1000.;
+}
+
+struct LoadCommandStats {
+	std::vector<double> latencies;
+	int errors;
+	int failedExpectations;
+	LoadCommandStats() : errors(0), failedExpectations(0) {}
+};
+
+struct LoadRun {
+	// Options
+	int gamerCount;
+	double rampUpMs, thinkMs, durationMs, rate;
+	string think;
+	// State
+	double startedAt, tokens, lastRefillAt;
+	map<string, LoadCommandStats> commands;
+	int iterations, abortedScripts;
+	string firstAbortError;
+	std::mt19937 random;
+
+	LoadRun() : gamerCount(1), rampUpMs(0), thinkMs(0), durationMs(0), rate(0), think("constant"),
+		startedAt(0), tokens(0), lastRefillAt(0), iterations(0), abortedScripts(0), random(1234) {}
+
+	double ThinkTime() {
+		if (thinkMs <= 0) return 0;
+		if (think == "uniform")
+			return std::uniform_real_distribution<double>(0, 2 * thinkMs)(random);
+		if (think == "exponential")
+			return std::exponential_distribution<double>(1. / thinkMs)(random);
+		return thinkMs;
+	}
+
+	// Token bucket limiting the commands issued per second by all gamers (no limit if rate is 0)
+	bool TakeToken(double now) {
+		if (rate <= 0) return true;
+		tokens = std::min(tokens + (now - lastRefillAt) * rate / 1000., std::max(1., rate / 10.));
+		lastRefillAt = now;
+		if (tokens < 1) return false;
+		tokens -= 1;
+		return true;
+	}
+};
+
+/**
+ * One of the simulated gamers of the load mode. Has its own client context, hence its own session, and runs the
+ * script silently.
+ */
+class LoadGamer : public CLI {
+	LoadRun *mRun;
+
+public:
+	CClientContext *context;
+	double startAt, nextCommandAt;
+	bool started, running, interrupted, finished;
+
+	LoadGamer(LoadRun *run, double startAt) : mRun(run), context(CClientContext::Create()), startAt(startAt), nextCommandAt(0),
+		started(false), running(false), interrupted(false), finished(false) {
+		mQuiet = true;
+	}
+
+	~LoadGamer() {
+		{
+			CClientContext::Scope scope(context);
+			CClan::Instance()->Terminate();
+		}
+		context->Release();
+		delete myClan;
+	}
+
+	virtual void logger(const char *message, typelog kind) {}
+	virtual void stopActivity(CloudBuilder::eErrorCode ec) {}
+
+	virtual void commandEnded(const char *command, eErrorCode ec, bool expectationFailed, long elapsedMs) {
+		LoadCommandStats &stats = mRun->commands[command];
+		stats.latencies.push_back(elapsedMs);
+		if (ec != enNoErr) stats.errors++;
+		if (expectationFailed) stats.failedExpectations++;
+		nextCommandAt = nowMs() + mRun->ThinkTime();
+	}
+
+	virtual void scriptEnded(const char *error) {
+		running = false;
+		if (error) {
+			if (mRun->abortedScripts++ == 0) mRun->firstAbortError = error;
+			finished = true;
+		} else if (!interrupted) {
+			mRun->iterations++;
+		}
+	}
+
+	// Runs the pending callbacks and the next line of the script when it is time to
+	void Step(const char *scriptName, double now, bool stopping) {
+		CClientContext::Scope scope(context);
+		CLI *previousCLI = gCLI;
+		gCLI = this;
+		if (!running && !finished) {
+			// Start or loop over the script until the end of the run
+			if (!started || (mRun->durationMs > 0 && !stopping)) {
+				if (script(1, &scriptName) == enNoErr) {
+					started = running = true;
+				} else {
+					scriptEnded("script not found or empty");
+				}
+			} else {
+				finished = true;
+			}
+		}
+		CClan::Instance()->ProcessIdleTasks();
+		if (running && !mWorking && now >= nextCommandAt) {
+			if (!nextScriptLineIsCommand())
+				idle();
+			else if (stopping) {
+				interrupted = true;
+				abortScript(NULL);
+			}
+			else if (mRun->TakeToken(now))
+				idle();
+		}
+		gCLI = previousCLI;
+	}
+};
+
+static double percentile(const std::vector<double> &sorted, double p) {
+	if (sorted.empty()) return 0;
+	size_t i = (size_t) (p * (sorted.size() - 1) + 0.5);
+	return sorted[i];
+}
+
+eErrorCode CLI::load(int argc, const char **argv)
+{
+	if (argc < 2)
+	{
+		logger("load script gamers [options]\n"
+			"  runs a script in parallel for as many simulated gamers, each with its own session. Options (JSON):\n"
+			"  rampUp: seconds over which the gamers are started (default 0)\n"
+			"  duration: seconds during which the gamers loop over the script (default 0, runs it once)\n"
+			"  thinkTime: milliseconds between two commands of a gamer (default 0)\n"
+			"  think: distribution of the think time, constant, uniform or exponential (default constant)\n"
+			"  rate: maximum number of commands per second for all gamers (default 0, unlimited)\n"
+			"  setup: JSON merged into the configuration of CClan::Setup, e.g. {\"localValues\": true}. The HTTP transport is\n"
+			"    shared by the whole process: httpReplayFile and httpRecordFile go to the setup of this session (setupoptions)\n"
+			"  output: file to which the report is written as JSON", kERR);
+		return (eErrorCode)-1;
+	}
+
+	LoadRun run;
+	run.gamerCount = atoi(argv[1]);
+	owned_ref<CHJSON> options (argc > 2 ? CHJSON::parse(argv[2]) : new CHJSON);
+	if (run.gamerCount <= 0 || !options)
+	{
+		logger("bad parameters for load", kERR);
+		return (eErrorCode)-1;
+	}
+	const CHJSON *setup = options->Get("setup");
+	if (setup && (setup->Has("httpReplayFile") || setup->Has("httpRecordFile")))
+	{
+		// Would stay in place for this session once the run is over
+		logger("httpReplayFile and httpRecordFile apply to the whole process, pass them to the setup of this session with setupoptions", kERR);
+		return (eErrorCode)-1;
+	}
+	run.rampUpMs = options->GetDouble("rampUp") * 1000;
+	run.durationMs = options->GetDouble("duration") * 1000;
+	run.thinkMs = options->GetDouble("thinkTime");
+	run.rate = options->GetDouble("rate");
+	if (options->GetString("think")) run.think = options->GetString("think");
+
+	char m[1000];
+	sprintf(m, "Load: %d gamers running %s", run.gamerCount, argv[0]);
+	logger(m, kSCRIPT);
+
+	CLI *mainCLI = gCLI;
+	CMemoryStats memoryBefore[enMemoryCategoryCount];
+	for (int c=0; c<enMemoryCategoryCount; c++)
+		CClan::Instance()->GetMemoryStats((eMemoryCategory) c, &memoryBefore[c]);
+	delete CClan::Instance()->GetHttpMetrics(true);
+	clock_t cpuStart = clock();
+	run.startedAt = run.lastRefillAt = nowMs();
+
+	std::vector<LoadGamer*> gamers;
+	for (int i=0; i<run.gamerCount; i++) {
+		double startAt = run.startedAt + (run.gamerCount > 1 ? run.rampUpMs * i / (run.gamerCount - 1) : 0);
+		LoadGamer *gamer = new LoadGamer(&run, startAt);
+		gamer->mSetupOverrides = options->Has("setup") ? options->Get("setup")->Duplicate() : NULL;
+		gamers.push_back(gamer);
+	}
+	gCLI = mainCLI;
+
+	double lastProgressAt = run.startedAt;
+	for (bool done = false; !done; ) {
+		double now = nowMs();
+		bool stopping = run.durationMs > 0 && now >= run.startedAt + run.durationMs;
+		done = true;
+		for (size_t i=0; i<gamers.size(); i++) {
+			LoadGamer *gamer = gamers[i];
+			if (now >= gamer->startAt && !gamer->finished)
+				gamer->Step(argv[0], now, stopping);
+			done = done && gamer->finished;
+		}
+		if (now - lastProgressAt >= 5000) {
+			int commandCount = 0, errorCount = 0;
+			for (map<string, LoadCommandStats>::iterator it = run.commands.begin(); it != run.commands.end(); ++it)
+				commandCount += it->second.latencies.size(), errorCount += it->second.errors;
+			sprintf(m, "%5.0fs: %d commands, %d errors", (now - run.startedAt) / 1000, commandCount, errorCount);
+			logger(m, kLOG);
+			lastProgressAt = now;
+		}
+		if (!done) usleep(1000);
+	}
+
+	double elapsedMs = nowMs() - run.startedAt;
+	double cpuMs = (clock() - cpuStart) * 1000. / CLOCKS_PER_SEC;
+	CHJSON *httpMetrics = CClan::Instance()->GetHttpMetrics();
+	for (size_t i=0; i<gamers.size(); i++)
+		delete gamers[i];
+	gCLI = mainCLI;
+
+	// Report
+	owned_ref<CHJSON> report (new CHJSON);
+	CHJSON *commands = new CHJSON;
+	int commandCount = 0, errorCount = 0;
+	sprintf(m, "\n--- Load summary ---\n\n%-20s %8s %8s %8s %8s %8s %8s", "command", "count", "errors", "failed", "p50 ms", "p90 ms", "p99 ms");
+	logger(m, kLOG);
+	for (map<string, LoadCommandStats>::iterator it = run.commands.begin(); it != run.commands.end(); ++it) {
+		std::vector<double> &l = it->second.latencies;
+		std::sort(l.begin(), l.end());
+		CHJSON *c = new CHJSON;
+		c->Put("count", (int) l.size());
+		c->Put("errors", it->second.errors);
+		c->Put("failedExpectations", it->second.failedExpectations);
+		c->Put("p50Ms", percentile(l, .5));
+		c->Put("p90Ms", percentile(l, .9));
+		c->Put("p99Ms", percentile(l, .99));
+		commands->Put(it->first.c_str(), c);
+		sprintf(m, "%-20s %8d %8d %8d %8.0f %8.0f %8.0f", it->first.c_str(), (int) l.size(), it->second.errors, it->second.failedExpectations,
+			percentile(l, .5), percentile(l, .9), percentile(l, .99));
+		logger(m, it->second.errors || it->second.failedExpectations ? kERR : kLOG);
+		commandCount += l.size();
+		errorCount += it->second.errors;
+	}
+
+	// Memory left allocated by the run (the gamers have been terminated), and peak usage of the SDK
+	long retainedBytes = 0, peakBytes = 0;
+	for (int c=0; c<enMemoryCategoryCount; c++) {
+		CMemoryStats after;
+		CClan::Instance()->GetMemoryStats((eMemoryCategory) c, &after);
+		retainedBytes += (long) after.currentBytes - (long) memoryBefore[c].currentBytes;
+		peakBytes += (long) after.peakBytes;
+	}
+
+	report->Put("script", argv[0]);
+	report->Put("gamers", run.gamerCount);
+	report->Put("elapsedMs", elapsedMs);
+	report->Put("iterations", run.iterations);
+	report->Put("abortedScripts", run.abortedScripts);
+	report->Put("commandsPerSec", commandCount * 1000. / elapsedMs);
+	report->Put("errorRate", commandCount ? (double) errorCount / commandCount : 0.);
+	report->Put("cpuMs", cpuMs);
+	report->Put("memoryRetainedBytes", (double) retainedBytes);
+	report->Put("memoryPeakBytes", (double) peakBytes);
+	report->Put("commands", commands);
+	if (httpMetrics) report->Put("http", httpMetrics);
+
+	sprintf(m, "\n%d commands in %.1fs: %.1f/s, %.2f%% errors, %d scripts run (%d aborted)\nCPU %.0fms (%.0f%%), SDK memory peak %ld bytes, retained %ld bytes\n---\n",
+		commandCount, elapsedMs / 1000, commandCount * 1000. / elapsedMs, commandCount ? errorCount * 100. / commandCount : 0., run.iterations, run.abortedScripts,
+		cpuMs, cpuMs * 100 / elapsedMs, peakBytes, retainedBytes);
+	logger(m, kLOG);
+	if (run.abortedScripts) {
+		sprintf(m, "First aborted script: %.900s", run.firstAbortError.c_str());
+		logger(m, kERR);
+	}
+
+	if (const char *output = options->GetString("output")) {
+		char basePath[1000];
+		this->getBasePath(basePath);
+		strcat(basePath, output);
+		FILE *fp = fopen(basePath, "w");
+		if (fp) {
+			fputs(report->printFormatted().c_str(), fp);
+			fclose(fp);
+		} else {
+			logger("can't write the report", kERR);
+		}
+	}
+	return (eErrorCode)-1;
+}
+
 eErrorCode CLI::setup(int argc, const char **argv)
 {
 	char context[1000];
@@ -2139,6 +2473,10 @@ eErrorCode CLI::setup2(int argc, const char **argv)
 	connection->Put("httpTimeout", 0);
 	connection->Put("httpVerbose", true);
 	connection->Put("forceFacebookSdk", true);
+	if (mSetupOverrides) {
+		for (int i=0; i<mSetupOverrides->size(); i++)
+			connection->Put(mSetupOverrides->Get(i)->name(), mSetupOverrides->Get(i));
+	}
 
 	CClan::Instance()->Setup(connection, MakeResultHandler(myClan, &MyClan::SetupDone));
 
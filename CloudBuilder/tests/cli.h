@@ -60,6 +60,8 @@ class CLI {
 		eErrorCode setup(int argc, const char **argv);
 		eErrorCode setup2(int argc, const char **argv);
 		eErrorCode script(int argc, const char **argv);
+		eErrorCode load(int argc, const char **argv);
+		eErrorCode setupOptions(int argc, const char **argv);
 		eErrorCode cd(int argc, const char **argv);
 		int tokenize(char *line, int *argc, char **argv);
 		void endCmd(eErrorCode ec, const CCloudResult *json=NULL);
@@ -75,11 +77,20 @@ class CLI {
 		void abortScript(const char *error);
 
 		void getFavorites(const char** &favoriteList, int &count);
+		bool nextScriptLineIsCommand();
+
+		// Called in script mode when a command has returned, and when the script has ended (error is NULL unless aborted)
+		virtual void commandEnded(const char *command, eErrorCode ec, bool expectationFailed, long elapsedMs) {}
+		virtual void scriptEnded(const char *error) {}
 
 		bool mWorking;
 		bool mModeScript;
 		int mFlowScript;
 		MyClan *myClan;
+		// Merged into the configuration passed to CClan::Setup
+		CHJSON *mSetupOverrides;
+		// Results are not printed in script mode
+		bool mQuiet;
 
 	private:
 		void setContext(const char *game);
@@ -96,6 +107,7 @@ class CLI {
 		CHJSON *mVar;
 		CHJSON *mMissedLog;
 		double mLastExecuteStartTime;
+		char mCurrentCommand[64];
 };
 
 #endif /* defined(__CloudBuilderMacOSX__cli__) */